@@ -0,0 +1,218 @@
+#include "admin.hpp"
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+#define ADMIN_LOG(level, admin, format, ...) LOG(level, LOG_SOURCE_SERVER, format, (admin)->sockFd __VA_OPT__(,) __VA_ARGS__)
+
+struct AdminConnection;
+
+void adminAccept(EpollHandler* sender);
+void adminOnRequest(EpollHandler* sender);
+void adminOnOutput(EpollHandler* sender);
+void adminWriteResponse(AdminConnection* connection);
+void adminCloseConnection(EpollHandler* sender);
+
+/**
+ * Structure representing the admin listener. It's only reachable locally:
+ * on a Unix domain socket or on a TCP port of the loopback interface
+ */
+struct Admin {
+    int sockFd;
+    string unixPath;                // Path of the Unix domain socket, empty for TCP
+    Epoll* epoll;                   // An epoll instance the listener is attached to
+    EpollHandler* epollHandler;
+};
+
+/**
+ * Structure representing a single connection to the admin listener
+ */
+struct AdminConnection {
+    int sockFd;
+    EpollHandler* epollHandler;
+    string response;                // Empty until the request has arrived
+    size_t responseOffset;          // The bytes of the response before it have been written
+};
+
+/**
+ * Creates the admin listener and binds it, but doesn't start it
+ * @param address A port number (TCP on 127.0.0.1) or a path of the Unix domain socket
+ * @return The admin listener
+ */
+Admin* adminCreate(const char* address){
+    auto admin = new Admin();
+    admin->epoll = nullptr;
+    char* end = nullptr;
+    long port = strtol(address, &end, 10);
+
+    if(*address != '\0' && *end == '\0'){
+        admin->sockFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(admin->sockFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in adminAddress {};
+        adminAddress.sin_family = AF_INET;
+        adminAddress.sin_port = htons((uint16_t)port);
+        adminAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(bind(admin->sockFd, (sockaddr*)&adminAddress, sizeof(adminAddress)) == -1){
+            close(admin->sockFd);
+            delete admin;
+            throw runtime_error("Failed to bind the admin socket.");
+        }
+    }else{
+        admin->sockFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        admin->unixPath = address;
+
+        sockaddr_un adminAddress {};
+        adminAddress.sun_family = AF_UNIX;
+        strncpy(adminAddress.sun_path, address, sizeof(adminAddress.sun_path) - 1);
+        unlink(address);
+        if(bind(admin->sockFd, (sockaddr*)&adminAddress, sizeof(adminAddress)) == -1){
+            close(admin->sockFd);
+            delete admin;
+            throw runtime_error("Failed to bind the admin socket.");
+        }
+    }
+
+    if(listen(admin->sockFd, 16) == -1){
+        close(admin->sockFd);
+        if(!admin->unixPath.empty()){
+            unlink(admin->unixPath.c_str());
+        }
+        delete admin;
+        throw runtime_error("Failed to listen on the admin socket.");
+    }
+    admin->epollHandler = epollCreateHandler(admin->sockFd);
+    epollHandlerSetOnInput(admin->epollHandler, adminAccept);
+    *(Admin**)(epollHandlerData(admin->epollHandler)) = admin;
+    return admin;
+}
+
+/**
+ * Starts accepting the admin connections
+ * @param admin The admin listener
+ * @param epoll The epoll instance to attach to
+ */
+void adminStart(Admin* admin, Epoll* epoll){
+    admin->epoll = epoll;
+    epollRegisterHandler(epoll, admin->epollHandler);
+    epollSetHandledEvents(admin->epollHandler, EPOLLIN);
+    ADMIN_LOG(LOG_LEVEL_INFO, admin, "Started admin listener on {}", admin->unixPath.empty() ? "127.0.0.1" : admin->unixPath);
+}
+
+/**
+ * Closes the admin listener. The connections that are being served are closed by themselves
+ * @param admin The admin listener
+ */
+void adminClose(Admin* admin){
+    epollUnregisterHandler(admin->epollHandler);
+    epollReleaseHandler(admin->epollHandler);
+    close(admin->sockFd);
+    if(!admin->unixPath.empty()){
+        unlink(admin->unixPath.c_str());
+    }
+    delete admin;
+}
+
+/**
+ * Accepts the admin connections. Each one is answered with the metrics as soon as it sends its request
+ * @param sender The handler that received the input event
+ */
+void adminAccept(EpollHandler* sender){
+    Admin* admin = *(Admin**)epollHandlerData(sender);
+
+    while(true){
+        int connectionSocket = accept4(admin->sockFd, nullptr, nullptr, SOCK_NONBLOCK);
+        if(connectionSocket == -1){
+            if(errno == EINTR) continue;
+            return;
+        }
+
+        auto connection = new AdminConnection();
+        connection->sockFd = connectionSocket;
+        connection->responseOffset = 0;
+        connection->epollHandler = epollCreateHandler(connectionSocket);
+        epollHandlerSetOnInput(connection->epollHandler, adminOnRequest);
+        epollHandlerSetOnOutput(connection->epollHandler, adminOnOutput);
+        epollHandlerSetOnDisconnect(connection->epollHandler, adminCloseConnection);
+        *(AdminConnection**)(epollHandlerData(connection->epollHandler)) = connection;
+        epollRegisterHandler(admin->epoll, connection->epollHandler);
+        epollSetHandledEvents(connection->epollHandler, EPOLLIN);
+    }
+}
+
+/**
+ * Answers the request with the metrics. Any request is accepted: a plain HTTP GET
+ * (so that the metrics can be scraped), or just a new line sent with a tool like netcat
+ * @param sender The handler that received the input event
+ */
+void adminOnRequest(EpollHandler* sender){
+    AdminConnection* connection = *(AdminConnection**)epollHandlerData(sender);
+
+    // The request itself doesn't matter, but it's read so that closing the socket doesn't reset it
+    char request[4096];
+    while(read(connection->sockFd, request, sizeof(request)) > 0);
+    if(!connection->response.empty()) return;
+
+    string body = metricsFormat();
+    connection->response = "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + to_string(body.length()) + "\r\n"
+                           "\r\n" + body;
+    adminWriteResponse(connection);
+}
+
+/**
+ * Writes the rest of the response once the socket buffer has room again
+ * @param sender The handler that received the output event
+ */
+void adminOnOutput(EpollHandler* sender){
+    adminWriteResponse(*(AdminConnection**)epollHandlerData(sender));
+}
+
+/**
+ * Writes as much of the response as the socket buffer takes. The rest waits for the output event,
+ * the connection is closed once the whole response has been written
+ * @param connection The connection that has sent its request
+ */
+void adminWriteResponse(AdminConnection* connection){
+    while(connection->responseOffset < connection->response.length()){
+        ssize_t written = write(connection->sockFd, connection->response.data() + connection->responseOffset,
+                                connection->response.length() - connection->responseOffset);
+        if(written == -1 && errno == EINTR) continue;
+        if(written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            // The request has been read already
+            epollSetHandledEvents(connection->epollHandler, EPOLLOUT);
+            return;
+        }
+        if(written <= 0) break;
+        connection->responseOffset += written;
+    }
+    adminCloseConnection(connection->epollHandler);
+}
+
+/**
+ * Closes the admin connection
+ * @param sender The handler of the connection
+ */
+void adminCloseConnection(EpollHandler* sender){
+    AdminConnection* connection = *(AdminConnection**)epollHandlerData(sender);
+    epollUnregisterHandler(connection->epollHandler);
+    epollReleaseHandler(connection->epollHandler);
+    close(connection->sockFd);
+    delete connection;
+}
@@ -0,0 +1,12 @@
+#ifndef ADMIN_HPP
+#define ADMIN_HPP
+
+#include "epoll.hpp"
+
+struct Admin;
+
+Admin* adminCreate(const char* address);
+void adminStart(Admin* admin, Epoll* epoll);
+void adminClose(Admin* admin);
+
+#endif
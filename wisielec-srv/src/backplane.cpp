@@ -0,0 +1,362 @@
+#include "backplane.hpp"
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+#define BACKPLANE_HEADER_SIZE 42        // Length, kind, flags, room, connection, time, coalescing key, origin time
+#define BACKPLANE_HAS_FRAME 0x01
+#define BACKPLANE_CONTROL_PRIORITY 0x02
+#define BACKPLANE_READ_SIZE 65536
+// The backplane carries the traffic of all the clients of a node, so its limits are higher than theirs
+#define BACKPLANE_LOW_WATERMARK (1024 * 1024)       // The input resumes once the output gets below it
+#define BACKPLANE_HIGH_WATERMARK (4 * 1024 * 1024)  // The input pauses once the output gets above it
+#define BACKPLANE_HARD_LIMIT_FACTOR 2               // Above this many high watermarks the peer is dropped
+
+#define PEER_LOG(level, peer, format, ...) LOG(level, LOG_SOURCE_SERVER, format, (peer)->sockFd __VA_OPT__(,) __VA_ARGS__)
+
+void backplanePeerOnInput(EpollHandler* sender);
+void backplanePeerOnOutput(EpollHandler* sender);
+void backplanePeerOnFlush(EpollHandler* sender);
+void backplanePeerOnDisconnect(EpollHandler* sender);
+bool backplanePeerReadInput(BackplanePeer* peer);
+bool backplanePeerDispatchInput(BackplanePeer* peer);
+void backplanePeerDrop(BackplanePeer* peer);
+bool backplanePeerWriteOutput(BackplanePeer* peer);
+void backplanePeerUpdateEvents(BackplanePeer* peer);
+void backplaneWriteInteger(string& output, uint64_t value, size_t size);
+uint64_t backplaneReadInteger(const char* data, size_t size);
+
+/**
+ * Structure representing one end of a backplane connection between two server processes.
+ * The channel messages are passed along with their frames. The messages sent in a wakeup of the event loop
+ * are written together at its end, and the ones that don't fit in the socket wait for it to become writable.
+ * The waiting output is bounded like a client's queue: above the high watermark the peer stops reading
+ * the other end's messages, so that the other end is held back by its own output, and above the hard limit
+ * the peer is dropped. A message longer than the hard limit drops it too
+ */
+struct BackplanePeer {
+    int sockFd;
+    Epoll* epoll;
+    EpollHandler* epollHandler;
+    string* input;                  // The bytes of the messages that haven't arrived whole yet
+    string* output;                 // The bytes waiting to be written
+    size_t outputOffset;            // How much of the output has been written already
+    bool isInputPaused;             // The input is left in the socket until the output gets below the low watermark
+    BackplaneReceiver receiver;     // Called for every message received
+    BackplaneCloser closer;         // Called once the connection is lost, before the peer is released
+    void* data;                     // Any data the receiver needs
+};
+
+/**
+ * Creates the Unix domain socket the nodes connect to and starts listening on it
+ * @param path Path of the socket, replaced if it exists
+ * @return The socket
+ */
+int backplaneListen(const char* path){
+    int sockFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if(bind(sockFd, (sockaddr*)&address, sizeof(address)) == -1 || listen(sockFd, 16) == -1){
+        close(sockFd);
+        throw runtime_error("Failed to listen on the backplane socket.");
+    }
+    return sockFd;
+}
+
+/**
+ * Connects to the backplane of the sequencer
+ * @param path Path of the sequencer's socket
+ * @return The connected non-blocking socket
+ */
+int backplaneConnect(const char* path){
+    int sockFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if(connect(sockFd, (sockaddr*)&address, sizeof(address)) == -1){
+        close(sockFd);
+        throw runtime_error("Failed to connect to the backplane.");
+    }
+    fcntl(sockFd, F_SETFL, fcntl(sockFd, F_GETFL) | O_NONBLOCK);
+    return sockFd;
+}
+
+/**
+ * Attaches the connected socket to the event loop of the calling thread
+ * @param sockFd The socket
+ * @param epoll The epoll instance
+ * @param receiver The function called for every message received, it takes over the message's frame
+ * @param closer The function called once the connection is lost
+ * @param data Any data the receiver needs
+ * @return The peer
+ */
+BackplanePeer* backplanePeerCreate(int sockFd, Epoll* epoll, BackplaneReceiver receiver, BackplaneCloser closer, void* data){
+    auto peer = new BackplanePeer();
+    peer->sockFd = sockFd;
+    peer->epoll = epoll;
+    peer->input = new string();
+    peer->output = new string();
+    peer->outputOffset = 0;
+    peer->isInputPaused = false;
+    peer->receiver = receiver;
+    peer->closer = closer;
+    peer->data = data;
+    peer->epollHandler = epollCreateHandler(sockFd);
+    epollHandlerSetOnInput(peer->epollHandler, backplanePeerOnInput);
+    epollHandlerSetOnOutput(peer->epollHandler, backplanePeerOnOutput);
+    epollHandlerSetOnFlush(peer->epollHandler, backplanePeerOnFlush);
+    epollHandlerSetOnDisconnect(peer->epollHandler, backplanePeerOnDisconnect);
+    *(BackplanePeer**)epollHandlerData(peer->epollHandler) = peer;
+    epollRegisterHandler(epoll, peer->epollHandler);
+    epollSetHandledEvents(peer->epollHandler, EPOLLIN);
+    PEER_LOG(LOG_LEVEL_INFO, peer, "Backplane connected");
+    return peer;
+}
+
+/**
+ * Writes what it can of the waiting output, closes the connection and releases the peer. The closer isn't called
+ * @param peer The peer
+ */
+void backplanePeerClose(BackplanePeer* peer){
+    backplanePeerWriteOutput(peer);
+    epollUnregisterHandler(peer->epollHandler);
+    epollReleaseHandler(peer->epollHandler);
+    shutdown(peer->sockFd, SHUT_RDWR);
+    close(peer->sockFd);
+    PEER_LOG(LOG_LEVEL_INFO, peer, "Backplane closed");
+    delete peer->input;
+    delete peer->output;
+    delete peer;
+}
+
+/**
+ * Returns the data given when the peer was created
+ * @param peer The peer
+ */
+void* backplanePeerGetData(BackplanePeer* peer){
+    return peer->data;
+}
+
+/**
+ * Sends the message to the other end. It's written at the end of the current wakeup
+ * @param peer The peer
+ * @param kind One of the CHANNEL_ constants
+ * @param connection The connection the message is about, as the receiving end knows it
+ * @param time When the message was received from the client, 0 for the game's messages
+ * @param frame The frame to pass along, only read. May be nullptr
+ * @param room The room the message is about, 0 if it's about none
+ */
+void backplanePeerSend(BackplanePeer* peer, int kind, uint64_t connection, uint64_t time, Frame* frame, uint32_t room){
+    size_t payloadLength = frame != nullptr ? frameGetLength(frame) - FRAME_LENGTH_SIZE : 0;
+    uint8_t flags = 0;
+    if(frame != nullptr){
+        flags |= BACKPLANE_HAS_FRAME;
+        if(frameGetPriority(frame) == FRAME_PRIORITY_CONTROL) flags |= BACKPLANE_CONTROL_PRIORITY;
+    }
+    string& output = *peer->output;
+    backplaneWriteInteger(output, BACKPLANE_HEADER_SIZE - sizeof(uint32_t) + payloadLength, sizeof(uint32_t));
+    backplaneWriteInteger(output, kind, sizeof(uint8_t));
+    backplaneWriteInteger(output, flags, sizeof(uint8_t));
+    backplaneWriteInteger(output, room, sizeof(uint32_t));
+    backplaneWriteInteger(output, connection, sizeof(uint64_t));
+    backplaneWriteInteger(output, time, sizeof(uint64_t));
+    backplaneWriteInteger(output, frame != nullptr ? frameGetCoalesceKey(frame) : 0, sizeof(uint64_t));
+    backplaneWriteInteger(output, frame != nullptr ? frameGetOriginTime(frame) : 0, sizeof(uint64_t));
+    if(frame != nullptr){
+        output.append(frameGetPayload(frame), payloadLength);
+    }
+    metricAdd(&metricBackplaneMessagesOut, 1);
+    epollRequestFlush(peer->epollHandler);
+}
+
+/**
+ * Reads everything the socket has and passes the complete messages to the receiver.
+ * The messages that have arrived before the connection was closed are passed on too
+ * @param sender The peer's handler
+ */
+void backplanePeerOnInput(EpollHandler* sender){
+    BackplanePeer* peer = *(BackplanePeer**)epollHandlerData(sender);
+    bool isOpen = backplanePeerReadInput(peer);
+    if(!backplanePeerDispatchInput(peer)){
+        PEER_LOG(LOG_LEVEL_ERROR, peer, "Invalid backplane message, dropping the connection");
+        backplanePeerDrop(peer);
+    }else if(!isOpen){
+        PEER_LOG(LOG_LEVEL_WARNING, peer, "Backplane connection lost");
+        backplanePeerDrop(peer);
+    }
+}
+
+/**
+ * Reads everything the socket has into the input
+ * @param peer The peer
+ * @return False if the connection has been closed or has failed
+ */
+bool backplanePeerReadInput(BackplanePeer* peer){
+    char buffer[BACKPLANE_READ_SIZE];
+    while(true){
+        ssize_t length = read(peer->sockFd, buffer, sizeof(buffer));
+        if(length == -1 && errno == EINTR) continue;
+        if(length == 0 || (length == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+        if(length == -1) return true;
+        peer->input->append(buffer, length);
+    }
+}
+
+/**
+ * Passes the complete messages of the input to the receiver
+ * @param peer The peer
+ * @return False if a message is shorter than its header or too long to be buffered, nothing is passed on after it
+ */
+bool backplanePeerDispatchInput(BackplanePeer* peer){
+    string& input = *peer->input;
+    size_t offset = 0;
+    while(input.length() - offset >= BACKPLANE_HEADER_SIZE){
+        const char* data = input.data() + offset;
+        size_t length = backplaneReadInteger(data, sizeof(uint32_t)) + sizeof(uint32_t);
+        if(length < BACKPLANE_HEADER_SIZE || length > BACKPLANE_HIGH_WATERMARK * BACKPLANE_HARD_LIMIT_FACTOR) return false;
+        if(input.length() - offset < length) break;
+
+        ChannelMessage message {};
+        message.kind = (int)backplaneReadInteger(data + 4, sizeof(uint8_t));
+        uint8_t flags = backplaneReadInteger(data + 5, sizeof(uint8_t));
+        message.room = backplaneReadInteger(data + 6, sizeof(uint32_t));
+        message.connection = backplaneReadInteger(data + 10, sizeof(uint64_t));
+        message.time = backplaneReadInteger(data + 18, sizeof(uint64_t));
+        message.frame = nullptr;
+        if(flags & BACKPLANE_HAS_FRAME){
+            message.frame = frameCreate(data + BACKPLANE_HEADER_SIZE, length - BACKPLANE_HEADER_SIZE);
+            frameSetCoalesceKey(message.frame, backplaneReadInteger(data + 26, sizeof(uint64_t)));
+            frameSetOriginTime(message.frame, backplaneReadInteger(data + 34, sizeof(uint64_t)));
+            if(flags & BACKPLANE_CONTROL_PRIORITY) frameSetPriority(message.frame, FRAME_PRIORITY_CONTROL);
+        }
+        offset += length;
+        metricAdd(&metricBackplaneMessagesIn, 1);
+        peer->receiver(peer, message);
+    }
+    input.erase(0, offset);
+    return true;
+}
+
+/**
+ * Writes the rest of the output once the socket becomes writable
+ * @param sender The peer's handler
+ */
+void backplanePeerOnOutput(EpollHandler* sender){
+    BackplanePeer* peer = *(BackplanePeer**)epollHandlerData(sender);
+    backplanePeerWriteOutput(peer);
+    backplanePeerUpdateEvents(peer);
+}
+
+/**
+ * Writes the messages sent during the wakeup and applies the watermarks to the rest
+ * @param sender The peer's handler
+ */
+void backplanePeerOnFlush(EpollHandler* sender){
+    BackplanePeer* peer = *(BackplanePeer**)epollHandlerData(sender);
+    backplanePeerWriteOutput(peer);
+    if(peer->output->length() - peer->outputOffset > BACKPLANE_HIGH_WATERMARK * BACKPLANE_HARD_LIMIT_FACTOR){
+        PEER_LOG(LOG_LEVEL_ERROR, peer, "The other end doesn't receive the backplane messages, dropping the connection");
+        backplanePeerDrop(peer);
+        return;
+    }
+    backplanePeerUpdateEvents(peer);
+}
+
+/**
+ * Handles the connection being lost. The messages that have arrived before are passed on first
+ * @param sender The peer's handler
+ */
+void backplanePeerOnDisconnect(EpollHandler* sender){
+    backplanePeerOnInput(sender);
+}
+
+/**
+ * Tells the owner that the connection is lost, closes it and releases the peer
+ * @param peer The peer
+ */
+void backplanePeerDrop(BackplanePeer* peer){
+    peer->closer(peer);
+    backplanePeerClose(peer);
+}
+
+/**
+ * Writes as much of the output as the socket takes
+ * @param peer The peer
+ * @return True if all the output has been written
+ */
+bool backplanePeerWriteOutput(BackplanePeer* peer){
+    string& output = *peer->output;
+    while(peer->outputOffset < output.length()){
+        ssize_t written = send(peer->sockFd, output.data() + peer->outputOffset, output.length() - peer->outputOffset, MSG_NOSIGNAL);
+        if(written == -1 && errno == EINTR) continue;
+        if(written <= 0){
+            // The messages keep being appended, so the written part is dropped before it outgrows the rest
+            if(peer->outputOffset > output.length() / 2){
+                output.erase(0, peer->outputOffset);
+                peer->outputOffset = 0;
+            }
+            return false;
+        }
+        peer->outputOffset += written;
+    }
+    output.clear();
+    peer->outputOffset = 0;
+    return true;
+}
+
+/**
+ * Applies the watermarks to the waiting output: the input pauses above the high one and resumes below the low one,
+ * and the socket is watched for becoming writable while anything waits
+ * @param peer The peer
+ */
+void backplanePeerUpdateEvents(BackplanePeer* peer){
+    size_t waiting = peer->output->length() - peer->outputOffset;
+    if(!peer->isInputPaused && waiting > BACKPLANE_HIGH_WATERMARK){
+        PEER_LOG(LOG_LEVEL_WARNING, peer, "The other end falls behind, pausing the backplane input");
+        peer->isInputPaused = true;
+    }else if(peer->isInputPaused && waiting <= BACKPLANE_LOW_WATERMARK){
+        PEER_LOG(LOG_LEVEL_INFO, peer, "Resuming the backplane input");
+        peer->isInputPaused = false;
+    }
+    // The socket is level-triggered, so the input left in it is reported again once it's resumed
+    epollSetHandledEvents(peer->epollHandler, (peer->isInputPaused ? 0u : (uint32_t)EPOLLIN) | (waiting > 0 ? (uint32_t)EPOLLOUT : 0u));
+}
+
+/**
+ * Appends the integer in big-endian order
+ * @param output Where to append it
+ * @param value The value
+ * @param size Number of bytes to write
+ */
+void backplaneWriteInteger(string& output, uint64_t value, size_t size){
+    for(size_t i = size; i > 0; i--){
+        output += (char)(value >> (8 * (i - 1)));
+    }
+}
+
+/**
+ * Reads a big-endian integer
+ * @param data The bytes
+ * @param size Number of bytes to read
+ */
+uint64_t backplaneReadInteger(const char* data, size_t size){
+    uint64_t value = 0;
+    for(size_t i = 0; i < size; i++){
+        value = (value << 8) | (uint8_t)data[i];
+    }
+    return value;
+}
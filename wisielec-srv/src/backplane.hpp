@@ -0,0 +1,27 @@
+#ifndef BACKPLANE_HPP
+#define BACKPLANE_HPP
+
+struct BackplanePeer;
+
+#include "channel.hpp"
+#include "epoll.hpp"
+#include "frame.hpp"
+
+#include <cstdint>
+
+#define BACKPLANE_NONE 0            // A standalone server
+#define BACKPLANE_SEQUENCER 1       // Hosts the backplane, runs the rooms and orders the requests of all the nodes
+#define BACKPLANE_NODE 2            // Only serves the connections, the rooms run on the sequencer
+
+typedef void (*BackplaneReceiver)(BackplanePeer* peer, const ChannelMessage& message);
+typedef void (*BackplaneCloser)(BackplanePeer* peer);
+
+int backplaneListen(const char* path);
+int backplaneConnect(const char* path);
+
+BackplanePeer* backplanePeerCreate(int sockFd, Epoll* epoll, BackplaneReceiver receiver, BackplaneCloser closer, void* data);
+void backplanePeerClose(BackplanePeer* peer);
+void* backplanePeerGetData(BackplanePeer* peer);
+void backplanePeerSend(BackplanePeer* peer, int kind, uint64_t connection, uint64_t time, Frame* frame, uint32_t room = 0);
+
+#endif
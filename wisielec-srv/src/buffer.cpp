@@ -1,5 +1,16 @@
 #include "buffer.hpp"
 
+#define BUFFERS_PER_SLAB 1024
+
+/**
+ * Who owns the data referenced by the buffer
+ */
+enum BufferDataOwner {
+    DATA_POOL,          // Allocated from the size class pools by the buffer
+    DATA_ARRAY,         // An array allocated with new[] by the caller
+    DATA_FRAME          // A shared frame
+};
+
 /**
  * Structure representing a data buffer
  */
@@ -7,40 +18,96 @@ struct Buffer {
     size_t length;
     size_t offset;
     char* data;
+    BufferDataOwner owner;
+    Frame* frame;       // The shared frame the data belongs to, if any
     Buffer* nextBuffer;
 };
 
+PoolGroup* bufferGetPools();
+
 /**
  * Creates a new buffer with the specified capacity. Allocates the space for data
  * @param capacity Capacity of the new buffer
  * @return The buffer
  */
 Buffer* bufferCreate(size_t capacity){
-    return bufferCreate(capacity, new char[capacity]);
+    Buffer* buffer = bufferCreate(capacity, (char*)poolAllocateBytes(capacity));
+    buffer->owner = DATA_POOL;
+    return buffer;
 }
 
 /**
- * Creates a new buffer referencing the passed data
+ * Creates a new buffer taking the ownership of the passed data
  * @param capacity Capacity of the new buffer
- * @param data A pointer to the array with data
+ * @param data A pointer to the array with data, allocated with new[]
  * @return The buffer
  */
 Buffer* bufferCreate(size_t capacity, char* data){
-    auto buffer = new Buffer();
+    auto buffer = (Buffer*)poolAllocate(poolGroupGetLocal(bufferGetPools()));
     buffer->length = capacity;
     buffer->offset = 0;
     buffer->data = data;
+    buffer->owner = DATA_ARRAY;
+    buffer->frame = nullptr;
     buffer->nextBuffer = nullptr;
     return buffer;
 }
 
 /**
- * Releases the buffer and the contained array
+ * Creates a new buffer referencing the data of the shared frame. The buffer becomes one of the frame owners
+ * @param frame The frame to reference
+ * @return The buffer
+ */
+Buffer* bufferCreate(Frame* frame){
+    Buffer* buffer = bufferCreate(frameGetLength(frame), frameGetData(frame));
+    buffer->owner = DATA_FRAME;
+    buffer->frame = frame;
+    frameRetain(frame);
+    return buffer;
+}
+
+/**
+ * Releases the buffer and the contained array. The shared frame is only released when it has no more owners
  * @param buffer The buffer to release
  */
 void bufferRelease(Buffer* buffer){
-    delete buffer->data;
-    delete buffer;
+    switch(buffer->owner){
+        case DATA_POOL:
+            poolFreeBytes(buffer->data, buffer->length);
+            break;
+        case DATA_ARRAY:
+            delete[] buffer->data;
+            break;
+        case DATA_FRAME:
+            frameRelease(buffer->frame);
+            break;
+    }
+    // The buffers never leave the thread that created them
+    poolFree(poolGroupGetLocal(bufferGetPools()), buffer);
+}
+
+/**
+ * Returns the shared frame the buffer references
+ * @param buffer The buffer
+ * @return The frame or nullptr if the buffer owns its data
+ */
+Frame* bufferGetFrame(Buffer* buffer){
+    return buffer->frame;
+}
+
+/**
+ * Returns the statistics of the pool the buffers are allocated from
+ */
+PoolStats bufferGetPoolStats(){
+    return poolGroupGetStats(bufferGetPools());
+}
+
+/**
+ * Returns the pools the buffers are allocated from, one per thread
+ */
+PoolGroup* bufferGetPools(){
+    static PoolGroup* pools = poolGroupCreate(sizeof(Buffer), BUFFERS_PER_SLAB);
+    return pools;
 }
 
 /**
@@ -97,6 +164,15 @@ void bufferAttachNext(Buffer* previous, Buffer* next){
     previous->nextBuffer = next;
 }
 
+/**
+ * Replaces the rest of the chain after the buffer. Used to insert buffers in the middle of a chain
+ * @param buffer The buffer
+ * @param next The new next buffer, or nullptr to end the chain
+ */
+void bufferSetNext(Buffer* buffer, Buffer* next){
+    buffer->nextBuffer = next;
+}
+
 /**
  * Gets the new buffer in the chain after this one
  * @param buffer The buffer
@@ -1,12 +1,16 @@
 #ifndef BUFFER_HPP
 #define BUFFER_HPP
 
+#include "frame.hpp"
+#include "pool.hpp"
+
 #include <unistd.h>
 
 struct Buffer;
 
 Buffer* bufferCreate(size_t capacity);
 Buffer* bufferCreate(size_t capacity, char* data);
+Buffer* bufferCreate(Frame* frame);
 void bufferRelease(Buffer* buffer);
 
 size_t bufferGetLength(Buffer* buffer);
@@ -16,6 +20,10 @@ char* bufferGetDataOrigin(Buffer* buffer);
 void bufferMovePointer(Buffer* buffer, ssize_t diff);
 
 void bufferAttachNext(Buffer* previous, Buffer* next);
+void bufferSetNext(Buffer* buffer, Buffer* next);
 Buffer* bufferGetNext(Buffer* buffer);
+Frame* bufferGetFrame(Buffer* buffer);
+
+PoolStats bufferGetPoolStats();
 
 #endif
@@ -0,0 +1,302 @@
+#include "channel.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+void channelOnFlush(EpollHandler* sender);
+void channelOnSpace(EpollHandler* sender);
+void channelOnReceive(EpollHandler* sender);
+bool channelTryPublish(Channel* channel, const ChannelMessage& message);
+void channelPublishOverflow(Channel* channel);
+void channelSignal(int fd);
+void channelClearSignal(int fd);
+
+/**
+ * Structure representing a single-producer single-consumer queue of messages between two event loops.
+ * The messages are published one by one, but the consumer is woken up only once per wakeup of the producer,
+ * when the producer's event loop flushes its output. When the ring is full, the producer keeps the messages
+ * on its side and the consumer wakes it up once it makes room, so neither side ever blocks.
+ * The indices grow forever, the slot is the index modulo the capacity
+ */
+struct Channel {
+    ChannelMessage* slots;
+    size_t capacity;                        // A power of two
+    void* data;                             // Any data the receiver needs
+
+    // Used by the producer only
+    alignas(64) size_t cachedHead;          // The consumer's index, as last seen by the producer
+    size_t signalledTail;                   // The index the consumer was last woken up for
+    deque<ChannelMessage>* overflow;        // The messages that didn't fit in the ring, in order
+    int spaceFd;                            // The eventfd the consumer signals when it makes room
+    EpollHandler* producerHandler;
+
+    // Used by the consumer only
+    alignas(64) size_t cachedTail;          // The producer's index, as last seen by the consumer
+    int receiveFd;                          // The eventfd the producer signals when it publishes messages
+    EpollHandler* consumerHandler;
+    ChannelReceiver receiver;
+
+    alignas(64) atomic<size_t> tail;        // The next slot to write to
+    alignas(64) atomic<size_t> head;        // The next slot to read from
+    atomic<bool> isProducerWaiting;         // Whether the producer waits for room in the ring
+};
+
+/**
+ * Creates a channel. Both ends have to be attached to their event loops before it's used
+ * @param capacity Number of messages that fit in the ring, rounded up to a power of two
+ * @return The channel
+ */
+Channel* channelCreate(size_t capacity){
+    auto channel = new Channel();
+    channel->capacity = 1;
+    while(channel->capacity < capacity){
+        channel->capacity <<= 1;
+    }
+    channel->receiveFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->spaceFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(channel->receiveFd == -1 || channel->spaceFd == -1){
+        if(channel->receiveFd != -1) close(channel->receiveFd);
+        if(channel->spaceFd != -1) close(channel->spaceFd);
+        delete channel;
+        throw runtime_error("Failed to create the channel.");
+    }
+    channel->slots = new ChannelMessage[channel->capacity];
+    channel->overflow = new deque<ChannelMessage>();
+    channel->data = nullptr;
+    channel->cachedHead = 0;
+    channel->signalledTail = 0;
+    channel->cachedTail = 0;
+    channel->producerHandler = nullptr;
+    channel->consumerHandler = nullptr;
+    channel->receiver = nullptr;
+    channel->tail = 0;
+    channel->head = 0;
+    channel->isProducerWaiting = false;
+    return channel;
+}
+
+/**
+ * Releases the channel with the frames of all the messages that haven't been received.
+ * Both ends have to be detached and neither thread may use the channel any more
+ * @param channel The channel
+ */
+void channelRelease(Channel* channel){
+    for(size_t i = channel->head; i != channel->tail; i++){
+        Frame* frame = channel->slots[i & (channel->capacity - 1)].frame;
+        if(frame != nullptr) frameRelease(frame);
+    }
+    for(ChannelMessage& message : *channel->overflow){
+        if(message.frame != nullptr) frameRelease(message.frame);
+    }
+    close(channel->receiveFd);
+    close(channel->spaceFd);
+    delete channel->overflow;
+    delete[] channel->slots;
+    delete channel;
+}
+
+/**
+ * Attaches the producing end to the event loop of the calling thread
+ * @param channel The channel
+ * @param epoll The producer's epoll instance
+ */
+void channelAttachProducer(Channel* channel, Epoll* epoll){
+    channel->producerHandler = epollCreateHandler(channel->spaceFd);
+    epollHandlerSetOnInput(channel->producerHandler, channelOnSpace);
+    epollHandlerSetOnFlush(channel->producerHandler, channelOnFlush);
+    *(Channel**)epollHandlerData(channel->producerHandler) = channel;
+    epollRegisterHandler(epoll, channel->producerHandler);
+    epollSetHandledEvents(channel->producerHandler, EPOLLIN);
+}
+
+/**
+ * Detaches the producing end from its event loop. Must be called by the producer
+ * @param channel The channel
+ */
+void channelDetachProducer(Channel* channel){
+    epollUnregisterHandler(channel->producerHandler);
+    epollReleaseHandler(channel->producerHandler);
+    channel->producerHandler = nullptr;
+}
+
+/**
+ * Attaches the consuming end to the event loop of the calling thread
+ * @param channel The channel
+ * @param epoll The consumer's epoll instance
+ * @param receiver The function called when there are messages to receive
+ * @param data Any data the receiver needs
+ */
+void channelAttachConsumer(Channel* channel, Epoll* epoll, ChannelReceiver receiver, void* data){
+    channel->receiver = receiver;
+    channel->data = data;
+    channel->consumerHandler = epollCreateHandler(channel->receiveFd);
+    epollHandlerSetOnInput(channel->consumerHandler, channelOnReceive);
+    *(Channel**)epollHandlerData(channel->consumerHandler) = channel;
+    epollRegisterHandler(epoll, channel->consumerHandler);
+    epollSetHandledEvents(channel->consumerHandler, EPOLLIN);
+}
+
+/**
+ * Detaches the consuming end from its event loop. Must be called by the consumer
+ * @param channel The channel
+ */
+void channelDetachConsumer(Channel* channel){
+    epollUnregisterHandler(channel->consumerHandler);
+    epollReleaseHandler(channel->consumerHandler);
+    channel->consumerHandler = nullptr;
+}
+
+/**
+ * Returns the data given when the consumer was attached
+ * @param channel The channel
+ */
+void* channelGetData(Channel* channel){
+    return channel->data;
+}
+
+/**
+ * Sends the message. The consumer is woken up at the end of the producer's wakeup. Must be called by the producer
+ * @param channel The channel
+ * @param kind One of the CHANNEL_ constants
+ * @param connection The connection the message is about
+ * @param time When the I/O thread sent the message, 0 for the game thread's messages
+ * @param frame The frame to pass along, the message takes over the caller's reference. May be nullptr
+ * @param room The room the message is about, 0 if it's about none
+ */
+void channelPush(Channel* channel, int kind, uint64_t connection, uint64_t time, Frame* frame, uint32_t room){
+    ChannelMessage message { kind, room, connection, time, frame };
+    // The messages waiting on the producer's side go first
+    if(!channel->overflow->empty() || !channelTryPublish(channel, message)){
+        channel->overflow->push_back(message);
+    }
+    epollRequestFlush(channel->producerHandler);
+}
+
+/**
+ * Wakes the consumer up if anything has been published since it was last woken up.
+ * Called at the end of the producer's wakeup, or directly when the producer's event loop doesn't run any more
+ * @param channel The channel
+ */
+void channelFlush(Channel* channel){
+    if(!channel->overflow->empty()){
+        channelPublishOverflow(channel);
+        if(!channel->overflow->empty()){
+            // The flag is set before looking at the ring again, so the consumer either sees the flag
+            // or has already made the room
+            channel->isProducerWaiting.store(true);
+            channelPublishOverflow(channel);
+        }
+    }
+
+    size_t tail = channel->tail.load(memory_order_relaxed);
+    if(tail != channel->signalledTail){
+        channel->signalledTail = tail;
+        channelSignal(channel->receiveFd);
+    }
+}
+
+/**
+ * Returns the oldest message that hasn't been received. Must be called by the consumer
+ * @param channel The channel
+ * @return The message, valid until channelPop, or nullptr if there are no messages
+ */
+ChannelMessage* channelPeek(Channel* channel){
+    size_t head = channel->head.load(memory_order_relaxed);
+    if(head == channel->cachedTail){
+        channel->cachedTail = channel->tail.load(memory_order_acquire);
+        if(head == channel->cachedTail) return nullptr;
+    }
+    return &channel->slots[head & (channel->capacity - 1)];
+}
+
+/**
+ * Removes the oldest message. The frame of the message isn't released, the consumer takes it over
+ * @param channel The channel
+ */
+void channelPop(Channel* channel){
+    channel->head.store(channel->head.load(memory_order_relaxed) + 1);
+    if(channel->isProducerWaiting.load() && channel->isProducerWaiting.exchange(false)){
+        channelSignal(channel->spaceFd);
+    }
+}
+
+/**
+ * Handles the flush at the end of the producer's wakeup
+ * @param sender The producer's handler
+ */
+void channelOnFlush(EpollHandler* sender){
+    channelFlush(*(Channel**)epollHandlerData(sender));
+}
+
+/**
+ * Handles the consumer making room in the ring
+ * @param sender The producer's handler
+ */
+void channelOnSpace(EpollHandler* sender){
+    Channel* channel = *(Channel**)epollHandlerData(sender);
+    channelClearSignal(channel->spaceFd);
+    channelFlush(channel);
+}
+
+/**
+ * Handles the producer publishing messages
+ * @param sender The consumer's handler
+ */
+void channelOnReceive(EpollHandler* sender){
+    Channel* channel = *(Channel**)epollHandlerData(sender);
+    // Cleared before receiving, so the messages published in the meantime wake the consumer up again
+    channelClearSignal(channel->receiveFd);
+    channel->receiver(channel);
+}
+
+/**
+ * Puts the message in the ring, if there's room
+ * @param channel The channel
+ * @param message The message
+ * @return False if the ring is full
+ */
+bool channelTryPublish(Channel* channel, const ChannelMessage& message){
+    size_t tail = channel->tail.load(memory_order_relaxed);
+    if(tail - channel->cachedHead == channel->capacity){
+        channel->cachedHead = channel->head.load();
+        if(tail - channel->cachedHead == channel->capacity) return false;
+    }
+    channel->slots[tail & (channel->capacity - 1)] = message;
+    channel->tail.store(tail + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Moves as many waiting messages into the ring as there's room for
+ * @param channel The channel
+ */
+void channelPublishOverflow(Channel* channel){
+    while(!channel->overflow->empty() && channelTryPublish(channel, channel->overflow->front())){
+        channel->overflow->pop_front();
+    }
+}
+
+/**
+ * Signals the eventfd
+ * @param fd The eventfd
+ */
+void channelSignal(int fd){
+    uint64_t one = 1;
+    while(write(fd, &one, sizeof(one)) == -1 && errno == EINTR);
+}
+
+/**
+ * Resets the eventfd, so that it's not readable until it's signalled again
+ * @param fd The eventfd
+ */
+void channelClearSignal(int fd){
+    uint64_t count;
+    while(read(fd, &count, sizeof(count)) == -1 && errno == EINTR);
+}
@@ -0,0 +1,61 @@
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+#include "epoll.hpp"
+#include "frame.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// Sent by the I/O threads to the game threads
+#define CHANNEL_CONNECT 1           // A connection has been accepted, or has moved here holding a seat in the room
+#define CHANNEL_REQUEST 2           // A request has been received, the frame holds its payload
+#define CHANNEL_DISCONNECT 3        // The connection has been closed, if it was moving it still holds a seat in the room
+
+// Sent by the game threads to the I/O threads
+#define CHANNEL_SEND 4              // The frame is to be sent to the connection
+#define CHANNEL_BROADCAST 5         // The frame is to be sent to all the members of the room
+#define CHANNEL_ADD_MEMBER 6        // The connection starts receiving the broadcasts of the room
+#define CHANNEL_REMOVE_MEMBER 7     // The connection stops receiving the broadcasts
+#define CHANNEL_MOVE 8              // The connection is to be served by the game thread of the room,
+                                    // the frame holds the request to handle there
+
+// Sent by the main thread to the other threads
+#define CHANNEL_STOP 9              // The thread is to finish
+
+// Sent by an I/O thread after a window of requests, and sent back by the game thread once it has handled them
+#define CHANNEL_SYNC 10
+
+#define CHANNEL_DEFAULT_CAPACITY 4096
+
+struct Channel;
+
+/**
+ * A single message passed through the channel
+ */
+struct ChannelMessage {
+    int kind;                   // One of the CHANNEL_ constants
+    uint32_t room;              // The room the message is about, 0 if it's about none
+    uint64_t connection;        // The connection the message is about, 0 if it's about none
+    uint64_t time;              // Monotonic time in nanoseconds when an I/O thread sent the message, 0 for the game thread's messages
+    Frame* frame;               // Owned by the message, nullptr if the message doesn't carry one
+};
+
+typedef void (*ChannelReceiver)(Channel* channel);
+
+Channel* channelCreate(size_t capacity = CHANNEL_DEFAULT_CAPACITY);
+void channelRelease(Channel* channel);
+
+void channelAttachProducer(Channel* channel, Epoll* epoll);
+void channelDetachProducer(Channel* channel);
+void channelAttachConsumer(Channel* channel, Epoll* epoll, ChannelReceiver receiver, void* data);
+void channelDetachConsumer(Channel* channel);
+void* channelGetData(Channel* channel);
+
+void channelPush(Channel* channel, int kind, uint64_t connection, uint64_t time, Frame* frame, uint32_t room = 0);
+void channelFlush(Channel* channel);
+
+ChannelMessage* channelPeek(Channel* channel);
+void channelPop(Channel* channel);
+
+#endif
@@ -1,10 +1,16 @@
 #include "client.hpp"
 
 #include "buffer.hpp"
-#include "game/hangman_player.hpp"
-#include "game/hangman_server.hpp"
-
+#include "log.hpp"
+#include "metrics.hpp"
+#include "output_queue.hpp"
+#include "pool.hpp"
+#include "ring_buffer.hpp"
+#include "unicode.hpp"
+
+#include <cerrno>
 #include <cstdio>
+#include <new>
 #include <sys/socket.h>
 #include <string>
 #include <unistd.h>
@@ -14,29 +20,47 @@ using namespace std;
 void clientOnInput(EpollHandler* sender);
 void clientOnOutput(EpollHandler* sender);
 void clientOnDisconnect(EpollHandler* sender);
-void clientProcessInputData(Client* client);
-void clientFinishWrite(Client* client);
-void clientLog(Client* client, const string& text);
-
-/**
- * States of client reading the data
- */
-enum ClientReadStatus {
-    READING_LENGTH,
-    READING_CONTENT
-};
+void clientOnRelease(EpollHandler* sender);
+void clientOnFlush(EpollHandler* sender);
+void clientOnSent(EpollHandler* sender, ssize_t result);
+void clientWriteQueue(Client* client);
+void clientReadInput(Client* client);
+void clientOnIdle(Timer* timer);
+void clientOnSlow(Timer* timer);
+bool clientCheckQueue(Client* client);
+bool clientProcessInputData(Client* client);
+void clientPauseInput(Client* client);
+void clientResumeInput(Client* client);
+PoolGroup* clientGetPools();
+
+#define CLIENT_LOG(level, client, format, ...) LOG(level, LOG_SOURCE_CLIENT, format, (client)->sockFd __VA_OPT__(,) __VA_ARGS__)
+
+#define CLIENT_RECEIVE_CAPACITY 4096
+#define CLIENT_LENGTH_SIZE FRAME_LENGTH_SIZE
+#define CLIENT_MAX_IOVEC 64
+#define CLIENTS_PER_SLAB 64
+#define CLIENT_SLOW_GRACE_MS 5000       // How long a client may stay above the high watermark
+#define CLIENT_HARD_LIMIT_FACTOR 2      // Above this many high watermarks the client is closed at once
+#define CLIENT_REQUEST_WINDOW 32        // How many requests may be passed to the game thread before it confirms handling them
 
 /**
  * Structure representing the client
  */
 struct Client {
     int sockFd;                     // Socket descriptor for the connection
-    Buffer* readBuffer;             // Buffer used while reading data from remote
-    ClientReadStatus readStatus;    // What is the current read state
-    Buffer* writeBuffer;            // Buffer containing the data to send to remote
+    RingBuffer* receiveRing;        // Buffer for the data received from remote, not parsed yet
+    OutputQueue* outputQueue;       // Buffers containing the data to send to remote
     EpollHandler* epollHandler;     // A handler that describes reactions to epoll events
     Server* server;                 // Server that the client is connected to
-    HangmanPlayer* player;          // Game player associated with the connection
+    uint64_t connection;            // Identifies the connection to the game threads
+    int worker;                     // Index of the game thread that handles the requests
+    const ClientLimits* limits;     // Limits set by the server
+    Timer* idleTimer;               // Closes the connection when nothing is received for too long
+    Timer* slowTimer;               // Closes the connection when the output queue stays above the high watermark
+    bool isInputPaused;             // No more messages are processed until the output queue gets below the low watermark
+    bool isWaitingForSync;          // No more messages are processed until the game thread confirms handling the window
+    bool isSending;                 // A send through io_uring hasn't completed yet
+    int windowRequests;             // Requests passed to the game thread since the last confirmation was asked for
 };
 
 /**
@@ -44,29 +68,57 @@ struct Client {
  * @param sockFd Socket descriptor to use
  * @param epoll An epoll instance serving as the event handler
  * @param server Server that accepted the connection
+ * @param timers The timing wheel for the timeouts
+ * @param limits The limits of the connection, owned by the server
+ * @param connection Identifies the connection to the game threads
+ * @param worker Index of the game thread that handles the requests
  * @return New client
  */
-Client* clientCreate(int sockFd, Epoll* epoll, Server* server){
-    auto client = new Client();
+Client* clientCreate(int sockFd, Epoll* epoll, Server* server, TimerWheel* timers, const ClientLimits* limits,
+                     uint64_t connection, int worker){
+    // All the per-connection objects are packed into a single pool slot, in this order:
+    // Client, EpollHandler, two Timers, OutputQueue and RingBuffer with its data
+    char* slot = (char*)poolAllocate(poolGroupGetLocal(clientGetPools()));
+    char* handlerMemory = slot + poolAlign(sizeof(Client));
+    char* idleTimerMemory = handlerMemory + poolAlign(epollGetHandlerSize());
+    char* slowTimerMemory = idleTimerMemory + poolAlign(timerGetSize());
+    char* queueMemory = slowTimerMemory + poolAlign(timerGetSize());
+    char* ringMemory = queueMemory + poolAlign(outputQueueGetSize());
+
+    auto client = new(slot) Client();
     client->sockFd = sockFd;
-    client->readBuffer = bufferCreate(sizeof(uint32_t));
-    client->readStatus = READING_LENGTH;
-    client->writeBuffer = nullptr;
-    client->epollHandler = epollCreateHandler(sockFd);
+    client->receiveRing = ringBufferCreate(CLIENT_RECEIVE_CAPACITY, ringMemory);
+    client->outputQueue = outputQueueCreate(queueMemory);
+    client->epollHandler = epollCreateHandler(sockFd, handlerMemory);
+    epollHandlerSetEdgeTriggered(client->epollHandler, true);
     epollHandlerSetOnInput(client->epollHandler, clientOnInput);
     epollHandlerSetOnOutput(client->epollHandler, clientOnOutput);
     epollHandlerSetOnDisconnect(client->epollHandler, clientOnDisconnect);
+    epollHandlerSetOnRelease(client->epollHandler, clientOnRelease);
+    epollHandlerSetOnFlush(client->epollHandler, clientOnFlush);
+    epollHandlerSetOnSent(client->epollHandler, clientOnSent);
 
     client->server = server;
-    client->player = new HangmanPlayer(HangmanServer::getInstance());
-    client->player->attachNetworkClient(client);
+    client->connection = connection;
+    client->worker = worker;
+
+    client->limits = limits;
+    client->isInputPaused = false;
+    client->isWaitingForSync = false;
+    client->isSending = false;
+    client->windowRequests = 0;
+    client->idleTimer = timerCreate(timers, clientOnIdle, client, idleTimerMemory);
+    client->slowTimer = timerCreate(timers, clientOnSlow, client, slowTimerMemory);
+    if(limits->idleTimeoutMs > 0){
+        timerSchedule(client->idleTimer, limits->idleTimeoutMs);
+    }
 
     // Store a pointer to server in the epollHandler
     *(Client**)(epollHandlerData(client->epollHandler)) = client;
     epollRegisterHandler(epoll, client->epollHandler);
     epollSetHandledEvents(client->epollHandler, EPOLLIN);
 
-    clientLog(client, "Created");
+    CLIENT_LOG(LOG_LEVEL_INFO, client, "Created");
 
     return client;
 }
@@ -78,65 +130,144 @@ Client* clientCreate(int sockFd, Epoll* epoll, Server* server){
 void clientOnInput(EpollHandler* sender){
     // Read the client
     Client* client = *(Client**)epollHandlerData(sender);
-
-    char* buffer = bufferGetData(client->readBuffer);
-    size_t remaining = bufferGetRemaining(client->readBuffer);
-    ssize_t readBytes = read(client->sockFd, buffer, remaining);
-
-    if(readBytes == -1){
-        // Error
-        clientLog(client, "An error happened during read.");
-        return;
-    }
-    else if(readBytes == 0){
-        // EOF
-        clientClose(client);
-        return;
+    if(client->limits->idleTimeoutMs > 0){
+        timerSchedule(client->idleTimer, client->limits->idleTimeoutMs);
     }
-    bufferMovePointer(client->readBuffer, readBytes);
+    clientReadInput(client);
+}
 
-    string msg = "Read " + to_string(readBytes) + "/" + to_string(bufferGetLength(client->readBuffer)) + " bytes";
-    clientLog(client, msg);
+/**
+ * Reads until the socket is drained, processing every complete message. While the input is paused,
+ * the data is left in the socket, so that the client's own TCP window slows it down
+ * @param client The client
+ */
+void clientReadInput(Client* client){
+    bool isDrained = false;
+    while(true){
+        if(!clientProcessInputData(client)){
+            clientClose(client);
+            return;
+        }
+        if(client->isInputPaused || isDrained) return;
+
+        size_t writable = ringBufferGetWritable(client->receiveRing);
+        if(writable == 0){
+            // A single message doesn't fit in the buffer
+            CLIENT_LOG(LOG_LEVEL_WARNING, client, "The message is too long.");
+            clientClose(client);
+            return;
+        }
+        char* buffer = ringBufferGetWritePointer(client->receiveRing);
+        ssize_t readBytes = epollRead(client->epollHandler, buffer, writable);
+
+        if(readBytes == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            // Error
+            CLIENT_LOG(LOG_LEVEL_WARNING, client, "An error happened during read.");
+            clientClose(client);
+            return;
+        }
+        else if(readBytes == 0){
+            // EOF
+            clientClose(client);
+            return;
+        }
+        ringBufferCommitWrite(client->receiveRing, readBytes);
+        metricAdd(&metricBytesIn, readBytes);
+
+        CLIENT_LOG(LOG_LEVEL_DEBUG, client, "Read {} bytes", readBytes);
 
-    if(bufferGetRemaining(client->readBuffer) == 0){
-        // Finished reading size or message content
-        clientProcessInputData(client);
+        // A short read means that the socket has been drained
+        isDrained = (size_t)readBytes < writable;
     }
 }
 
 /**
- * Handles the output event
+ * Handles the output event: the socket can accept more data after a write has been cut short
  * @param sender The epoll handler that's related to this event
  */
 void clientOnOutput(EpollHandler* sender) {
-    // Read the client
+    clientWriteQueue(*(Client**)epollHandlerData(sender));
+}
+
+/**
+ * Handles the flush at the end of the wakeup. Everything queued during the wakeup is written at once,
+ * without waiting for the output event
+ * @param sender The epoll handler that's related to this event
+ */
+void clientOnFlush(EpollHandler* sender) {
+    clientWriteQueue(*(Client**)epollHandlerData(sender));
+}
+
+/**
+ * Handles the completion of a send through io_uring, and sends what has been queued meanwhile
+ * @param sender The epoll handler that's related to this event
+ * @param result Number of the sent bytes or -errno
+ */
+void clientOnSent(EpollHandler* sender, ssize_t result){
     Client* client = *(Client**)epollHandlerData(sender);
-    if(client->writeBuffer == nullptr){
-        clientFinishWrite(client);
+    client->isSending = false;
+    if(result < 0){
+        CLIENT_LOG(LOG_LEVEL_WARNING, client, "An error happened during write.");
+        clientClose(client);
         return;
     }
+    outputQueueConsume(client->outputQueue, result);
+    metricAdd(&metricBytesOut, result);
+    CLIENT_LOG(LOG_LEVEL_DEBUG, client, "Sent {} bytes", result);
+    clientWriteQueue(client);
+}
 
-    char* buffer = bufferGetData(client->writeBuffer);
-    size_t len = bufferGetRemaining(client->writeBuffer);
-    ssize_t writtenBytes = write(client->sockFd, buffer, len);
+/**
+ * Writes until the queue is empty or the socket can't accept more data.
+ * As many queued buffers as possible are sent with a single writev.
+ * The output event is subscribed for only while the socket is full.
+ * With io_uring, the queued buffers are sent with a single send instead, one at a time,
+ * and it's submitted along with the next wait
+ * @param client The client
+ */
+void clientWriteQueue(Client* client) {
+    iovec iov[CLIENT_MAX_IOVEC];
+    if(epollHasAsyncIo(client->epollHandler)){
+        if(!client->isSending && !outputQueueIsEmpty(client->outputQueue)){
+            int iovCount = outputQueueStartSend(client->outputQueue, iov, CLIENT_MAX_IOVEC);
+            epollSend(client->epollHandler, iov, iovCount);
+            client->isSending = true;
+        }
+    }
+    while(!client->isSending && !outputQueueIsEmpty(client->outputQueue)){
+        int iovCount = outputQueueFillIovec(client->outputQueue, iov, CLIENT_MAX_IOVEC);
+        size_t len = 0;
+        for(int i = 0; i < iovCount; i++){
+            len += iov[i].iov_len;
+        }
+        ssize_t writtenBytes = writev(client->sockFd, iov, iovCount);
+
+        if(writtenBytes == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            // Error
+            CLIENT_LOG(LOG_LEVEL_WARNING, client, "An error happened during write.");
+            clientClose(client);
+            return;
+        }
+        outputQueueConsume(client->outputQueue, writtenBytes);
+        metricAdd(&metricBytesOut, writtenBytes);
+        CLIENT_LOG(LOG_LEVEL_DEBUG, client, "Written {}/{} bytes", writtenBytes, len);
 
-    if(writtenBytes == -1){
-        // Error
-        clientFinishWrite(client);
-        clientLog(client, "An error happened during write.");
-        return;
+        // A short write means that the socket buffer is full
+        if((size_t)writtenBytes < len) break;
     }
-    else if(writtenBytes == 0){
-        // EOF
-        clientClose(client);
-        return;
+    if(!clientCheckQueue(client)) return;
+    if(!epollHasAsyncIo(client->epollHandler)){
+        epollSetHandledEvents(client->epollHandler, outputQueueIsEmpty(client->outputQueue) ? EPOLLIN : EPOLLIN | EPOLLOUT);
     }
-    bufferMovePointer(client->writeBuffer, writtenBytes);
-    string msg = "Written " + to_string(writtenBytes) + "/" + to_string(bufferGetLength(client->writeBuffer)) + " bytes";
-    clientLog(client, msg);
 
-    if(bufferGetRemaining(client->writeBuffer) == 0){
-        clientFinishWrite(client);
+    if(client->isInputPaused && !client->isWaitingForSync && outputQueueGetBytes(client->outputQueue) <= client->limits->lowWatermark){
+        // The data left in the socket won't cause another input event
+        CLIENT_LOG(LOG_LEVEL_DEBUG, client, "Resuming the input");
+        clientResumeInput(client);
     }
 }
 
@@ -148,109 +279,262 @@ void clientOnDisconnect(EpollHandler* sender) {
     // Read the client
     Client* client = *(Client**)epollHandlerData(sender);
 
-    clientLog(client, "Disconnected");
+    CLIENT_LOG(LOG_LEVEL_INFO, client, "Disconnected");
     clientClose(client);
 }
 
+/**
+ * Handles the release of the epoll handler, which happens after the client is closed, all the pending events
+ * are dispatched and the sends in flight have completed. Frees the queued data and the pool slot of the client
+ * @param sender The epoll handler that's related to this event
+ */
+void clientOnRelease(EpollHandler* sender) {
+    Client* client = *(Client**)epollHandlerData(sender);
+    ringBufferRelease(client->receiveRing);
+    outputQueueRelease(client->outputQueue);
+    // The clients never leave the I/O thread that accepted them
+    poolFree(poolGroupGetLocal(clientGetPools()), client);
+}
+
+/**
+ * Handles the idle timeout: closes the client that hasn't sent anything for too long
+ * @param timer The idle timer of the client
+ */
+void clientOnIdle(Timer* timer){
+    auto client = (Client*)timerGetData(timer);
+    CLIENT_LOG(LOG_LEVEL_INFO, client, "Idle for too long");
+    metricAdd(&metricConnectionsIdle, 1);
+    clientClose(client);
+}
+
+/**
+ * Handles the slow consumer timeout: closes the client that hasn't caught up with its output
+ * @param timer The slow timer of the client
+ */
+void clientOnSlow(Timer* timer){
+    auto client = (Client*)timerGetData(timer);
+    CLIENT_LOG(LOG_LEVEL_WARNING, client, "Closing, the client doesn't receive its messages fast enough");
+    metricAdd(&metricConnectionsSlow, 1);
+    clientClose(client);
+}
+
+/**
+ * Applies the watermarks to the output queue, after the queue has been written. A client above the high watermark
+ * has a few seconds to get below the low one. A client above the hard limit is closed at once
+ * @param client The client
+ * @return False if the client has been closed
+ */
+bool clientCheckQueue(Client* client){
+    size_t bytes = outputQueueGetBytes(client->outputQueue);
+
+    if(bytes > client->limits->highWatermark * CLIENT_HARD_LIMIT_FACTOR){
+        CLIENT_LOG(LOG_LEVEL_WARNING, client, "Closing, {} bytes are waiting to be sent", bytes);
+        metricAdd(&metricConnectionsSlow, 1);
+        clientClose(client);
+        return false;
+    }
+    if(bytes > client->limits->highWatermark){
+        if(!timerIsScheduled(client->slowTimer)){
+            CLIENT_LOG(LOG_LEVEL_INFO, client, "Above the high watermark, {} bytes queued", bytes);
+            timerSchedule(client->slowTimer, CLIENT_SLOW_GRACE_MS);
+        }
+    }else if(bytes <= client->limits->lowWatermark && timerIsScheduled(client->slowTimer)){
+        CLIENT_LOG(LOG_LEVEL_INFO, client, "Below the low watermark again");
+        timerCancel(client->slowTimer);
+    }
+    return true;
+}
+
 /**
  * Closes the client and unregisters it from the epoll mechanism
  * @param client The client to close
  */
 void clientClose(Client* client){
-    // First, notify others
-    if(client->player->checkIsAlive()){
-        client->player->attachNetworkClient(nullptr);
-    }
+    // First, notify the game, the player leaves it
     serverOnClientClose(client->server, client);
 
     // Then release the resources and disappear
     epollUnregisterHandler(client->epollHandler);
-    epollReleaseHandler(client->epollHandler);
     shutdown(client->sockFd, SHUT_RDWR);
     close(client->sockFd);
-    bufferRelease(client->readBuffer);
-    delete client->player;
+    timerRelease(client->idleTimer);
+    timerRelease(client->slowTimer);
+
+    CLIENT_LOG(LOG_LEVEL_INFO, client, "Closed");
+    // The handler frees the whole slot, possibly after the current batch of events
+    epollReleaseHandler(client->epollHandler);
+}
+
+/**
+ * Returns the size of the pool slot holding all the objects of a single connection.
+ * It's the memory taken by an idle connection
+ */
+size_t clientGetSlotSize(){
+    return poolAlign(sizeof(Client))
+            + poolAlign(epollGetHandlerSize())
+            + poolAlign(timerGetSize()) * 2
+            + poolAlign(outputQueueGetSize())
+            + ringBufferGetSize(CLIENT_RECEIVE_CAPACITY);
+}
 
-    clientLog(client, "Closed");
-    delete client;
+/**
+ * Returns the statistics of the pools the clients are allocated from, summed over all the I/O threads
+ */
+PoolStats clientGetPoolStats(){
+    return poolGroupGetStats(clientGetPools());
 }
 
 /**
- * Processes the whole buffer that was read
- * @param client The client that finished reading data
+ * Returns the identifier of the connection, which the game threads know the client by
+ * @param client The client
  */
-void clientProcessInputData(Client* client){
-    switch(client->readStatus){
-        case READING_LENGTH: {
-            // The message length was read. Parse it and create a new buffer for the message content.
-            char* data = bufferGetDataOrigin(client->readBuffer);
-            size_t length = bufferGetLength(client->readBuffer);
-            size_t messageLength = 0;
-            for(size_t i = 0; i < length; i++){
-                messageLength <<= 8;
-                messageLength |= data[i];
+uint64_t clientGetConnection(Client* client){
+    return client->connection;
+}
+
+/**
+ * Returns the index of the game thread that handles the client's requests
+ * @param client The client
+ */
+int clientGetWorker(Client* client){
+    return client->worker;
+}
+
+/**
+ * Hands the client's next requests to another game thread
+ * @param client The client
+ * @param worker Index of the game thread
+ */
+void clientSetWorker(Client* client, int worker){
+    client->worker = worker;
+}
+
+/**
+ * Handles the game thread's confirmation that it has handled the requests of the window.
+ * Their responses are already queued, so the output queue tells whether the client may go on
+ * @param client The client
+ */
+void clientOnSync(Client* client){
+    client->isWaitingForSync = false;
+    if(outputQueueGetBytes(client->outputQueue) > client->limits->highWatermark) return;
+    clientResumeInput(client);
+}
+
+/**
+ * Stops processing the client's messages. The client isn't idle while the server itself holds it back,
+ * and no input event comes while its data waits in the socket, so the idle timer is suspended until the input resumes
+ * @param client The client
+ */
+void clientPauseInput(Client* client){
+    client->isInputPaused = true;
+    timerCancel(client->idleTimer);
+}
+
+/**
+ * Resumes processing the client's messages, restarting the idle timer, and processes the data left in the socket,
+ * which won't cause another input event
+ * @param client The client
+ */
+void clientResumeInput(Client* client){
+    client->isInputPaused = false;
+    if(client->limits->idleTimeoutMs > 0){
+        timerSchedule(client->idleTimer, client->limits->idleTimeoutMs);
+    }
+    clientReadInput(client);
+}
+
+/**
+ * Returns the pools the clients are allocated from, one per I/O thread
+ */
+PoolGroup* clientGetPools(){
+    static PoolGroup* pools = poolGroupCreate(clientGetSlotSize(), CLIENTS_PER_SLAB);
+    return pools;
+}
+
+/**
+ * Processes all the complete messages in the receive buffer, unless the output queue is above the high watermark.
+ * The messages are validated in place and passed to the game thread, stamped with the time they've been received.
+ * The responses come back later, so after every window of requests the input waits for the game thread to catch up,
+ * otherwise a client sending a burst of requests would only learn about its full queue after all of them
+ * @param client The client that has read the data
+ * @return False if the client sent a message that can never be received
+ */
+bool clientProcessInputData(Client* client){
+    while(ringBufferGetReadable(client->receiveRing) >= CLIENT_LENGTH_SIZE){
+        if(client->isInputPaused || outputQueueGetBytes(client->outputQueue) > client->limits->highWatermark){
+            // The responses would only pile up in the queue
+            if(!client->isInputPaused){
+                metricAdd(&metricInputPauses, 1);
+                clientPauseInput(client);
             }
-            bufferRelease(client->readBuffer);
-            client->readBuffer = bufferCreate(messageLength);
-            client->readStatus = READING_CONTENT;
             break;
         }
-        case READING_CONTENT: {
-            // The message content has been read. Make use of it.
-            clientLog(client, "Completed reading message.");
-            client->player->parseMessage(
-                    bufferGetDataOrigin(client->readBuffer),
-                    bufferGetLength(client->readBuffer));
-
-            bufferRelease(client->readBuffer);
-            client->readBuffer = bufferCreate(sizeof(uint32_t));
-            client->readStatus = READING_LENGTH;
+
+        // Parse the message length
+        auto* data = (uint8_t*)ringBufferGetReadPointer(client->receiveRing);
+        size_t messageLength = 0;
+        for(size_t i = 0; i < CLIENT_LENGTH_SIZE; i++){
+            messageLength <<= 8;
+            messageLength |= data[i];
+        }
+        if(messageLength > ringBufferGetCapacity(client->receiveRing) - CLIENT_LENGTH_SIZE){
+            CLIENT_LOG(LOG_LEVEL_WARNING, client, "The message is too long.");
+            return false;
+        }
+        if(ringBufferGetReadable(client->receiveRing) < CLIENT_LENGTH_SIZE + messageLength){
+            // The message content hasn't arrived yet
+            break;
+        }
+
+        // The message content has been read. Make use of it.
+        CLIENT_LOG(LOG_LEVEL_DEBUG, client, "Completed reading message.");
+        metricAdd(&metricFramesIn, 1);
+        // The body stays in UTF-8, malformed UTF-8 is rejected and only the type is passed on.
+        // An empty message doesn't even have a type
+        char* payload = (char*)data + CLIENT_LENGTH_SIZE;
+        Journal* journal = serverGetJournal(client->server);
+        if(journal != nullptr){
+            // Captured as received, so that the replay sends the malformed requests too
+            journalAppend(journal, JOURNAL_FRAME, client->connection, payload, messageLength);
+        }
+        bool isMoving = false;
+        if(messageLength > 0){
+            size_t length = utf8Validate(payload + 1, messageLength - 1) ? messageLength : 1;
+            isMoving = serverPostRequest(client->server, client, frameCreate(payload, length));
+        }
+        ringBufferConsume(client->receiveRing, CLIENT_LENGTH_SIZE + messageLength);
+
+        // A request that may move the client to another game thread closes the window early
+        if(++client->windowRequests == CLIENT_REQUEST_WINDOW || isMoving){
+            client->windowRequests = 0;
+            client->isWaitingForSync = true;
+            clientPauseInput(client);
+            serverPostSync(client->server, client);
             break;
         }
     }
+    return true;
 }
 
 /**
- * Prepares the write buffer to sending data
+ * Queues the data to be sent to the client
  * @param client The client that is to send the data
  * @param data The bytes to send
  * @param length Number of bytes to send
  */
 void clientWrite(Client* client, const char* data, size_t length){
-    // Copy the data and prepend with a length sequence
-    char* rawData = new char[length + sizeof(uint32_t)];
-    size_t len = length;
-    for(int i = sizeof(uint32_t) - 1; i >= 0; i--) {
-        rawData[i] = (char)(len & 0xff);
-        len >>= 8;
-    }
-    for(size_t i = 0; i < length; i++){
-        rawData[i + sizeof(uint32_t)] = data[i];
-    }
-
-    Buffer* buffer = bufferCreate(length + sizeof(uint32_t), rawData);
-    if(client->writeBuffer == nullptr){
-        client->writeBuffer = buffer;
-    }else{
-        bufferAttachNext(client->writeBuffer, buffer);
-    }
-    epollSetHandledEvents(client->epollHandler, EPOLLIN | EPOLLOUT);
+    Frame* frame = frameCreate(data, length);
+    clientWriteFrame(client, frame);
+    frameRelease(frame);
 }
 
 /**
- * Finishes the current buffer and turns off listening for outbound events if necessary
- * @param client The client that's to stop sending
+ * Queues the encoded frame to be sent to the client. The frame isn't copied, the queue only references it.
+ * The frames queued during a wakeup are written together at its end, the limits are applied then
+ * @param client The client that is to send the frame
+ * @param frame The frame to send
  */
-void clientFinishWrite(Client* client){
-    Buffer* nextBuffer = bufferGetNext(client->writeBuffer);
-    bufferRelease(client->writeBuffer);
-    client->writeBuffer = nextBuffer;
-
-    if(client->writeBuffer == nullptr){
-        epollSetHandledEvents(client->epollHandler, EPOLLIN);
-    }
-}
-
-void clientLog(Client* client, const string& text){
-    printf("\x1b[1;36m[CLIENT: %d]\x1b[0m %s\n", client->sockFd, text.c_str());
+void clientWriteFrame(Client* client, Frame* frame){
+    outputQueuePush(client->outputQueue, bufferCreate(frame));
+    epollRequestFlush(client->epollHandler);
 }
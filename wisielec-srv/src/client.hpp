@@ -4,11 +4,36 @@
 struct Client;
 
 #include "epoll.hpp"
+#include "frame.hpp"
+#include "pool.hpp"
 #include "server.hpp"
+#include "timer.hpp"
 
-Client* clientCreate(int sockFd, Epoll* epoll, Server* server);
+#define CLIENT_DEFAULT_IDLE_TIMEOUT_MS (300 * 1000)
+#define CLIENT_DEFAULT_LOW_WATERMARK (64 * 1024)
+#define CLIENT_DEFAULT_HIGH_WATERMARK (256 * 1024)
+
+/**
+ * Limits applied to every connection of a server
+ */
+struct ClientLimits {
+    uint64_t idleTimeoutMs;     // After how long without any input the connection is closed, 0 to never close it
+    size_t lowWatermark;        // The queued bytes below which a slow client is forgiven
+    size_t highWatermark;       // The queued bytes above which a client has a few seconds to catch up
+};
+
+Client* clientCreate(int sockFd, Epoll* epoll, Server* server, TimerWheel* timers, const ClientLimits* limits,
+                     uint64_t connection, int worker);
 void clientClose(Client* client);
+uint64_t clientGetConnection(Client* client);
+int clientGetWorker(Client* client);
+void clientSetWorker(Client* client, int worker);
+void clientOnSync(Client* client);
 
 void clientWrite(Client* client, const char* data, size_t length);
+void clientWriteFrame(Client* client, Frame* frame);
+
+size_t clientGetSlotSize();
+PoolStats clientGetPoolStats();
 
 #endif
@@ -0,0 +1,375 @@
+#include "dictionary.hpp"
+
+#include "unicode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DICTIONARY_MAGIC "WISDICT"
+#define DICTIONARY_VERSION 1
+#define DICTIONARY_DEFAULT_CATEGORY "general"
+
+/**
+ * The header at the beginning of the dictionary file. All the offsets are counted from the beginning of the file
+ */
+struct DictionaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t wordCount;
+    uint32_t categoryCount;
+    uint32_t reserved;
+    uint64_t categoriesOffset;      // DictionaryCategory[categoryCount]
+    uint64_t bucketsOffset;         // DictionaryBucket[categoryCount * DICTIONARY_DIFFICULTY_COUNT]
+    uint64_t indexOffset;           // DictionaryEntry[wordCount], sorted by category and difficulty
+    uint64_t stringsOffset;         // UTF-8 names of the categories and the words, one after another
+    uint64_t stringsLength;
+};
+
+struct DictionaryCategory {
+    uint32_t nameOffset;            // Counted from the beginning of the strings
+    uint32_t nameLength;
+};
+
+/**
+ * A range of the index with the words of a single category and difficulty
+ */
+struct DictionaryBucket {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct DictionaryEntry {
+    uint32_t offset;                // Counted from the beginning of the strings
+    uint16_t length;
+    uint16_t category;
+};
+
+/**
+ * Structure representing a dictionary file mapped into memory.
+ * Only the pages that are actually read are loaded, so opening it costs the same for any size
+ */
+struct Dictionary {
+    void* memory;
+    size_t size;
+    const DictionaryHeader* header;
+    const DictionaryCategory* categories;
+    const DictionaryBucket* buckets;
+    const DictionaryEntry* index;
+    const char* strings;
+};
+
+uint32_t dictionaryPermute(const DictionaryBag& bag, uint32_t value);
+uint64_t dictionaryMix(uint64_t value);
+
+/**
+ * Maps the dictionary file into memory and checks its structure
+ * @param path Path of the file created by dictionaryCompile
+ * @return The dictionary
+ */
+Dictionary* dictionaryOpen(const char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        throw runtime_error(string("Failed to open the dictionary: ") + path);
+    }
+    struct stat fileStat {};
+    fstat(fd, &fileStat);
+    auto size = (size_t)fileStat.st_size;
+    if(size < sizeof(DictionaryHeader)){
+        close(fd);
+        throw runtime_error("The dictionary file is too short.");
+    }
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        throw runtime_error("Failed to map the dictionary.");
+    }
+    // The words are drawn at random, reading ahead would only waste memory
+    madvise(memory, size, MADV_RANDOM);
+
+    auto dictionary = new Dictionary();
+    dictionary->memory = memory;
+    dictionary->size = size;
+    dictionary->header = (const DictionaryHeader*)memory;
+
+    const DictionaryHeader* header = dictionary->header;
+    uint64_t bucketCount = (uint64_t)header->categoryCount * DICTIONARY_DIFFICULTY_COUNT;
+    bool isValid = memcmp(header->magic, DICTIONARY_MAGIC, sizeof(DICTIONARY_MAGIC)) == 0
+            && header->version == DICTIONARY_VERSION
+            && header->categoriesOffset + header->categoryCount * sizeof(DictionaryCategory) <= size
+            && header->bucketsOffset + bucketCount * sizeof(DictionaryBucket) <= size
+            && header->indexOffset + (uint64_t)header->wordCount * sizeof(DictionaryEntry) <= size
+            && header->stringsOffset + header->stringsLength <= size;
+    if(!isValid){
+        dictionaryClose(dictionary);
+        throw runtime_error("The dictionary file is corrupted.");
+    }
+
+    const char* base = (const char*)memory;
+    dictionary->categories = (const DictionaryCategory*)(base + header->categoriesOffset);
+    dictionary->buckets = (const DictionaryBucket*)(base + header->bucketsOffset);
+    dictionary->index = (const DictionaryEntry*)(base + header->indexOffset);
+    dictionary->strings = base + header->stringsOffset;
+    return dictionary;
+}
+
+/**
+ * Unmaps the dictionary
+ * @param dictionary The dictionary to close
+ */
+void dictionaryClose(Dictionary* dictionary){
+    munmap(dictionary->memory, dictionary->size);
+    delete dictionary;
+}
+
+/**
+ * Compiles a word list into the dictionary file. Every line of the list contains a phrase,
+ * optionally preceded by a category and a tab. The phrases are converted to upper case
+ * @param input The word list in UTF-8
+ * @param path Path of the file to create
+ */
+void dictionaryCompile(istream& input, const char* path){
+    struct Word {
+        uint16_t category;
+        uint8_t difficulty;
+        string text;
+    };
+    vector<Word> words;
+    vector<string> categoryNames;
+    map<string, uint16_t> categoryIds;
+
+    string line;
+    while(getline(input, line)){
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        size_t tab = line.find('\t');
+        string categoryName = tab == string::npos ? DICTIONARY_DEFAULT_CATEGORY : line.substr(0, tab);
+        u32string phrase = utf8ToUtf32(tab == string::npos ? line : line.substr(tab + 1));
+
+        // Trim the phrase and count its letters
+        size_t begin = phrase.find_first_not_of(U" ");
+        if(begin == u32string::npos) continue;
+        phrase = phrase.substr(begin, phrase.find_last_not_of(U" ") - begin + 1);
+        size_t letters = 0;
+        for(char32_t& c : phrase){
+            c = unicodeToUpper(c);
+            if(c != U' ' && c != U'-') letters++;
+        }
+        string text = utf32ToUtf8(phrase);
+        if(text.empty() || text.length() > UINT16_MAX) continue;
+
+        if(categoryIds.find(categoryName) == categoryIds.end()){
+            categoryIds[categoryName] = categoryNames.size();
+            categoryNames.push_back(categoryName);
+        }
+        uint8_t difficulty = letters <= 5 ? DICTIONARY_DIFFICULTY_EASY
+                : letters <= 9 ? DICTIONARY_DIFFICULTY_MEDIUM
+                : DICTIONARY_DIFFICULTY_HARD;
+        words.push_back(Word { categoryIds[categoryName], difficulty, text });
+    }
+
+    // The words of each category and difficulty form a single range of the index
+    stable_sort(words.begin(), words.end(), [](const Word& a, const Word& b){
+        return a.category != b.category ? a.category < b.category : a.difficulty < b.difficulty;
+    });
+
+    string strings;
+    vector<DictionaryCategory> categories;
+    for(const string& name : categoryNames){
+        categories.push_back(DictionaryCategory { (uint32_t)strings.length(), (uint32_t)name.length() });
+        strings += name;
+    }
+    vector<DictionaryBucket> buckets(categoryNames.size() * DICTIONARY_DIFFICULTY_COUNT, DictionaryBucket { 0, 0 });
+    vector<DictionaryEntry> index;
+    for(const Word& word : words){
+        DictionaryBucket& bucket = buckets[word.category * DICTIONARY_DIFFICULTY_COUNT + word.difficulty];
+        if(bucket.count == 0) bucket.first = index.size();
+        bucket.count++;
+        index.push_back(DictionaryEntry { (uint32_t)strings.length(), (uint16_t)word.text.length(), word.category });
+        strings += word.text;
+    }
+
+    DictionaryHeader header {};
+    memcpy(header.magic, DICTIONARY_MAGIC, sizeof(DICTIONARY_MAGIC));
+    header.version = DICTIONARY_VERSION;
+    header.wordCount = index.size();
+    header.categoryCount = categories.size();
+    header.categoriesOffset = sizeof(DictionaryHeader);
+    header.bucketsOffset = header.categoriesOffset + categories.size() * sizeof(DictionaryCategory);
+    header.indexOffset = header.bucketsOffset + buckets.size() * sizeof(DictionaryBucket);
+    header.stringsOffset = header.indexOffset + index.size() * sizeof(DictionaryEntry);
+    header.stringsLength = strings.length();
+
+    ofstream output(path, ios::binary | ios::trunc);
+    output.write((const char*)&header, sizeof(header));
+    output.write((const char*)categories.data(), categories.size() * sizeof(DictionaryCategory));
+    output.write((const char*)buckets.data(), buckets.size() * sizeof(DictionaryBucket));
+    output.write((const char*)index.data(), index.size() * sizeof(DictionaryEntry));
+    output.write(strings.data(), strings.length());
+    if(!output){
+        throw runtime_error(string("Failed to write the dictionary: ") + path);
+    }
+}
+
+/**
+ * Returns the number of words in the dictionary
+ * @param dictionary The dictionary
+ */
+uint32_t dictionaryGetWordCount(Dictionary* dictionary){
+    return dictionary->header->wordCount;
+}
+
+/**
+ * Returns the number of categories in the dictionary
+ * @param dictionary The dictionary
+ */
+uint32_t dictionaryGetCategoryCount(Dictionary* dictionary){
+    return dictionary->header->categoryCount;
+}
+
+/**
+ * Returns the name of the category
+ * @param dictionary The dictionary
+ * @param category Number of the category
+ */
+string dictionaryGetCategoryName(Dictionary* dictionary, uint32_t category){
+    const DictionaryCategory& entry = dictionary->categories[category];
+    if(entry.nameOffset + (uint64_t)entry.nameLength > dictionary->header->stringsLength) return "";
+    return string(dictionary->strings + entry.nameOffset, entry.nameLength);
+}
+
+/**
+ * Finds the category by its name
+ * @param dictionary The dictionary
+ * @param name Name of the category
+ * @return Number of the category or -1 if there's no such category
+ */
+int dictionaryFindCategory(Dictionary* dictionary, const string& name){
+    for(uint32_t i = 0; i < dictionary->header->categoryCount; i++){
+        if(dictionaryGetCategoryName(dictionary, i) == name) return (int)i;
+    }
+    return -1;
+}
+
+/**
+ * Parses the difficulty name
+ * @param name One of: easy, medium, hard
+ * @return The difficulty or -1 if the name is unknown
+ */
+int dictionaryParseDifficulty(const string& name){
+    if(name == "easy") return DICTIONARY_DIFFICULTY_EASY;
+    if(name == "medium") return DICTIONARY_DIFFICULTY_MEDIUM;
+    if(name == "hard") return DICTIONARY_DIFFICULTY_HARD;
+    return -1;
+}
+
+/**
+ * Returns the word from the index
+ * @param dictionary The dictionary
+ * @param index Position of the word in the index
+ * @return The word in UTF-8, empty if the entry is corrupted
+ */
+string dictionaryGetWord(Dictionary* dictionary, uint32_t index){
+    const DictionaryEntry& entry = dictionary->index[index];
+    if(entry.offset + (uint64_t)entry.length > dictionary->header->stringsLength) return "";
+    return string(dictionary->strings + entry.offset, entry.length);
+}
+
+/**
+ * Creates a shuffle bag of the words
+ * @param dictionary The dictionary
+ * @param category Number of the category or DICTIONARY_ANY
+ * @param difficulty The difficulty or DICTIONARY_ANY
+ * @param seed Seed of the pseudo-random order
+ * @return The bag
+ */
+DictionaryBag dictionaryCreateBag(Dictionary* dictionary, int category, int difficulty, uint64_t seed){
+    DictionaryBag bag {};
+    bag.key = dictionaryMix(seed);
+    bag.count = 0;
+    bag.position = 0;
+
+    for(uint32_t c = 0; c < dictionary->header->categoryCount; c++){
+        if(category != DICTIONARY_ANY && (int)c != category) continue;
+        for(int d = 0; d < DICTIONARY_DIFFICULTY_COUNT; d++){
+            if(difficulty != DICTIONARY_ANY && d != difficulty) continue;
+            const DictionaryBucket& bucket = dictionary->buckets[c * DICTIONARY_DIFFICULTY_COUNT + d];
+            if(bucket.count == 0 || bucket.first + (uint64_t)bucket.count > dictionary->header->wordCount) continue;
+
+            // Merge the adjacent ranges
+            if(!bag.ranges.empty() && bag.ranges.back().first + bag.ranges.back().second == bucket.first){
+                bag.ranges.back().second += bucket.count;
+            }else{
+                bag.ranges.emplace_back(bucket.first, bucket.count);
+            }
+            bag.count += bucket.count;
+        }
+    }
+
+    // The smallest even number of bits that covers all the words
+    bag.halfBits = 1;
+    while(((uint64_t)1 << (2 * bag.halfBits)) < bag.count){
+        bag.halfBits++;
+    }
+    return bag;
+}
+
+/**
+ * Draws the next word from the bag. When all the words have been drawn, the bag is shuffled again
+ * @param dictionary The dictionary
+ * @param bag The bag
+ * @return The word in UTF-8, empty if the bag has no words
+ */
+string dictionaryDraw(Dictionary* dictionary, DictionaryBag& bag){
+    if(bag.count == 0) return "";
+    if(bag.position == bag.count){
+        bag.position = 0;
+        bag.key = dictionaryMix(bag.key);
+    }
+
+    // Walk the permutation until it lands inside the bag
+    uint32_t value = bag.position++;
+    do {
+        value = dictionaryPermute(bag, value);
+    } while(value >= bag.count);
+
+    for(const auto& range : bag.ranges){
+        if(value < range.second) return dictionaryGetWord(dictionary, range.first + value);
+        value -= range.second;
+    }
+    return "";
+}
+
+/**
+ * Permutes the numbers below 2^(2 * halfBits) with a 4-round Feistel network keyed with the bag key
+ * @param bag The bag
+ * @param value The number to permute
+ */
+uint32_t dictionaryPermute(const DictionaryBag& bag, uint32_t value){
+    uint32_t mask = ((uint32_t)1 << bag.halfBits) - 1;
+    uint32_t left = value >> bag.halfBits;
+    uint32_t right = value & mask;
+    for(uint64_t round = 0; round < 4; round++){
+        uint32_t next = left ^ ((uint32_t)dictionaryMix(bag.key + round * 0x9e3779b97f4a7c15ull + right) & mask);
+        left = right;
+        right = next;
+    }
+    return (left << bag.halfBits) | right;
+}
+
+/**
+ * Mixes the bits of the number (the SplitMix64 finalizer)
+ * @param value The number
+ */
+uint64_t dictionaryMix(uint64_t value){
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
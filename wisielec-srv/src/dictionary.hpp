@@ -0,0 +1,47 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#define DICTIONARY_DIFFICULTY_EASY 0       // Up to 5 letters
+#define DICTIONARY_DIFFICULTY_MEDIUM 1     // 6 to 9 letters
+#define DICTIONARY_DIFFICULTY_HARD 2       // 10 letters or more
+#define DICTIONARY_DIFFICULTY_COUNT 3
+#define DICTIONARY_ANY -1
+
+struct Dictionary;
+
+/**
+ * A shuffle bag over the words of the dictionary, optionally limited to a category and a difficulty.
+ * The words are drawn in a pseudo-random order without repeats, until all of them have been drawn.
+ * The order is a keyed permutation, so the bag takes the same memory for any number of words
+ */
+struct DictionaryBag {
+    vector<pair<uint32_t, uint32_t>> ranges;     // Ranges of the word index (first, count) the bag draws from
+    uint32_t count;                             // Number of words in all the ranges
+    uint32_t position;                          // Number of words drawn since the last shuffle
+    uint32_t halfBits;                          // The permutation works on 2 * halfBits bits
+    uint64_t key;
+};
+
+Dictionary* dictionaryOpen(const char* path);
+void dictionaryClose(Dictionary* dictionary);
+void dictionaryCompile(istream& input, const char* path);
+
+uint32_t dictionaryGetWordCount(Dictionary* dictionary);
+uint32_t dictionaryGetCategoryCount(Dictionary* dictionary);
+string dictionaryGetCategoryName(Dictionary* dictionary, uint32_t category);
+int dictionaryFindCategory(Dictionary* dictionary, const string& name);
+int dictionaryParseDifficulty(const string& name);
+string dictionaryGetWord(Dictionary* dictionary, uint32_t index);
+
+DictionaryBag dictionaryCreateBag(Dictionary* dictionary, int category, int difficulty, uint64_t seed);
+string dictionaryDraw(Dictionary* dictionary, DictionaryBag& bag);
+
+#endif
@@ -1,10 +1,85 @@
 #include "epoll.hpp"
 
+#include "metrics.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+
+#define EPOLL_URING_MIN_ENTRIES 64
+#define EPOLL_URING_IGNORED URING_IGNORED   // User data of the poll removals, whose completions aren't dispatched
+#define EPOLL_URING_SEND (1ull << 63)       // Marks the user data of the sends, the rest of it points to the send
+#define EPOLL_URING_ACCEPTED (1u << 24)     // The event carries an accepted socket, epoll never reports this bit
+#define EPOLL_URING_SENT (1u << 25)         // The event carries the result of a send
+#define EPOLL_URING_BUFFER_GROUP 0
+#define EPOLL_URING_BUFFER_COUNT 2048       // Buffers shared by all the receives of a loop, a power of two
+#define EPOLL_URING_BUFFER_SIZE 4096
+#define EPOLL_URING_MAX_HELD EPOLL_URING_BUFFER_SIZE    // Received bytes a handler may hold before its receive is stopped
+#define EPOLL_URING_NO_BUFFER UINT16_MAX
+
+int epollBackend = EPOLL_BACKEND_EPOLL;     // The backend of the event loops created from now on
+bool epollHasBufferRing = false;            // Whether the received buffers are given back through a shared ring
+
+/**
+ * Part of the received data held for a handler, in one of the provided buffers
+ */
+struct EpollReceived {
+    uint32_t length;
+    uint16_t next;                  // The buffer held after this one by the same handler
+};
+
+/**
+ * A send in flight. The kernel reads the message header and the iovec array until the send completes
+ */
+struct EpollSend {
+    EpollHandler* handler;          // The handler that has sent, nullptr while the send is free
+    msghdr header;
+    iovec iov[EPOLL_MAX_SEND_IOVEC];
+};
+
 /**
- * Structure representing an epoll instance
+ * Structure representing an event loop. It waits either with epoll or with io_uring.
+ * With io_uring, a handler that accepts (epollHandlerSetOnAccept) has a multishot accept in the kernel, and a handler
+ * that sends (epollHandlerSetOnSent) has a multishot receive into the buffers provided to the kernel, so the sockets
+ * are accepted and read without any system call of their own. The received data is held until epollRead takes it.
+ * The sends are submitted as they come and complete with the handler's send function. Every other handler has
+ * a poll operation, which is multishot for the edge-triggered handlers and one-shot (armed again after every event)
+ * for the level-triggered ones. Registering a handler or changing its events only queues the handler to be armed,
+ * and all the queued operations and sends are submitted by the system call that waits for the next events.
+ * An operation's user data is the handler's slot with the generation of the operation,
+ * so the completions of the operations that have been replaced or removed are recognized and skipped
  */
 struct Epoll {
-    int fd;
+    int fd;                                     // The epoll descriptor, -1 if io_uring is used
+    Uring* ring;                                // The io_uring instance, nullptr if epoll is used
+    int maxEvents;                              // Capacity of the events array
+    epoll_event* events;                        // Events returned by a single epoll_wait
+    bool isDispatching;                         // Whether the events are being dispatched right now
+    vector<EpollHandler*>* releasedHandlers;    // Handlers released during the dispatch, freed after it
+    vector<EpollHandler*>* flushedHandlers;     // Handlers that asked to be flushed at the end of the wakeup
+    EpollStats stats;                           // Event loop statistics
+    uint64_t now;                               // Monotonic time of the last wakeup, in nanoseconds
+
+    // Used by io_uring only
+    vector<EpollHandler*>* pollSlots;           // The registered handlers by their slots, nullptr in the free slots
+    vector<uint32_t>* pollGenerations;          // Generation of the latest poll armed for each slot
+    vector<uint32_t>* freePollSlots;
+    vector<uint32_t>* pendingArms;              // Slots of the handlers whose polls are armed before the next wait
+    int32_t* results;                           // Results of the accepts and the sends, by the event
+    uint64_t wakeup;                            // Counter of the waits, tells whether a handler's input is reported already
+    UringBuffers* buffers;                      // Buffers the kernel receives into, created for the first receiving handler
+    vector<EpollReceived>* received;            // What the held buffers contain, by the buffer identifiers
+    uint32_t heldBuffers;                       // Number of the buffers held by the handlers
+    vector<uint32_t>* starvedSlots;             // Slots of the handlers whose receives have run out of buffers
+    vector<EpollSend*>* sends;                  // All the sends ever allocated
+    vector<EpollSend*>* freeSends;
 };
 
 /**
@@ -14,18 +89,139 @@ struct EpollHandler {
     int fd;
     Epoll* epoll;
     void* data;
+    bool isRegistered;
+    bool isReleased;
+    bool isEdgeTriggered;       // Whether the events are reported only on state changes (EPOLLET)
+    bool isFlushRequested;      // Whether the handler is in the list of handlers to flush
+    uint32_t handledEvents;     // Events the handler is currently subscribed for
+
+    // Used by io_uring only
+    uint32_t pollSlot;          // Index of the handler in the slot table
+    uint32_t armedEvents;       // Events of the poll armed in the kernel
+    bool isPollArmed;           // Whether the kernel has a poll (or an accept, or a receive) of the latest generation
+    bool isArmPending;          // Whether the handler is queued to be armed
+    bool isCancelPending;       // Whether the accept or the receive is being cancelled, it's armed until its last completion
+    bool isReceiveFull;         // The receive is stopped, the handler holds enough data that hasn't been read
+    bool isReceiveStarved;      // The receive has been ended by the kernel, as no buffer was left
+    bool isReceiveEnded;        // The peer has closed the connection, reported once the held data has been read
+    bool isFreePending;         // The handler has been released, it's freed by the completion of its last send
+    int receiveError;           // The error that has ended the receive, 0 if none
+    uint16_t heldHead;          // The held buffers in the order of the data, EPOLL_URING_NO_BUFFER if none
+    uint16_t heldTail;
+    uint32_t heldOffset;        // Bytes of the first held buffer that have been read already
+    uint32_t heldBytes;
+    uint32_t pendingSends;      // Sends the kernel hasn't completed yet
+    uint64_t reportedWakeup;    // The wait after which the latest input event has been reported
 
     EventHandler handleInput;
     EventHandler handleOutput;
     EventHandler handleDisconnect;
+    EventHandler handleRelease;     // Frees the memory of a handler created in place
+    EventHandler handleFlush;       // Writes the output staged during the wakeup
+    AcceptHandler handleAccept;     // Takes the accepted sockets, with io_uring only
+    SendHandler handleSent;         // Takes the results of the sends, with io_uring only
 };
 
+uint64_t epollNow();
+void epollFreeHandler(EpollHandler* handler);
+void epollFlushHandlers(Epoll* epoll);
+uint32_t epollGetFlags(EpollHandler* handler);
+int epollWaitForCompletions(Epoll* epoll);
+void epollDispatch(Epoll* epoll, int eventCount);
+void epollQueueArm(EpollHandler* handler);
+void epollArmPolls(Epoll* epoll);
+void epollRemovePoll(EpollHandler* handler);
+void epollArmOperation(EpollHandler* handler);
+void epollCancelOperation(EpollHandler* handler);
+void epollPrepareReceive(io_uring_sqe* sqe, int fd);
+bool epollProbeReceive(bool isRing);
+bool epollIsReceiving(EpollHandler* handler);
+bool epollOnReceived(EpollHandler* handler, int32_t result);
+void epollHoldBuffer(EpollHandler* handler, uint16_t id, uint32_t length);
+void epollReleaseHeldBuffers(EpollHandler* handler);
+void epollRecycleBuffer(Epoll* epoll, uint16_t id);
+bool epollCompleteSend(Epoll* epoll, EpollSend* send, int32_t result, int eventIndex);
+uint64_t epollGetPollData(Epoll* epoll, uint32_t slot);
+
+/**
+ * Chooses the backend of the event loops created from now on. Must be called before any threads start
+ * @param backend One of the EPOLL_BACKEND_ constants
+ * @return False if the kernel doesn't support io_uring well enough, epoll is used then
+ */
+bool epollSetBackend(int backend){
+    epollBackend = EPOLL_BACKEND_EPOLL;
+    if(backend == EPOLL_BACKEND_URING){
+        // Some kernels take the buffer ring, but never pick a buffer from it
+        epollHasBufferRing = epollProbeReceive(true);
+        if(!epollHasBufferRing && !epollProbeReceive(false)) return false;
+        epollBackend = EPOLL_BACKEND_URING;
+    }
+    return true;
+}
+
+/**
+ * Checks that the kernel receives into the provided buffers with multishot receives, which came with Linux 6.0,
+ * by receiving a byte sent over a socket pair
+ * @param isRing Whether to provide the buffers through a shared ring
+ * @return True if the receive has completed and stays armed
+ */
+bool epollProbeReceive(bool isRing){
+    Uring* ring = uringCreate(2, 4);
+    if(ring == nullptr) return false;
+    UringBuffers* buffers = uringCreateBuffers(ring, EPOLL_URING_BUFFER_GROUP, 1, 64, isRing);
+    int sockets[2];
+    if(buffers == nullptr || socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1){
+        if(buffers != nullptr) uringReleaseBuffers(buffers);
+        uringRelease(ring);
+        return false;
+    }
+
+    bool isSupported = false;
+    epollPrepareReceive(uringGetSqe(ring), sockets[0]);
+    if(write(sockets[1], "", 1) == 1 && uringSubmitAndWait(ring, 1) >= 0){
+        io_uring_cqe* cqe = uringPeekCqe(ring);
+        isSupported = cqe != nullptr && cqe->res == 1
+                      && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER);
+    }
+    close(sockets[0]);
+    close(sockets[1]);
+    uringReleaseBuffers(buffers);
+    uringRelease(ring);
+    return isSupported;
+}
+
 /**
  * Creates a new epoll instance
+ * @param maxEvents Maximum number of events dispatched after a single wakeup
  */
-Epoll* epollCreate(){
+Epoll* epollCreate(int maxEvents){
     auto* epoll = new Epoll();
-    epoll->fd = epoll_create1(0);
+    epoll->maxEvents = maxEvents > 0 ? maxEvents : 1;
+    epoll->ring = nullptr;
+    if(epollBackend == EPOLL_BACKEND_URING){
+        // Room for a removal and an arm of every handler dispatched in a wakeup, and for the events of several wakeups
+        unsigned entries = max(epoll->maxEvents, EPOLL_URING_MIN_ENTRIES);
+        epoll->ring = uringCreate(2 * entries, 8 * entries);
+    }
+    epoll->fd = epoll->ring == nullptr ? epoll_create1(0) : -1;
+    epoll->events = new epoll_event[epoll->maxEvents];
+    epoll->isDispatching = false;
+    epoll->releasedHandlers = new vector<EpollHandler*>();
+    epoll->flushedHandlers = new vector<EpollHandler*>();
+    epoll->stats = {};
+    epoll->now = epollNow();
+    epoll->pollSlots = new vector<EpollHandler*>();
+    epoll->pollGenerations = new vector<uint32_t>();
+    epoll->freePollSlots = new vector<uint32_t>();
+    epoll->pendingArms = new vector<uint32_t>();
+    epoll->results = new int32_t[epoll->maxEvents];
+    epoll->wakeup = 0;
+    epoll->buffers = nullptr;
+    epoll->received = new vector<EpollReceived>();
+    epoll->heldBuffers = 0;
+    epoll->starvedSlots = new vector<uint32_t>();
+    epoll->sends = new vector<EpollSend*>();
+    epoll->freeSends = new vector<EpollSend*>();
     return epoll;
 }
 
@@ -33,6 +229,34 @@ Epoll* epollCreate(){
  * Releases the epoll
  */
 void epollRelease(Epoll* epoll){
+    if(epoll->ring != nullptr){
+        if(epoll->buffers != nullptr){
+            uringReleaseBuffers(epoll->buffers);
+        }
+        uringRelease(epoll->ring);
+    }else{
+        close(epoll->fd);
+    }
+    // The kernel has cancelled the sends, the handlers waiting for them can be freed now
+    for(EpollSend* send : *epoll->sends){
+        EpollHandler* handler = send->handler;
+        if(handler != nullptr && --handler->pendingSends == 0 && handler->isFreePending){
+            epollFreeHandler(handler);
+        }
+        delete send;
+    }
+    delete[] epoll->events;
+    delete[] epoll->results;
+    delete epoll->received;
+    delete epoll->starvedSlots;
+    delete epoll->sends;
+    delete epoll->freeSends;
+    delete epoll->releasedHandlers;
+    delete epoll->flushedHandlers;
+    delete epoll->pollSlots;
+    delete epoll->pollGenerations;
+    delete epoll->freePollSlots;
+    delete epoll->pendingArms;
     delete epoll;
 }
 
@@ -42,22 +266,77 @@ void epollRelease(Epoll* epoll){
  * @return A new epoll handler
  */
 EpollHandler* epollCreateHandler(int fd){
-    EpollHandler* handler = new EpollHandler();
+    return epollCreateHandler(fd, new EpollHandler());
+}
+
+/**
+ * Creates a new epoll handler in the provided memory. The memory must be freed
+ * by the function set with epollHandlerSetOnRelease
+ * @param fd Socket descriptor to listen for events on
+ * @param memory At least epollGetHandlerSize() bytes for the handler
+ * @return A new epoll handler
+ */
+EpollHandler* epollCreateHandler(int fd, void* memory){
+    auto* handler = (EpollHandler*)memory;
     handler->fd = fd;
     handler->epoll = nullptr;
+    handler->data = nullptr;
+    handler->isRegistered = false;
+    handler->isReleased = false;
+    handler->isEdgeTriggered = false;
+    handler->isFlushRequested = false;
+    handler->handledEvents = 0;
+    handler->pollSlot = 0;
+    handler->armedEvents = 0;
+    handler->isPollArmed = false;
+    handler->isArmPending = false;
+    handler->isCancelPending = false;
+    handler->isReceiveFull = false;
+    handler->isReceiveStarved = false;
+    handler->isReceiveEnded = false;
+    handler->isFreePending = false;
+    handler->receiveError = 0;
+    handler->heldHead = EPOLL_URING_NO_BUFFER;
+    handler->heldTail = EPOLL_URING_NO_BUFFER;
+    handler->heldOffset = 0;
+    handler->heldBytes = 0;
+    handler->pendingSends = 0;
+    handler->reportedWakeup = 0;
     handler->handleInput = nullptr;
     handler->handleOutput = nullptr;
     handler->handleDisconnect = nullptr;
+    handler->handleRelease = nullptr;
+    handler->handleFlush = nullptr;
+    handler->handleAccept = nullptr;
+    handler->handleSent = nullptr;
 
     return handler;
 }
 
 /**
- * Releases the epoll handler
+ * Releases the epoll handler. If the events are being dispatched, the handler is only marked
+ * as released, so that the rest of the batch skips it, and it's freed after the dispatch
  * @param handler The handler to release
  */
 void epollReleaseHandler(EpollHandler* handler) {
-    delete handler;
+    if(handler->epoll != nullptr && handler->epoll->isDispatching){
+        handler->isReleased = true;
+        handler->epoll->releasedHandlers->push_back(handler);
+        return;
+    }
+    if(handler->isFlushRequested){
+        // Only happens outside of the event loop, e.g. at shutdown
+        vector<EpollHandler*>* flushed = handler->epoll->flushedHandlers;
+        flushed->erase(find(flushed->begin(), flushed->end(), handler));
+    }
+    epollFreeHandler(handler);
+}
+
+/**
+ * Returns the number of bytes needed to create a handler in place
+ */
+size_t epollGetHandlerSize(){
+    return sizeof(EpollHandler);
 }
 
 /**
@@ -87,6 +366,56 @@ void epollHandlerSetOnDisconnect(EpollHandler* epollHandler, EventHandler eventH
     epollHandler->handleDisconnect = eventHandler;
 }
 
+/**
+ * Sets a function to invoke when the handler is freed. It's responsible for freeing the handler memory
+ * @param epollHandler The epoll handler
+ * @param eventHandler The function to invoke
+ */
+void epollHandlerSetOnRelease(EpollHandler* epollHandler, EventHandler eventHandler){
+    epollHandler->handleRelease = eventHandler;
+}
+
+/**
+ * Sets a function to invoke at the end of the wakeup in which epollRequestFlush was called
+ * @param epollHandler The epoll handler
+ * @param eventHandler The function to invoke
+ */
+void epollHandlerSetOnFlush(EpollHandler* epollHandler, EventHandler eventHandler){
+    epollHandler->handleFlush = eventHandler;
+}
+
+/**
+ * Switches the handler to the edge-triggered mode. Must be called before registering the handler.
+ * An edge-triggered handler has to read and write until EAGAIN, as the events are not repeated
+ * @param epollHandler The epoll handler
+ * @param isEdgeTriggered Whether to use the edge-triggered mode
+ */
+void epollHandlerSetEdgeTriggered(EpollHandler* epollHandler, bool isEdgeTriggered){
+    epollHandler->isEdgeTriggered = isEdgeTriggered;
+}
+
+/**
+ * Sets a function to take the accepted sockets. With io_uring, the listener then has a multishot accept
+ * instead of the input events, and the function gets every accepted socket (blocking, as nothing else reads it)
+ * or -errno. With epoll, it's never called. Must be called before registering the handler
+ * @param epollHandler The epoll handler of a listening socket
+ * @param acceptHandler The function to invoke
+ */
+void epollHandlerSetOnAccept(EpollHandler* epollHandler, AcceptHandler acceptHandler){
+    epollHandler->handleAccept = acceptHandler;
+}
+
+/**
+ * Sets a function to take the results of epollSend. With io_uring, the socket then has a multishot receive
+ * instead of the polls: the input event means that epollRead has data, and the output events aren't reported.
+ * With epoll, it's never called. Must be called before registering the handler
+ * @param epollHandler The epoll handler of a connected socket
+ * @param sendHandler The function to invoke
+ */
+void epollHandlerSetOnSent(EpollHandler* epollHandler, SendHandler sendHandler){
+    epollHandler->handleSent = sendHandler;
+}
+
 /**
  * Returns a pointer to data associated with the handler. It can point to any desired data
  * @param handler The epoll handler
@@ -97,26 +426,291 @@ void** epollHandlerData(EpollHandler* handler){
 }
 
 /**
- * Waits for an event on the epoll
+ * Waits for events on the epoll and dispatches all of them
  * @param epoll The epoll to wait on
  */
 void epollWaitForEvent(Epoll* epoll){
-    epoll_event ee;
-    int eventCount = epoll_wait(epoll->fd, &ee, 1, 500);
+    // Timed events come from timerfd handlers, so there's no need to wake up periodically
+    int eventCount = epoll->ring != nullptr ? epollWaitForCompletions(epoll)
+                                            : epoll_wait(epoll->fd, epoll->events, epoll->maxEvents, -1);
+    uint64_t startTime = epollNow();
+    epoll->now = startTime;
+    epoll->stats.iterations++;
     if(eventCount <= 0) return;
 
-    EpollHandler* eventSource = (EpollHandler*)ee.data.ptr;
-    if((ee.events & EPOLLRDHUP) && eventSource->handleDisconnect != nullptr) {
-        eventSource->handleDisconnect(eventSource);
-        // The eventSource becomes undefined here. Don't use it.
-        // Otherwise, the SIGSEGV will appear.
+    epollDispatch(epoll, eventCount);
+
+    uint64_t elapsed = epollNow() - startTime;
+    epoll->stats.wakeups++;
+    epoll->stats.events += eventCount;
+    if((uint64_t)eventCount > epoll->stats.maxEventsPerWakeup) epoll->stats.maxEventsPerWakeup = eventCount;
+    epoll->stats.totalIterationNs += elapsed;
+    if(elapsed > epoll->stats.maxIterationNs) epoll->stats.maxIterationNs = elapsed;
+
+    metricAdd(&metricLoopWakeups, 1);
+    metricAdd(&metricLoopEvents, eventCount);
+    histogramObserve(&histogramLoopIteration, elapsed);
+}
+
+/**
+ * Submits the queued polls and waits for completions with a single system call, then turns the completions
+ * of the current polls into epoll events. The completions beyond the maximum are left for the next wakeup
+ * @param epoll The event loop using io_uring
+ * @return Number of the events
+ */
+int epollWaitForCompletions(Epoll* epoll){
+    epollArmPolls(epoll);
+    int submitted = uringSubmitAndWait(epoll->ring, 1);
+    if(submitted > 0) metricAdd(&metricLoopSubmissions, submitted);
+    epoll->wakeup++;
+
+    int eventCount = 0;
+    io_uring_cqe* cqe;
+    while(eventCount < epoll->maxEvents && (cqe = uringPeekCqe(epoll->ring)) != nullptr){
+        uint64_t data = cqe->user_data;
+        int32_t result = cqe->res;
+        uint32_t flags = cqe->flags;
+        uringSeeCqe(epoll->ring);
+        if(data == EPOLL_URING_IGNORED) continue;
+        if(data & EPOLL_URING_SEND){
+            if(epollCompleteSend(epoll, (EpollSend*)(data & ~EPOLL_URING_SEND), result, eventCount)) eventCount++;
+            continue;
+        }
+
+        auto slot = (uint32_t)data;
+        EpollHandler* handler = (*epoll->pollSlots)[slot];
+        bool isCurrent = handler != nullptr && epollGetPollData(epoll, slot) == data;
+        if(flags & IORING_CQE_F_BUFFER){
+            // The data received for a handler that's gone is dropped
+            auto id = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+            if(isCurrent && result > 0){
+                epollHoldBuffer(handler, id, result);
+            }else{
+                epollRecycleBuffer(epoll, id);
+            }
+        }
+        if(!isCurrent) continue;
+        if(!(flags & IORING_CQE_F_MORE)){
+            // A one-shot poll has fired or the kernel has ended a multishot operation
+            handler->isPollArmed = false;
+            handler->isCancelPending = false;
+            epollQueueArm(handler);
+        }
+
+        if(handler->handleAccept != nullptr){
+            if(result == -ECANCELED || result == -EAGAIN) continue;
+            epoll->events[eventCount] = { EPOLL_URING_ACCEPTED, {.ptr=handler} };
+            epoll->results[eventCount++] = result;
+        }else if(handler->handleSent != nullptr){
+            // Everything received in a wakeup is reported with a single input event
+            if(!epollOnReceived(handler, result) || handler->reportedWakeup == epoll->wakeup) continue;
+            handler->reportedWakeup = epoll->wakeup;
+            epoll->events[eventCount++] = { EPOLLIN, {.ptr=handler} };
+        }else if(result >= 0){
+            epoll->events[eventCount++] = { (uint32_t)result, {.ptr=handler} };
+        }
+    }
+    return eventCount;
+}
+
+/**
+ * Updates the state of the handler's receive after its completion. The data itself is held already
+ * @param handler The handler whose receive has completed
+ * @param result The result of the completion
+ * @return True if the handler has something to read: data, the end of the connection, or an error
+ */
+bool epollOnReceived(EpollHandler* handler, int32_t result){
+    if(result > 0) return true;
+    if(result == -ECANCELED) return false;
+    if(result == -ENOBUFS){
+        // Armed again once a buffer is recycled, or right away if it's been recycled meanwhile
+        Epoll* epoll = handler->epoll;
+        if(epoll->heldBuffers < EPOLL_URING_BUFFER_COUNT) return false;
+        if(!handler->isReceiveStarved){
+            handler->isReceiveStarved = true;
+            epoll->starvedSlots->push_back(handler->pollSlot);
+        }
+        return false;
+    }
+    if(result == 0){
+        handler->isReceiveEnded = true;
+    }else{
+        handler->receiveError = -result;
+    }
+    return true;
+}
+
+/**
+ * Appends the buffer the kernel has received into to the handler's held data. Once the handler holds enough,
+ * its receive is stopped until the data is read, so that a client that isn't read keeps its data in its socket
+ * @param handler The handler that has received the data
+ * @param id Identifier of the buffer
+ * @param length Number of the received bytes
+ */
+void epollHoldBuffer(EpollHandler* handler, uint16_t id, uint32_t length){
+    Epoll* epoll = handler->epoll;
+    EpollReceived& received = (*epoll->received)[id];
+    received.length = length;
+    received.next = EPOLL_URING_NO_BUFFER;
+    if(handler->heldTail == EPOLL_URING_NO_BUFFER){
+        handler->heldHead = id;
+    }else{
+        (*epoll->received)[handler->heldTail].next = id;
+    }
+    handler->heldTail = id;
+    handler->heldBytes += length;
+    epoll->heldBuffers++;
+    if(handler->heldBytes >= EPOLL_URING_MAX_HELD && !handler->isReceiveFull){
+        handler->isReceiveFull = true;
+        epollQueueArm(handler);
+    }
+}
+
+/**
+ * Gives all the buffers the handler holds back to the kernel, dropping their data
+ * @param handler The handler
+ */
+void epollReleaseHeldBuffers(EpollHandler* handler){
+    Epoll* epoll = handler->epoll;
+    while(handler->heldHead != EPOLL_URING_NO_BUFFER){
+        uint16_t id = handler->heldHead;
+        handler->heldHead = (*epoll->received)[id].next;
+        epoll->heldBuffers--;
+        epollRecycleBuffer(epoll, id);
+    }
+    handler->heldTail = EPOLL_URING_NO_BUFFER;
+    handler->heldOffset = 0;
+    handler->heldBytes = 0;
+}
+
+/**
+ * Gives the buffer back to the kernel and arms the receives that have run out of buffers again
+ * @param epoll The event loop using io_uring
+ * @param id Identifier of the buffer
+ */
+void epollRecycleBuffer(Epoll* epoll, uint16_t id){
+    uringRecycleBuffer(epoll->buffers, id);
+    for(uint32_t slot : *epoll->starvedSlots){
+        EpollHandler* handler = (*epoll->pollSlots)[slot];
+        if(handler == nullptr || !handler->isReceiveStarved) continue;
+        handler->isReceiveStarved = false;
+        epollQueueArm(handler);
+    }
+    epoll->starvedSlots->clear();
+}
+
+/**
+ * Returns the completed send to the free ones and turns it into an event for its handler,
+ * unless the handler has been released. Then the last completion frees it
+ * @param epoll The event loop using io_uring
+ * @param send The send that has completed
+ * @param result Number of the sent bytes or -errno
+ * @param eventIndex Where to put the event
+ * @return True if the event has been added
+ */
+bool epollCompleteSend(Epoll* epoll, EpollSend* send, int32_t result, int eventIndex){
+    EpollHandler* handler = send->handler;
+    send->handler = nullptr;
+    epoll->freeSends->push_back(send);
+    handler->pendingSends--;
+    if(handler->isFreePending){
+        if(handler->pendingSends == 0) epollFreeHandler(handler);
+        return false;
+    }
+    epoll->events[eventIndex] = { EPOLL_URING_SENT, {.ptr=handler} };
+    epoll->results[eventIndex] = result;
+    return true;
+}
+
+/**
+ * Dispatches the events gathered after a wakeup, flushes the handlers and frees the ones released meanwhile
+ * @param epoll The event loop
+ * @param eventCount Number of the events
+ */
+void epollDispatch(Epoll* epoll, int eventCount){
+    epoll->isDispatching = true;
+    for(int i = 0; i < eventCount; i++){
+        epoll_event& ee = epoll->events[i];
+        auto* eventSource = (EpollHandler*)ee.data.ptr;
+
+        // The handler could have been released by an earlier event in this batch
+        if(eventSource->isReleased) continue;
+
+        if(ee.events & EPOLL_URING_ACCEPTED){
+            eventSource->handleAccept(eventSource, epoll->results[i]);
+            continue;
+        }
+        if(ee.events & EPOLL_URING_SENT){
+            eventSource->handleSent(eventSource, epoll->results[i]);
+            continue;
+        }
+
+        if((ee.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && eventSource->handleDisconnect != nullptr) {
+            eventSource->handleDisconnect(eventSource);
+            continue;
+        }
+        if((ee.events & EPOLLIN) && eventSource->handleInput != nullptr) {
+            eventSource->handleInput(eventSource);
+        }
+        if(eventSource->isReleased) continue;
+        if((ee.events & EPOLLOUT) && eventSource->handleOutput != nullptr) {
+            eventSource->handleOutput(eventSource);
+        }
     }
-    else if((ee.events & EPOLLIN) && eventSource->handleInput != nullptr) {
-        eventSource->handleInput(eventSource);
+    epollFlushHandlers(epoll);
+    epoll->isDispatching = false;
+
+    // Now nothing refers to the released handlers anymore
+    for(EpollHandler* handler : *epoll->releasedHandlers){
+        epollFreeHandler(handler);
     }
-    else if((ee.events & EPOLLOUT) && eventSource->handleOutput != nullptr) {
-        eventSource->handleOutput(eventSource);
+    epoll->releasedHandlers->clear();
+}
+
+/**
+ * Asks for the handler's flush function to be called once at the end of the current wakeup,
+ * after all the events have been dispatched. Any number of requests in a wakeup result in a single flush
+ * @param handler The epoll handler
+ */
+void epollRequestFlush(EpollHandler* handler){
+    if(handler->isFlushRequested || handler->epoll == nullptr) return;
+    handler->isFlushRequested = true;
+    handler->epoll->flushedHandlers->push_back(handler);
+}
+
+/**
+ * Calls the flush functions of the handlers that asked for it. Flushing may cause more requests
+ * (e.g. a client closed by a failed write notifies the others), these are handled in the same pass
+ * @param epoll The epoll instance
+ */
+void epollFlushHandlers(Epoll* epoll){
+    vector<EpollHandler*>* flushed = epoll->flushedHandlers;
+    for(size_t i = 0; i < flushed->size(); i++){
+        EpollHandler* handler = (*flushed)[i];
+        handler->isFlushRequested = false;
+        if(handler->isReleased || handler->handleFlush == nullptr) continue;
+        handler->handleFlush(handler);
     }
+    epoll->stats.flushes += flushed->size();
+    flushed->clear();
+}
+
+/**
+ * Returns the event loop statistics
+ * @param epoll The epoll instance
+ */
+const EpollStats* epollGetStats(Epoll* epoll){
+    return &(epoll->stats);
+}
+
+/**
+ * Returns the monotonic time of the last wakeup. It's read once per wakeup,
+ * so all the events dispatched after it see the same time
+ * @param epoll The epoll instance
+ * @return The time in nanoseconds
+ */
+uint64_t epollGetTime(Epoll* epoll){
+    return epoll->now;
 }
 
 /**
@@ -126,25 +720,318 @@ void epollWaitForEvent(Epoll* epoll){
  */
 void epollRegisterHandler(Epoll* epoll, EpollHandler* handler){
     handler->epoll = epoll;
-    epoll_event ee { EPOLLRDHUP, {.ptr=handler}};
+    handler->isRegistered = true;
+    handler->handledEvents = 0;
+    if(epoll->ring != nullptr){
+        if(epoll->freePollSlots->empty()){
+            handler->pollSlot = epoll->pollSlots->size();
+            epoll->pollSlots->push_back(handler);
+            epoll->pollGenerations->push_back(0);
+        }else{
+            handler->pollSlot = epoll->freePollSlots->back();
+            epoll->freePollSlots->pop_back();
+            (*epoll->pollSlots)[handler->pollSlot] = handler;
+        }
+        handler->isPollArmed = false;
+        if(handler->handleSent != nullptr && epoll->buffers == nullptr){
+            epoll->buffers = uringCreateBuffers(epoll->ring, EPOLL_URING_BUFFER_GROUP, EPOLL_URING_BUFFER_COUNT,
+                                                EPOLL_URING_BUFFER_SIZE, epollHasBufferRing);
+            epoll->received->resize(EPOLL_URING_BUFFER_COUNT);
+        }
+        epollQueueArm(handler);
+        return;
+    }
+    epoll_event ee { epollGetFlags(handler), {.ptr=handler}};
     epoll_ctl(epoll->fd, EPOLL_CTL_ADD, handler->fd, &ee);
 }
 
 /**
- * Unregisters a handler from the epoll instance
+ * Unregisters a handler from the epoll instance.
+ * The handler remembers the epoll, so that it can be released safely during the dispatch
  * @param handler The epoll handler to register
  */
 void epollUnregisterHandler(EpollHandler* handler){
-    epoll_ctl(handler->epoll->fd, EPOLL_CTL_DEL, handler->fd, nullptr);
-    handler->epoll = nullptr;
+    if(!handler->isRegistered) return;
+    handler->isRegistered = false;
+    Epoll* epoll = handler->epoll;
+    if(epoll->ring != nullptr){
+        // The slot is reused right away, the new generation tells the completions of the removed poll apart
+        if(handler->handleAccept != nullptr || handler->handleSent != nullptr){
+            if(handler->isPollArmed && !handler->isCancelPending) epollCancelOperation(handler);
+            handler->isPollArmed = false;
+            epollReleaseHeldBuffers(handler);
+        }else{
+            epollRemovePoll(handler);
+        }
+        (*epoll->pollSlots)[handler->pollSlot] = nullptr;
+        (*epoll->pollGenerations)[handler->pollSlot]++;
+        epoll->freePollSlots->push_back(handler->pollSlot);
+        handler->isArmPending = false;
+        return;
+    }
+    epoll_ctl(epoll->fd, EPOLL_CTL_DEL, handler->fd, nullptr);
 }
 
 /**
- * Subscribes for the specified epoll events
+ * Subscribes for the specified epoll events. Does nothing if the handler is already subscribed for them
  * @param handler The epoll handler to update the events for
  * @param events The events to listen for
  */
 void epollSetHandledEvents(EpollHandler* handler, uint32_t events){
-    epoll_event ee { EPOLLRDHUP | events, {.ptr=handler}};
+    if(!handler->isRegistered || handler->handledEvents == events) return;
+    handler->handledEvents = events;
+    if(handler->epoll->ring != nullptr){
+        epollQueueArm(handler);
+        return;
+    }
+    epoll_event ee { epollGetFlags(handler) | events, {.ptr=handler}};
     epoll_ctl(handler->epoll->fd, EPOLL_CTL_MOD, handler->fd, &ee);
 }
+
+/**
+ * Queues the handler to have its poll armed before the next wait, unless it's queued already.
+ * Any number of changes to the events in a wakeup result in at most one replaced poll
+ * @param handler The handler registered with an event loop using io_uring
+ */
+void epollQueueArm(EpollHandler* handler){
+    if(handler->isArmPending) return;
+    handler->isArmPending = true;
+    handler->epoll->pendingArms->push_back(handler->pollSlot);
+}
+
+/**
+ * Fills the submission entries for the queued handlers whose events differ from the armed ones.
+ * The edge-triggered handlers get multishot polls, which stay armed until they're removed
+ * @param epoll The event loop using io_uring
+ */
+void epollArmPolls(Epoll* epoll){
+    for(uint32_t slot : *epoll->pendingArms){
+        EpollHandler* handler = (*epoll->pollSlots)[slot];
+        // The handler may have been unregistered, and the slot reused by one queued again
+        if(handler == nullptr || !handler->isArmPending) continue;
+        handler->isArmPending = false;
+        if(handler->handleAccept != nullptr || handler->handleSent != nullptr){
+            epollArmOperation(handler);
+            continue;
+        }
+        uint32_t events = epollGetFlags(handler) | handler->handledEvents;
+        if(handler->isPollArmed && handler->armedEvents == events) continue;
+
+        epollRemovePoll(handler);
+        (*epoll->pollGenerations)[slot]++;
+        io_uring_sqe* sqe = uringGetSqe(epoll->ring);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = handler->fd;
+        sqe->poll32_events = events & ~(uint32_t)EPOLLET;
+        sqe->len = handler->isEdgeTriggered ? IORING_POLL_ADD_MULTI : 0;
+        sqe->user_data = epollGetPollData(epoll, slot);
+        handler->armedEvents = events;
+        handler->isPollArmed = true;
+    }
+    epoll->pendingArms->clear();
+}
+
+/**
+ * Starts or cancels the handler's multishot accept or receive, depending on whether it wants the input now.
+ * A cancelled operation keeps its generation, as the data it receives in the meantime still counts,
+ * and it's started again only after its last completion
+ * @param handler The handler registered with an event loop using io_uring
+ */
+void epollArmOperation(EpollHandler* handler){
+    Epoll* epoll = handler->epoll;
+    bool isWanted = (handler->handledEvents & EPOLLIN) && (handler->handleAccept != nullptr || epollIsReceiving(handler));
+    if(isWanted && !handler->isPollArmed){
+        (*epoll->pollGenerations)[handler->pollSlot]++;
+        io_uring_sqe* sqe = uringGetSqe(epoll->ring);
+        if(handler->handleAccept != nullptr){
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = handler->fd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        }else{
+            epollPrepareReceive(sqe, handler->fd);
+        }
+        sqe->user_data = epollGetPollData(epoll, handler->pollSlot);
+        handler->isPollArmed = true;
+    }else if(!isWanted && handler->isPollArmed && !handler->isCancelPending){
+        epollCancelOperation(handler);
+    }
+}
+
+/**
+ * Fills a submission entry that cancels the handler's accept or receive. It still completes the last time
+ * @param handler The handler registered with an event loop using io_uring
+ */
+void epollCancelOperation(EpollHandler* handler){
+    io_uring_sqe* sqe = uringGetSqe(handler->epoll->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = epollGetPollData(handler->epoll, handler->pollSlot);
+    sqe->user_data = EPOLL_URING_IGNORED;
+    handler->isCancelPending = true;
+}
+
+/**
+ * Fills a submission entry with a multishot receive into the loop's provided buffers
+ * @param sqe The entry
+ * @param fd The socket to receive from
+ */
+void epollPrepareReceive(io_uring_sqe* sqe, int fd){
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = EPOLL_URING_BUFFER_GROUP;
+}
+
+/**
+ * Checks if the handler's receive may go on: it doesn't hold too much, there are buffers, and the connection lasts
+ * @param handler The handler with a receive
+ */
+bool epollIsReceiving(EpollHandler* handler){
+    return !handler->isReceiveFull && !handler->isReceiveStarved && !handler->isReceiveEnded && handler->receiveError == 0;
+}
+
+/**
+ * Fills a submission entry that removes the handler's poll, if the kernel has one
+ * @param handler The handler registered with an event loop using io_uring
+ */
+void epollRemovePoll(EpollHandler* handler){
+    if(!handler->isPollArmed) return;
+    handler->isPollArmed = false;
+    io_uring_sqe* sqe = uringGetSqe(handler->epoll->ring);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = epollGetPollData(handler->epoll, handler->pollSlot);
+    sqe->user_data = EPOLL_URING_IGNORED;
+}
+
+/**
+ * Returns the user data of the latest poll armed for the slot: the generation in the upper half, the slot in the lower
+ * @param epoll The event loop using io_uring
+ * @param slot The slot
+ */
+uint64_t epollGetPollData(Epoll* epoll, uint32_t slot){
+    // The top bit marks the sends
+    return (uint64_t)((*epoll->pollGenerations)[slot] & INT32_MAX) << 32 | slot;
+}
+
+/**
+ * Checks if the handler's input is received and its output sent through io_uring: epollRead and epollSend
+ * don't make system calls, and the output events aren't reported
+ * @param handler The epoll handler with the send function set
+ */
+bool epollHasAsyncIo(EpollHandler* handler){
+    return handler->epoll != nullptr && handler->epoll->ring != nullptr && handler->handleSent != nullptr;
+}
+
+/**
+ * Reads the received data. With io_uring, it's copied from the buffers held for the handler, which are given back
+ * to the kernel as they're emptied, otherwise it's read from the socket
+ * @param handler The registered epoll handler
+ * @param buffer Where to copy the data
+ * @param length Capacity of the buffer
+ * @return Number of the read bytes, 0 at the end of the connection, or -1 with errno set (EAGAIN if nothing is held)
+ */
+ssize_t epollRead(EpollHandler* handler, void* buffer, size_t length){
+    if(!epollHasAsyncIo(handler)) return read(handler->fd, buffer, length);
+
+    Epoll* epoll = handler->epoll;
+    size_t copied = 0;
+    while(copied < length && handler->heldHead != EPOLL_URING_NO_BUFFER){
+        uint16_t id = handler->heldHead;
+        EpollReceived& received = (*epoll->received)[id];
+        size_t chunk = min(length - copied, (size_t)(received.length - handler->heldOffset));
+        memcpy((char*)buffer + copied, uringGetBuffer(epoll->buffers, id) + handler->heldOffset, chunk);
+        copied += chunk;
+        handler->heldOffset += chunk;
+        handler->heldBytes -= chunk;
+        if(handler->heldOffset < received.length) break;
+
+        handler->heldHead = received.next;
+        handler->heldOffset = 0;
+        if(handler->heldHead == EPOLL_URING_NO_BUFFER) handler->heldTail = EPOLL_URING_NO_BUFFER;
+        epoll->heldBuffers--;
+        epollRecycleBuffer(epoll, id);
+    }
+    if(handler->isReceiveFull && handler->heldBytes < EPOLL_URING_MAX_HELD){
+        handler->isReceiveFull = false;
+        epollQueueArm(handler);
+    }
+
+    if(copied > 0) return (ssize_t)copied;
+    if(handler->receiveError != 0){
+        errno = handler->receiveError;
+        return -1;
+    }
+    if(handler->isReceiveEnded) return 0;
+    errno = EAGAIN;
+    return -1;
+}
+
+/**
+ * Sends the data described by the iovec array with io_uring. The send is submitted along with the next wait,
+ * it's complete once the whole data has been sent, or the connection has failed. The data must stay in place
+ * until the handler's send function gets the result. A released handler is only freed after its sends complete
+ * @param handler The epoll handler for which epollHasAsyncIo is true
+ * @param iov The data to send
+ * @param count Number of the iovec entries, at most EPOLL_MAX_SEND_IOVEC
+ */
+void epollSend(EpollHandler* handler, const iovec* iov, int count){
+    Epoll* epoll = handler->epoll;
+    EpollSend* send;
+    if(epoll->freeSends->empty()){
+        send = new EpollSend();
+        epoll->sends->push_back(send);
+    }else{
+        send = epoll->freeSends->back();
+        epoll->freeSends->pop_back();
+    }
+    count = min(count, EPOLL_MAX_SEND_IOVEC);
+    send->handler = handler;
+    memcpy(send->iov, iov, count * sizeof(iovec));
+    send->header = {};
+    send->header.msg_iov = send->iov;
+    send->header.msg_iovlen = count;
+
+    io_uring_sqe* sqe = uringGetSqe(epoll->ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = handler->fd;
+    sqe->addr = (uint64_t)&send->header;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = EPOLL_URING_SEND | (uint64_t)send;
+    handler->pendingSends++;
+}
+
+/**
+ * Frees the handler memory
+ * @param handler The handler to free
+ */
+void epollFreeHandler(EpollHandler* handler){
+    if(handler->pendingSends > 0){
+        // The kernel still reads the data of the sends
+        handler->isFreePending = true;
+        return;
+    }
+    if(handler->handleRelease != nullptr){
+        handler->handleRelease(handler);
+    }else{
+        delete handler;
+    }
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t epollNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Returns the epoll flags that are always set for the handler
+ * @param handler The epoll handler
+ */
+uint32_t epollGetFlags(EpollHandler* handler){
+    return EPOLLRDHUP | (handler->isEdgeTriggered ? (uint32_t)EPOLLET : 0u);
+}
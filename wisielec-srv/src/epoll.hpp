@@ -2,29 +2,67 @@
 #define EPOLL_HPP
 
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <cstddef>
+
+#define EPOLL_DEFAULT_MAX_EVENTS 256
+#define EPOLL_MAX_SEND_IOVEC 64
+
+#define EPOLL_BACKEND_EPOLL 0
+#define EPOLL_BACKEND_URING 1
 
 struct Epoll;
 struct EpollHandler;
 
 typedef void (*EventHandler)(EpollHandler* sender);
-typedef void (*EventHandler)(EpollHandler* sender);
+typedef void (*AcceptHandler)(EpollHandler* sender, int result);
+typedef void (*SendHandler)(EpollHandler* sender, ssize_t result);
 
-Epoll* epollCreate();
+/**
+ * Statistics of the event loop, gathered by epollWaitForEvent
+ */
+struct EpollStats {
+    uint64_t wakeups;               // Number of epoll_wait calls that returned at least one event
+    uint64_t events;                // Total number of dispatched events
+    uint64_t maxEventsPerWakeup;    // The biggest batch returned by a single epoll_wait
+    uint64_t iterations;            // Number of loop iterations (including timeouts)
+    uint64_t totalIterationNs;      // Total time spent dispatching events
+    uint64_t maxIterationNs;        // The longest time spent dispatching a single batch
+    uint64_t flushes;               // Number of flushes at the end of the wakeups
+};
+
+bool epollSetBackend(int backend);
+Epoll* epollCreate(int maxEvents = EPOLL_DEFAULT_MAX_EVENTS);
 void epollRelease(Epoll* epoll);
 
 EpollHandler* epollCreateHandler(int fd);
+EpollHandler* epollCreateHandler(int fd, void* memory);
 void epollReleaseHandler(EpollHandler* handler);
+size_t epollGetHandlerSize();
 
 void epollHandlerSetOnInput(EpollHandler* epollHandler, EventHandler eventHandler);
 void epollHandlerSetOnOutput(EpollHandler* epollHandler, EventHandler eventHandler);
 void epollHandlerSetOnDisconnect(EpollHandler* epollHandler, EventHandler eventHandler);
+void epollHandlerSetOnRelease(EpollHandler* epollHandler, EventHandler eventHandler);
+void epollHandlerSetOnFlush(EpollHandler* epollHandler, EventHandler eventHandler);
+void epollHandlerSetEdgeTriggered(EpollHandler* epollHandler, bool isEdgeTriggered);
+void epollHandlerSetOnAccept(EpollHandler* epollHandler, AcceptHandler acceptHandler);
+void epollHandlerSetOnSent(EpollHandler* epollHandler, SendHandler sendHandler);
 
 void** epollHandlerData(EpollHandler* handler);
 
 void epollWaitForEvent(Epoll* epoll);
+void epollRequestFlush(EpollHandler* handler);
+const EpollStats* epollGetStats(Epoll* epoll);
+uint64_t epollGetTime(Epoll* epoll);
 
 void epollRegisterHandler(Epoll* epoll, EpollHandler* handler);
 void epollUnregisterHandler(EpollHandler* handler);
 void epollSetHandledEvents(EpollHandler* handler, uint32_t events);
 
+bool epollHasAsyncIo(EpollHandler* handler);
+ssize_t epollRead(EpollHandler* handler, void* buffer, size_t length);
+void epollSend(EpollHandler* handler, const iovec* iov, int count);
+
 #endif
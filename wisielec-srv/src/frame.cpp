@@ -0,0 +1,163 @@
+#include "frame.hpp"
+
+#include "pool.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+/**
+ * Structure representing an encoded message, ready to be sent: the length sequence followed by the payload.
+ * The frame is immutable once filled and shared by all the clients it's sent to, possibly on different threads.
+ * The data is stored right after the structure, in the same pooled block
+ */
+struct Frame {
+    atomic<size_t> refCount;    // Number of owners, the frame is released when it drops to zero
+    Pool* pool;                 // The pool the frame was allocated from, nullptr if it's too big for the pools
+    size_t length;      // Length of the whole frame, including the length sequence
+    uint64_t originTime;    // When the event the frame notifies about happened, 0 if not measured
+    uint64_t coalesceKey;   // Frames with the same key supersede each other in an output queue, FRAME_NO_COALESCING if they don't
+    int priority;
+    char* data;
+};
+
+/**
+ * Creates a new frame with the length sequence filled. The payload has to be filled by the caller
+ * @param payloadLength Number of bytes of the payload
+ * @return The frame, owned by the caller
+ */
+Frame* frameCreate(size_t payloadLength){
+    size_t length = payloadLength + FRAME_LENGTH_SIZE;
+    // The frame remembers its pool, as the last owner may be on another thread
+    Pool* pool = poolGetBytesPool(poolAlign(sizeof(Frame)) + length);
+    void* memory = pool != nullptr ? poolAllocate(pool) : new char[poolAlign(sizeof(Frame)) + length];
+    auto frame = new(memory) Frame();
+    frame->refCount.store(1, memory_order_relaxed);
+    frame->pool = pool;
+    frame->length = length;
+    frame->originTime = 0;
+    frame->coalesceKey = FRAME_NO_COALESCING;
+    frame->priority = FRAME_PRIORITY_BULK;
+    frame->data = (char*)frame + poolAlign(sizeof(Frame));
+
+    // The length sequence is big-endian
+    size_t len = payloadLength;
+    for(int i = FRAME_LENGTH_SIZE - 1; i >= 0; i--) {
+        frame->data[i] = (char)(len & 0xff);
+        len >>= 8;
+    }
+    return frame;
+}
+
+/**
+ * Creates a new frame containing a copy of the payload
+ * @param payload The bytes to send
+ * @param payloadLength Number of bytes to send
+ * @return The frame, owned by the caller
+ */
+Frame* frameCreate(const char* payload, size_t payloadLength){
+    Frame* frame = frameCreate(payloadLength);
+    memcpy(frameGetPayload(frame), payload, payloadLength);
+    return frame;
+}
+
+/**
+ * Adds an owner to the frame
+ * @param frame The frame
+ */
+void frameRetain(Frame* frame){
+    frame->refCount.fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Removes an owner from the frame. Releases the frame if it was the last one
+ * @param frame The frame
+ */
+void frameRelease(Frame* frame){
+    if(frame->refCount.fetch_sub(1, memory_order_acq_rel) > 1) return;
+    Pool* pool = frame->pool;
+    frame->~Frame();
+    if(pool != nullptr){
+        poolFree(pool, frame);
+    }else{
+        delete[] (char*)frame;
+    }
+}
+
+/**
+ * Returns a pointer to the beginning of the frame, including the length sequence
+ * @param frame The frame
+ */
+char* frameGetData(Frame* frame){
+    return frame->data;
+}
+
+/**
+ * Returns the length of the whole frame, including the length sequence
+ * @param frame The frame
+ */
+size_t frameGetLength(Frame* frame){
+    return frame->length;
+}
+
+/**
+ * Returns a pointer to the payload, right after the length sequence
+ * @param frame The frame
+ */
+char* frameGetPayload(Frame* frame){
+    return frame->data + FRAME_LENGTH_SIZE;
+}
+
+/**
+ * Sets the time of the event that caused the frame, so that the delivery latency can be measured
+ * @param frame The frame
+ * @param time Monotonic time in nanoseconds
+ */
+void frameSetOriginTime(Frame* frame, uint64_t time){
+    frame->originTime = time;
+}
+
+/**
+ * Returns the time of the event that caused the frame, or 0 if it's not measured
+ * @param frame The frame
+ */
+uint64_t frameGetOriginTime(Frame* frame){
+    return frame->originTime;
+}
+
+/**
+ * Sets whether the frame is sent ahead of the other frames
+ * @param frame The frame
+ * @param priority FRAME_PRIORITY_CONTROL or FRAME_PRIORITY_BULK
+ */
+void frameSetPriority(Frame* frame, int priority){
+    frame->priority = priority;
+}
+
+/**
+ * Returns FRAME_PRIORITY_CONTROL or FRAME_PRIORITY_BULK
+ * @param frame The frame
+ */
+int frameGetPriority(Frame* frame){
+    return frame->priority;
+}
+
+/**
+ * Marks the frame as superseding the frames with the same key. If a client hasn't started receiving
+ * such a frame yet, the new one takes its place in the output queue
+ * @param frame The frame
+ * @param key The key or FRAME_NO_COALESCING
+ */
+void frameSetCoalesceKey(Frame* frame, uint64_t key){
+    frame->coalesceKey = key;
+}
+
+/**
+ * Returns the key of the frames the frame supersedes, or FRAME_NO_COALESCING
+ * @param frame The frame
+ */
+uint64_t frameGetCoalesceKey(Frame* frame){
+    return frame->coalesceKey;
+}
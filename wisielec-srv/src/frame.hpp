@@ -0,0 +1,32 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <unistd.h>
+#include <cstdint>
+
+#define FRAME_LENGTH_SIZE sizeof(uint32_t)
+
+#define FRAME_PRIORITY_CONTROL 0    // Responses to the client's requests, sent ahead of the bulk frames
+#define FRAME_PRIORITY_BULK 1       // Notifications, sent in order
+
+#define FRAME_NO_COALESCING 0
+
+struct Frame;
+
+Frame* frameCreate(size_t payloadLength);
+Frame* frameCreate(const char* payload, size_t payloadLength);
+void frameRetain(Frame* frame);
+void frameRelease(Frame* frame);
+
+char* frameGetData(Frame* frame);
+size_t frameGetLength(Frame* frame);
+char* frameGetPayload(Frame* frame);
+
+void frameSetOriginTime(Frame* frame, uint64_t time);
+uint64_t frameGetOriginTime(Frame* frame);
+void frameSetPriority(Frame* frame, int priority);
+int frameGetPriority(Frame* frame);
+void frameSetCoalesceKey(Frame* frame, uint64_t key);
+uint64_t frameGetCoalesceKey(Frame* frame);
+
+#endif
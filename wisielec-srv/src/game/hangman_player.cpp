@@ -1,135 +1,174 @@
 #include "hangman_player.hpp"
 
+#include "room_manager.hpp"
+#include "../log.hpp"
 #include "../unicode.hpp"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 
-#include <iostream>
 using namespace std;
 
+#define PLAYER_LOG(level, format, ...) LOG(level, LOG_SOURCE_PLAYER, format, this->name __VA_OPT__(,) __VA_ARGS__)
+
 /**
  * Creates a new hangman player
- * @param server The game server
+ * @param worker The game thread serving the player
+ * @param connection The network connection of the player
+ * @param room The room the player already has a seat in, ROOM_NONE if it has none
  */
-HangmanPlayer::HangmanPlayer(HangmanServer* server) {
-    this->server = server;
-    this->name = U"Unnamed player";
-    this->isAlive = true;
-    this->networkClient = nullptr;
+HangmanPlayer::HangmanPlayer(Worker* worker, uint64_t connection, uint32_t room) {
+    this->worker = worker;
+    this->server = nullptr;
+    this->setName("Unnamed player");
+    this->id = PLAYER_ID_NONE;
+    this->connection = connection;
+    this->room = room;
+    this->hasMoved = false;
 }
 
 /**
  * Returns the player name
  */
-const u32string& HangmanPlayer::getName() const {
+const string& HangmanPlayer::getName() const {
     return this->name;
 }
 
 /**
  * Sets the player name
- * @param name The player name
+ * @param name The player name in UTF-8
  */
-void HangmanPlayer::setName(u32string name) {
-    this->name = name;
+void HangmanPlayer::setName(string name) {
+    this->name = std::move(name);
 }
 
 /**
- * Checks if the player is alive
+ * Returns the player's ID in the server's registry
  */
-bool HangmanPlayer::checkIsAlive() {
-    return this->isAlive;
+uint32_t HangmanPlayer::getId() const {
+    return this->id;
 }
 
 /**
- * Attaches the network client to the player
- * @param client The client to attach
+ * Sets the player's ID, when the player joins or leaves the game
+ * @param id The ID or PLAYER_ID_NONE
  */
-void HangmanPlayer::attachNetworkClient(Client* client) {
-    // If the network client has just disconnected, leave the game
-    if(client == nullptr && this->networkClient != nullptr){
-        this->server->leavePlayer(this);
-    }
+void HangmanPlayer::setId(uint32_t id) {
+    this->id = id;
+}
 
-    this->networkClient = client;
+/**
+ * Returns the player's network connection
+ */
+uint64_t HangmanPlayer::getConnection() const {
+    return this->connection;
 }
 
 /**
- * Handles the join event
- * @param player The player that has joined
+ * Returns the room the player has a seat in, ROOM_NONE if it has none
  */
-void HangmanPlayer::onJoin(const HangmanPlayer* player) {
-    log(utf32ToUtf8(player->getName()) + " has joined the game.");
-    Message response(MDIR_NOTIFY | MTYPE_JOIN, U"{\"name\": \"" + player->getName() + U"\"}");
-    this->sendToClient(response);
+uint32_t HangmanPlayer::getRoom() const {
+    return this->room;
 }
 
 /**
- * Handles the leave event
- * @param player The player that has left
+ * Checks if the player has joined the game and is still alive
  */
-void HangmanPlayer::onLeave(const HangmanPlayer* player) {
-    log(utf32ToUtf8(player->getName()) + " has left the game.");
-    Message response(MDIR_NOTIFY | MTYPE_LEAVE, U"{\"name\": \"" + player->getName() + U"\"}");
-    this->sendToClient(response);
+bool HangmanPlayer::checkIsAlive() {
+    return this->id != PLAYER_ID_NONE && this->server->getPlayers().isAlive(this->id);
 }
 
 /**
- * Fired when this player has lost
+ * Checks if the player's connection has been handed over to another game thread.
+ * Such a player is forgotten, its seat goes along with the connection
  */
-void HangmanPlayer::onLose() {
-    this->isAlive = false;
-    log("Lost.");
-    Message response(MDIR_NOTIFY | MTYPE_LOSE, U"{}");
-    this->sendToClient(response);
+bool HangmanPlayer::checkHasMoved() const {
+    return this->hasMoved;
 }
 
 /**
- * Fired when this player has won
+ * Fired when the network connection has been closed. The player leaves the game and gives its seat back
  */
-void HangmanPlayer::onWin() {
-    this->isAlive = false;
-    log("Won.");
-    Message response(MDIR_NOTIFY | MTYPE_WIN, U"{}");
-    this->sendToClient(response);
+void HangmanPlayer::onDisconnect() {
+    this->leave();
 }
 
 /**
- * Fired when the phrase has been revealed
+ * Creates the notification about the player joining the game
+ * @param player The player that has joined
+ */
+Message HangmanPlayer::createJoinNotification(const HangmanPlayer& player) {
+    return Message(MDIR_NOTIFY | MTYPE_JOIN, "{\"name\": \"" + player.getName() + "\"}");
+}
+
+/**
+ * Creates the notification about the player leaving the game
+ * @param player The player that has left
+ */
+Message HangmanPlayer::createLeaveNotification(const HangmanPlayer& player) {
+    return Message(MDIR_NOTIFY | MTYPE_LEAVE, "{\"name\": \"" + player.getName() + "\"}");
+}
+
+/**
+ * Creates the notification about the phrase being revealed
  * @param phrase The new phrase
  */
-void HangmanPlayer::onPhraseReveal(const u32string& phrase) {
-    log("Phrase revealed: " + utf32ToUtf8(phrase));
-    Message response(MDIR_NOTIFY | MTYPE_GUESS, U"{\"phrase\": \"" + phrase + U"\"}");
-    this->sendToClient(response);
+Message HangmanPlayer::createPhraseNotification(const string& phrase) {
+    return Message(MDIR_NOTIFY | MTYPE_GUESS, "{\"phrase\": \"" + phrase + "\"}");
 }
 
 /**
- * Fired when the player is hung
+ * Creates the notification about the player being hung
  * @param player The player who's hung
  * @param fails The number of body parts hung
  */
-void HangmanPlayer::onHang(const HangmanPlayer& player, int fails) {
-    log(utf32ToUtf8(player.getName()) + " has been hanged (" + to_string(fails) + " fails).");
-    Message response(MDIR_NOTIFY | MTYPE_HANG, U"{\"player\": \"" + player.getName() + U"\", \"fails\": " + intToUtf32(fails) + U"}");
-    this->sendToClient(response);
+Message HangmanPlayer::createHangNotification(const HangmanPlayer& player, int fails) {
+    return Message(MDIR_NOTIFY | MTYPE_HANG, "{\"player\": \"" + player.getName() + "\", \"fails\": " + to_string(fails) + "}");
 }
 
 /**
- * Fired when the player score changes
+ * Creates the notification about the player score change
  * @param player The player whose score changed
  * @param newScore The new player score
  */
-void HangmanPlayer::onScoreChange(const HangmanPlayer& player, int newScore) {
-    log(utf32ToUtf8(player.getName()) + " has " + to_string(newScore) + " points.");
-    Message response(MDIR_NOTIFY | MTYPE_SCORE, U"{\"player\": \"" + player.getName() + U"\", \"score\": " + intToUtf32(newScore) + U"}");
+Message HangmanPlayer::createScoreNotification(const HangmanPlayer& player, int newScore) {
+    return Message(MDIR_NOTIFY | MTYPE_SCORE, "{\"player\": \"" + player.getName() + "\", \"score\": " + to_string(newScore) + "}");
+}
+
+/**
+ * Fired when this player has lost
+ */
+void HangmanPlayer::onLose() {
+    PLAYER_LOG(LOG_LEVEL_INFO, "Lost.");
+    Message response(MDIR_NOTIFY | MTYPE_LOSE, "{}");
     this->sendToClient(response);
 }
 
+/**
+ * Fired when this player has won
+ */
+void HangmanPlayer::onWin() {
+    PLAYER_LOG(LOG_LEVEL_INFO, "Won.");
+    Message response(MDIR_NOTIFY | MTYPE_WIN, "{}");
+    this->sendToClient(response);
+}
+
+/**
+ * Fired when the phrase has been revealed
+ * @param phrase The new phrase
+ */
+void HangmanPlayer::onPhraseReveal(const string& phrase) {
+    PLAYER_LOG(LOG_LEVEL_DEBUG, "Phrase revealed: {}", phrase);
+    this->sendToClient(createPhraseNotification(phrase));
+}
+
 /**
  * Tries to make a guess
  * @param guess The guess
  */
 void HangmanPlayer::makeGuess(char32_t guess) {
-    // Dead players cannot make guesses
-    if (!this->isAlive) return;
+    // Dead players and the ones that haven't joined cannot make guesses
+    if (!this->checkIsAlive()) return;
 
     if (this->server != nullptr) {
         this->server->makeGuess(this, guess);
@@ -137,16 +176,14 @@ void HangmanPlayer::makeGuess(char32_t guess) {
 }
 
 /**
- * Parses the incoming message
- * @param data The received bytes
+ * Parses the incoming message. The I/O thread has already validated its body
+ * @param data The received bytes, the type followed by the body in UTF-8
  * @param length Number of bytes received
  */
 void HangmanPlayer::parseMessage(char* data, size_t length){
-    uint8_t messageType = data[0];
-    string messageBody(data + 1,  length - 1);
-    u32string messageBodyUtf32 = utf8ToUtf32(messageBody);
-
-    Message message(messageType, messageBodyUtf32);
+    // An empty message doesn't even have a type
+    if(length == 0) return;
+    Message message((uint8_t)data[0], string(data + 1, length - 1));
     this->parseMessage(message);
 }
 
@@ -157,87 +194,165 @@ void HangmanPlayer::parseMessage(char* data, size_t length){
 void HangmanPlayer::parseMessage(const Message& message) {
     // Only requests are valid to come in to the player
     // Other messages are sent by the player
-    log("Message arrived of type: " + to_string((int)message.type));
+    PLAYER_LOG(LOG_LEVEL_DEBUG, "Message arrived of type: {}", message.type);
     if((message.type & MDIR_MASK) != MDIR_REQUEST){
-        log("Stumbled upon a message that's not a request.");
+        PLAYER_LOG(LOG_LEVEL_WARNING, "Stumbled upon a message that's not a request.");
         return;
     }
 
     switch(message.type & MTYPE_MASK) {
         case MTYPE_JOIN: {
             // Client asked to join the game
-            log("Trying to join...");
-            this->setName(message.content);
-            bool success = this->server->joinPlayer(this);
-            if(!success){
-                this->setName(U"");
-            }
-            u32string content = success ? U"{\"success\":1}" : U"{\"success\":0}";
-            Message response(MDIR_RESPONSE | MTYPE_JOIN, content);
-            this->sendToClient(response);
+            PLAYER_LOG(LOG_LEVEL_DEBUG, "Trying to join...");
+            this->join(message);
             break;
         }
         case MTYPE_LEAVE: {
             // Client has left
-            log("Leaving the game...");
-            this->server->leavePlayer(this);
-            Message response(MDIR_RESPONSE | MTYPE_JOIN, U"{}");
+            PLAYER_LOG(LOG_LEVEL_DEBUG, "Leaving the game...");
+            this->leave();
+            Message response(MDIR_RESPONSE | MTYPE_JOIN, "{}");
             this->sendToClient(response);
             break;
         }
+        case MTYPE_ROOM: {
+            // Client asked for the rooms or for a seat in one
+            if(message.content.length() == 0){
+                this->sendToClient(Message(MDIR_RESPONSE | MTYPE_ROOM, workerGetRooms(this->worker)->list()));
+            }else{
+                this->takeSeat(message.content);
+            }
+            break;
+        }
         case MTYPE_GUESS: {
             // Client made a guess or asks for the phrase
+            if(this->server == nullptr) break;
             if(message.content.length() == 0){
                 this->onPhraseReveal(this->server->getCurrentPhrase());
             }else{
-                log("Guessing...");
-                this->makeGuess(message.content[0]);
+                PLAYER_LOG(LOG_LEVEL_DEBUG, "Guessing...");
+                // Only the first letter is guessed
+                char32_t guess;
+                if(utf8DecodeChar(message.content.data(), message.content.length(), guess) > 0){
+                    this->makeGuess(guess);
+                }
             }
             break;
         }
         case MTYPE_SCORE: {
-            // Client requested the scoreboard
-            log("Requesting the scoreboard...");
-            const map<u32string, int>* scores = this->server->getScores();
-            const map<u32string, int>* fails = this->server->getFails();
-
-            u32string responseContent = U"[";
-            bool isFirst = true;
-            for (auto& score : *scores) {
-                if (!isFirst) {
-                    responseContent += U", ";
-                }
-                responseContent += U"{\"name\": \"" + score.first + U"\","
-                        + U"\"score\": " + intToUtf32(score.second) + U","
-                        + U"\"fails\": " + intToUtf32(fails->at(score.first)) + U"}";
-                isFirst = false;
-            }
-            responseContent += U"]";
-
-            Message response(MDIR_RESPONSE | MTYPE_SCORE, responseContent);
-            this->sendToClient(response);
+            // Client requested the scoreboard, the body tells which part of it
+            PLAYER_LOG(LOG_LEVEL_DEBUG, "Requesting the scoreboard...");
+            if(this->server == nullptr) break;
+            this->sendToClient(this->server->getScoreboard().getResponse(message.content, this->id));
             break;
         }
         default: {
-            log("Unknown message type.");
+            PLAYER_LOG(LOG_LEVEL_WARNING, "Unknown message type.");
+        }
+    }
+}
+
+/**
+ * Takes a seat in a room, before joining the game. The seat taken before is given back
+ * @param request "new" to create a room, "auto" to find one with a free seat or the room number
+ */
+void HangmanPlayer::takeSeat(const string& request){
+    RoomManager* rooms = workerGetRooms(this->worker);
+    // A player that has already joined stays in its room
+    if(this->id == PLAYER_ID_NONE){
+        if(this->room != ROOM_NONE){
+            rooms->releaseSeat(this->room);
+            this->room = ROOM_NONE;
+        }
+        if(request == "new"){
+            this->room = rooms->createRoom();
+        }else if(request == "auto"){
+            this->room = rooms->findRoom();
+        }else{
+            // Only a plain decimal room number is accepted, a larger one would wrap onto another room
+            const char* text = request.c_str();
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long room = isdigit((unsigned char)*text) ? strtoull(text, &end, 10) : 0;
+            bool isValid = end != nullptr && *end == '\0' && errno != ERANGE && room <= UINT32_MAX;
+            if(isValid && room != ROOM_NONE && rooms->reserveSeat((uint32_t)room)){
+                this->room = (uint32_t)room;
+            }
         }
     }
+    PLAYER_LOG(LOG_LEVEL_DEBUG, "Has a seat in room {}.", this->room);
+    this->sendToClient(Message(MDIR_RESPONSE | MTYPE_ROOM, "{\"room\":" + to_string(this->room) + "}"));
+}
+
+/**
+ * Joins the game of the room the player has a seat in. A player without a seat takes one in any room first.
+ * The game runs on the game thread of the room, so the player may have to move there before joining
+ * @param message The join request, its content is the player name
+ */
+void HangmanPlayer::join(const Message& message){
+    // A player that has already joined keeps its name
+    bool success = false;
+    if(this->id == PLAYER_ID_NONE){
+        RoomManager* rooms = workerGetRooms(this->worker);
+        if(this->room == ROOM_NONE){
+            this->room = rooms->findRoom();
+        }
+        if(rooms->getWorker(this->room) != workerGetIndex(this->worker)){
+            // The request is handled again by the game thread of the room, which responds to it
+            PLAYER_LOG(LOG_LEVEL_DEBUG, "Moving to room {}.", this->room);
+            workerMove(this->worker, this->connection, this->room, message.encode());
+            this->hasMoved = true;
+            return;
+        }
+
+        this->server = workerOpenRoom(this->worker, this->room);
+        this->setName(message.content);
+        success = this->server->joinPlayer(this);
+        if(!success){
+            // The player keeps the seat and may try another name
+            this->setName("");
+            this->server = nullptr;
+            workerCloseRoom(this->worker, this->room);
+        }
+    }
+    string content = success ? "{\"success\":1,\"room\":" + to_string(this->room) + "}" : "{\"success\":0}";
+    Message response(MDIR_RESPONSE | MTYPE_JOIN, content);
+    this->sendToClient(response);
+}
+
+/**
+ * Leaves the game and gives the seat back
+ */
+void HangmanPlayer::leave(){
+    if(this->server != nullptr){
+        this->server->leavePlayer(this);
+        this->server = nullptr;
+        workerCloseRoom(this->worker, this->room);
+    }
+    if(this->room != ROOM_NONE){
+        workerGetRooms(this->worker)->releaseSeat(this->room);
+        this->room = ROOM_NONE;
+    }
 }
 
 /**
  * Sends the message to the client
  * @param message The message to send
  */
-void HangmanPlayer::sendToClient(Message& message){
-    log("Sending response.");
-    if(this->networkClient == nullptr) return;
-
-    string messageBodyUtf8 = utf32ToUtf8(message.content);
-    string messageContent = string(1, (char)message.type) + messageBodyUtf8;
+void HangmanPlayer::sendToClient(const Message& message){
+    PLAYER_LOG(LOG_LEVEL_DEBUG, "Sending response.");
+    if(this->worker == nullptr) return;
 
-    clientWrite(this->networkClient, messageContent.c_str(), messageContent.length());
+    Frame* frame = message.encode();
+    workerSend(this->worker, this->connection, frame);
+    frameRelease(frame);
 }
 
-void HangmanPlayer::log(const string& s) const{
-    cout << "\x1b[1;32m[PLAYER: " << utf32ToUtf8(this->getName()) << "]\x1b[0m " << s << endl;
+/**
+ * Sends the already encoded frame to the client. Used to broadcast a message encoded once
+ * @param frame The frame to send
+ */
+void HangmanPlayer::sendToClient(Frame* frame){
+    if(this->worker == nullptr) return;
+    workerSend(this->worker, this->connection, frame);
 }
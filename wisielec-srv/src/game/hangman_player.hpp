@@ -5,44 +5,58 @@ class HangmanPlayer;
 
 #include "hangman_server.hpp"
 #include "message.hpp"
-#include "../client.hpp"
+#include "../frame.hpp"
+#include "../worker.hpp"
+#include <cstdint>
 #include <string>
 
 using namespace std;
 
 class HangmanPlayer {
     protected:
-    HangmanServer* server;
-    u32string name;
-    bool isAlive;
-    Client* networkClient;
+    Worker* worker;             // The game thread serving the player
+    HangmanServer* server;      // The game of the room the player has joined, nullptr until the player joins
+    string name;                // UTF-8
+    uint32_t id;                // ID in the server's registry, PLAYER_ID_NONE until the player joins
+    uint64_t connection;        // The network connection, served by one of the I/O threads
+    uint32_t room;              // The room the player has a seat in, ROOM_NONE if it has none
+    bool hasMoved;              // The connection is handed over to the game thread of the room
 
 public:
-    HangmanPlayer(HangmanServer* server);
-    const u32string& getName() const;
-    void setName(u32string name);
+    HangmanPlayer(Worker* worker, uint64_t connection, uint32_t room);
+    const string& getName() const;
+    void setName(string name);
+    uint32_t getId() const;
+    void setId(uint32_t id);
+    uint64_t getConnection() const;
+    uint32_t getRoom() const;
     bool checkIsAlive();
-    void attachNetworkClient(Client* client);
+    bool checkHasMoved() const;
+    void onDisconnect();
 
-    void onJoin(const HangmanPlayer* player);
-    void onLeave(const HangmanPlayer* player);
+    static Message createJoinNotification(const HangmanPlayer& player);
+    static Message createLeaveNotification(const HangmanPlayer& player);
+    static Message createPhraseNotification(const string& phrase);
+    static Message createHangNotification(const HangmanPlayer& player, int fails);
+    static Message createScoreNotification(const HangmanPlayer& player, int newScore);
 
     void onLose();
     void onWin();
 
-    void onPhraseReveal(const u32string& phrase);
-    void onHang(const HangmanPlayer& player, int fails);
-
-    void onScoreChange(const HangmanPlayer& player, int newScore);
+    void onPhraseReveal(const string& phrase);
 
     void makeGuess(char32_t guess);
 
     void parseMessage(char* message, size_t length);
     void parseMessage(const Message& message);
 
+    void sendToClient(Frame* frame);
+
 protected:
-    void sendToClient(Message& message);
-    void log(const string& s) const;
+    void sendToClient(const Message& message);
+    void takeSeat(const string& request);
+    void join(const Message& message);
+    void leave();
 };
 
 #endif
\ No newline at end of file
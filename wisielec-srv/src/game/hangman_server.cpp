@@ -1,33 +1,80 @@
 #include "hangman_server.hpp"
 
+#include "../log.hpp"
+#include "../metrics.hpp"
 #include "../unicode.hpp"
-#include <iostream>
-#include <cstdlib>
 
-#define MAX_FAILS 6
-#define TIME_MAX (time_t)0x7fffffff
+#define GAME_LOG(level, format, ...) LOG(level, LOG_SOURCE_ROOM, format, this->room __VA_OPT__(,) __VA_ARGS__)
 
-HangmanServer* HangmanServer::instance = nullptr;
+#define MAX_FAILS 6
+#define NEW_ROUND_DELAY_MS 3000
 
 /**
- * Creates a new game server
+ * Creates the game of a room. The phrases follow from the seed and the room alone,
+ * so the same requests give the same phrases whatever the threads' timing
+ * @param room The room
+ * @param worker The game thread the room runs on, nullptr to play without any connections
+ * @param seed Seed of the phrases, shared by all the rooms
  */
-HangmanServer::HangmanServer() {
-    srand(time(nullptr));
-    this->players = list<HangmanPlayer*>();
+HangmanServer::HangmanServer(uint32_t room, Worker* worker, uint64_t seed) : scoreboard(&this->players) {
+    this->room = room;
+    this->worker = worker;
+    this->dictionary = nullptr;
+    this->timers = nullptr;
+    this->roundTimer = nullptr;
+    this->guessCooldownMs = 0;
+    this->randomState = seed ^ ((uint64_t)room * 0xbf58476d1ce4e5b9ull);
     this->currentWord = this->generatePhrase();
-    this->newRoundTime = TIME_MAX;
     this->obscurePhrase();
 }
 
 /**
- * Returns the game server instance
+ * Finishes the game. The players have to leave it before
  */
-HangmanServer* HangmanServer::getInstance() {
-    if(HangmanServer::instance == nullptr) {
-        HangmanServer::instance = new HangmanServer();
+HangmanServer::~HangmanServer() {
+    if(this->roundTimer != nullptr) {
+        timerRelease(this->roundTimer);
     }
-    return HangmanServer::instance;
+}
+
+/**
+ * Makes the server draw the phrases from the dictionary. The current phrase is drawn again,
+ * so it should be called before the players join. Without a dictionary only a few built-in phrases are used
+ * @param dictionary The dictionary
+ * @param category Number of the category or DICTIONARY_ANY
+ * @param difficulty The difficulty or DICTIONARY_ANY
+ */
+void HangmanServer::useDictionary(Dictionary* dictionary, int category, int difficulty) {
+    this->dictionary = dictionary;
+    this->dictionaryBag = dictionaryCreateBag(dictionary, category, difficulty, this->nextRandom());
+    GAME_LOG(LOG_LEVEL_INFO, "Using a dictionary of {} phrases.", this->dictionaryBag.count);
+    this->currentWord = this->generatePhrase();
+    this->obscurePhrase();
+}
+
+/**
+ * Attaches the server to the timing wheel that runs the rounds and measures the guess cooldown.
+ * Has to be called before the players join
+ * @param timers The timing wheel
+ */
+void HangmanServer::setTimers(TimerWheel* timers) {
+    this->timers = timers;
+    this->roundTimer = timerCreate(timers, HangmanServer::onRoundTimer, this);
+}
+
+/**
+ * Returns the room the game is played in
+ */
+uint32_t HangmanServer::getRoom() const {
+    return this->room;
+}
+
+/**
+ * Sets the minimum time between the guesses of a player. The guesses made sooner are ignored
+ * @param cooldownMs The time in milliseconds, 0 to allow any number of guesses
+ */
+void HangmanServer::setGuessCooldown(uint64_t cooldownMs) {
+    this->guessCooldownMs = cooldownMs;
 }
 
 /**
@@ -40,21 +87,21 @@ bool HangmanServer::joinPlayer(HangmanPlayer* player) {
         return false;
     }
     // Check if the player's name is already taken
-    if(this->playerNames.find(player->getName()) != this->playerNames.end()){
+    if(this->players.find(player->getName()) != PLAYER_ID_NONE){
         return false;
     }
 
     // The joining player is not notified
-    for(HangmanPlayer* p : this->players) {
-        p->onJoin(player);
-    }
+    GAME_LOG(LOG_LEVEL_INFO, "{} has joined the game.", player->getName());
+    this->broadcast(HangmanPlayer::createJoinNotification(*player));
 
-    // Remember the player
-    this->players.push_back(player);
-    this->playerNames.insert(player->getName());
-    this->scores[player->getName()] = 0;
-    this->fails[player->getName()] = 0;
-    this->log("There are " + to_string(this->countAlivePlayers()) + " alive players now.");
+    // Remember the player, the broadcasts reach the player from now on
+    player->setId(this->players.add(player));
+    this->scoreboard.onChange(player->getId());
+    if(this->worker != nullptr) {
+        workerAddMember(this->worker, player->getConnection(), this->room);
+    }
+    GAME_LOG(LOG_LEVEL_INFO, "There are {} alive players now.", this->players.getAliveCount());
     return true;
 }
 
@@ -63,17 +110,21 @@ bool HangmanServer::joinPlayer(HangmanPlayer* player) {
  * @param player The player to remove
  */
 void HangmanServer::leavePlayer(HangmanPlayer* player) {
+    // The player might have not joined or already left
+    if(player->getId() == PLAYER_ID_NONE) return;
+
     // Forget about the player
-    this->players.remove(player);
-    this->playerNames.erase(player->getName());
-    this->scores.erase(player->getName());
-    this->fails.erase(player->getName());
-    this->log("There are " + to_string(this->countAlivePlayers()) + " alive players now.");
+    this->scoreboard.onRemove(player->getId());
+    this->players.remove(player->getId());
+    player->setId(PLAYER_ID_NONE);
+    if(this->worker != nullptr) {
+        workerRemoveMember(this->worker, player->getConnection());
+    }
+    GAME_LOG(LOG_LEVEL_INFO, "There are {} alive players now.", this->players.getAliveCount());
 
     // The leaving player is not notified
-    for(HangmanPlayer* p : this->players) {
-        p->onLeave(player);
-    }
+    GAME_LOG(LOG_LEVEL_INFO, "{} has left the game.", player->getName());
+    this->broadcast(HangmanPlayer::createLeaveNotification(*player));
 }
 
 /**
@@ -82,131 +133,232 @@ void HangmanServer::leavePlayer(HangmanPlayer* player) {
  * @param guess The letter to guess
  */
 void HangmanServer::makeGuess(HangmanPlayer* player, char32_t guess) {
-    guess = toupper(guess);
+    uint32_t id = player->getId();
+    if(id == PLAYER_ID_NONE) return;
+    if(this->guessCooldownMs > 0 && this->timers != nullptr) {
+        // The clock of the timing wheel is cached for the whole wakeup, so it costs nothing
+        uint64_t now = timerWheelGetTime(this->timers);
+        uint64_t lastGuessTime = this->players.getLastGuessTime(id);
+        if(lastGuessTime != 0 && now < lastGuessTime + this->guessCooldownMs) {
+            GAME_LOG(LOG_LEVEL_DEBUG, "{} is guessing too fast.", player->getName());
+            return;
+        }
+        this->players.setLastGuessTime(id, now);
+    }
+    uint64_t guessTime = metricsNow();
+    metricAdd(&metricGuesses, 1);
+    guess = unicodeToUpper(guess);
 
-    // Count the guessed letters and remaining ones
+    // Reveal the positions of the letter. A revealed letter is removed from the index,
+    // so guessing it again counts as a miss
     int found = 0;
-    int remaining = 0;
-    for (size_t i = 0; i < this->currentWord.length(); i++) {
-        if (this->currentWord[i] == guess && this->currentWordObscured[i] == U'_') {
-            this->currentWordObscured[i] = guess;
-            found++;
-        }
-        if (this->currentWordObscured[i] == U'_') {
-            remaining++;
+    auto positions = this->letterPositions.find(guess);
+    if (positions != this->letterPositions.end()) {
+        const vector<uint64_t>& mask = positions->second;
+        for (size_t word = 0; word < mask.size(); word++) {
+            this->revealedPositions[word] |= mask[word];
+            found += __builtin_popcountll(mask[word]);
         }
+        this->letterPositions.erase(positions);
+        this->remainingLetters -= found;
+        this->renderObscuredPhrase();
     }
 
     // If the player hasn't guessed anything, add one fail
     if (found == 0) {
-        int failCount = ++this->fails[player->getName()];
-        for(HangmanPlayer* p : this->players){
-            p->onHang(*player, failCount);
-        }
+        int failCount = this->players.addFail(id);
+        this->scoreboard.onChange(id);
+        GAME_LOG(LOG_LEVEL_DEBUG, "{} has been hanged ({} fails).", player->getName(), failCount);
+        this->broadcast(HangmanPlayer::createHangNotification(*player, failCount), guessTime,
+                HangmanServer::getCoalesceKey(MTYPE_HANG, this->players.getSerial(id)));
 
-        if (this->fails[player->getName()] >= MAX_FAILS) {
+        if (failCount >= MAX_FAILS) {
+            this->players.kill(id);
             player->onLose();
 
-            if(this->countAlivePlayers() == 1) {
-                // Find the only alive player
-                for(auto winner : this->players){
-                    if(!winner->checkIsAlive()) continue;
-                    winner->onWin();
+            if(this->players.getAliveCount() == 1) {
+                // Find the only alive player. It happens once per game, so it may take a while
+                for(uint32_t winnerId : this->players.getIds()){
+                    if(!this->players.isAlive(winnerId)) continue;
+                    this->players.kill(winnerId);
+                    this->players.get(winnerId)->onWin();
                     break;
                 }
             }
 
-            this->log("There are " + to_string(this->countAlivePlayers()) + " alive players now.");
+            GAME_LOG(LOG_LEVEL_INFO, "There are {} alive players now.", this->players.getAliveCount());
         }
     } else {
+        metricAdd(&metricGuessHits, 1);
+
         // Update the player's score
-        int score = (this->scores[player->getName()] += found);
+        int score = this->players.addScore(id, found);
+        this->scoreboard.onChange(id);
 
         // Send the currently visible phrase to all players
-        for(HangmanPlayer* p : this->players) {
-            p->onPhraseReveal(this->currentWordObscured);
-            p->onScoreChange(*player, score);
-        }
+        GAME_LOG(LOG_LEVEL_DEBUG, "Phrase revealed: {}", this->currentWordObscured);
+        this->broadcast(HangmanPlayer::createPhraseNotification(this->currentWordObscured), guessTime,
+                HangmanServer::getCoalesceKey(MTYPE_GUESS, 0));
+        GAME_LOG(LOG_LEVEL_DEBUG, "{} has {} points.", player->getName(), score);
+        this->broadcast(HangmanPlayer::createScoreNotification(*player, score), guessTime,
+                HangmanServer::getCoalesceKey(MTYPE_SCORE, this->players.getSerial(id)));
 
-        if(remaining == 0) {
-            // Set the time when to start the new round (in a few seconds)
-            this->newRoundTime = time(nullptr) + 3;
+        if(this->remainingLetters == 0 && this->roundTimer != nullptr) {
+            // Start the new round in a few seconds
+            timerSchedule(this->roundTimer, NEW_ROUND_DELAY_MS);
         }
     }
 }
 
 /**
- * Checks if the time for this round has elapsed.
- * If so, starts the next round
+ * Handles the round timer: the time between the rounds has elapsed
+ * @param timer The round timer
  */
-void HangmanServer::startNewRoundIfNeeded() {
-    if(this->newRoundTime > time(nullptr)) return;
+void HangmanServer::onRoundTimer(Timer* timer) {
+    ((HangmanServer*)timerGetData(timer))->startNewRound();
+}
 
-    this->newRoundTime = TIME_MAX;
+/**
+ * Starts the next round with a new phrase
+ */
+void HangmanServer::startNewRound() {
     this->currentWord = this->generatePhrase();
     this->obscurePhrase();
 
     // Broadcast the new phrase
-    for(HangmanPlayer* p : this->players) {
-        p->onPhraseReveal(this->currentWordObscured);
-    }
+    this->broadcast(HangmanPlayer::createPhraseNotification(this->currentWordObscured), 0,
+            HangmanServer::getCoalesceKey(MTYPE_GUESS, 0));
 }
 
 /**
  * Generates a new phrase
  */
-u32string HangmanServer::generatePhrase() {
-    u32string phrases[] = {
-            U"EEL", U"MOCK", U"HATCH", U"DRIVER", U"HANGMAN",
-            U"ELEPHANT", U"PROFESSOR", U"DEPARTMENT", U"CONSEQUENCE",
-            U"INTELLIGENCE"
+string HangmanServer::generatePhrase() {
+    if(this->dictionary != nullptr && this->dictionaryBag.count > 0) {
+        string phrase = dictionaryDraw(this->dictionary, this->dictionaryBag);
+        if(!phrase.empty()) {
+            GAME_LOG(LOG_LEVEL_INFO, "Chosen phrase: {} (drawn: {})", phrase, this->dictionaryBag.position);
+            return phrase;
+        }
+    }
+
+    static const char* const phrases[] = {
+            "EEL", "MOCK", "HATCH", "DRIVER", "HANGMAN",
+            "ELEPHANT", "PROFESSOR", "DEPARTMENT", "CONSEQUENCE",
+            "INTELLIGENCE"
     };
-    int choice = rand() % 10; // 10 = phrases[] length
-    u32string phrase = phrases[choice];
-    log("Chosen phrase: " + utf32ToUtf8(phrase) + " (index: " + to_string(choice) + ")");
-    return phrase;
+    int choice = (int)(this->nextRandom() % (sizeof(phrases) / sizeof(phrases[0])));
+    GAME_LOG(LOG_LEVEL_INFO, "Chosen phrase: {} (index: {})", phrases[choice], choice);
+    return phrases[choice];
 }
 
 /**
- * Replaces the letters with underscores
+ * Returns the next pseudo-random number of the room (SplitMix64)
+ */
+uint64_t HangmanServer::nextRandom() {
+    this->randomState += 0x9e3779b97f4a7c15ull;
+    uint64_t value = this->randomState;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+/**
+ * Replaces the letters with underscores. Spaces and hyphens stay visible.
+ * Builds the index of the letters' positions, used to evaluate the guesses.
+ * The positions are counted in characters, not in bytes
  */
 void HangmanServer::obscurePhrase() {
-    this->currentWordObscured = this->currentWord;
-    fill(this->currentWordObscured.begin(), this->currentWordObscured.end(), '_');
+    this->letterOffsets.clear();
+    this->revealedPositions.clear();
+    this->letterPositions.clear();
+    this->remainingLetters = 0;
+
+    size_t offset = 0;
+    while (offset < this->currentWord.length()) {
+        char32_t c;
+        size_t charLength = utf8DecodeChar(this->currentWord.data() + offset, this->currentWord.length() - offset, c);
+        if (charLength == 0) {
+            // Only a malformed phrase, the rest of it is dropped
+            this->currentWord.resize(offset);
+            break;
+        }
+
+        size_t i = this->letterOffsets.size();
+        this->letterOffsets.push_back(offset);
+        offset += charLength;
+        if (i % 64 == 0) this->revealedPositions.push_back(0);
+
+        if (c == U' ' || c == U'-') {
+            this->revealedPositions[i / 64] |= (uint64_t)1 << (i % 64);
+            continue;
+        }
+        vector<uint64_t>& mask = this->letterPositions[c];
+        mask.resize(i / 64 + 1);
+        mask[i / 64] |= (uint64_t)1 << (i % 64);
+        this->remainingLetters++;
+    }
+    this->letterOffsets.push_back(this->currentWord.length());
+    this->renderObscuredPhrase();
+}
+
+/**
+ * Builds the phrase as it should be displayed: the revealed characters and underscores in place of the hidden ones
+ */
+void HangmanServer::renderObscuredPhrase() {
+    this->currentWordObscured.clear();
+    for (size_t i = 0; i + 1 < this->letterOffsets.size(); i++) {
+        if ((this->revealedPositions[i / 64] >> (i % 64)) & 1) {
+            this->currentWordObscured.append(this->currentWord, this->letterOffsets[i], this->letterOffsets[i + 1] - this->letterOffsets[i]);
+        } else {
+            this->currentWordObscured += '_';
+        }
+    }
 }
 
 /**
- * Returns the players' scores
+ * Returns the players that have joined the game, with their scores and fails
  */
-const map<u32string, int>* HangmanServer::getScores() {
-    return &(this->scores);
+const PlayerRegistry& HangmanServer::getPlayers() const {
+    return this->players;
 }
 
 /**
- * Returns the number of players' fails
+ * Returns the scoreboard responses
  */
-const map<u32string, int>* HangmanServer::getFails() {
-    return &(this->fails);
+Scoreboard& HangmanServer::getScoreboard() {
+    return this->scoreboard;
 }
 
 /**
  * Returns the current phrase as it should be displayed (with underscores)
  */
-u32string HangmanServer::getCurrentPhrase() {
+const string& HangmanServer::getCurrentPhrase() {
     return this->currentWordObscured;
 }
 
 /**
- * Counts all players that are still alive
+ * Sends the message to all the players of the room. The message is encoded only once, on the game thread,
+ * and every player's client references the same frame. Each I/O thread gets the frame once
+ * @param message The message to send
+ * @param originTime When the event that caused the message happened, to measure the latency. 0 if not measured
+ * @param coalesceKey The key of the older messages this one supersedes, if they haven't been sent yet
  */
-int HangmanServer::countAlivePlayers() const {
-    int count = 0;
-    for(auto player : this->players){
-        if(player->checkIsAlive()) count++;
+void HangmanServer::broadcast(const Message& message, uint64_t originTime, uint64_t coalesceKey) {
+    Frame* frame = message.encode();
+    frameSetOriginTime(frame, originTime);
+    frameSetCoalesceKey(frame, coalesceKey);
+    if(this->worker != nullptr) {
+        workerBroadcast(this->worker, this->room, frame);
     }
-    return count;
+    frameRelease(frame);
 }
-
-void HangmanServer::log(const string& s) const{
-    cout << "\x1b[1;34m[GAME SERVER]\x1b[0m " << s << endl;
+/**
+ * Returns the key shared by the notifications that supersede each other: only the latest phrase,
+ * and the latest score and fails of each player matter to a client that lags behind
+ * @param type The message type
+ * @param serial Serial number of the player the message is about, 0 if it's about the game
+ */
+uint64_t HangmanServer::getCoalesceKey(uint8_t type, uint32_t serial) {
+    return ((uint64_t)type << 32) | serial;
 }
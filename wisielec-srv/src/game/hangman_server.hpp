@@ -4,50 +4,69 @@
 class HangmanServer;
 
 #include "hangman_player.hpp"
-#include <list>
-#include <map>
-#include <set>
+#include "message.hpp"
+#include "player_registry.hpp"
+#include "scoreboard.hpp"
+#include "../dictionary.hpp"
+#include "../timer.hpp"
+#include "../worker.hpp"
+#include <unordered_map>
+#include <vector>
 #include <string>
-#include <ctime>
 
 using namespace std;
 
 class HangmanServer {
     protected:
-    static HangmanServer* instance;
-    time_t newRoundTime;
+    uint32_t room;                                                  // The room the game is played in
+    Worker* worker;                                                 // The game thread of the room, passes the frames to the I/O threads
+    TimerWheel* timers;
+    Timer* roundTimer;                                              // Starts the next round after the phrase is guessed
+    uint64_t guessCooldownMs;                                       // Minimum time between the guesses of a player
 
-    list<HangmanPlayer*> players;
-    set<u32string> playerNames;
-    map<u32string, int> scores;
-    map<u32string, int> fails;
+    PlayerRegistry players;
+    Scoreboard scoreboard;
 
-    u32string currentWord;
-    u32string currentWordObscured;
+    string currentWord;                                             // UTF-8
+    string currentWordObscured;                                     // UTF-8, with the hidden letters replaced by underscores
+    vector<size_t> letterOffsets;                                   // Where each character of the phrase starts, followed by the phrase length
+    vector<uint64_t> revealedPositions;                             // Bitmask of the characters that are shown
+    unordered_map<char32_t, vector<uint64_t>> letterPositions;     // Bitmasks of the positions of the hidden letters
+    int remainingLetters;
+
+    Dictionary* dictionary;
+    DictionaryBag dictionaryBag;
+    uint64_t randomState;                                           // Draws the phrases
 
-    HangmanServer();
-    
     public:
-    static HangmanServer* getInstance();
+    HangmanServer(uint32_t room, Worker* worker, uint64_t seed = 0);
+    ~HangmanServer();
+
+    void useDictionary(Dictionary* dictionary, int category, int difficulty);
+    void setTimers(TimerWheel* timers);
+    uint32_t getRoom() const;
+    void setGuessCooldown(uint64_t cooldownMs);
 
     bool joinPlayer(HangmanPlayer* player);
     void leavePlayer(HangmanPlayer* player);
 
     void makeGuess(HangmanPlayer* player, char32_t guess);
 
-    const map<u32string, int>* getScores();
-    const map<u32string, int>* getFails();
-
-    u32string getCurrentPhrase();
+    const PlayerRegistry& getPlayers() const;
+    Scoreboard& getScoreboard();
 
-    void startNewRoundIfNeeded();
+    const string& getCurrentPhrase();
 
     protected:
-    u32string generatePhrase();
+    static void onRoundTimer(Timer* timer);
+    void startNewRound();
+    string generatePhrase();
+    uint64_t nextRandom();
     void obscurePhrase();
+    void renderObscuredPhrase();
 
-    int countAlivePlayers() const;
-    void log(const string& s) const;
+    void broadcast(const Message& message, uint64_t originTime = 0, uint64_t coalesceKey = FRAME_NO_COALESCING);
+    static uint64_t getCoalesceKey(uint8_t type, uint32_t serial);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "leaderboard.hpp"
+
+/**
+ * Adds the player to the ranking or moves the player after the score or fails have changed
+ * @param id ID of the player
+ * @param score The player's score
+ * @param fails The player's fails
+ */
+void Leaderboard::update(uint32_t id, int score, int fails) {
+    if(this->keys.size() <= id) {
+        this->keys.resize(id + 1);
+        this->isRanked.resize(id + 1, 0);
+    }
+    if(this->isRanked[id]) {
+        this->ranking.erase(this->keys[id]);
+    }
+    this->keys[id] = LeaderboardKey(-score, fails, id);
+    this->ranking.insert(this->keys[id]);
+    this->isRanked[id] = 1;
+}
+
+/**
+ * Removes the player from the ranking
+ * @param id ID of the player
+ */
+void Leaderboard::remove(uint32_t id) {
+    if(id >= this->keys.size() || !this->isRanked[id]) return;
+    this->ranking.erase(this->keys[id]);
+    this->isRanked[id] = 0;
+}
+
+/**
+ * Returns the number of ranked players
+ */
+size_t Leaderboard::getCount() const {
+    return this->ranking.size();
+}
+
+/**
+ * Returns the player's rank
+ * @param id ID of the player
+ * @return The rank, counted from 0
+ */
+size_t Leaderboard::getRank(uint32_t id) const {
+    return this->ranking.order_of_key(this->keys[id]);
+}
+
+/**
+ * Returns the players at the consecutive ranks
+ * @param first The first rank, counted from 0
+ * @param count The maximum number of players
+ * @return IDs of the players, from the best
+ */
+vector<uint32_t> Leaderboard::getRange(size_t first, size_t count) const {
+    vector<uint32_t> ids;
+    if(first >= this->ranking.size()) return ids;
+    auto entry = this->ranking.find_by_order(first);
+    for(; entry != this->ranking.end() && ids.size() < count; entry++) {
+        ids.push_back(get<2>(*entry));
+    }
+    return ids;
+}
@@ -0,0 +1,36 @@
+#ifndef LEADERBOARD_HPP
+#define LEADERBOARD_HPP
+
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+using namespace std;
+
+// Players are ranked by the score (descending), then by the fails (ascending), then by the ID
+typedef tuple<int, int, uint32_t> LeaderboardKey;
+
+/**
+ * The players ordered by their rank. It's a balanced tree that knows the size of each subtree,
+ * so finding the player's rank or the player at a given rank takes O(log n)
+ */
+class Leaderboard {
+    protected:
+    __gnu_pbds::tree<LeaderboardKey, __gnu_pbds::null_type, less<LeaderboardKey>,
+            __gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update> ranking;
+    vector<LeaderboardKey> keys;            // Current key of each player, indexed by the player ID
+    vector<uint8_t> isRanked;
+
+    public:
+    void update(uint32_t id, int score, int fails);
+    void remove(uint32_t id);
+
+    size_t getCount() const;
+    size_t getRank(uint32_t id) const;
+    vector<uint32_t> getRange(size_t first, size_t count) const;
+};
+
+#endif
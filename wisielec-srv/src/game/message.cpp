@@ -1,11 +1,29 @@
 #include "message.hpp"
 
+#include <cstring>
+
 /**
  * Creates and fills the message object
  * @param type The message type
- * @param content The message content
+ * @param content The message content in UTF-8
  */
-Message::Message(uint8_t type, u32string content) {
-    this->content = content;
+Message::Message(uint8_t type, string content) {
+    this->content = std::move(content);
     this->type = type;
 }
+
+/**
+ * Encodes the message into a frame that can be sent to any number of clients.
+ * The responses are sent ahead of the notifications waiting in the clients' queues
+ * @return The frame, owned by the caller
+ */
+Frame* Message::encode() const {
+    Frame* frame = frameCreate(1 + this->content.length());
+    if((this->type & MDIR_MASK) == MDIR_RESPONSE) {
+        frameSetPriority(frame, FRAME_PRIORITY_CONTROL);
+    }
+    char* payload = frameGetPayload(frame);
+    payload[0] = (char)this->type;
+    memcpy(payload + 1, this->content.data(), this->content.length());
+    return frame;
+}
@@ -1,12 +1,15 @@
 #ifndef MESSAGE_HPP
 #define MESSAGE_HPP
 
+#include "../frame.hpp"
+
 #include <string>
 #include <cstdint>
 
 #define MTYPE_MASK 0x3f
 #define MTYPE_JOIN 0x01     // Joining the game
 #define MTYPE_LEAVE 0x02    // Leaving the game
+#define MTYPE_ROOM 0x03     // Listing the rooms or taking a seat in one
 #define MTYPE_GUESS 0x11    // Guessing a letter
 #define MTYPE_SCORE 0x12    // Changing score
 #define MTYPE_HANG 0x13     // Hanging a player
@@ -23,9 +26,11 @@ using namespace std;
 class Message {
     public:
     uint8_t type;
-    u32string content;
+    string content;             // UTF-8
+
+    Message(uint8_t type, string content);
 
-    Message(uint8_t type, u32string content);
+    Frame* encode() const;
 };
 
 #endif
@@ -0,0 +1,189 @@
+#include "player_registry.hpp"
+
+#include "hangman_player.hpp"
+
+/**
+ * Creates an empty registry
+ */
+PlayerRegistry::PlayerRegistry() {
+    this->aliveCount = 0;
+    this->nextSerial = 0;
+}
+
+/**
+ * Adds the player to the registry
+ * @param player The player to add
+ * @return ID of the player or PLAYER_ID_NONE if the player's name is already taken
+ */
+uint32_t PlayerRegistry::add(HangmanPlayer* player) {
+    auto entry = this->nameIndex.emplace(player->getName(), 0);
+    if(!entry.second) {
+        return PLAYER_ID_NONE;
+    }
+
+    uint32_t id;
+    if(!this->freeIds.empty()) {
+        id = this->freeIds.back();
+        this->freeIds.pop_back();
+    } else {
+        id = this->players.size();
+        this->players.push_back(nullptr);
+        this->scores.push_back(0);
+        this->fails.push_back(0);
+        this->alive.push_back(0);
+        this->lastGuessTimes.push_back(0);
+        this->serials.push_back(0);
+        this->densePositions.push_back(0);
+    }
+
+    entry.first->second = id;
+    this->players[id] = player;
+    this->scores[id] = 0;
+    this->fails[id] = 0;
+    this->alive[id] = 1;
+    this->lastGuessTimes[id] = 0;
+    this->serials[id] = this->nextSerial++;
+    this->aliveCount++;
+    this->densePositions[id] = this->ids.size();
+    this->ids.push_back(id);
+    return id;
+}
+
+/**
+ * Removes the player from the registry. The ID may be given to another player
+ * @param id ID of the player
+ */
+void PlayerRegistry::remove(uint32_t id) {
+    this->nameIndex.erase(this->players[id]->getName());
+    if(this->alive[id]) {
+        this->aliveCount--;
+    }
+
+    // Move the last ID into the removed one's place
+    uint32_t position = this->densePositions[id];
+    uint32_t lastId = this->ids.back();
+    this->ids[position] = lastId;
+    this->densePositions[lastId] = position;
+    this->ids.pop_back();
+
+    this->players[id] = nullptr;
+    this->alive[id] = 0;
+    this->freeIds.push_back(id);
+}
+
+/**
+ * Finds the player by name
+ * @param name Name of the player
+ * @return ID of the player or PLAYER_ID_NONE if there's no such player
+ */
+uint32_t PlayerRegistry::find(const string& name) const {
+    auto entry = this->nameIndex.find(name);
+    return entry == this->nameIndex.end() ? PLAYER_ID_NONE : entry->second;
+}
+
+/**
+ * Returns the player with the ID
+ * @param id ID of the player
+ */
+HangmanPlayer* PlayerRegistry::get(uint32_t id) const {
+    return this->players[id];
+}
+
+/**
+ * Returns the number the player got on joining. It tells apart the players that got the same ID one after another
+ * @param id ID of the player
+ */
+uint32_t PlayerRegistry::getSerial(uint32_t id) const {
+    return this->serials[id];
+}
+
+/**
+ * Returns the IDs of all the players, in no particular order
+ */
+const vector<uint32_t>& PlayerRegistry::getIds() const {
+    return this->ids;
+}
+
+/**
+ * Returns the number of players
+ */
+size_t PlayerRegistry::getCount() const {
+    return this->ids.size();
+}
+
+/**
+ * Returns the player's score
+ * @param id ID of the player
+ */
+int PlayerRegistry::getScore(uint32_t id) const {
+    return this->scores[id];
+}
+
+/**
+ * Adds the points to the player's score
+ * @param id ID of the player
+ * @param points The points to add
+ * @return The new score
+ */
+int PlayerRegistry::addScore(uint32_t id, int points) {
+    return this->scores[id] += points;
+}
+
+/**
+ * Returns the number of the player's fails
+ * @param id ID of the player
+ */
+int PlayerRegistry::getFails(uint32_t id) const {
+    return this->fails[id];
+}
+
+/**
+ * Adds a fail to the player
+ * @param id ID of the player
+ * @return The new number of fails
+ */
+int PlayerRegistry::addFail(uint32_t id) {
+    return ++this->fails[id];
+}
+
+/**
+ * Returns when the player has guessed last time, 0 if the player hasn't guessed yet
+ * @param id ID of the player
+ */
+uint64_t PlayerRegistry::getLastGuessTime(uint32_t id) const {
+    return this->lastGuessTimes[id];
+}
+
+/**
+ * Remembers when the player has guessed
+ * @param id ID of the player
+ * @param time The time in milliseconds
+ */
+void PlayerRegistry::setLastGuessTime(uint32_t id, uint64_t time) {
+    this->lastGuessTimes[id] = time;
+}
+
+/**
+ * Checks if the player is still in the game
+ * @param id ID of the player
+ */
+bool PlayerRegistry::isAlive(uint32_t id) const {
+    return this->alive[id];
+}
+
+/**
+ * Marks the player as no longer in the game, after a loss or a win
+ * @param id ID of the player
+ */
+void PlayerRegistry::kill(uint32_t id) {
+    if(!this->alive[id]) return;
+    this->alive[id] = 0;
+    this->aliveCount--;
+}
+
+/**
+ * Returns the number of players that are still in the game
+ */
+int PlayerRegistry::getAliveCount() const {
+    return this->aliveCount;
+}
@@ -0,0 +1,59 @@
+#ifndef PLAYER_REGISTRY_HPP
+#define PLAYER_REGISTRY_HPP
+
+class HangmanPlayer;
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#define PLAYER_ID_NONE UINT32_MAX
+
+/**
+ * The players that have joined the game. Every player gets a small integer ID, reused after the player leaves.
+ * The scores, fails, alive flags and guess times are kept in arrays indexed by the ID,
+ * and the IDs of the joined players are kept densely, so that they can be iterated over quickly
+ */
+class PlayerRegistry {
+    protected:
+    vector<HangmanPlayer*> players;         // Indexed by ID, nullptr for free IDs
+    vector<int> scores;
+    vector<int> fails;
+    vector<uint8_t> alive;
+    vector<uint64_t> lastGuessTimes;        // In milliseconds of the timing wheel's clock
+    vector<uint32_t> serials;               // Unlike the IDs, the serials aren't reused for a long time
+    uint32_t nextSerial;
+    vector<uint32_t> densePositions;        // Position of the ID in ids
+    vector<uint32_t> ids;                   // IDs of the joined players
+    vector<uint32_t> freeIds;
+    unordered_map<string, uint32_t> nameIndex;
+    int aliveCount;
+
+    public:
+    PlayerRegistry();
+
+    uint32_t add(HangmanPlayer* player);
+    void remove(uint32_t id);
+
+    uint32_t find(const string& name) const;
+    HangmanPlayer* get(uint32_t id) const;
+    uint32_t getSerial(uint32_t id) const;
+    const vector<uint32_t>& getIds() const;
+    size_t getCount() const;
+
+    int getScore(uint32_t id) const;
+    int addScore(uint32_t id, int points);
+    int getFails(uint32_t id) const;
+    int addFail(uint32_t id);
+    uint64_t getLastGuessTime(uint32_t id) const;
+    void setLastGuessTime(uint32_t id, uint64_t time);
+
+    bool isAlive(uint32_t id) const;
+    void kill(uint32_t id);
+    int getAliveCount() const;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "room_manager.hpp"
+
+#include "../log.hpp"
+#include "../metrics.hpp"
+#include <cstdlib>
+
+#define ROOM_LOG(level, room, format, ...) LOG(level, LOG_SOURCE_ROOM, format, room __VA_OPT__(,) __VA_ARGS__)
+
+/**
+ * Creates the manager without any rooms
+ * @param workerCount Number of the game threads the rooms are spread between
+ * @param seats Maximum number of the players in a room
+ */
+RoomManager::RoomManager(int workerCount, int seats) {
+    this->workerCount = workerCount;
+    this->seats = seats;
+    this->sequence = 0;
+    this->workerSeats.resize(workerCount, 0);
+    this->dictionary = nullptr;
+    this->category = DICTIONARY_ANY;
+    this->difficulty = DICTIONARY_ANY;
+    this->guessCooldownMs = 0;
+    this->seed = ((uint64_t)rand() << 32) | rand();
+}
+
+/**
+ * Makes the rooms opened from now on draw the phrases from the dictionary
+ * @param dictionary The dictionary
+ * @param category Number of the category or DICTIONARY_ANY
+ * @param difficulty The difficulty or DICTIONARY_ANY
+ */
+void RoomManager::useDictionary(Dictionary* dictionary, int category, int difficulty) {
+    this->dictionary = dictionary;
+    this->category = category;
+    this->difficulty = difficulty;
+}
+
+/**
+ * Sets the minimum time between the guesses of a player in the rooms opened from now on
+ * @param cooldownMs The time in milliseconds, 0 to allow any number of guesses
+ */
+void RoomManager::setGuessCooldown(uint64_t cooldownMs) {
+    this->guessCooldownMs = cooldownMs;
+}
+
+/**
+ * Sets the seed of the phrases in the rooms opened from now on. The phrases of a room follow from the seed
+ * and the room's identifier alone, so the same requests give the same phrases whatever the threads' timing
+ * @param seed The seed
+ */
+void RoomManager::setSeed(uint64_t seed) {
+    this->seed = seed;
+}
+
+/**
+ * Returns the seed of the phrases, random unless it has been set
+ */
+uint64_t RoomManager::getSeed() const {
+    return this->seed;
+}
+
+/**
+ * Returns the index of the game thread the room runs on. It follows from the room's identifier alone,
+ * so the I/O threads know where to pass the requests without asking the manager
+ * @param room The room
+ */
+int RoomManager::getWorker(uint32_t room) const {
+    return (int)(room % this->workerCount);
+}
+
+/**
+ * Creates a new room on the game thread with the fewest players, and takes a seat in it
+ * @return The room
+ */
+uint32_t RoomManager::createRoom() {
+    lock_guard<mutex> guard(this->lock);
+    int worker = 0;
+    for(int i = 1; i < this->workerCount; i++) {
+        if(this->workerSeats[i] < this->workerSeats[worker]) worker = i;
+    }
+    uint32_t room = ++this->sequence * this->workerCount + worker;
+    this->setTakenSeats(room, 0, 1);
+    metricAdd(&metricRooms, 1);
+    ROOM_LOG(LOG_LEVEL_INFO, room, "Created on game thread {}.", worker);
+    return room;
+}
+
+/**
+ * Takes a seat in the fullest room that has a free one, so that the players meet each other.
+ * If all the rooms are full, a new one is created
+ * @return The room
+ */
+uint32_t RoomManager::findRoom() {
+    {
+        lock_guard<mutex> guard(this->lock);
+        if(!this->openRooms.empty()) {
+            auto [count, room] = *this->openRooms.rbegin();
+            this->setTakenSeats(room, count, count + 1);
+            return room;
+        }
+    }
+    return this->createRoom();
+}
+
+/**
+ * Takes a seat in the room
+ * @param room The room
+ * @return False if there's no such room or all its seats are taken
+ */
+bool RoomManager::reserveSeat(uint32_t room) {
+    lock_guard<mutex> guard(this->lock);
+    auto entry = this->takenSeats.find(room);
+    if(entry == this->takenSeats.end() || entry->second >= this->seats) return false;
+    this->setTakenSeats(room, entry->second, entry->second + 1);
+    return true;
+}
+
+/**
+ * Gives the seat back. The room is forgotten once all its seats are free
+ * @param room The room
+ */
+void RoomManager::releaseSeat(uint32_t room) {
+    lock_guard<mutex> guard(this->lock);
+    auto entry = this->takenSeats.find(room);
+    if(entry == this->takenSeats.end()) return;
+    int count = entry->second - 1;
+    this->setTakenSeats(room, entry->second, count);
+    if(count == 0) {
+        metricAdd(&metricRooms, -1);
+        ROOM_LOG(LOG_LEVEL_INFO, room, "All the seats are free.");
+    }
+}
+
+/**
+ * Lists the rooms in JSON: {"rooms":[{"id":1,"players":3,"seats":32}]}
+ */
+string RoomManager::list() {
+    lock_guard<mutex> guard(this->lock);
+    string content = "{\"rooms\":[";
+    for(auto& [room, count] : this->takenSeats) {
+        if(content.back() == '}') content += ',';
+        content += "{\"id\":" + to_string(room) + ",\"players\":" + to_string(count)
+                + ",\"seats\":" + to_string(this->seats) + "}";
+    }
+    content += "]}";
+    return content;
+}
+
+/**
+ * Creates the game of the room. Called by the game thread of the room, the game lives on that thread only
+ * @param room The room
+ * @param worker The game thread of the room
+ * @return The game
+ */
+HangmanServer* RoomManager::openRoom(uint32_t room, Worker* worker) {
+    auto game = new HangmanServer(room, worker, this->seed);
+    game->setTimers(workerGetTimers(worker));
+    game->setGuessCooldown(this->guessCooldownMs);
+    if(this->dictionary != nullptr) {
+        game->useDictionary(this->dictionary, this->category, this->difficulty);
+    }
+    return game;
+}
+
+/**
+ * Updates the number of the taken seats of the room. Called with the lock held
+ * @param room The room
+ * @param oldCount The seats taken until now
+ * @param newCount The seats taken from now on, 0 to forget the room
+ */
+void RoomManager::setTakenSeats(uint32_t room, int oldCount, int newCount) {
+    if(oldCount < this->seats) this->openRooms.erase({ oldCount, room });
+    if(newCount < this->seats && newCount > 0) this->openRooms.emplace(newCount, room);
+    this->workerSeats[this->getWorker(room)] += newCount - oldCount;
+    if(newCount == 0) {
+        this->takenSeats.erase(room);
+    } else {
+        this->takenSeats[room] = newCount;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef ROOM_MANAGER_HPP
+#define ROOM_MANAGER_HPP
+
+class RoomManager;
+
+#include "hangman_server.hpp"
+#include "../dictionary.hpp"
+#include "../worker.hpp"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define ROOM_NONE 0                 // No room, the identifiers of the rooms start above it
+#define ROOM_DEFAULT_SEATS 32
+
+class RoomManager {
+    protected:
+    mutex lock;                                 // The manager is shared by all the game threads
+    int workerCount;
+    int seats;                                  // Maximum number of the players in a room
+    uint32_t sequence;                          // Counter of the created rooms
+    map<uint32_t, int> takenSeats;              // The seats taken in each room, the rooms without any are forgotten
+    set<pair<int, uint32_t>> openRooms;         // The rooms with a free seat, by the number of the taken seats
+    vector<int> workerSeats;                    // The seats taken in the rooms of each game thread
+
+    Dictionary* dictionary;
+    int category;
+    int difficulty;
+    uint64_t guessCooldownMs;
+    uint64_t seed;                              // Seed of the phrases in all the rooms
+
+    public:
+    RoomManager(int workerCount, int seats);
+
+    void useDictionary(Dictionary* dictionary, int category, int difficulty);
+    void setGuessCooldown(uint64_t cooldownMs);
+    void setSeed(uint64_t seed);
+    uint64_t getSeed() const;
+    int getWorker(uint32_t room) const;
+
+    uint32_t createRoom();
+    uint32_t findRoom();
+    bool reserveSeat(uint32_t room);
+    void releaseSeat(uint32_t room);
+    string list();
+
+    HangmanServer* openRoom(uint32_t room, Worker* worker);
+
+    protected:
+    void setTakenSeats(uint32_t room, int oldCount, int newCount);
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "scoreboard.hpp"
+
+#include "hangman_player.hpp"
+#include "message.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_set>
+
+/**
+ * Creates the scoreboard of the players
+ * @param players The registry the rows are read from
+ */
+Scoreboard::Scoreboard(const PlayerRegistry* players) {
+    this->players = players;
+    this->version = 0;
+    this->oldestVersion = 0;
+    this->tableFrame = nullptr;
+    this->tableVersion = 0;
+    this->snapshotFrame = nullptr;
+    this->snapshotVersion = 0;
+    this->changesFrame = nullptr;
+    this->changesSince = 0;
+    this->changesVersion = 0;
+    this->rankingFrame = nullptr;
+    this->rankingFirst = 0;
+    this->rankingCount = 0;
+    this->rankingVersion = 0;
+}
+
+/**
+ * Releases the cached frames
+ */
+Scoreboard::~Scoreboard() {
+    for(Frame* frame : {this->tableFrame, this->snapshotFrame, this->changesFrame, this->rankingFrame}) {
+        if(frame != nullptr) frameRelease(frame);
+    }
+}
+
+/**
+ * Records that the player has joined or the player's score or fails have changed
+ * @param id ID of the player
+ */
+void Scoreboard::onChange(uint32_t id) {
+    this->leaderboard.update(id, this->players->getScore(id), this->players->getFails(id));
+    this->version++;
+    if(this->rowVersions.size() <= id) {
+        this->rowVersions.resize(id + 1, 0);
+    }
+    this->rowVersions[id] = this->version;
+    this->changes.push_back(ScoreboardChange { this->version, id, "" });
+
+    if(this->changes.size() > SCOREBOARD_MAX_CHANGES) {
+        // Forget the older half of the changes at once
+        this->changes.erase(this->changes.begin(), this->changes.begin() + SCOREBOARD_MAX_CHANGES / 2);
+        this->oldestVersion = this->changes.front().version - 1;
+    }
+}
+
+/**
+ * Records that the player is leaving. Has to be called while the player is still in the registry
+ * @param id ID of the player
+ */
+void Scoreboard::onRemove(uint32_t id) {
+    this->onChange(id);
+    this->changes.back().removedName = this->players->get(id)->getName();
+    this->leaderboard.remove(id);
+}
+
+/**
+ * Returns the current version of the scoreboard
+ */
+uint64_t Scoreboard::getVersion() const {
+    return this->version;
+}
+
+/**
+ * Answers the scoreboard request. The request is one of:
+ * empty - the whole table, sorted by name;
+ * a version number - the changes since that version;
+ * "top K" - K best players;
+ * "page P K" - the P-th page (counted from 1) of K players;
+ * "around K" - K players around the requesting player.
+ * Unknown requests get the whole table
+ * @param request The content of the request
+ * @param id ID of the requesting player or PLAYER_ID_NONE if the player hasn't joined
+ * @return The frame, owned by the scoreboard
+ */
+Frame* Scoreboard::getResponse(const string& request, uint32_t id) {
+    unsigned long long first = 0;
+    unsigned long long count = 0;
+    int consumed = 0;
+    const char* text = request.c_str();
+
+    if(sscanf(text, "%llu%n", &first, &consumed) == 1 && text[consumed] == '\0') {
+        return this->getChangesFrame(first);
+    }
+    if(sscanf(text, "top %llu%n", &count, &consumed) == 1 && text[consumed] == '\0') {
+        return this->getRankingFrame(0, count);
+    }
+    if(sscanf(text, "page %llu %llu%n", &first, &count, &consumed) == 2 && text[consumed] == '\0' && first > 0) {
+        // A page past the end is empty anyway, clamping it keeps the multiplication from overflowing
+        count = min(count, (unsigned long long)SCOREBOARD_MAX_RANKING_ROWS);
+        if(count > 0) {
+            unsigned long long pages = (this->leaderboard.getCount() + count - 1) / count;
+            first = min(first, pages + 1);
+        }
+        return this->getRankingFrame(count > 0 ? (first - 1) * count : 0, count);
+    }
+    if(sscanf(text, "around %llu%n", &count, &consumed) == 1 && text[consumed] == '\0') {
+        // The requesting player is in the middle of the page
+        size_t rank = id == PLAYER_ID_NONE ? 0 : this->leaderboard.getRank(id);
+        count = min(count, (unsigned long long)SCOREBOARD_MAX_RANKING_ROWS);
+        return this->getRankingFrame(rank > count / 2 ? rank - count / 2 : 0, count);
+    }
+    return this->getTableFrame();
+}
+
+/**
+ * Returns the response with the whole table, sorted by the players' names
+ * @return The frame, owned by the scoreboard
+ */
+Frame* Scoreboard::getTableFrame() {
+    if(this->tableFrame == nullptr || this->tableVersion != this->version) {
+        this->replaceFrame(this->tableFrame, this->formatTable());
+        this->tableVersion = this->version;
+    }
+    return this->tableFrame;
+}
+
+/**
+ * Returns the response with the rows changed since the version, along with the names of the players that have left.
+ * If the changes since that version aren't known any more, the response contains the whole table
+ * @param since The version the client already has
+ * @return The frame, owned by the scoreboard
+ */
+Frame* Scoreboard::getChangesFrame(uint64_t since) {
+    string header = "{\"version\": " + to_string(this->version);
+
+    if(since < this->oldestVersion || since > this->version) {
+        if(this->snapshotFrame == nullptr || this->snapshotVersion != this->version) {
+            // The table is copied from its own frame, so it's sorted only once per version
+            Frame* table = this->getTableFrame();
+            string content = header + ", \"full\": 1, \"players\": "
+                    + string(frameGetPayload(table) + 1, frameGetLength(table) - FRAME_LENGTH_SIZE - 1)
+                    + ", \"removed\": []}";
+            this->replaceFrame(this->snapshotFrame, content);
+            this->snapshotVersion = this->version;
+        }
+        return this->snapshotFrame;
+    }
+
+    // Most clients poll in step, so they ask for the changes since the same version
+    if(this->changesFrame != nullptr && this->changesSince == since && this->changesVersion == this->version) {
+        return this->changesFrame;
+    }
+
+    auto first = upper_bound(this->changes.begin(), this->changes.end(), since,
+            [](uint64_t version, const ScoreboardChange& change){ return version < change.version; });
+    string rows;
+    string removed;
+    unordered_set<string> removedNames;
+    for(auto change = first; change != this->changes.end(); change++) {
+        if(!change->removedName.empty()) {
+            // A player that has rejoined since is listed with the changed rows
+            if(this->players->find(change->removedName) != PLAYER_ID_NONE) continue;
+            if(!removedNames.insert(change->removedName).second) continue;
+            removed += (removed.empty() ? "\"" : ", \"") + change->removedName + "\"";
+        } else if(this->rowVersions[change->id] == change->version) {
+            // Only the last change of the row is sent
+            rows += (rows.empty() ? "" : ", ") + this->formatRow(change->id);
+        }
+    }
+
+    this->replaceFrame(this->changesFrame, header + ", \"full\": 0, \"players\": [" + rows + "], \"removed\": [" + removed + "]}");
+    this->changesSince = since;
+    this->changesVersion = this->version;
+    return this->changesFrame;
+}
+
+/**
+ * Returns the response with the players at the consecutive ranks, from the best.
+ * The same response is shared as long as the scoreboard doesn't change
+ * @param first The first rank, counted from 0
+ * @param count Number of rows, at most SCOREBOARD_MAX_RANKING_ROWS
+ * @return The frame, owned by the scoreboard
+ */
+Frame* Scoreboard::getRankingFrame(size_t first, size_t count) {
+    count = min(count, (size_t)SCOREBOARD_MAX_RANKING_ROWS);
+    if(this->rankingFrame != nullptr && this->rankingVersion == this->version
+            && this->rankingFirst == first && this->rankingCount == count) {
+        return this->rankingFrame;
+    }
+
+    string rows;
+    size_t rank = first;
+    for(uint32_t id : this->leaderboard.getRange(first, count)) {
+        rows += (rows.empty() ? "{\"rank\": " : ", {\"rank\": ") + to_string(++rank) + ", " + this->formatRow(id).substr(1);
+    }
+    this->replaceFrame(this->rankingFrame, "{\"version\": " + to_string(this->version)
+            + ", \"total\": " + to_string(this->leaderboard.getCount())
+            + ", \"players\": [" + rows + "]}");
+    this->rankingFirst = first;
+    this->rankingCount = count;
+    this->rankingVersion = this->version;
+    return this->rankingFrame;
+}
+
+/**
+ * Serializes a row of the scoreboard
+ * @param id ID of the player
+ */
+string Scoreboard::formatRow(uint32_t id) const {
+    return "{\"name\": \"" + this->players->get(id)->getName() + "\","
+            + "\"score\": " + to_string(this->players->getScore(id)) + ","
+            + "\"fails\": " + to_string(this->players->getFails(id)) + "}";
+}
+
+/**
+ * Serializes the whole table, sorted by the players' names
+ */
+string Scoreboard::formatTable() const {
+    vector<uint32_t> ids = this->players->getIds();
+    sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b){
+        return this->players->get(a)->getName() < this->players->get(b)->getName();
+    });
+
+    string table = "[";
+    for(size_t i = 0; i < ids.size(); i++) {
+        if(i > 0) table += ", ";
+        table += this->formatRow(ids[i]);
+    }
+    return table + "]";
+}
+
+/**
+ * Replaces the cached frame with a new scoreboard response.
+ * The clients that are still sending the old frame keep their references
+ * @param frame The cached frame
+ * @param content The content of the response
+ */
+void Scoreboard::replaceFrame(Frame*& frame, const string& content) {
+    if(frame != nullptr) frameRelease(frame);
+    frame = Message(MDIR_RESPONSE | MTYPE_SCORE, content).encode();
+}
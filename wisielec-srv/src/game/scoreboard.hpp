@@ -0,0 +1,70 @@
+#ifndef SCOREBOARD_HPP
+#define SCOREBOARD_HPP
+
+#include "leaderboard.hpp"
+#include "player_registry.hpp"
+#include "../frame.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define SCOREBOARD_MAX_CHANGES 4096     // Number of remembered changes, older versions get the whole table
+#define SCOREBOARD_MAX_RANKING_ROWS 100 // Number of rows of a single ranking response
+
+/**
+ * A change of a single row of the scoreboard
+ */
+struct ScoreboardChange {
+    uint64_t version;       // The scoreboard version the change created
+    uint32_t id;            // ID of the player
+    string removedName;     // Name of the player that has left, empty if the row was added or updated
+};
+
+/**
+ * The scoreboard responses, kept up to date as the scores change. Every change of a row creates a new version.
+ * The responses are serialized only once per version and shared by all the clients that ask for them
+ */
+class Scoreboard {
+    protected:
+    const PlayerRegistry* players;
+    Leaderboard leaderboard;
+    uint64_t version;
+    uint64_t oldestVersion;                 // The oldest version the changes are known since
+    vector<uint64_t> rowVersions;           // Version of the last change of each row, indexed by the player ID
+    vector<ScoreboardChange> changes;       // Sorted by version
+
+    Frame* tableFrame;                      // The whole table, sorted by name
+    uint64_t tableVersion;
+    Frame* snapshotFrame;                   // The whole table with its version
+    uint64_t snapshotVersion;
+    Frame* changesFrame;                    // The changes since changesSince
+    uint64_t changesSince;
+    uint64_t changesVersion;
+    Frame* rankingFrame;                    // The ranks from rankingFirst
+    size_t rankingFirst;
+    size_t rankingCount;
+    uint64_t rankingVersion;
+
+    public:
+    Scoreboard(const PlayerRegistry* players);
+    ~Scoreboard();
+
+    void onChange(uint32_t id);
+    void onRemove(uint32_t id);
+
+    uint64_t getVersion() const;
+    Frame* getResponse(const string& request, uint32_t id);
+    Frame* getTableFrame();
+    Frame* getChangesFrame(uint64_t since);
+    Frame* getRankingFrame(size_t first, size_t count);
+
+    protected:
+    string formatRow(uint32_t id) const;
+    string formatTable() const;
+    void replaceFrame(Frame*& frame, const string& content);
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "gateway.hpp"
+
+#include "backplane.hpp"
+#include "channel.hpp"
+#include "server.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+void gatewayStopThread(Channel* control);
+
+/**
+ * Structure connecting the threads that serve the connections (the sources) with the threads that handle
+ * their requests (the sinks). Every source has a channel to every sink and one back, so every channel
+ * has a single producer and a single consumer. The main thread only starts and stops the others,
+ * through their control channels.
+ * The sources are the I/O threads, followed by the sequencer if the process hosts the backplane.
+ * The sinks are the game threads, or the uplink to the sequencer if the process is a node
+ */
+struct Gateway {
+    Epoll* epoll;                   // The main thread's epoll instance
+    int threadCount;
+    IoThread** threads;
+    Sequencer* sequencer;           // nullptr unless the process hosts the backplane
+    int workerCount;
+    Worker** workers;
+    Uplink* uplink;                 // nullptr unless the process is a node
+    int sourceCount;
+    int sinkCount;
+    Channel** toSinks;              // From source i to sink j at i * sinkCount + j
+    Channel** fromSinks;            // From sink j to source i at i * sinkCount + j
+    Channel** controls;             // From the main thread to the sources, followed by the sinks
+};
+
+/**
+ * Creates the threads with the channels between them, but doesn't start them
+ * @param epoll The main thread's epoll instance
+ * @param threadCount Number of the I/O threads, at most SERVER_MAX_THREADS, one less for the sequencer
+ * @param workerCount Number of the game threads, ignored by a node
+ * @param maxEvents Maximum number of events handled by a thread after a single wakeup
+ * @param rooms The room manager shared by the game threads
+ * @param backplaneRole One of the BACKPLANE_ constants
+ * @param backplanePath Path of the backplane's Unix domain socket, unless the process is standalone
+ * @return The gateway
+ */
+Gateway* gatewayCreate(Epoll* epoll, int threadCount, int workerCount, int maxEvents, RoomManager* rooms,
+                       int backplaneRole, const char* backplanePath){
+    if(backplaneRole == BACKPLANE_NODE){
+        workerCount = 0;
+    }
+    int sourceCount = threadCount + (backplaneRole == BACKPLANE_SEQUENCER ? 1 : 0);
+    int sinkCount = backplaneRole == BACKPLANE_NODE ? 1 : workerCount;
+    if(threadCount < 1 || sourceCount > SERVER_MAX_THREADS){
+        throw runtime_error("Invalid number of I/O threads.");
+    }
+    if(sinkCount < 1){
+        throw runtime_error("Invalid number of game threads.");
+    }
+    auto gateway = new Gateway();
+    gateway->epoll = epoll;
+    gateway->threadCount = threadCount;
+    gateway->threads = new IoThread*[threadCount];
+    gateway->sequencer = nullptr;
+    gateway->workerCount = workerCount;
+    gateway->workers = new Worker*[workerCount];
+    gateway->uplink = nullptr;
+    gateway->sourceCount = sourceCount;
+    gateway->sinkCount = sinkCount;
+    gateway->toSinks = new Channel*[sourceCount * sinkCount];
+    gateway->fromSinks = new Channel*[sourceCount * sinkCount];
+    gateway->controls = new Channel*[sourceCount + sinkCount];
+    for(int i = 0; i < sourceCount * sinkCount; i++){
+        gateway->toSinks[i] = channelCreate();
+        gateway->fromSinks[i] = channelCreate();
+    }
+    for(int i = 0; i < sourceCount + sinkCount; i++){
+        gateway->controls[i] = channelCreate();
+    }
+
+    // The channels of a source are consecutive, the sinks get them gathered by source
+    for(int i = 0; i < threadCount; i++){
+        gateway->threads[i] = ioThreadCreate(i, maxEvents, sinkCount, gateway->toSinks + i * sinkCount,
+                gateway->fromSinks + i * sinkCount, gateway->controls[i]);
+    }
+    if(backplaneRole == BACKPLANE_SEQUENCER){
+        gateway->sequencer = sequencerCreate(threadCount, maxEvents, backplanePath, sinkCount,
+                gateway->toSinks + threadCount * sinkCount, gateway->fromSinks + threadCount * sinkCount,
+                gateway->controls[threadCount]);
+    }
+    for(int j = 0; j < sinkCount; j++){
+        vector<Channel*> fromSources(sourceCount);
+        vector<Channel*> toSources(sourceCount);
+        for(int i = 0; i < sourceCount; i++){
+            fromSources[i] = gateway->toSinks[i * sinkCount + j];
+            toSources[i] = gateway->fromSinks[i * sinkCount + j];
+        }
+        Channel* control = gateway->controls[sourceCount + j];
+        if(backplaneRole == BACKPLANE_NODE){
+            gateway->uplink = uplinkCreate(maxEvents, backplanePath, sourceCount, fromSources.data(), toSources.data(), control);
+        }else{
+            gateway->workers[j] = workerCreate(j, maxEvents, rooms, sourceCount, fromSources.data(), toSources.data(), control);
+        }
+    }
+    return gateway;
+}
+
+/**
+ * Starts the sinks and then the sources, which start accepting the connections
+ * @param gateway The gateway
+ * @param port The port on which to listen
+ */
+void gatewayStart(Gateway* gateway, short port){
+    for(int i = 0; i < gateway->sourceCount + gateway->sinkCount; i++){
+        channelAttachProducer(gateway->controls[i], gateway->epoll);
+    }
+    for(int j = 0; j < gateway->workerCount; j++){
+        workerStart(gateway->workers[j]);
+    }
+    if(gateway->uplink != nullptr){
+        uplinkStart(gateway->uplink);
+    }
+    if(gateway->sequencer != nullptr){
+        sequencerStart(gateway->sequencer);
+    }
+    for(int i = 0; i < gateway->threadCount; i++){
+        ioThreadStart(gateway->threads[i], port);
+    }
+}
+
+/**
+ * Stops the sources and waits until they close their connections, then stops the sinks.
+ * Called after the main thread's event loop finishes
+ * @param gateway The gateway
+ */
+void gatewayStop(Gateway* gateway){
+    for(int i = 0; i < gateway->sourceCount; i++){
+        gatewayStopThread(gateway->controls[i]);
+    }
+    for(int i = 0; i < gateway->threadCount; i++){
+        ioThreadJoin(gateway->threads[i]);
+    }
+    if(gateway->sequencer != nullptr){
+        sequencerJoin(gateway->sequencer);
+    }
+    for(int j = 0; j < gateway->sinkCount; j++){
+        gatewayStopThread(gateway->controls[gateway->sourceCount + j]);
+    }
+    for(int j = 0; j < gateway->workerCount; j++){
+        workerJoin(gateway->workers[j]);
+    }
+    if(gateway->uplink != nullptr){
+        uplinkJoin(gateway->uplink);
+    }
+}
+
+/**
+ * Releases the gateway with the stopped threads and all the channels
+ * @param gateway The gateway
+ */
+void gatewayRelease(Gateway* gateway){
+    for(int i = 0; i < gateway->threadCount; i++){
+        ioThreadRelease(gateway->threads[i]);
+    }
+    if(gateway->sequencer != nullptr){
+        sequencerRelease(gateway->sequencer);
+    }
+    for(int j = 0; j < gateway->workerCount; j++){
+        workerRelease(gateway->workers[j]);
+    }
+    if(gateway->uplink != nullptr){
+        uplinkRelease(gateway->uplink);
+    }
+    for(int i = 0; i < gateway->sourceCount * gateway->sinkCount; i++){
+        channelRelease(gateway->toSinks[i]);
+        channelRelease(gateway->fromSinks[i]);
+    }
+    for(int i = 0; i < gateway->sourceCount + gateway->sinkCount; i++){
+        channelDetachProducer(gateway->controls[i]);
+        channelRelease(gateway->controls[i]);
+    }
+    delete[] gateway->threads;
+    delete[] gateway->workers;
+    delete[] gateway->toSinks;
+    delete[] gateway->fromSinks;
+    delete[] gateway->controls;
+    delete gateway;
+}
+
+/**
+ * Returns the number of the I/O threads
+ * @param gateway The gateway
+ */
+int gatewayGetThreadCount(Gateway* gateway){
+    return gateway->threadCount;
+}
+
+/**
+ * Returns the I/O thread
+ * @param gateway The gateway
+ * @param index Index of the thread
+ */
+IoThread* gatewayGetThread(Gateway* gateway, int index){
+    return gateway->threads[index];
+}
+
+/**
+ * Returns the number of the game threads, 0 if the process is a node
+ * @param gateway The gateway
+ */
+int gatewayGetWorkerCount(Gateway* gateway){
+    return gateway->workerCount;
+}
+
+/**
+ * Returns the game thread
+ * @param gateway The gateway
+ * @param index Index of the thread
+ */
+Worker* gatewayGetWorker(Gateway* gateway, int index){
+    return gateway->workers[index];
+}
+
+/**
+ * Returns the sequencer, nullptr unless the process hosts the backplane
+ * @param gateway The gateway
+ */
+Sequencer* gatewayGetSequencer(Gateway* gateway){
+    return gateway->sequencer;
+}
+
+/**
+ * Returns the uplink to the sequencer, nullptr unless the process is a node
+ * @param gateway The gateway
+ */
+Uplink* gatewayGetUplink(Gateway* gateway){
+    return gateway->uplink;
+}
+
+/**
+ * Tells the thread to finish. The main thread's event loop doesn't run any more, so the channel is flushed right away
+ * @param control The thread's control channel
+ */
+void gatewayStopThread(Channel* control){
+    channelPush(control, CHANNEL_STOP, 0, 0, nullptr);
+    channelFlush(control);
+}
@@ -0,0 +1,25 @@
+#ifndef GATEWAY_HPP
+#define GATEWAY_HPP
+
+struct Gateway;
+
+#include "epoll.hpp"
+#include "io_thread.hpp"
+#include "sequencer.hpp"
+#include "uplink.hpp"
+#include "worker.hpp"
+
+Gateway* gatewayCreate(Epoll* epoll, int threadCount, int workerCount, int maxEvents, RoomManager* rooms,
+                       int backplaneRole, const char* backplanePath);
+void gatewayStart(Gateway* gateway, short port);
+void gatewayStop(Gateway* gateway);
+void gatewayRelease(Gateway* gateway);
+
+int gatewayGetThreadCount(Gateway* gateway);
+IoThread* gatewayGetThread(Gateway* gateway, int index);
+int gatewayGetWorkerCount(Gateway* gateway);
+Worker* gatewayGetWorker(Gateway* gateway, int index);
+Sequencer* gatewayGetSequencer(Gateway* gateway);
+Uplink* gatewayGetUplink(Gateway* gateway);
+
+#endif
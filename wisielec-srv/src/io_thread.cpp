@@ -0,0 +1,183 @@
+#include "io_thread.hpp"
+
+#include "log.hpp"
+#include "timer.hpp"
+
+#include <thread>
+
+using namespace std;
+
+void ioThreadRun(IoThread* thread);
+void ioThreadOnReceive(Channel* channel);
+void ioThreadOnControl(Channel* channel);
+
+/**
+ * Structure representing an I/O thread. It runs its own event loop with its own listening socket,
+ * reads and frames the requests of the clients it has accepted and writes the frames the game threads send back.
+ * All the objects of the thread are used only by the thread, once it has started
+ */
+struct IoThread {
+    int index;
+    Epoll* epoll;
+    TimerWheel* timers;
+    Server* server;
+    int workerCount;
+    Channel** toWorkers;        // Requests for the game threads, by their indices. The thread is the producer
+    Channel** fromWorkers;      // Frames to send, by the indices of the game threads. The thread is the consumer
+    Channel* control;           // Messages from the main thread, the thread is the consumer
+    thread* runner;
+    bool isRunning;
+    EpollStats stats;           // The event loop statistics, copied when the loop finishes
+};
+
+/**
+ * Creates the I/O thread with its event loop, but doesn't start it
+ * @param index Index of the thread, less than SERVER_MAX_THREADS
+ * @param maxEvents Maximum number of events handled after a single wakeup
+ * @param workerCount Number of the game threads
+ * @param toWorkers The channels to the game threads, the array has to outlive the thread
+ * @param fromWorkers The channels from the game threads, the array has to outlive the thread
+ * @param control The channel from the main thread
+ * @return The thread
+ */
+IoThread* ioThreadCreate(int index, int maxEvents, int workerCount, Channel** toWorkers, Channel** fromWorkers,
+                         Channel* control){
+    auto ioThread = new IoThread();
+    ioThread->index = index;
+    ioThread->epoll = epollCreate(maxEvents);
+    ioThread->timers = timerWheelCreate(ioThread->epoll);
+    ioThread->server = serverCreate(index, toWorkers, workerCount);
+    ioThread->workerCount = workerCount;
+    ioThread->toWorkers = toWorkers;
+    ioThread->fromWorkers = fromWorkers;
+    ioThread->control = control;
+    ioThread->runner = nullptr;
+    ioThread->isRunning = true;
+    ioThread->stats = {};
+    return ioThread;
+}
+
+/**
+ * Starts listening on the port and runs the event loop on a new thread.
+ * The server has to be configured before
+ * @param thread The I/O thread
+ * @param port The port on which to listen, shared by all the I/O threads
+ */
+void ioThreadStart(IoThread* thread, short port){
+    serverStart(thread->server, port, thread->epoll, thread->timers);
+    for(int i = 0; i < thread->workerCount; i++){
+        channelAttachProducer(thread->toWorkers[i], thread->epoll);
+        channelAttachConsumer(thread->fromWorkers[i], thread->epoll, ioThreadOnReceive, thread);
+    }
+    channelAttachConsumer(thread->control, thread->epoll, ioThreadOnControl, thread);
+    thread->runner = new std::thread(ioThreadRun, thread);
+}
+
+/**
+ * Waits until the thread finishes, after the main thread has sent it CHANNEL_STOP
+ * @param thread The I/O thread
+ */
+void ioThreadJoin(IoThread* thread){
+    if(thread->runner == nullptr) return;
+    thread->runner->join();
+    delete thread->runner;
+    thread->runner = nullptr;
+}
+
+/**
+ * Releases the thread that has finished. The channels are left to their owner
+ * @param thread The I/O thread
+ */
+void ioThreadRelease(IoThread* thread){
+    delete thread;
+}
+
+/**
+ * Returns the server of the thread, to be configured before the thread starts
+ * @param thread The I/O thread
+ */
+Server* ioThreadGetServer(IoThread* thread){
+    return thread->server;
+}
+
+/**
+ * Returns the event loop statistics of the thread that has finished
+ * @param thread The I/O thread
+ */
+const EpollStats* ioThreadGetStats(IoThread* thread){
+    return &thread->stats;
+}
+
+/**
+ * Runs the event loop until the main thread stops it, then closes the clients and releases the loop
+ * @param thread The I/O thread
+ */
+void ioThreadRun(IoThread* thread){
+    LOG_INFO(LOG_SOURCE_MAIN, "I/O thread {} started.", thread->index);
+    while(thread->isRunning){
+        epollWaitForEvent(thread->epoll);
+    }
+
+    // The game threads don't receive the disconnections any more, the channels release them
+    serverClose(thread->server);
+    for(int i = 0; i < thread->workerCount; i++){
+        channelDetachProducer(thread->toWorkers[i]);
+        channelDetachConsumer(thread->fromWorkers[i]);
+    }
+    channelDetachConsumer(thread->control);
+    timerWheelRelease(thread->timers);
+    thread->stats = *epollGetStats(thread->epoll);
+    epollRelease(thread->epoll);
+    LOG_INFO(LOG_SOURCE_MAIN, "I/O thread {} finished.", thread->index);
+}
+
+/**
+ * Handles the messages from a game thread
+ * @param channel The channel from the game thread
+ */
+void ioThreadOnReceive(Channel* channel){
+    auto thread = (IoThread*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        switch(message->kind){
+            case CHANNEL_SEND:
+                serverSend(thread->server, message->connection, message->frame);
+                break;
+            case CHANNEL_BROADCAST:
+                serverBroadcast(thread->server, message->room, message->frame);
+                break;
+            case CHANNEL_ADD_MEMBER:
+                serverAddMember(thread->server, message->connection, message->room);
+                break;
+            case CHANNEL_REMOVE_MEMBER:
+                serverRemoveMember(thread->server, message->connection);
+                break;
+            case CHANNEL_MOVE:
+                // The server takes the frame over
+                serverMove(thread->server, message->connection, message->room, message->frame);
+                message->frame = nullptr;
+                break;
+            case CHANNEL_SYNC:
+                serverOnSync(thread->server, message->connection);
+                break;
+        }
+        if(message->frame != nullptr) frameRelease(message->frame);
+        channelPop(channel);
+    }
+}
+
+/**
+ * Handles the messages from the main thread
+ * @param channel The control channel
+ */
+void ioThreadOnControl(Channel* channel){
+    auto thread = (IoThread*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        if(message->kind == CHANNEL_STOP){
+            // The loop finishes after the current wakeup
+            thread->isRunning = false;
+        }
+        channelPop(channel);
+    }
+}
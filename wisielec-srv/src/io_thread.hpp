@@ -0,0 +1,19 @@
+#ifndef IO_THREAD_HPP
+#define IO_THREAD_HPP
+
+struct IoThread;
+
+#include "channel.hpp"
+#include "epoll.hpp"
+#include "server.hpp"
+
+IoThread* ioThreadCreate(int index, int maxEvents, int workerCount, Channel** toWorkers, Channel** fromWorkers,
+                         Channel* control);
+void ioThreadStart(IoThread* thread, short port);
+void ioThreadJoin(IoThread* thread);
+void ioThreadRelease(IoThread* thread);
+
+Server* ioThreadGetServer(IoThread* thread);
+const EpollStats* ioThreadGetStats(IoThread* thread);
+
+#endif
@@ -0,0 +1,319 @@
+#include "journal.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define JOURNAL_MAGIC "WSLJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 16          // Magic, version, seed
+#define JOURNAL_FLUSH_SIZE 65536        // The writer is woken up once this many bytes wait
+#define JOURNAL_FLUSH_INTERVAL_MS 1000  // and writes whatever waits at least this often anyway
+#define JOURNAL_READ_SIZE 65536
+
+void journalRun(Journal* journal);
+void journalWrite(Journal* journal, const string& batch);
+void journalWriteVarint(string& output, uint64_t value);
+bool journalReadVarint(JournalReader* reader, uint64_t* value);
+bool journalFill(JournalReader* reader, size_t length);
+uint64_t journalNow();
+
+/**
+ * Structure representing a journal being captured: every frame received by the server, with the connection
+ * that sent it and the time it was received, so that the traffic can be replayed later.
+ * The header holds the magic, the format version and the seed of the rooms' phrases, both big-endian.
+ * Every record starts with its kind, followed by varints: the nanoseconds since the previous record
+ * and the connection, and for the frames the length followed by the content.
+ * The I/O threads share the journal, so appending takes a lock, and the time is taken under it
+ * to keep the records in order. Nothing is written under the lock: the writer thread takes the whole batch
+ * of the pending records and writes it to the file while the I/O threads append the next one
+ */
+struct Journal {
+    int fd;                         // Used only by the writer thread once it has started
+    mutex lock;
+    condition_variable wakeup;      // Wakes the writer thread up before its interval passes
+    string pending;                 // The records that haven't been taken by the writer thread yet
+    uint64_t startTime;             // Monotonic time of the capture's start in nanoseconds
+    uint64_t lastTime;              // Time of the latest record
+    bool isRunning;
+    thread* writer;
+};
+
+/**
+ * Structure reading a journal from the start
+ */
+struct JournalReader {
+    int fd;
+    uint64_t seed;
+    uint64_t time;                  // Time of the latest record read
+    char* input;
+    size_t inputOffset;             // The bytes before it have been parsed
+    size_t inputLength;
+};
+
+/**
+ * Creates the journal, replacing the file if it exists
+ * @param path Path of the file
+ * @param seed Seed of the rooms' phrases, replaying gives the same phrases with the same seed
+ * @return The journal
+ */
+Journal* journalCreate(const char* path, uint64_t seed){
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1){
+        throw runtime_error(string("Failed to create the journal: ") + path);
+    }
+    auto journal = new Journal();
+    journal->fd = fd;
+    journal->startTime = journalNow();
+    journal->lastTime = journal->startTime;
+    journal->pending.append(JOURNAL_MAGIC, 4);
+    for(int shift = 24; shift >= 0; shift -= 8){
+        journal->pending += (char)(JOURNAL_VERSION >> shift);
+    }
+    for(int shift = 56; shift >= 0; shift -= 8){
+        journal->pending += (char)(seed >> shift);
+    }
+    journal->isRunning = true;
+    journal->writer = new thread(journalRun, journal);
+    return journal;
+}
+
+/**
+ * Writes the remaining records and closes the journal. Nothing may append to it any more
+ * @param journal The journal
+ */
+void journalClose(Journal* journal){
+    {
+        lock_guard<mutex> guard(journal->lock);
+        journal->isRunning = false;
+    }
+    journal->wakeup.notify_one();
+    journal->writer->join();
+    delete journal->writer;
+    if(journal->fd != -1){
+        close(journal->fd);
+    }
+    delete journal;
+}
+
+/**
+ * Appends a record, stamped with the current time. The records are written in batches by the writer thread,
+ * at most a second late
+ * @param journal The journal
+ * @param kind One of the JOURNAL_ constants
+ * @param connection The connection
+ * @param payload Content of the frame, nullptr unless the record is a frame
+ * @param length Length of the content
+ */
+void journalAppend(Journal* journal, int kind, uint64_t connection, const char* payload, size_t length){
+    lock_guard<mutex> guard(journal->lock);
+    uint64_t now = journalNow();
+    journal->pending += (char)kind;
+    journalWriteVarint(journal->pending, now - journal->lastTime);
+    journalWriteVarint(journal->pending, connection);
+    if(kind == JOURNAL_FRAME){
+        journalWriteVarint(journal->pending, length);
+        journal->pending.append(payload, length);
+    }
+    journal->lastTime = now;
+    if(journal->pending.length() >= JOURNAL_FLUSH_SIZE){
+        journal->wakeup.notify_one();
+    }
+}
+
+/**
+ * The main loop of the writer thread. Every second, or sooner when enough records wait, takes the pending records
+ * and writes them. The records appended until the journal is closed are written before the thread finishes
+ * @param journal The journal
+ */
+void journalRun(Journal* journal){
+    string batch;
+    unique_lock<mutex> guard(journal->lock);
+    while(true){
+        bool isRunning = journal->isRunning;
+        // The batch's memory is reused by the next records
+        batch.clear();
+        batch.swap(journal->pending);
+        guard.unlock();
+        journalWrite(journal, batch);
+        guard.lock();
+        if(!isRunning) return;
+        journal->wakeup.wait_for(guard, chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS), [journal]{
+            return !journal->isRunning || journal->pending.length() >= JOURNAL_FLUSH_SIZE;
+        });
+    }
+}
+
+/**
+ * Writes the batch of the records. If writing fails, the capture stops and the records are dropped from then on
+ * @param journal The journal
+ * @param batch The records
+ */
+void journalWrite(Journal* journal, const string& batch){
+    size_t offset = 0;
+    while(journal->fd != -1 && offset < batch.length()){
+        ssize_t written = write(journal->fd, batch.data() + offset, batch.length() - offset);
+        if(written == -1){
+            if(errno == EINTR) continue;
+            perror("Failed to write the journal, the capture stops");
+            close(journal->fd);
+            journal->fd = -1;
+            break;
+        }
+        offset += written;
+    }
+}
+
+/**
+ * Appends the number in the LEB128 encoding: 7 bits per byte, starting from the least significant ones,
+ * the highest bit set in all the bytes but the last
+ * @param output The output
+ * @param value The number
+ */
+void journalWriteVarint(string& output, uint64_t value){
+    while(value >= 0x80){
+        output += (char)(value | 0x80);
+        value >>= 7;
+    }
+    output += (char)value;
+}
+
+/**
+ * Opens the journal for reading and reads its header
+ * @param path Path of the file
+ * @return The reader
+ */
+JournalReader* journalOpen(const char* path){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        throw runtime_error(string("Failed to open the journal: ") + path);
+    }
+    auto reader = new JournalReader();
+    reader->fd = fd;
+    reader->time = 0;
+    reader->input = new char[JOURNAL_READ_SIZE];
+    reader->inputOffset = 0;
+    reader->inputLength = 0;
+    auto header = (const uint8_t*)reader->input;
+    if(!journalFill(reader, JOURNAL_HEADER_SIZE) || memcmp(header, JOURNAL_MAGIC, 4) != 0){
+        journalReaderClose(reader);
+        throw runtime_error(string("Not a journal: ") + path);
+    }
+    uint32_t version = 0;
+    for(int i = 4; i < 8; i++){
+        version = version << 8 | header[i];
+    }
+    if(version != JOURNAL_VERSION){
+        journalReaderClose(reader);
+        throw runtime_error("Unsupported version of the journal.");
+    }
+    reader->seed = 0;
+    for(int i = 8; i < JOURNAL_HEADER_SIZE; i++){
+        reader->seed = reader->seed << 8 | header[i];
+    }
+    reader->inputOffset = JOURNAL_HEADER_SIZE;
+    return reader;
+}
+
+/**
+ * Closes the journal
+ * @param reader The reader
+ */
+void journalReaderClose(JournalReader* reader){
+    close(reader->fd);
+    delete[] reader->input;
+    delete reader;
+}
+
+/**
+ * Returns the seed of the rooms' phrases the server used during the capture
+ * @param reader The reader
+ */
+uint64_t journalReaderGetSeed(JournalReader* reader){
+    return reader->seed;
+}
+
+/**
+ * Reads the next record
+ * @param reader The reader
+ * @param record The record to fill
+ * @return False at the end of the journal. A record cut short, by a server that didn't close the journal, ends it too
+ */
+bool journalRead(JournalReader* reader, JournalRecord* record){
+    uint64_t delta;
+    uint64_t length = 0;
+    if(!journalFill(reader, 1)) return false;
+    record->kind = (uint8_t)reader->input[reader->inputOffset++];
+    if(!journalReadVarint(reader, &delta) || !journalReadVarint(reader, &record->connection)) return false;
+    if(record->kind == JOURNAL_FRAME && !journalReadVarint(reader, &length)) return false;
+
+    // A frame is never longer than the client's receive buffer, but the reader doesn't rely on it
+    record->payload.clear();
+    while(length > 0){
+        if(!journalFill(reader, 1)) return false;
+        size_t chunk = min<uint64_t>(length, reader->inputLength - reader->inputOffset);
+        record->payload.append(reader->input + reader->inputOffset, chunk);
+        reader->inputOffset += chunk;
+        length -= chunk;
+    }
+    reader->time += delta;
+    record->time = reader->time;
+    return true;
+}
+
+/**
+ * Reads a number in the LEB128 encoding
+ * @param reader The reader
+ * @param value The number
+ * @return False if the journal ends first
+ */
+bool journalReadVarint(JournalReader* reader, uint64_t* value){
+    *value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(!journalFill(reader, 1)) return false;
+        auto byte = (uint8_t)reader->input[reader->inputOffset++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Makes sure that the given number of bytes past the parsed ones is in the input, reading more of the file if needed
+ * @param reader The reader
+ * @param length Number of the bytes, at most JOURNAL_READ_SIZE
+ * @return False if the file ends first
+ */
+bool journalFill(JournalReader* reader, size_t length){
+    if(reader->inputLength - reader->inputOffset >= length) return true;
+    memmove(reader->input, reader->input + reader->inputOffset, reader->inputLength - reader->inputOffset);
+    reader->inputLength -= reader->inputOffset;
+    reader->inputOffset = 0;
+    while(reader->inputLength < length){
+        ssize_t readBytes = read(reader->fd, reader->input + reader->inputLength, JOURNAL_READ_SIZE - reader->inputLength);
+        if(readBytes == -1 && errno == EINTR) continue;
+        if(readBytes <= 0) return false;
+        reader->inputLength += readBytes;
+    }
+    return true;
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t journalNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,37 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Kinds of the records
+#define JOURNAL_CONNECT 1           // A connection has been accepted
+#define JOURNAL_FRAME 2             // A whole frame has been received, the payload holds its content
+#define JOURNAL_DISCONNECT 3        // The connection has been closed
+
+struct Journal;
+struct JournalReader;
+
+/**
+ * A single record of the journal
+ */
+struct JournalRecord {
+    int kind;                   // One of the JOURNAL_ constants
+    uint64_t time;              // Nanoseconds since the capture started
+    uint64_t connection;        // The server's identifier of the connection
+    string payload;             // Content of the frame, without the length, empty for the other kinds
+};
+
+Journal* journalCreate(const char* path, uint64_t seed);
+void journalClose(Journal* journal);
+void journalAppend(Journal* journal, int kind, uint64_t connection, const char* payload = nullptr, size_t length = 0);
+
+JournalReader* journalOpen(const char* path);
+void journalReaderClose(JournalReader* reader);
+uint64_t journalReaderGetSeed(JournalReader* reader);
+bool journalRead(JournalReader* reader, JournalRecord* record);
+
+#endif
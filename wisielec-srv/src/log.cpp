@@ -0,0 +1,261 @@
+#include "log.hpp"
+
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+#include <strings.h>
+#include <thread>
+#include <unistd.h>
+
+#define LOG_QUEUE_CAPACITY 16384     // Must be a power of two
+
+/**
+ * A slot of the record queue. The sequence number tells whether the slot is free or filled
+ */
+struct LogSlot {
+    atomic<size_t> sequence;
+    LogRecord record;
+};
+
+/**
+ * A bounded lock-free queue of records with many producers and a single consumer (the logging thread).
+ * When the queue is full, the records are dropped rather than blocking the producer
+ */
+struct LogQueue {
+    LogSlot* slots;
+    alignas(64) atomic<size_t> enqueuePosition;
+    alignas(64) size_t dequeuePosition;
+    alignas(64) atomic<uint64_t> droppedCount;
+};
+
+int logLevel = LOG_LEVEL_INFO;
+LogQueue logQueue {};
+FILE* logFile = nullptr;
+bool logUseColors = false;
+atomic<bool> logIsRunning(false);
+thread* logThread = nullptr;
+
+void logRun();
+bool logPop(LogRecord& record);
+void logFormat(const LogRecord& record);
+
+const char* logLevelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR", "NONE" };
+
+/**
+ * Starts the logging thread
+ * @param level Minimal level of the records to write
+ * @param path The file to append the records to, or nullptr for the standard output
+ */
+void logStart(int level, const char* path){
+    logSetLevel(level);
+    logFile = path != nullptr ? fopen(path, "a") : nullptr;
+    if(logFile == nullptr){
+        if(path != nullptr) perror("Failed to open the log file");
+        logFile = stdout;
+    }
+    logUseColors = isatty(fileno(logFile));
+
+    logQueue.slots = new LogSlot[LOG_QUEUE_CAPACITY];
+    for(size_t i = 0; i < LOG_QUEUE_CAPACITY; i++){
+        logQueue.slots[i].sequence.store(i, memory_order_relaxed);
+    }
+    logIsRunning = true;
+    logThread = new thread(logRun);
+}
+
+/**
+ * Stops the logging thread, after it writes all the remaining records
+ */
+void logStop(){
+    if(logThread == nullptr) return;
+    logIsRunning = false;
+    logThread->join();
+    delete logThread;
+    logThread = nullptr;
+
+    if(logFile != stdout){
+        fclose(logFile);
+    }
+    logFile = nullptr;
+}
+
+/**
+ * Sets the minimal level of the records to write. The records below it cost a single comparison
+ * @param level The level
+ */
+void logSetLevel(int level){
+    logLevel = level;
+}
+
+/**
+ * Parses the level name
+ * @param name One of: debug, info, warning, error, none
+ * @return The level or -1 if the name is unknown
+ */
+int logParseLevel(const char* name){
+    for(int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_NONE; level++){
+        if(strcasecmp(name, logLevelNames[level]) == 0) return level;
+    }
+    return -1;
+}
+
+/**
+ * Pushes the record to the queue. Doesn't block, if the queue is full the record is dropped
+ * @param record The record
+ */
+void logPush(LogRecord& record){
+    if(logQueue.slots == nullptr) return;
+    timespec ts {};
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    record.time = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    size_t position = logQueue.enqueuePosition.load(memory_order_relaxed);
+    while(true){
+        LogSlot& slot = logQueue.slots[position & (LOG_QUEUE_CAPACITY - 1)];
+        size_t sequence = slot.sequence.load(memory_order_acquire);
+        auto diff = (intptr_t)sequence - (intptr_t)position;
+        if(diff == 0){
+            // The slot is free, try to claim it
+            if(logQueue.enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)){
+                // Only the used part of the text is copied
+                memcpy((void*)&slot.record, &record, offsetof(LogRecord, text) + record.textLength);
+                slot.sequence.store(position + 1, memory_order_release);
+                return;
+            }
+        }else if(diff < 0){
+            // The queue is full
+            logQueue.droppedCount.fetch_add(1, memory_order_relaxed);
+            return;
+        }else{
+            position = logQueue.enqueuePosition.load(memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Returns the number of records dropped because the queue was full
+ */
+uint64_t logGetDroppedCount(){
+    return logQueue.droppedCount.load(memory_order_relaxed);
+}
+
+/**
+ * Adds a text argument to the record. The text is truncated if there's no more space in the record
+ * @param record The record
+ * @param text The text
+ * @param length Length of the text
+ */
+void logAddText(LogRecord& record, const char* text, size_t length){
+    if(record.argCount == LOG_MAX_ARGS) return;
+    size_t available = LOG_TEXT_CAPACITY - record.textLength;
+    if(length > available) length = available;
+
+    LogArgument& arg = record.args[record.argCount++];
+    arg.isText = true;
+    arg.textOffset = record.textLength;
+    arg.textLength = length;
+    memcpy(record.text + record.textLength, text, length);
+    record.textLength += length;
+}
+
+/**
+ * The main loop of the logging thread. Writes the records as long as the logging is running
+ */
+void logRun(){
+    LogRecord record;
+    uint64_t reportedDrops = 0;
+    while(true){
+        bool isRunning = logIsRunning;
+        int count = 0;
+        while(logPop(record)){
+            logFormat(record);
+            count++;
+        }
+
+        uint64_t drops = logGetDroppedCount();
+        if(drops != reportedDrops){
+            fprintf(logFile, "[LOG] %llu records dropped\n", (unsigned long long)(drops - reportedDrops));
+            reportedDrops = drops;
+        }
+        if(count > 0){
+            fflush(logFile);
+        }
+        if(!isRunning) return;
+        if(count == 0){
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+}
+
+/**
+ * Takes the oldest record from the queue
+ * @param record The place to copy the record to
+ * @return False if the queue is empty
+ */
+bool logPop(LogRecord& record){
+    size_t position = logQueue.dequeuePosition;
+    LogSlot& slot = logQueue.slots[position & (LOG_QUEUE_CAPACITY - 1)];
+    if(slot.sequence.load(memory_order_acquire) != position + 1) return false;
+
+    memcpy((void*)&record, &slot.record, offsetof(LogRecord, text) + slot.record.textLength);
+    slot.sequence.store(position + LOG_QUEUE_CAPACITY, memory_order_release);
+    logQueue.dequeuePosition = position + 1;
+    return true;
+}
+
+/**
+ * Writes a single argument
+ * @param record The record
+ * @param index Index of the argument
+ */
+void logFormatArgument(const LogRecord& record, int index){
+    if(index >= record.argCount) return;
+    const LogArgument& arg = record.args[index];
+    if(arg.isText){
+        fwrite(record.text + arg.textOffset, 1, arg.textLength, logFile);
+    }else{
+        fprintf(logFile, "%lld", (long long)arg.number);
+    }
+}
+
+/**
+ * Formats the record and writes it to the log file
+ * @param record The record
+ */
+void logFormat(const LogRecord& record){
+    time_t seconds = record.time / 1000;
+    tm localTime {};
+    localtime_r(&seconds, &localTime);
+    fprintf(logFile, "%02d:%02d:%02d.%03d %-7s ", localTime.tm_hour, localTime.tm_min, localTime.tm_sec,
+            (int)(record.time % 1000), logLevelNames[record.level]);
+
+    // The prefix may take the first argument
+    int argIndex = 0;
+    const char* color = nullptr;
+    const char* name = nullptr;
+    switch(record.source){
+        case LOG_SOURCE_SERVER: color = "\x1b[1;35m"; name = "SERVER: "; break;
+        case LOG_SOURCE_CLIENT: color = "\x1b[1;36m"; name = "CLIENT: "; break;
+        case LOG_SOURCE_PLAYER: color = "\x1b[1;32m"; name = "PLAYER: "; break;
+        case LOG_SOURCE_ROOM: color = "\x1b[1;34m"; name = "ROOM: "; break;
+    }
+    if(name != nullptr){
+        if(logUseColors) fputs(color, logFile);
+        fprintf(logFile, "[%s", name);
+        logFormatArgument(record, argIndex++);
+        fputs(logUseColors ? "]\x1b[0m " : "] ", logFile);
+    }
+
+    for(const char* c = record.format; *c != '\0'; c++){
+        if(c[0] == '{' && c[1] == '}'){
+            logFormatArgument(record, argIndex++);
+            c++;
+        }else{
+            fputc(*c, logFile);
+        }
+    }
+    fputc('\n', logFile);
+}
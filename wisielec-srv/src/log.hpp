@@ -0,0 +1,119 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+using namespace std;
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+// Records below this level are not even compiled in
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_CAPACITY 160
+
+/**
+ * The part of the server that has written the record. Determines the record prefix
+ */
+enum LogSource {
+    LOG_SOURCE_MAIN,        // No prefix
+    LOG_SOURCE_SERVER,      // [SERVER: fd], the first argument is the descriptor
+    LOG_SOURCE_CLIENT,      // [CLIENT: fd], the first argument is the descriptor
+    LOG_SOURCE_PLAYER,      // [PLAYER: name], the first argument is the name
+    LOG_SOURCE_ROOM         // [ROOM: id], the first argument is the room
+};
+
+/**
+ * A single argument of the record, stored in binary form until the record is formatted
+ */
+struct LogArgument {
+    bool isText;
+    int64_t number;
+    uint16_t textOffset;
+    uint16_t textLength;
+};
+
+/**
+ * A log record. The message is formatted by the logging thread: every {} in the format
+ * is replaced with the next argument
+ */
+struct LogRecord {
+    uint64_t time;
+    uint8_t level;
+    uint8_t source;
+    uint8_t argCount;
+    const char* format;     // Must be a string literal, it's read by the logging thread
+    LogArgument args[LOG_MAX_ARGS];
+    uint16_t textLength;
+    char text[LOG_TEXT_CAPACITY];
+};
+
+extern int logLevel;
+
+void logStart(int level, const char* path);
+void logStop();
+void logSetLevel(int level);
+int logParseLevel(const char* name);
+void logPush(LogRecord& record);
+uint64_t logGetDroppedCount();
+
+void logAddText(LogRecord& record, const char* text, size_t length);
+
+inline void logAddArgument(LogRecord& record, const string& value){
+    logAddText(record, value.data(), value.length());
+}
+
+inline void logAddArgument(LogRecord& record, const char* value){
+    logAddText(record, value, strlen(value));
+}
+
+template <typename T, typename = enable_if_t<is_integral_v<T> || is_enum_v<T>>>
+inline void logAddArgument(LogRecord& record, T value){
+    if(record.argCount == LOG_MAX_ARGS) return;
+    LogArgument& arg = record.args[record.argCount++];
+    arg.isText = false;
+    arg.number = (int64_t)value;
+}
+
+/**
+ * Fills a binary record and pushes it to the logging thread. Nothing is formatted here
+ * @param level Level of the record
+ * @param source The part of the server that writes the record
+ * @param format The format, with {} in place of the arguments
+ * @param args The arguments: integers or strings
+ */
+template <typename... Args>
+void logWrite(int level, LogSource source, const char* format, const Args&... args){
+    LogRecord record;
+    record.level = level;
+    record.source = source;
+    record.argCount = 0;
+    record.textLength = 0;
+    record.format = format;
+    (logAddArgument(record, args), ...);
+    logPush(record);
+}
+
+// The arguments are evaluated only if the level is enabled
+#define LOG(level, source, ...) do { \
+        if((level) >= LOG_COMPILE_LEVEL && (level) >= logLevel) { \
+            logWrite((level), (source), __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define LOG_DEBUG(source, ...) LOG(LOG_LEVEL_DEBUG, source, __VA_ARGS__)
+#define LOG_INFO(source, ...) LOG(LOG_LEVEL_INFO, source, __VA_ARGS__)
+#define LOG_WARNING(source, ...) LOG(LOG_LEVEL_WARNING, source, __VA_ARGS__)
+#define LOG_ERROR(source, ...) LOG(LOG_LEVEL_ERROR, source, __VA_ARGS__)
+
+#endif
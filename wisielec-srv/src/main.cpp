@@ -1,43 +1,323 @@
+#include "admin.hpp"
+#include "backplane.hpp"
+#include "buffer.hpp"
+#include "client.hpp"
+#include "dictionary.hpp"
 #include "epoll.hpp"
+#include "gateway.hpp"
+#include "io_thread.hpp"
+#include "journal.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "pool.hpp"
 #include "server.hpp"
-#include "game/hangman_server.hpp"
+#include "worker.hpp"
+#include "game/room_manager.hpp"
 
 #include <iostream>
 #include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 using namespace std;
 
-void terminate(int);
+void onSignal(EpollHandler* sender);
+void printStats();
+void printLoopStats(const char* name, const EpollStats* stats);
+void printUsage(const char* program);
+void collectMetrics();
 
 Epoll* epoll;
-Server* server;
+Gateway* gateway;
+Admin* admin = nullptr;
+int signalFd;
+bool isRunning = true;
+
+Metric memoryReserved("wisielec_memory_reserved_bytes", "Memory reserved by the pools", METRIC_GAUGE);
+Metric memoryPerConnection("wisielec_memory_per_connection_bytes", "Memory taken by an idle connection", METRIC_GAUGE);
 
 int main(int argc, char** argv){
-    if(argc < 2){
+    int maxEvents = EPOLL_DEFAULT_MAX_EVENTS;
+    int level = LOG_LEVEL_INFO;
+    const char* logPath = nullptr;
+    const char* adminAddress = nullptr;
+    const char* dictionaryPath = nullptr;
+    const char* categoryName = nullptr;
+    int difficulty = DICTIONARY_ANY;
+    uint64_t idleTimeoutMs = CLIENT_DEFAULT_IDLE_TIMEOUT_MS;
+    size_t lowWatermark = CLIENT_DEFAULT_LOW_WATERMARK;
+    size_t highWatermark = CLIENT_DEFAULT_HIGH_WATERMARK;
+    uint64_t guessCooldownMs = 0;
+    int threadCount = 1;
+    int workerCount = 1;
+    int seats = ROOM_DEFAULT_SEATS;
+    int backplaneRole = BACKPLANE_NONE;
+    const char* backplanePath = nullptr;
+    int backend = EPOLL_BACKEND_EPOLL;
+    const char* journalPath = nullptr;
+    bool isSeeded = false;
+    uint64_t seed = 0;
+
+    int option;
+    while((option = getopt(argc, argv, "e:l:o:a:d:c:D:i:g:w:t:G:s:b:B:uj:S:")) != -1){
+        switch(option){
+            case 'e':
+                // Maximum number of events handled after a single wakeup
+                maxEvents = atoi(optarg);
+                break;
+            case 'l':
+                level = logParseLevel(optarg);
+                if(level < 0){
+                    cout << "Unknown log level: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'o':
+                logPath = optarg;
+                break;
+            case 'a':
+                // Port on the loopback interface or a Unix socket path for the metrics
+                adminAddress = optarg;
+                break;
+            case 'd':
+                // Dictionary compiled with wisielec-dict
+                dictionaryPath = optarg;
+                break;
+            case 'c':
+                categoryName = optarg;
+                break;
+            case 'D':
+                difficulty = dictionaryParseDifficulty(optarg);
+                if(difficulty < 0){
+                    cout << "Unknown difficulty: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'i':
+                // Seconds without any input after which a client is disconnected, 0 to never disconnect
+                idleTimeoutMs = strtoull(optarg, nullptr, 10) * 1000;
+                break;
+            case 'g':
+                // Minimum milliseconds between the guesses of a player
+                guessCooldownMs = strtoull(optarg, nullptr, 10);
+                break;
+            case 'w':
+                // Low and high watermarks of the output queues in KiB
+                if(sscanf(optarg, "%zu:%zu", &lowWatermark, &highWatermark) != 2 || lowWatermark >= highWatermark){
+                    cout << "Invalid watermarks: " << optarg << endl;
+                    return 1;
+                }
+                lowWatermark *= 1024;
+                highWatermark *= 1024;
+                break;
+            case 't':
+                // Number of the threads serving the connections, besides the game threads
+                threadCount = atoi(optarg);
+                if(threadCount < 1 || threadCount > SERVER_MAX_THREADS){
+                    cout << "Invalid number of I/O threads: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'G':
+                // Number of the threads running the rooms
+                workerCount = atoi(optarg);
+                if(workerCount < 1){
+                    cout << "Invalid number of game threads: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 's':
+                // Maximum number of the players in a room
+                seats = atoi(optarg);
+                if(seats < 1){
+                    cout << "Invalid number of seats: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'b':
+                // Host the backplane on this Unix socket path and run the rooms of all the nodes
+                backplaneRole = BACKPLANE_SEQUENCER;
+                backplanePath = optarg;
+                break;
+            case 'B':
+                // Serve the connections only, the rooms run on the sequencer listening on this path
+                backplaneRole = BACKPLANE_NODE;
+                backplanePath = optarg;
+                break;
+            case 'u':
+                // Wait for the events with io_uring instead of epoll
+                backend = EPOLL_BACKEND_URING;
+                break;
+            case 'j':
+                // Capture the received frames into this journal, for wisielec-replay
+                journalPath = optarg;
+                break;
+            case 'S':
+                // Seed of the phrases, the same requests give the same phrases
+                isSeeded = true;
+                seed = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc){
         cout << "Missing argument: server port number" << endl;
+        printUsage(argv[0]);
         return 1;
     }
-    auto port = (short)atoi(argv[1]);
+    auto port = (short)atoi(argv[optind]);
 
+    // SIGINT is received through the event loop, as the loop sleeps until the next event.
+    // It's blocked before the logging and I/O threads start, so that the threads inherit the mask
     signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, terminate);
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
 
-    epoll = epollCreate();
-    server = serverCreate();
-    serverStart(server, port, epoll);
+    logStart(level, logPath);
+    srand(time(nullptr));
+    if(!epollSetBackend(backend)){
+        LOG_WARNING(LOG_SOURCE_MAIN, "io_uring is not available, falling back to epoll.");
+    }else if(backend == EPOLL_BACKEND_URING){
+        LOG_INFO(LOG_SOURCE_MAIN, "The event loops use io_uring.");
+    }
+    epoll = epollCreate(maxEvents);
+    EpollHandler* signalHandler = epollCreateHandler(signalFd);
+    epollHandlerSetOnInput(signalHandler, onSignal);
+    epollRegisterHandler(epoll, signalHandler);
+    epollSetHandledEvents(signalHandler, EPOLLIN);
 
-    HangmanServer* gameServer = HangmanServer::getInstance();
+    // The rooms run on the game threads, the connections are served by the I/O threads.
+    // A node has no game threads, it passes the requests to the sequencer's ones.
+    // The main thread only handles the signals and the metrics
+    RoomManager rooms(workerCount, seats);
+    if(isSeeded){
+        rooms.setSeed(seed);
+    }
+    LOG_INFO(LOG_SOURCE_MAIN, "The phrases follow from the seed {}.", to_string(rooms.getSeed()));
+    Journal* journal = nullptr;
+    if(journalPath != nullptr){
+        journal = journalCreate(journalPath, rooms.getSeed());
+        LOG_INFO(LOG_SOURCE_MAIN, "Capturing the received frames into {}.", journalPath);
+    }
+    gateway = gatewayCreate(epoll, threadCount, workerCount, maxEvents, &rooms, backplaneRole, backplanePath);
+    for(int i = 0; i < threadCount; i++){
+        Server* server = ioThreadGetServer(gatewayGetThread(gateway, i));
+        serverSetIdleTimeout(server, idleTimeoutMs);
+        serverSetWatermarks(server, lowWatermark, highWatermark);
+        serverSetJournal(server, journal);
+    }
+    if(adminAddress != nullptr){
+        admin = adminCreate(adminAddress);
+        metricsSetCollector(collectMetrics);
+        adminStart(admin, epoll);
+    }
 
-    while(true){
-        gameServer->startNewRoundIfNeeded();
+    rooms.setGuessCooldown(guessCooldownMs);
+    Dictionary* dictionary = nullptr;
+    if(dictionaryPath != nullptr){
+        dictionary = dictionaryOpen(dictionaryPath);
+        int category = DICTIONARY_ANY;
+        if(categoryName != nullptr){
+            category = dictionaryFindCategory(dictionary, categoryName);
+            if(category < 0){
+                LOG_WARNING(LOG_SOURCE_MAIN, "Unknown category: {}", categoryName);
+                category = DICTIONARY_ANY;
+            }
+        }
+        rooms.useDictionary(dictionary, category, difficulty);
+    }
+    gatewayStart(gateway, port);
+
+    while(isRunning){
         epollWaitForEvent(epoll);
     }
-}
 
-void terminate(int){
-    cout << endl << "Terminating..." << endl;
-    serverClose(server);
+    LOG_INFO(LOG_SOURCE_MAIN, "Terminating...");
+    gatewayStop(gateway);
+    if(journal != nullptr){
+        journalClose(journal);
+    }
+    if(admin != nullptr){
+        adminClose(admin);
+    }
+    if(dictionary != nullptr){
+        dictionaryClose(dictionary);
+    }
+    epollUnregisterHandler(signalHandler);
+    epollReleaseHandler(signalHandler);
+    close(signalFd);
+    LOG_INFO(LOG_SOURCE_MAIN, "Terminated.");
+    logStop();
+    printStats();
+    gatewayRelease(gateway);
     epollRelease(epoll);
-    cout << "Terminated." << endl;
-    exit(0);
+    return 0;
+}
+
+/**
+ * Handles SIGINT received through the signalfd. The main loop finishes after the current wakeup
+ */
+void onSignal(EpollHandler*){
+    signalfd_siginfo info;
+    while(read(signalFd, &info, sizeof(info)) == -1 && errno == EINTR);
+    isRunning = false;
+}
+
+void printUsage(const char* program){
+    cout << "Usage: " << program << " [-e max events per wakeup] [-l debug|info|warning|error|none] [-o log file] [-a admin port or socket path] [-d dictionary] [-c category] [-D easy|medium|hard] [-i idle timeout in seconds] [-g guess cooldown in ms] [-w low:high watermark in KiB] [-t I/O threads] [-G game threads] [-s seats per room] [-b backplane path | -B sequencer path] [-u] [-j journal] [-S seed] port" << endl;
+}
+
+/**
+ * Updates the metrics that are computed only when they're requested
+ */
+void collectMetrics(){
+    metricSet(&memoryReserved, clientGetPoolStats().reservedBytes
+            + bufferGetPoolStats().reservedBytes
+            + poolGetBytesStats().reservedBytes);
+    metricSet(&memoryPerConnection, clientGetSlotSize());
+}
+
+void printStats(){
+    printLoopStats("Main loop", epollGetStats(epoll));
+    for(int i = 0; i < gatewayGetWorkerCount(gateway); i++){
+        string name = "Game loop " + to_string(i);
+        printLoopStats(name.c_str(), workerGetStats(gatewayGetWorker(gateway, i)));
+    }
+    if(gatewayGetSequencer(gateway) != nullptr){
+        printLoopStats("Sequencer loop", sequencerGetStats(gatewayGetSequencer(gateway)));
+    }
+    if(gatewayGetUplink(gateway) != nullptr){
+        printLoopStats("Uplink loop", uplinkGetStats(gatewayGetUplink(gateway)));
+    }
+    for(int i = 0; i < gatewayGetThreadCount(gateway); i++){
+        string name = "I/O loop " + to_string(i);
+        printLoopStats(name.c_str(), ioThreadGetStats(gatewayGetThread(gateway, i)));
+    }
+
+    PoolStats clients = clientGetPoolStats();
+    PoolStats buffers = bufferGetPoolStats();
+    PoolStats bytes = poolGetBytesStats();
+    cout << "Memory: " << clientGetSlotSize() << " bytes per idle connection, "
+         << clients.usedObjects << " connections (" << clients.reservedBytes << " bytes reserved), "
+         << buffers.usedObjects << " buffers (" << buffers.reservedBytes << " bytes reserved), "
+         << bytes.usedObjects << " data blocks (" << bytes.reservedBytes << " bytes reserved)" << endl;
+}
+
+void printLoopStats(const char* name, const EpollStats* stats){
+    double eventsPerWakeup = stats->wakeups > 0 ? (double)stats->events / stats->wakeups : 0;
+    double usPerIteration = stats->wakeups > 0 ? stats->totalIterationNs / 1000.0 / stats->wakeups : 0;
+    cout << name << ": " << stats->events << " events in " << stats->wakeups << " wakeups ("
+         << eventsPerWakeup << " per wakeup, max " << stats->maxEventsPerWakeup << "), "
+         << usPerIteration << " us per iteration (max " << stats->maxIterationNs / 1000.0 << " us), "
+         << stats->flushes << " output flushes" << endl;
 }
@@ -0,0 +1,157 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+Metric* metricsFirst = nullptr;
+Histogram* histogramsFirst = nullptr;
+void (*metricsCollector)() = nullptr;
+
+Metric metricLoopWakeups("wisielec_loop_wakeups_total", "Wakeups of the event loop that returned events", METRIC_COUNTER);
+Metric metricLoopEvents("wisielec_loop_events_total", "Events dispatched by the event loop", METRIC_COUNTER);
+Metric metricLoopSubmissions("wisielec_loop_submissions_total", "Operations submitted to io_uring by the event loop", METRIC_COUNTER);
+Histogram histogramLoopIteration("wisielec_loop_iteration_seconds", "Time spent dispatching a batch of events");
+
+Metric metricConnectionsAccepted("wisielec_connections_accepted_total", "Accepted connections", METRIC_COUNTER);
+Metric metricConnectionsClosed("wisielec_connections_closed_total", "Closed connections", METRIC_COUNTER);
+Metric metricConnectionsIdle("wisielec_connections_idle_closed_total", "Connections closed for being idle", METRIC_COUNTER);
+Metric metricConnectionsSlow("wisielec_connections_slow_closed_total", "Connections closed for not receiving their messages fast enough", METRIC_COUNTER);
+Metric metricInputPauses("wisielec_input_pauses_total", "Times a client's messages stopped being processed until its output queue drains", METRIC_COUNTER);
+Metric metricConnectionsActive("wisielec_connections_active", "Open connections", METRIC_GAUGE);
+Metric metricFramesIn("wisielec_frames_in_total", "Messages received from the clients", METRIC_COUNTER);
+Metric metricFramesOut("wisielec_frames_out_total", "Messages sent to the clients", METRIC_COUNTER);
+Metric metricBytesIn("wisielec_bytes_in_total", "Bytes received from the clients", METRIC_COUNTER);
+Metric metricBytesOut("wisielec_bytes_out_total", "Bytes sent to the clients", METRIC_COUNTER);
+Metric metricFramesCoalesced("wisielec_frames_coalesced_total", "Queued notifications replaced by newer ones before being sent", METRIC_COUNTER);
+Metric metricQueuedFrames("wisielec_output_queue_frames", "Messages waiting to be sent, summed over all clients", METRIC_GAUGE);
+Metric metricQueuedBytes("wisielec_output_queue_bytes", "Bytes waiting to be sent, summed over all clients", METRIC_GAUGE);
+
+Metric metricGuesses("wisielec_guesses_total", "Guesses made by the players", METRIC_COUNTER);
+Metric metricGuessHits("wisielec_guess_hits_total", "Guesses that revealed at least one letter", METRIC_COUNTER);
+Metric metricRooms("wisielec_rooms", "Rooms with at least one seat taken", METRIC_GAUGE);
+Histogram histogramGuessBroadcast("wisielec_guess_broadcast_seconds", "Time from a guess to its notification being written to a client");
+Histogram histogramRequestHandoff("wisielec_request_handoff_seconds", "Time from a request being read by an I/O thread to the game thread handling it");
+
+Metric metricBackplaneMessagesIn("wisielec_backplane_messages_in_total", "Messages received from the other server processes", METRIC_COUNTER);
+Metric metricBackplaneMessagesOut("wisielec_backplane_messages_out_total", "Messages sent to the other server processes", METRIC_COUNTER);
+
+/**
+ * Creates and registers the metric
+ * @param name Name of the metric
+ * @param help Description of the metric
+ * @param type Counter or gauge
+ */
+Metric::Metric(const char* name, const char* help, MetricType type) {
+    this->name = name;
+    this->help = help;
+    this->type = type;
+    this->value = 0;
+    this->next = metricsFirst;
+    metricsFirst = this;
+}
+
+/**
+ * Creates and registers the histogram
+ * @param name Name of the histogram
+ * @param help Description of the histogram
+ */
+Histogram::Histogram(const char* name, const char* help) {
+    this->name = name;
+    this->help = help;
+    for(auto& bucket : this->buckets){
+        bucket = 0;
+    }
+    this->count = 0;
+    this->sumNs = 0;
+    this->next = histogramsFirst;
+    histogramsFirst = this;
+}
+
+/**
+ * Adds the value to the metric
+ * @param metric The metric
+ * @param diff The value to add, can be negative for gauges
+ */
+void metricAdd(Metric* metric, int64_t diff){
+    metric->value.fetch_add(diff, memory_order_relaxed);
+}
+
+/**
+ * Sets the value of the gauge
+ * @param metric The metric
+ * @param value The new value
+ */
+void metricSet(Metric* metric, int64_t value){
+    metric->value.store(value, memory_order_relaxed);
+}
+
+/**
+ * Records a duration in the histogram
+ * @param histogram The histogram
+ * @param durationNs The duration in nanoseconds
+ */
+void histogramObserve(Histogram* histogram, uint64_t durationNs){
+    // The bucket is the number of bits of the duration in microseconds
+    uint64_t us = durationNs / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if(bucket > METRICS_HISTOGRAM_BUCKETS) bucket = METRICS_HISTOGRAM_BUCKETS;
+
+    histogram->buckets[bucket].fetch_add(1, memory_order_relaxed);
+    histogram->count.fetch_add(1, memory_order_relaxed);
+    histogram->sumNs.fetch_add(durationNs, memory_order_relaxed);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t metricsNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Sets the function that updates the gauges computed on demand, just before the metrics are formatted
+ * @param collector The function
+ */
+void metricsSetCollector(void (*collector)()){
+    metricsCollector = collector;
+}
+
+/**
+ * Formats all the metrics in the Prometheus text format
+ */
+string metricsFormat(){
+    if(metricsCollector != nullptr){
+        metricsCollector();
+    }
+
+    string text;
+    for(Metric* metric = metricsFirst; metric != nullptr; metric = metric->next){
+        text += string("# HELP ") + metric->name + " " + metric->help + "\n";
+        text += string("# TYPE ") + metric->name + (metric->type == METRIC_COUNTER ? " counter\n" : " gauge\n");
+        text += string(metric->name) + " " + to_string(metric->value.load(memory_order_relaxed)) + "\n";
+    }
+
+    for(Histogram* histogram = histogramsFirst; histogram != nullptr; histogram = histogram->next){
+        text += string("# HELP ") + histogram->name + " " + histogram->help + "\n";
+        text += string("# TYPE ") + histogram->name + " histogram\n";
+        uint64_t cumulative = 0;
+        for(int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++){
+            cumulative += histogram->buckets[i].load(memory_order_relaxed);
+            // Bucket i holds the durations below 2^i microseconds
+            double bound = (double)(1ull << i) / 1000000;
+            char boundText[32];
+            snprintf(boundText, sizeof(boundText), "%g", bound);
+            text += string(histogram->name) + "_bucket{le=\"" + boundText + "\"} " + to_string(cumulative) + "\n";
+        }
+        cumulative += histogram->buckets[METRICS_HISTOGRAM_BUCKETS].load(memory_order_relaxed);
+        text += string(histogram->name) + "_bucket{le=\"+Inf\"} " + to_string(cumulative) + "\n";
+
+        char sumText[32];
+        snprintf(sumText, sizeof(sumText), "%.9f", histogram->sumNs.load(memory_order_relaxed) / 1e9);
+        text += string(histogram->name) + "_sum " + sumText + "\n";
+        text += string(histogram->name) + "_count " + to_string(histogram->count.load(memory_order_relaxed)) + "\n";
+    }
+    return text;
+}
@@ -0,0 +1,85 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+#define METRICS_HISTOGRAM_BUCKETS 24     // Powers of two of microseconds: 1 us to about 8 s
+
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE
+};
+
+/**
+ * Structure representing a counter or a gauge. The metrics are defined as globals,
+ * and they register themselves, so that they're all exported
+ */
+struct Metric {
+    const char* name;
+    const char* help;
+    MetricType type;
+    atomic<int64_t> value;
+    Metric* next;
+
+    Metric(const char* name, const char* help, MetricType type);
+};
+
+/**
+ * Structure representing a histogram of durations
+ */
+struct Histogram {
+    const char* name;
+    const char* help;
+    atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS + 1];     // The last one is for everything bigger
+    atomic<uint64_t> count;
+    atomic<uint64_t> sumNs;
+    Histogram* next;
+
+    Histogram(const char* name, const char* help);
+};
+
+void metricAdd(Metric* metric, int64_t diff);
+void metricSet(Metric* metric, int64_t value);
+void histogramObserve(Histogram* histogram, uint64_t durationNs);
+
+uint64_t metricsNow();
+void metricsSetCollector(void (*collector)());
+string metricsFormat();
+
+// Event loop
+extern Metric metricLoopWakeups;
+extern Metric metricLoopEvents;
+extern Metric metricLoopSubmissions;
+extern Histogram histogramLoopIteration;
+
+// Client I/O
+extern Metric metricConnectionsAccepted;
+extern Metric metricConnectionsClosed;
+extern Metric metricConnectionsIdle;
+extern Metric metricConnectionsSlow;
+extern Metric metricInputPauses;
+extern Metric metricConnectionsActive;
+extern Metric metricFramesIn;
+extern Metric metricFramesOut;
+extern Metric metricBytesIn;
+extern Metric metricBytesOut;
+extern Metric metricFramesCoalesced;
+extern Metric metricQueuedFrames;
+extern Metric metricQueuedBytes;
+
+// Game
+extern Metric metricGuesses;
+extern Metric metricGuessHits;
+extern Metric metricRooms;
+extern Histogram histogramGuessBroadcast;
+extern Histogram histogramRequestHandoff;
+
+// Backplane
+extern Metric metricBackplaneMessagesIn;
+extern Metric metricBackplaneMessagesOut;
+
+#endif
@@ -0,0 +1,283 @@
+#include "output_queue.hpp"
+
+#include "metrics.hpp"
+
+void outputQueueOnSent(Buffer* buffer);
+bool outputQueueReplace(OutputQueue* queue, Buffer* buffer, uint64_t key);
+void outputQueueInsertAfter(OutputQueue* queue, Buffer* previous, Buffer* buffer);
+bool outputQueueIsStarted(Buffer* buffer);
+
+/**
+ * Structure representing a queue of buffers waiting to be sent.
+ * The control frames are kept at the front, in order, followed by the bulk frames
+ */
+struct OutputQueue {
+    Buffer* head;       // The buffer that's being sent now
+    Buffer* tail;       // The last buffer in the chain, new buffers are attached after it
+    Buffer* lastControl;    // The last control frame, the next control frame is inserted after it
+    Buffer* lastInFlight;   // The last buffer of a send that hasn't completed, the buffers up to it stay in place
+    size_t length;      // Number of buffers in the queue
+    size_t bytes;       // Number of bytes that remain to be sent
+    bool isInPlace;     // Whether the queue was created in the memory provided by the caller
+};
+
+/**
+ * Creates a new, empty output queue
+ * @return The queue
+ */
+OutputQueue* outputQueueCreate(){
+    OutputQueue* queue = outputQueueCreate(new OutputQueue());
+    queue->isInPlace = false;
+    return queue;
+}
+
+/**
+ * Creates a new, empty output queue in the provided memory
+ * @param memory At least outputQueueGetSize() bytes for the queue
+ * @return The queue
+ */
+OutputQueue* outputQueueCreate(void* memory){
+    auto queue = (OutputQueue*)memory;
+    queue->head = nullptr;
+    queue->tail = nullptr;
+    queue->lastControl = nullptr;
+    queue->lastInFlight = nullptr;
+    queue->length = 0;
+    queue->bytes = 0;
+    queue->isInPlace = true;
+    return queue;
+}
+
+/**
+ * Returns the number of bytes needed to create a queue in place
+ */
+size_t outputQueueGetSize(){
+    return sizeof(OutputQueue);
+}
+
+/**
+ * Releases the queue and all the buffers that are still in it.
+ * The memory provided by the caller isn't freed
+ * @param queue The queue to release
+ */
+void outputQueueRelease(OutputQueue* queue){
+    metricAdd(&metricQueuedFrames, -(int64_t)queue->length);
+    metricAdd(&metricQueuedBytes, -(int64_t)queue->bytes);
+    while(queue->head != nullptr){
+        Buffer* next = bufferGetNext(queue->head);
+        bufferRelease(queue->head);
+        queue->head = next;
+    }
+    if(!queue->isInPlace){
+        delete queue;
+    }
+}
+
+/**
+ * Adds the buffer to the queue. A frame that supersedes a frame that's still waiting takes its place.
+ * Control frames are sent after the other control frames, but before all the bulk frames that haven't been started.
+ * Other buffers are appended to the end
+ * @param queue The queue
+ * @param buffer The buffer to add
+ */
+void outputQueuePush(OutputQueue* queue, Buffer* buffer){
+    Frame* frame = bufferGetFrame(buffer);
+    if(frame != nullptr && frameGetCoalesceKey(frame) != FRAME_NO_COALESCING
+            && outputQueueReplace(queue, buffer, frameGetCoalesceKey(frame))){
+        return;
+    }
+
+    if(frame != nullptr && frameGetPriority(frame) == FRAME_PRIORITY_CONTROL){
+        // A frame that's partially sent has to be finished first, and so has a send in flight
+        Buffer* previous = queue->lastControl;
+        if(previous == nullptr && queue->lastInFlight != nullptr){
+            previous = queue->lastInFlight;
+        }else if(previous == nullptr && queue->head != nullptr && outputQueueIsStarted(queue->head)){
+            previous = queue->head;
+        }
+        outputQueueInsertAfter(queue, previous, buffer);
+        queue->lastControl = buffer;
+    }else{
+        outputQueueInsertAfter(queue, queue->tail, buffer);
+    }
+    queue->length++;
+    queue->bytes += bufferGetRemaining(buffer);
+    metricAdd(&metricQueuedFrames, 1);
+    metricAdd(&metricQueuedBytes, bufferGetRemaining(buffer));
+}
+
+/**
+ * Replaces the waiting buffer of the frame with the same coalescing key. There's at most one such buffer,
+ * as every frame with a key replaces the previous one
+ * @param queue The queue
+ * @param buffer The new buffer
+ * @param key The coalescing key of the new buffer's frame
+ * @return False if there's no buffer to replace
+ */
+bool outputQueueReplace(OutputQueue* queue, Buffer* buffer, uint64_t key){
+    Buffer* previous = nullptr;
+    bool isInFlight = queue->lastInFlight != nullptr;
+    for(Buffer* old = queue->head; old != nullptr; previous = old, old = bufferGetNext(old)){
+        if(isInFlight){
+            // The kernel may be reading the buffer already
+            isInFlight = old != queue->lastInFlight;
+            continue;
+        }
+        Frame* frame = bufferGetFrame(old);
+        if(frame == nullptr || frameGetCoalesceKey(frame) != key || outputQueueIsStarted(old)) continue;
+
+        if(previous == nullptr){
+            queue->head = buffer;
+        }else{
+            bufferSetNext(previous, buffer);
+        }
+        bufferSetNext(buffer, bufferGetNext(old));
+        bufferSetNext(old, nullptr);
+        if(queue->tail == old) queue->tail = buffer;
+        if(queue->lastControl == old) queue->lastControl = buffer;
+
+        int64_t difference = (int64_t)bufferGetRemaining(buffer) - (int64_t)bufferGetRemaining(old);
+        queue->bytes += difference;
+        metricAdd(&metricQueuedBytes, difference);
+        metricAdd(&metricFramesCoalesced, 1);
+        bufferRelease(old);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Links the buffer into the chain
+ * @param queue The queue
+ * @param previous The buffer to insert after, or nullptr to insert at the front
+ * @param buffer The buffer to insert
+ */
+void outputQueueInsertAfter(OutputQueue* queue, Buffer* previous, Buffer* buffer){
+    if(previous == nullptr){
+        bufferSetNext(buffer, queue->head);
+        queue->head = buffer;
+    }else{
+        bufferSetNext(buffer, bufferGetNext(previous));
+        bufferSetNext(previous, buffer);
+    }
+    if(previous == queue->tail){
+        queue->tail = buffer;
+    }
+}
+
+/**
+ * Checks if a part of the buffer has already been sent
+ * @param buffer The buffer
+ */
+bool outputQueueIsStarted(Buffer* buffer){
+    return bufferGetRemaining(buffer) < bufferGetLength(buffer);
+}
+
+/**
+ * Checks if there's nothing more to send
+ * @param queue The queue
+ */
+bool outputQueueIsEmpty(OutputQueue* queue){
+    return queue->head == nullptr;
+}
+
+/**
+ * Returns the number of buffers in the queue
+ * @param queue The queue
+ */
+size_t outputQueueGetLength(OutputQueue* queue){
+    return queue->length;
+}
+
+/**
+ * Returns the number of bytes that remain to be sent
+ * @param queue The queue
+ */
+size_t outputQueueGetBytes(OutputQueue* queue){
+    return queue->bytes;
+}
+
+/**
+ * Describes the beginning of the queue with an iovec array, ready to be passed to writev
+ * @param queue The queue
+ * @param iov The array to fill
+ * @param maxCount Capacity of the array
+ * @return Number of filled iovec entries
+ */
+int outputQueueFillIovec(OutputQueue* queue, iovec* iov, int maxCount){
+    int count = 0;
+    for(Buffer* buffer = queue->head; buffer != nullptr && count < maxCount; buffer = bufferGetNext(buffer)){
+        iov[count].iov_base = bufferGetData(buffer);
+        iov[count].iov_len = bufferGetRemaining(buffer);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Describes the beginning of the queue like outputQueueFillIovec, for a send that completes later. Until then
+ * (outputQueueConsume), the described buffers stay in place: they aren't replaced and nothing is inserted among them
+ * @param queue The queue, without a send in flight
+ * @param iov The array to fill
+ * @param maxCount Capacity of the array
+ * @return Number of filled iovec entries
+ */
+int outputQueueStartSend(OutputQueue* queue, iovec* iov, int maxCount){
+    int count = 0;
+    for(Buffer* buffer = queue->head; buffer != nullptr && count < maxCount; buffer = bufferGetNext(buffer)){
+        iov[count].iov_base = bufferGetData(buffer);
+        iov[count].iov_len = bufferGetRemaining(buffer);
+        count++;
+        queue->lastInFlight = buffer;
+        if(buffer == queue->lastControl){
+            // The next control frame goes after the whole send
+            queue->lastControl = nullptr;
+        }
+    }
+    return count;
+}
+
+/**
+ * Marks the bytes as sent, which also completes the send in flight. Releases the buffers that have been sent completely
+ * @param queue The queue
+ * @param length Number of bytes sent
+ */
+void outputQueueConsume(OutputQueue* queue, size_t length){
+    queue->lastInFlight = nullptr;
+    queue->bytes -= length;
+    metricAdd(&metricQueuedBytes, -(int64_t)length);
+    while(length > 0){
+        size_t remaining = bufferGetRemaining(queue->head);
+        if(length < remaining){
+            bufferMovePointer(queue->head, length);
+            return;
+        }
+        length -= remaining;
+
+        Buffer* next = bufferGetNext(queue->head);
+        if(queue->lastControl == queue->head){
+            queue->lastControl = nullptr;
+        }
+        outputQueueOnSent(queue->head);
+        bufferRelease(queue->head);
+        queue->head = next;
+        queue->length--;
+        metricAdd(&metricQueuedFrames, -1);
+    }
+    if(queue->head == nullptr){
+        queue->tail = nullptr;
+    }
+}
+
+/**
+ * Updates the metrics after the buffer has been sent completely
+ * @param buffer The buffer that's been sent
+ */
+void outputQueueOnSent(Buffer* buffer){
+    metricAdd(&metricFramesOut, 1);
+
+    Frame* frame = bufferGetFrame(buffer);
+    if(frame != nullptr && frameGetOriginTime(frame) != 0){
+        histogramObserve(&histogramGuessBroadcast, metricsNow() - frameGetOriginTime(frame));
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef OUTPUT_QUEUE_HPP
+#define OUTPUT_QUEUE_HPP
+
+#include "buffer.hpp"
+
+#include <sys/uio.h>
+
+struct OutputQueue;
+
+OutputQueue* outputQueueCreate();
+OutputQueue* outputQueueCreate(void* memory);
+void outputQueueRelease(OutputQueue* queue);
+size_t outputQueueGetSize();
+
+void outputQueuePush(OutputQueue* queue, Buffer* buffer);
+bool outputQueueIsEmpty(OutputQueue* queue);
+size_t outputQueueGetLength(OutputQueue* queue);
+size_t outputQueueGetBytes(OutputQueue* queue);
+
+int outputQueueFillIovec(OutputQueue* queue, iovec* iov, int maxCount);
+int outputQueueStartSend(OutputQueue* queue, iovec* iov, int maxCount);
+void outputQueueConsume(OutputQueue* queue, size_t length);
+
+#endif
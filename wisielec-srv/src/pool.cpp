@@ -0,0 +1,305 @@
+#include "pool.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+#define POOL_SIZE_CLASS_COUNT 7
+#define POOL_MIN_SIZE_CLASS 64      // The size classes are the powers of two: 64, 128, ..., 4096
+#define POOL_SLAB_SIZE 65536        // Size of a slab for the size classes
+#define POOL_MAX_GROUPS 16
+
+/**
+ * Structure representing a pool of equally sized objects. The objects are carved out of big slabs,
+ * and the free ones are linked into a list through their first bytes.
+ * Only the thread that created the pool allocates from it. Any thread can free an object:
+ * the objects freed by the other threads are pushed onto a lock-free stack,
+ * which the owner takes over as a whole when its own free list runs out
+ */
+struct Pool {
+    size_t objectSize;
+    size_t objectsPerSlab;
+    int ownerThread;                    // ID of the thread that created the pool
+    void* freeList;                     // The first free object, used only by the owner
+    vector<char*>* slabs;               // All the allocated slabs
+    atomic<size_t> slabCount;
+    atomic<size_t> usedObjects;         // Written only by the owner, so that the statistics can be read by any thread
+    alignas(64) atomic<void*> remoteFreeList;
+    atomic<size_t> remoteFrees;         // Number of objects freed by the other threads
+};
+
+/**
+ * Structure representing a set of pools of the same objects, one pool per thread
+ */
+struct PoolGroup {
+    int index;                  // Position of the thread's pool in poolLocalPools
+    size_t objectSize;
+    size_t objectsPerSlab;
+    mutex poolsMutex;
+    vector<Pool*> pools;        // The pools of all the threads, for the statistics
+};
+
+atomic<int> poolNextThreadId(0);
+atomic<int> poolGroupCount(0);
+thread_local int poolThreadId = 0;
+thread_local Pool* poolLocalPools[POOL_MAX_GROUPS] = {};
+
+void poolAddSlab(Pool* pool);
+int poolGetSizeClass(size_t size);
+PoolGroup* poolGetSizeClassGroup(int sizeClass);
+int poolGetThreadId();
+
+/**
+ * Creates a new pool, owned by the calling thread. No memory is reserved until the first allocation
+ * @param objectSize Size of a single object
+ * @param objectsPerSlab Number of objects in a single slab
+ * @return The pool
+ */
+Pool* poolCreate(size_t objectSize, size_t objectsPerSlab){
+    auto pool = new Pool();
+    pool->objectSize = poolAlign(objectSize < sizeof(void*) ? sizeof(void*) : objectSize);
+    pool->objectsPerSlab = objectsPerSlab > 0 ? objectsPerSlab : 1;
+    pool->ownerThread = poolGetThreadId();
+    pool->freeList = nullptr;
+    pool->slabs = new vector<char*>();
+    pool->slabCount = 0;
+    pool->usedObjects = 0;
+    pool->remoteFreeList = nullptr;
+    pool->remoteFrees = 0;
+    return pool;
+}
+
+/**
+ * Releases the pool with all its slabs. The objects allocated from the pool become invalid
+ * @param pool The pool to release
+ */
+void poolRelease(Pool* pool){
+    for(char* slab : *pool->slabs){
+        delete[] slab;
+    }
+    delete pool->slabs;
+    delete pool;
+}
+
+/**
+ * Allocates an object from the pool. The memory isn't initialized. Must be called by the pool's owner
+ * @param pool The pool
+ * @return Pointer to the object
+ */
+void* poolAllocate(Pool* pool){
+    if(pool->freeList == nullptr){
+        // The whole stack is taken at once, so there's no ABA problem
+        pool->freeList = pool->remoteFreeList.exchange(nullptr, memory_order_acquire);
+        if(pool->freeList == nullptr){
+            poolAddSlab(pool);
+        }
+    }
+    void* object = pool->freeList;
+    pool->freeList = *(void**)object;
+    pool->usedObjects.store(pool->usedObjects.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    return object;
+}
+
+/**
+ * Returns the object to the pool. Can be called by any thread
+ * @param pool The pool the object was allocated from
+ * @param object The object to free
+ */
+void poolFree(Pool* pool, void* object){
+    if(pool->ownerThread == poolGetThreadId()){
+        *(void**)object = pool->freeList;
+        pool->freeList = object;
+        pool->usedObjects.store(pool->usedObjects.load(memory_order_relaxed) - 1, memory_order_relaxed);
+        return;
+    }
+
+    void* head = pool->remoteFreeList.load(memory_order_relaxed);
+    do{
+        *(void**)object = head;
+    }while(!pool->remoteFreeList.compare_exchange_weak(head, object, memory_order_release, memory_order_relaxed));
+    pool->remoteFrees.fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Returns the statistics of the pool. Can be called by any thread, the numbers may be slightly out of date
+ * @param pool The pool
+ */
+PoolStats poolGetStats(Pool* pool){
+    PoolStats stats {};
+    stats.objectSize = pool->objectSize;
+    stats.usedObjects = pool->usedObjects.load(memory_order_relaxed) - pool->remoteFrees.load(memory_order_relaxed);
+    stats.totalObjects = pool->slabCount.load(memory_order_relaxed) * pool->objectsPerSlab;
+    stats.reservedBytes = stats.totalObjects * pool->objectSize;
+    return stats;
+}
+
+/**
+ * Creates a group of pools. Every thread that uses the group gets its own pool,
+ * so the threads never contend for the free lists
+ * @param objectSize Size of a single object
+ * @param objectsPerSlab Number of objects in a single slab
+ * @return The group
+ */
+PoolGroup* poolGroupCreate(size_t objectSize, size_t objectsPerSlab){
+    auto group = new PoolGroup();
+    group->index = poolGroupCount.fetch_add(1);
+    group->objectSize = objectSize;
+    group->objectsPerSlab = objectsPerSlab;
+    if(group->index >= POOL_MAX_GROUPS){
+        throw runtime_error("Too many pool groups.");
+    }
+    return group;
+}
+
+/**
+ * Returns the calling thread's pool of the group, creating it on the first use
+ * @param group The group
+ */
+Pool* poolGroupGetLocal(PoolGroup* group){
+    Pool*& pool = poolLocalPools[group->index];
+    if(pool == nullptr){
+        pool = poolCreate(group->objectSize, group->objectsPerSlab);
+        lock_guard<mutex> lock(group->poolsMutex);
+        group->pools.push_back(pool);
+    }
+    return pool;
+}
+
+/**
+ * Returns the statistics summed over the pools of all the threads
+ * @param group The group
+ */
+PoolStats poolGroupGetStats(PoolGroup* group){
+    PoolStats total {};
+    total.objectSize = poolAlign(group->objectSize);
+    lock_guard<mutex> lock(group->poolsMutex);
+    for(Pool* pool : group->pools){
+        PoolStats stats = poolGetStats(pool);
+        total.usedObjects += stats.usedObjects;
+        total.totalObjects += stats.totalObjects;
+        total.reservedBytes += stats.reservedBytes;
+    }
+    return total;
+}
+
+/**
+ * Allocates a memory block of any size. Small blocks come from the calling thread's size class pools,
+ * the bigger ones from the heap. The block should be freed by the same thread,
+ * the blocks that are passed to other threads are allocated from poolGetBytesPool
+ * @param size Number of bytes to allocate
+ * @return Pointer to the memory
+ */
+void* poolAllocateBytes(size_t size){
+    Pool* pool = poolGetBytesPool(size);
+    if(pool == nullptr){
+        return new char[size];
+    }
+    return poolAllocate(pool);
+}
+
+/**
+ * Frees the memory block allocated with poolAllocateBytes
+ * @param memory Pointer to the memory
+ * @param size Number of bytes that were allocated
+ */
+void poolFreeBytes(void* memory, size_t size){
+    Pool* pool = poolGetBytesPool(size);
+    if(pool == nullptr){
+        delete[] (char*)memory;
+        return;
+    }
+    poolFree(pool, memory);
+}
+
+/**
+ * Returns the calling thread's size class pool that fits the size
+ * @param size Number of bytes
+ * @return The pool or nullptr if the size is too big for all the size classes
+ */
+Pool* poolGetBytesPool(size_t size){
+    int sizeClass = poolGetSizeClass(size);
+    if(sizeClass < 0) return nullptr;
+    return poolGroupGetLocal(poolGetSizeClassGroup(sizeClass));
+}
+
+/**
+ * Returns the statistics summed over all the size class pools
+ */
+PoolStats poolGetBytesStats(){
+    PoolStats total {};
+    for(int i = 0; i < POOL_SIZE_CLASS_COUNT; i++){
+        PoolStats stats = poolGroupGetStats(poolGetSizeClassGroup(i));
+        total.usedObjects += stats.usedObjects;
+        total.totalObjects += stats.totalObjects;
+        total.reservedBytes += stats.reservedBytes;
+    }
+    return total;
+}
+
+/**
+ * Rounds the size up, so that any object can be placed right after a block of that size
+ * @param size The size to round
+ */
+size_t poolAlign(size_t size){
+    size_t alignment = alignof(max_align_t);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Allocates a new slab and puts all its objects on the free list
+ * @param pool The pool
+ */
+void poolAddSlab(Pool* pool){
+    char* slab = new char[pool->objectSize * pool->objectsPerSlab];
+    pool->slabs->push_back(slab);
+    pool->slabCount.store(pool->slabs->size(), memory_order_relaxed);
+    for(size_t i = pool->objectsPerSlab; i > 0; i--){
+        void* object = slab + (i - 1) * pool->objectSize;
+        *(void**)object = pool->freeList;
+        pool->freeList = object;
+    }
+}
+
+/**
+ * Finds the smallest size class that fits the size
+ * @param size Number of bytes
+ * @return Index of the size class or -1 if the size is too big for all of them
+ */
+int poolGetSizeClass(size_t size){
+    size_t classSize = POOL_MIN_SIZE_CLASS;
+    for(int i = 0; i < POOL_SIZE_CLASS_COUNT; i++){
+        if(size <= classSize) return i;
+        classSize <<= 1;
+    }
+    return -1;
+}
+
+/**
+ * Returns the group of the size class pools
+ * @param sizeClass Index of the size class
+ */
+PoolGroup* poolGetSizeClassGroup(int sizeClass){
+    static PoolGroup** groups = [](){
+        auto created = new PoolGroup*[POOL_SIZE_CLASS_COUNT];
+        for(int i = 0; i < POOL_SIZE_CLASS_COUNT; i++){
+            size_t objectSize = (size_t)POOL_MIN_SIZE_CLASS << i;
+            created[i] = poolGroupCreate(objectSize, POOL_SLAB_SIZE / objectSize);
+        }
+        return created;
+    }();
+    return groups[sizeClass];
+}
+
+/**
+ * Returns a number identifying the calling thread
+ */
+int poolGetThreadId(){
+    if(poolThreadId == 0){
+        poolThreadId = poolNextThreadId.fetch_add(1) + 1;
+    }
+    return poolThreadId;
+}
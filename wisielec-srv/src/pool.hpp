@@ -0,0 +1,37 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <unistd.h>
+
+struct Pool;
+struct PoolGroup;
+
+/**
+ * Statistics of a pool
+ */
+struct PoolStats {
+    size_t objectSize;      // Size of a single slot, including the alignment
+    size_t usedObjects;     // Number of slots that are allocated now
+    size_t totalObjects;    // Number of slots in all the slabs
+    size_t reservedBytes;   // Memory taken by all the slabs
+};
+
+Pool* poolCreate(size_t objectSize, size_t objectsPerSlab);
+void poolRelease(Pool* pool);
+
+void* poolAllocate(Pool* pool);
+void poolFree(Pool* pool, void* object);
+PoolStats poolGetStats(Pool* pool);
+
+PoolGroup* poolGroupCreate(size_t objectSize, size_t objectsPerSlab);
+Pool* poolGroupGetLocal(PoolGroup* group);
+PoolStats poolGroupGetStats(PoolGroup* group);
+
+void* poolAllocateBytes(size_t size);
+void poolFreeBytes(void* memory, size_t size);
+Pool* poolGetBytesPool(size_t size);
+PoolStats poolGetBytesStats();
+
+size_t poolAlign(size_t size);
+
+#endif
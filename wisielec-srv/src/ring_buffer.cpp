@@ -0,0 +1,132 @@
+#include "ring_buffer.hpp"
+
+#include "pool.hpp"
+
+#include <cstring>
+
+/**
+ * Structure representing a fixed-capacity receive buffer.
+ * The unread data is always contiguous, so that complete messages can be parsed in place.
+ * When the free space at the end runs out, the unread data is moved back to the beginning
+ */
+struct RingBuffer {
+    size_t capacity;
+    size_t readOffset;      // Position of the first unread byte
+    size_t writeOffset;     // Position right after the last written byte
+    char* data;
+    bool isInPlace;         // Whether the buffer was created in the memory provided by the caller
+};
+
+/**
+ * Creates a new ring buffer
+ * @param capacity Capacity of the new buffer
+ * @return The buffer
+ */
+RingBuffer* ringBufferCreate(size_t capacity){
+    RingBuffer* ring = ringBufferCreate(capacity, new char[ringBufferGetSize(capacity)]);
+    ring->isInPlace = false;
+    return ring;
+}
+
+/**
+ * Creates a new ring buffer in the provided memory. The data is stored right after the structure
+ * @param capacity Capacity of the new buffer
+ * @param memory At least ringBufferGetSize(capacity) bytes for the buffer
+ * @return The buffer
+ */
+RingBuffer* ringBufferCreate(size_t capacity, void* memory){
+    auto ring = (RingBuffer*)memory;
+    ring->capacity = capacity;
+    ring->readOffset = 0;
+    ring->writeOffset = 0;
+    ring->data = (char*)memory + poolAlign(sizeof(RingBuffer));
+    ring->isInPlace = true;
+    return ring;
+}
+
+/**
+ * Releases the ring buffer and the contained array. The memory provided by the caller isn't freed
+ * @param ring The buffer to release
+ */
+void ringBufferRelease(RingBuffer* ring){
+    if(ring->isInPlace) return;
+    delete[] (char*)ring;
+}
+
+/**
+ * Returns the number of bytes needed to create a buffer in place, including the data
+ * @param capacity Capacity of the buffer
+ */
+size_t ringBufferGetSize(size_t capacity){
+    return poolAlign(sizeof(RingBuffer)) + capacity;
+}
+
+/**
+ * Returns the total capacity of the buffer
+ * @param ring The buffer
+ */
+size_t ringBufferGetCapacity(RingBuffer* ring){
+    return ring->capacity;
+}
+
+/**
+ * Returns a pointer to the place where the new data should be written
+ * @param ring The buffer
+ */
+char* ringBufferGetWritePointer(RingBuffer* ring){
+    return ring->data + ring->writeOffset;
+}
+
+/**
+ * Returns the number of bytes that can be written at the write pointer.
+ * Moves the unread data to the beginning of the buffer if that gives more space
+ * @param ring The buffer
+ */
+size_t ringBufferGetWritable(RingBuffer* ring){
+    if(ring->writeOffset == ring->capacity && ring->readOffset > 0){
+        size_t readable = ring->writeOffset - ring->readOffset;
+        memmove(ring->data, ring->data + ring->readOffset, readable);
+        ring->readOffset = 0;
+        ring->writeOffset = readable;
+    }
+    return ring->capacity - ring->writeOffset;
+}
+
+/**
+ * Marks the bytes at the write pointer as written
+ * @param ring The buffer
+ * @param length Number of bytes written
+ */
+void ringBufferCommitWrite(RingBuffer* ring, size_t length){
+    ring->writeOffset += length;
+}
+
+/**
+ * Returns a pointer to the first unread byte
+ * @param ring The buffer
+ */
+char* ringBufferGetReadPointer(RingBuffer* ring){
+    return ring->data + ring->readOffset;
+}
+
+/**
+ * Returns the number of unread bytes
+ * @param ring The buffer
+ */
+size_t ringBufferGetReadable(RingBuffer* ring){
+    return ring->writeOffset - ring->readOffset;
+}
+
+/**
+ * Marks the bytes at the read pointer as read
+ * @param ring The buffer
+ * @param length Number of bytes read
+ */
+void ringBufferConsume(RingBuffer* ring, size_t length){
+    ring->readOffset += length;
+    if(ring->readOffset == ring->writeOffset){
+        // Nothing left, start from the beginning again
+        ring->readOffset = 0;
+        ring->writeOffset = 0;
+    }
+}
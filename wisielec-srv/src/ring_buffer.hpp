@@ -0,0 +1,23 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <unistd.h>
+
+struct RingBuffer;
+
+RingBuffer* ringBufferCreate(size_t capacity);
+RingBuffer* ringBufferCreate(size_t capacity, void* memory);
+void ringBufferRelease(RingBuffer* ring);
+size_t ringBufferGetSize(size_t capacity);
+
+size_t ringBufferGetCapacity(RingBuffer* ring);
+
+char* ringBufferGetWritePointer(RingBuffer* ring);
+size_t ringBufferGetWritable(RingBuffer* ring);
+void ringBufferCommitWrite(RingBuffer* ring, size_t length);
+
+char* ringBufferGetReadPointer(RingBuffer* ring);
+size_t ringBufferGetReadable(RingBuffer* ring);
+void ringBufferConsume(RingBuffer* ring, size_t length);
+
+#endif
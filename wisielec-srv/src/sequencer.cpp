@@ -0,0 +1,358 @@
+#include "sequencer.hpp"
+
+#include "backplane.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "server.hpp"
+
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+void sequencerRun(Sequencer* sequencer);
+void sequencerAccept(EpollHandler* sender);
+void sequencerOnPeerMessage(BackplanePeer* peer, const ChannelMessage& message);
+void sequencerOnPeerClose(BackplanePeer* peer);
+void sequencerOnReceive(Channel* channel);
+void sequencerOnControl(Channel* channel);
+void sequencerDisconnect(Sequencer* sequencer, uint64_t connection);
+void sequencerRemoveMember(Sequencer* sequencer, uint64_t connection);
+
+/**
+ * Structure representing a connection served by a node, as the game threads know it
+ */
+struct SequencerConnection {
+    BackplanePeer* peer;        // The node serving the connection
+    uint64_t nodeConnection;    // The identifier the node knows the connection by
+    int worker;                 // Index of the game thread that handles the requests
+    uint32_t room;              // The room whose broadcasts the connection receives, 0 if it isn't a member of any
+};
+
+/**
+ * Structure representing a node connected to the backplane
+ */
+struct SequencerNode {
+    Sequencer* sequencer;
+    unordered_map<uint64_t, uint64_t> connections;     // The sequencer's identifiers by the node's ones
+};
+
+/**
+ * Structure representing the sequencer: the thread hosting the backplane the nodes connect to.
+ * To the game threads it looks like one more I/O thread, whose connections are served by the nodes.
+ * The requests of all the nodes are ordered by the game threads of this process, so every node
+ * sees the same order of the guesses. A broadcast comes from a game thread once and is published once
+ * to every node that has members of the room
+ */
+struct Sequencer {
+    int index;                                              // The I/O thread index the game threads know it by
+    int sockFd;                                             // The listening Unix domain socket
+    string path;
+    Epoll* epoll;
+    EpollHandler* epollHandler;
+    int workerCount;
+    Channel** toWorkers;                                    // Requests for the game threads, the thread is the producer
+    Channel** fromWorkers;                                  // Frames for the nodes, the thread is the consumer
+    Channel* control;                                       // Messages from the main thread
+    uint64_t nextConnection;
+    unordered_map<uint64_t, SequencerConnection>* connections;
+    unordered_map<uint32_t, unordered_map<BackplanePeer*, int>>* subscriptions;    // Members of each room, by node
+    unordered_map<BackplanePeer*, SequencerNode*>* nodes;
+    thread* runner;
+    bool isRunning;
+    EpollStats stats;
+};
+
+/**
+ * Creates the sequencer and starts listening on its socket, but doesn't accept the nodes yet
+ * @param index Index of the sequencer among the I/O threads, less than SERVER_MAX_THREADS
+ * @param maxEvents Maximum number of events handled after a single wakeup
+ * @param path Path of the Unix domain socket of the backplane
+ * @param workerCount Number of the game threads
+ * @param toWorkers The channels to the game threads, the array has to outlive the thread
+ * @param fromWorkers The channels from the game threads, the array has to outlive the thread
+ * @param control The channel from the main thread
+ * @return The sequencer
+ */
+Sequencer* sequencerCreate(int index, int maxEvents, const char* path, int workerCount, Channel** toWorkers,
+                           Channel** fromWorkers, Channel* control){
+    auto sequencer = new Sequencer();
+    sequencer->index = index;
+    sequencer->sockFd = backplaneListen(path);
+    sequencer->path = path;
+    sequencer->epoll = epollCreate(maxEvents);
+    sequencer->epollHandler = epollCreateHandler(sequencer->sockFd);
+    epollHandlerSetOnInput(sequencer->epollHandler, sequencerAccept);
+    *(Sequencer**)epollHandlerData(sequencer->epollHandler) = sequencer;
+    sequencer->workerCount = workerCount;
+    sequencer->toWorkers = toWorkers;
+    sequencer->fromWorkers = fromWorkers;
+    sequencer->control = control;
+    sequencer->nextConnection = 0;
+    sequencer->connections = new unordered_map<uint64_t, SequencerConnection>();
+    sequencer->subscriptions = new unordered_map<uint32_t, unordered_map<BackplanePeer*, int>>();
+    sequencer->nodes = new unordered_map<BackplanePeer*, SequencerNode*>();
+    sequencer->runner = nullptr;
+    sequencer->isRunning = true;
+    sequencer->stats = {};
+    return sequencer;
+}
+
+/**
+ * Starts accepting the nodes on a new thread
+ * @param sequencer The sequencer
+ */
+void sequencerStart(Sequencer* sequencer){
+    epollRegisterHandler(sequencer->epoll, sequencer->epollHandler);
+    epollSetHandledEvents(sequencer->epollHandler, EPOLLIN);
+    for(int i = 0; i < sequencer->workerCount; i++){
+        channelAttachProducer(sequencer->toWorkers[i], sequencer->epoll);
+        channelAttachConsumer(sequencer->fromWorkers[i], sequencer->epoll, sequencerOnReceive, sequencer);
+    }
+    channelAttachConsumer(sequencer->control, sequencer->epoll, sequencerOnControl, sequencer);
+    sequencer->runner = new std::thread(sequencerRun, sequencer);
+    LOG_INFO(LOG_SOURCE_MAIN, "Hosting the backplane on {}", sequencer->path);
+}
+
+/**
+ * Waits until the thread finishes, after the main thread has sent it CHANNEL_STOP
+ * @param sequencer The sequencer
+ */
+void sequencerJoin(Sequencer* sequencer){
+    if(sequencer->runner == nullptr) return;
+    sequencer->runner->join();
+    delete sequencer->runner;
+    sequencer->runner = nullptr;
+}
+
+/**
+ * Releases the sequencer that has finished. The channels are left to their owner
+ * @param sequencer The sequencer
+ */
+void sequencerRelease(Sequencer* sequencer){
+    delete sequencer->connections;
+    delete sequencer->subscriptions;
+    delete sequencer->nodes;
+    delete sequencer;
+}
+
+/**
+ * Returns the event loop statistics of the sequencer that has finished
+ * @param sequencer The sequencer
+ */
+const EpollStats* sequencerGetStats(Sequencer* sequencer){
+    return &sequencer->stats;
+}
+
+/**
+ * Runs the event loop until the main thread stops it, then disconnects the nodes and releases the loop
+ * @param sequencer The sequencer
+ */
+void sequencerRun(Sequencer* sequencer){
+    while(sequencer->isRunning){
+        epollWaitForEvent(sequencer->epoll);
+    }
+
+    // The nodes finish once their backplane connection is closed
+    for(auto& entry : *sequencer->nodes){
+        backplanePeerClose(entry.first);
+        delete entry.second;
+    }
+    epollUnregisterHandler(sequencer->epollHandler);
+    epollReleaseHandler(sequencer->epollHandler);
+    close(sequencer->sockFd);
+    unlink(sequencer->path.c_str());
+    for(int i = 0; i < sequencer->workerCount; i++){
+        channelDetachProducer(sequencer->toWorkers[i]);
+        channelDetachConsumer(sequencer->fromWorkers[i]);
+    }
+    channelDetachConsumer(sequencer->control);
+    sequencer->stats = *epollGetStats(sequencer->epoll);
+    epollRelease(sequencer->epoll);
+    LOG_INFO(LOG_SOURCE_MAIN, "Backplane closed.");
+}
+
+/**
+ * Accepts the nodes connecting to the backplane
+ * @param sender The listening socket's handler
+ */
+void sequencerAccept(EpollHandler* sender){
+    Sequencer* sequencer = *(Sequencer**)epollHandlerData(sender);
+    while(true){
+        int peerSocket = accept4(sequencer->sockFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(peerSocket == -1){
+            if(errno == EINTR) continue;
+            return;
+        }
+        auto node = new SequencerNode();
+        node->sequencer = sequencer;
+        BackplanePeer* peer = backplanePeerCreate(peerSocket, sequencer->epoll, sequencerOnPeerMessage, sequencerOnPeerClose, node);
+        sequencer->nodes->emplace(peer, node);
+    }
+}
+
+/**
+ * Passes the message from a node to the game thread serving the connection. The node's connection identifiers
+ * are replaced with the sequencer's own ones, which lead the game threads' messages back here
+ * @param peer The node
+ * @param message The message, its frame is taken over
+ */
+void sequencerOnPeerMessage(BackplanePeer* peer, const ChannelMessage& message){
+    auto node = (SequencerNode*)backplanePeerGetData(peer);
+    Sequencer* sequencer = node->sequencer;
+    uint64_t connection;
+    if(message.kind == CHANNEL_CONNECT){
+        sequencer->nextConnection++;
+        connection = sequencer->nextConnection * SERVER_MAX_THREADS + sequencer->index;
+        int worker = (int)(sequencer->nextConnection % sequencer->workerCount);
+        node->connections[message.connection] = connection;
+        sequencer->connections->emplace(connection, SequencerConnection { peer, message.connection, worker, 0 });
+    }else{
+        auto entry = node->connections.find(message.connection);
+        if(entry == node->connections.end()){
+            if(message.frame != nullptr) frameRelease(message.frame);
+            return;
+        }
+        connection = entry->second;
+    }
+
+    auto entry = sequencer->connections->find(connection);
+    Channel* toWorker = sequencer->toWorkers[entry->second.worker];
+    switch(message.kind){
+        case CHANNEL_CONNECT:
+        case CHANNEL_REQUEST:
+        case CHANNEL_SYNC:
+            // The time the node has received the request from the client orders it among the requests of the other nodes
+            channelPush(toWorker, message.kind, connection, message.time, message.frame);
+            break;
+        case CHANNEL_DISCONNECT:
+            node->connections.erase(message.connection);
+            sequencerDisconnect(sequencer, connection);
+            if(message.frame != nullptr) frameRelease(message.frame);
+            break;
+        default:
+            if(message.frame != nullptr) frameRelease(message.frame);
+    }
+}
+
+/**
+ * Handles a node leaving the backplane. The game learns that all its connections have been closed
+ * @param peer The node
+ */
+void sequencerOnPeerClose(BackplanePeer* peer){
+    auto node = (SequencerNode*)backplanePeerGetData(peer);
+    Sequencer* sequencer = node->sequencer;
+    for(auto& entry : node->connections){
+        sequencerDisconnect(sequencer, entry.second);
+    }
+    sequencer->nodes->erase(peer);
+    delete node;
+}
+
+/**
+ * Handles the messages from a game thread: the frames are published to the nodes and the connections are moved
+ * between the game threads, as an I/O thread would do
+ * @param channel The channel from the game thread
+ */
+void sequencerOnReceive(Channel* channel){
+    auto sequencer = (Sequencer*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        auto entry = sequencer->connections->find(message->connection);
+        bool isKnown = entry != sequencer->connections->end();
+        switch(message->kind){
+            case CHANNEL_SEND:
+            case CHANNEL_SYNC:
+                if(isKnown){
+                    backplanePeerSend(entry->second.peer, message->kind, entry->second.nodeConnection, 0, message->frame);
+                }
+                break;
+            case CHANNEL_BROADCAST: {
+                // Published once to every node that has members of the room
+                auto subscribers = sequencer->subscriptions->find(message->room);
+                if(subscribers == sequencer->subscriptions->end()) break;
+                for(auto& subscriber : subscribers->second){
+                    backplanePeerSend(subscriber.first, CHANNEL_BROADCAST, 0, 0, message->frame, message->room);
+                }
+                break;
+            }
+            case CHANNEL_ADD_MEMBER:
+                if(!isKnown || entry->second.room != 0) break;
+                entry->second.room = message->room;
+                (*sequencer->subscriptions)[message->room][entry->second.peer]++;
+                backplanePeerSend(entry->second.peer, CHANNEL_ADD_MEMBER, entry->second.nodeConnection, 0, nullptr, message->room);
+                break;
+            case CHANNEL_REMOVE_MEMBER:
+                if(!isKnown) break;
+                sequencerRemoveMember(sequencer, message->connection);
+                backplanePeerSend(entry->second.peer, CHANNEL_REMOVE_MEMBER, entry->second.nodeConnection, 0, nullptr);
+                break;
+            case CHANNEL_MOVE: {
+                // The game thread of the room handles the connection's requests from now on
+                int worker = (int)(message->room % sequencer->workerCount);
+                if(!isKnown){
+                    channelPush(sequencer->toWorkers[worker], CHANNEL_DISCONNECT, message->connection, metricsNow(), nullptr, message->room);
+                    break;
+                }
+                entry->second.worker = worker;
+                channelPush(sequencer->toWorkers[worker], CHANNEL_CONNECT, message->connection, metricsNow(), nullptr, message->room);
+                channelPush(sequencer->toWorkers[worker], CHANNEL_REQUEST, message->connection, metricsNow(), message->frame);
+                message->frame = nullptr;
+                break;
+            }
+        }
+        if(message->frame != nullptr) frameRelease(message->frame);
+        channelPop(channel);
+    }
+}
+
+/**
+ * Handles the messages from the main thread
+ * @param channel The control channel
+ */
+void sequencerOnControl(Channel* channel){
+    auto sequencer = (Sequencer*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        if(message->kind == CHANNEL_STOP){
+            // The loop finishes after the current wakeup
+            sequencer->isRunning = false;
+        }
+        channelPop(channel);
+    }
+}
+
+/**
+ * Forgets the connection closed by its node and tells its game thread about it
+ * @param sequencer The sequencer
+ * @param connection The sequencer's identifier of the connection
+ */
+void sequencerDisconnect(Sequencer* sequencer, uint64_t connection){
+    auto entry = sequencer->connections->find(connection);
+    if(entry == sequencer->connections->end()) return;
+    sequencerRemoveMember(sequencer, connection);
+    int worker = entry->second.worker;
+    sequencer->connections->erase(entry);
+    channelPush(sequencer->toWorkers[worker], CHANNEL_DISCONNECT, connection, metricsNow(), nullptr);
+}
+
+/**
+ * Stops publishing the broadcasts of the connection's room to its node, unless the node has other members there
+ * @param sequencer The sequencer
+ * @param connection The sequencer's identifier of the connection
+ */
+void sequencerRemoveMember(Sequencer* sequencer, uint64_t connection){
+    SequencerConnection& entry = sequencer->connections->at(connection);
+    if(entry.room == 0) return;
+    auto subscribers = sequencer->subscriptions->find(entry.room);
+    if(--subscribers->second[entry.peer] == 0){
+        subscribers->second.erase(entry.peer);
+        if(subscribers->second.empty()) sequencer->subscriptions->erase(subscribers);
+    }
+    entry.room = 0;
+}
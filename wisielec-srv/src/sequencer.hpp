@@ -0,0 +1,17 @@
+#ifndef SEQUENCER_HPP
+#define SEQUENCER_HPP
+
+struct Sequencer;
+
+#include "channel.hpp"
+#include "epoll.hpp"
+
+Sequencer* sequencerCreate(int index, int maxEvents, const char* path, int workerCount, Channel** toWorkers,
+                           Channel** fromWorkers, Channel* control);
+void sequencerStart(Sequencer* sequencer);
+void sequencerJoin(Sequencer* sequencer);
+void sequencerRelease(Sequencer* sequencer);
+
+const EpollStats* sequencerGetStats(Sequencer* sequencer);
+
+#endif
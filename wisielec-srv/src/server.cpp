@@ -1,51 +1,111 @@
 #include "server.hpp"
 
+#include "log.hpp"
+#include "metrics.hpp"
+#include "game/message.hpp"
+
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
-#include <list>
+#include <cstring>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 using namespace std;
 
+#define SERVER_ACCEPT_BACKOFF_MS 100     // How long the listener waits when no descriptor is left, even for the reserve
+
+#define SERVER_LOG(level, server, format, ...) LOG(level, LOG_SOURCE_SERVER, format, (server)->sockFd __VA_OPT__(,) __VA_ARGS__)
+
 int serverCreateSocket();
 void serverBind(int sockFd, short port);
 void serverListen(int sockFd);
 void serverAccept(EpollHandler* sender);
-void serverLog(Server* server, const string& text);
+void serverOnAccept(EpollHandler* sender, int result);
+void serverAddClient(Server* server, int clientSocket);
+bool serverShedConnection(Server* server);
+void serverOnAcceptBackoff(Timer* timer);
+
+/**
+ * Structure representing a connection of the server
+ */
+struct ServerConnection {
+    Client* client;
+    uint32_t room;              // The room whose broadcasts the client receives, 0 if it isn't a member of any
+    size_t memberPosition;      // Position of the client in the members of the room
+};
 
 /**
- * Structure representing a server
+ * Structure representing the members of a room that are connected to the server
+ */
+struct ServerRoom {
+    vector<Client*> members;
+    vector<uint64_t> connections;   // Connection identifiers of the members, in the same order
+};
+
+/**
+ * Structure representing a server: the listening socket of a single I/O thread and the clients it has accepted.
+ * Every I/O thread listens on the same port, the kernel spreads the connections between them
  */
 struct Server {
     int sockFd;                     // Socket file descriptor
+    int index;                      // Index of the I/O thread the server runs on
     Epoll* epoll;                   // An epoll instance the server is attached to
     EpollHandler* epollHandler;     // A handler that describes reactions to epoll events
-    list<Client*>* clients;         // List of clients that are associated with this server
+    TimerWheel* timers;             // The timing wheel for the timeouts of the clients
+    Timer* acceptTimer;             // Re-arms the listener after it has run out of descriptors
+    int reserveFd;                  // Kept open to be freed for accepting and closing a connection when no descriptor is left
+    Channel** toWorkers;            // Pass the requests to the game threads, by their indices
+    int workerCount;
+    ClientLimits limits;            // Limits of all the clients
+    Journal* journal;               // Captures the received traffic, nullptr unless it's being captured
+    uint64_t nextConnection;        // Counter of the accepted connections
+    unordered_map<uint64_t, ServerConnection>* connections;     // The clients by their connection identifiers
+    unordered_map<uint32_t, ServerRoom>* rooms;                 // The members of the rooms
 };
 
 
 /**
  * Creates a new instance of server but doesn't start it
+ * @param index Index of the I/O thread the server runs on, less than SERVER_MAX_THREADS
+ * @param toWorkers The channels to the game threads, the server is their producer
+ * @param workerCount Number of the game threads
  * @return The server
  */
-Server* serverCreate() {
+Server* serverCreate(int index, Channel** toWorkers, int workerCount) {
     // Create a new server struct and fill it
     auto server = new Server();
     server->sockFd = serverCreateSocket();
+    server->index = index;
     server->epoll = nullptr;
+    server->timers = nullptr;
+    server->acceptTimer = nullptr;
+    server->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    server->toWorkers = toWorkers;
+    server->workerCount = workerCount;
+    server->nextConnection = 0;
+    server->limits.idleTimeoutMs = CLIENT_DEFAULT_IDLE_TIMEOUT_MS;
+    server->limits.lowWatermark = CLIENT_DEFAULT_LOW_WATERMARK;
+    server->limits.highWatermark = CLIENT_DEFAULT_HIGH_WATERMARK;
+    server->journal = nullptr;
     server->epollHandler = epollCreateHandler(server->sockFd);
     epollHandlerSetOnInput(server->epollHandler, serverAccept);
-    server->clients = new list<Client*>();
+    epollHandlerSetOnAccept(server->epollHandler, serverOnAccept);
+    server->connections = new unordered_map<uint64_t, ServerConnection>();
+    server->rooms = new unordered_map<uint32_t, ServerRoom>();
 
     // Store a pointer to server in the epollHandler
     *(Server**)(epollHandlerData(server->epollHandler)) = server;
 
-    serverLog(server, "Created server");
+    SERVER_LOG(LOG_LEVEL_INFO, server, "Created server");
     return server;
 }
 
@@ -54,15 +114,56 @@ Server* serverCreate() {
  * @param server The server to start
  * @param port The port on which to listen
  * @param epoll The epoll instance to attach to
+ * @param timers The timing wheel attached to the same epoll instance
  */
-void serverStart(Server* server, short port, Epoll* epoll) {
+void serverStart(Server* server, short port, Epoll* epoll, TimerWheel* timers) {
     server->epoll = epoll;
+    server->timers = timers;
+    server->acceptTimer = timerCreate(timers, serverOnAcceptBackoff, server);
     serverBind(server->sockFd, port);
     serverListen(server->sockFd);
     epollRegisterHandler(epoll, server->epollHandler);
     epollSetHandledEvents(server->epollHandler, EPOLLIN);
 
-    serverLog(server, "Started server on port " + to_string(port));
+    SERVER_LOG(LOG_LEVEL_INFO, server, "Started server on port {}", port);
+}
+
+/**
+ * Sets after how long the clients that don't send anything are closed
+ * @param server The server
+ * @param timeoutMs The timeout in milliseconds, 0 to never close the idle clients
+ */
+void serverSetIdleTimeout(Server* server, uint64_t timeoutMs) {
+    server->limits.idleTimeoutMs = timeoutMs;
+}
+
+/**
+ * Sets how many bytes may wait to be sent to a client. A client above the high watermark
+ * is closed unless it gets below the low watermark within a few seconds
+ * @param server The server
+ * @param low The low watermark in bytes
+ * @param high The high watermark in bytes
+ */
+void serverSetWatermarks(Server* server, size_t low, size_t high) {
+    server->limits.lowWatermark = low;
+    server->limits.highWatermark = high;
+}
+
+/**
+ * Makes the server capture the connections and the frames its clients receive
+ * @param server The server
+ * @param journal The journal shared by all the servers, nullptr to stop capturing
+ */
+void serverSetJournal(Server* server, Journal* journal) {
+    server->journal = journal;
+}
+
+/**
+ * Returns the journal capturing the received traffic, nullptr unless it's being captured
+ * @param server The server
+ */
+Journal* serverGetJournal(Server* server) {
+    return server->journal;
 }
 
 /**
@@ -70,7 +171,7 @@ void serverStart(Server* server, short port, Epoll* epoll) {
  * @return Socket descriptor
  */
 int serverCreateSocket(){
-    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if(serverSocket == -1){
         perror("Failed to create socket");
         exit(1);
@@ -79,6 +180,8 @@ int serverCreateSocket(){
     // Enable REUSE_ADDR option - so that we can use the recently abandoned port
     int one = 1;
     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Enable REUSE_PORT option - so that every I/O thread can have its own listening socket
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
     return serverSocket;
 }
 
@@ -103,29 +206,123 @@ void serverBind(int sockFd, short port) {
  * @param sockFd Socket descriptor
  */
 void serverListen(int sockFd){
-    if(listen(sockFd, 16) == -1){
+    if(listen(sockFd, SOMAXCONN) == -1){
         throw runtime_error("Failed to listen on the socket.");
     }
 }
 
 /**
- * Accepts the incoming connection
+ * Accepts all the incoming connections, with epoll. The client sockets are non-blocking
  * @param sender The handler that received the input event
  */
 void serverAccept(EpollHandler* sender){
     // Read the server
     Server* server = *(Server**)epollHandlerData(sender);
 
-    // Accept the connection
-    sockaddr_in clientAddress {};
-    socklen_t clientAddressLength = sizeof(clientAddress);
-    int clientSocket = accept(server->sockFd, (struct sockaddr*)&clientAddress, &clientAddressLength);
+    while(true){
+        // Accept the connection
+        sockaddr_in clientAddress {};
+        socklen_t clientAddressLength = sizeof(clientAddress);
+        int clientSocket = accept4(server->sockFd, (struct sockaddr*)&clientAddress, &clientAddressLength, SOCK_NONBLOCK);
+        if(clientSocket == -1){
+            if(errno == EINTR) continue;
+            // The listener is level-triggered, a connection left in the backlog would wake the loop up again at once
+            if(errno == EMFILE || errno == ENFILE){
+                if(serverShedConnection(server)) continue;
+                return;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                SERVER_LOG(LOG_LEVEL_ERROR, server, "Failed to accept the client: {}", strerror(errno));
+            }
+            return;
+        }
+        serverAddClient(server, clientSocket);
+    }
+}
+
+/**
+ * Takes a connection accepted by the listener's multishot accept, with io_uring
+ * @param sender The handler of the listener
+ * @param result The socket of the connection or -errno
+ */
+void serverOnAccept(EpollHandler* sender, int result){
+    Server* server = *(Server**)epollHandlerData(sender);
+    if(result == -EMFILE || result == -ENFILE){
+        // The kernel has ended the accept, it's armed again unless the listener is paused
+        while(serverShedConnection(server));
+        return;
+    }
+    if(result < 0){
+        SERVER_LOG(LOG_LEVEL_ERROR, server, "Failed to accept the client: {}", strerror(-result));
+        return;
+    }
+    serverAddClient(server, result);
+}
+
+/**
+ * Creates a new client representing the accepted connection and stores it. The game learns about it first,
+ * on the game thread picked by the connection counter, until the client joins a room
+ * @param server The server
+ * @param clientSocket The socket of the connection
+ */
+void serverAddClient(Server* server, int clientSocket){
+    // The output is already coalesced into one write per wakeup, Nagle's algorithm would only hold
+    // the replies back until the client's delayed ACK
+    int one = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    SERVER_LOG(LOG_LEVEL_INFO, server, "Accepted client on socket {}", clientSocket);
+
+    metricAdd(&metricConnectionsAccepted, 1);
+    metricAdd(&metricConnectionsActive, 1);
 
-    serverLog(server, "Accepted client on socket " + to_string(clientSocket));
+    server->nextConnection++;
+    uint64_t connection = server->nextConnection * SERVER_MAX_THREADS + server->index;
+    int worker = (int)(server->nextConnection % server->workerCount);
+    channelPush(server->toWorkers[worker], CHANNEL_CONNECT, connection, metricsNow(), nullptr);
+    if(server->journal != nullptr) {
+        journalAppend(server->journal, JOURNAL_CONNECT, connection);
+    }
+    Client* c = clientCreate(clientSocket, server->epoll, server, server->timers, &server->limits, connection, worker);
+    server->connections->emplace(connection, ServerConnection { c, 0, 0 });
+}
+
+/**
+ * Drops a connection waiting in the backlog when no descriptor is left to accept it with. The reserve descriptor
+ * is freed to accept the connection and close it at once, so the client learns it isn't served. If the reserve is gone,
+ * the listener stops reporting the connections for a while instead
+ * @param server The server
+ * @return True if a connection has been dropped and the next one may be accepted
+ */
+bool serverShedConnection(Server* server){
+    if(server->reserveFd != -1){
+        close(server->reserveFd);
+        int clientSocket = accept(server->sockFd, nullptr, nullptr);
+        int error = errno;
+        if(clientSocket != -1){
+            close(clientSocket);
+        }
+        server->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if(clientSocket != -1){
+            SERVER_LOG(LOG_LEVEL_WARNING, server, "Dropped a client, no file descriptor is left");
+            return true;
+        }
+        // The connection has gone away in the meantime
+        if(error == EAGAIN || error == EWOULDBLOCK || error == ECONNABORTED) return false;
+    }
+    SERVER_LOG(LOG_LEVEL_WARNING, server, "No file descriptor is left, pausing accepting the clients for {} ms", SERVER_ACCEPT_BACKOFF_MS);
+    epollSetHandledEvents(server->epollHandler, 0);
+    timerSchedule(server->acceptTimer, SERVER_ACCEPT_BACKOFF_MS);
+    return false;
+}
 
-    // Create a new client representing the connection and store it
-    Client* c = clientCreate(clientSocket, server->epoll, server);
-    server->clients->push_back(c);
+/**
+ * Re-arms the listener after the backoff, the connections that have waited are accepted by the next input event
+ * @param timer The accept timer of the server
+ */
+void serverOnAcceptBackoff(Timer* timer){
+    auto server = (Server*)timerGetData(timer);
+    epollSetHandledEvents(server->epollHandler, EPOLLIN);
 }
 
 /**
@@ -134,18 +331,25 @@ void serverAccept(EpollHandler* sender){
  */
 void serverClose(Server* server) {
     // First, close all the remaining clients
-    while(server->clients->begin() != server->clients->end()){
-        auto c = server->clients->begin();
-        clientClose(*c);
+    while(!server->connections->empty()){
+        clientClose(server->connections->begin()->second.client);
     }
 
     // Then close the socket
+    if(server->acceptTimer != nullptr){
+        timerRelease(server->acceptTimer);
+    }
+    if(server->reserveFd != -1){
+        close(server->reserveFd);
+    }
     epollUnregisterHandler(server->epollHandler);
     epollReleaseHandler(server->epollHandler);
     shutdown(server->sockFd, SHUT_RDWR);
     close(server->sockFd);
 
-    serverLog(server, "Closed server");
+    SERVER_LOG(LOG_LEVEL_INFO, server, "Closed server");
+    delete server->connections;
+    delete server->rooms;
     delete server;
 }
 
@@ -155,10 +359,142 @@ void serverClose(Server* server) {
  * @param client The client that's closing
  */
 void serverOnClientClose(Server* server, Client* client) {
-    // Remove the closed client from the list
-    server->clients->remove(client);
+    metricAdd(&metricConnectionsClosed, 1);
+    metricAdd(&metricConnectionsActive, -1);
+
+    // Remove the closed client from the map, the game learns about it last
+    uint64_t connection = clientGetConnection(client);
+    serverRemoveMember(server, connection);
+    server->connections->erase(connection);
+    channelPush(server->toWorkers[clientGetWorker(client)], CHANNEL_DISCONNECT, connection, metricsNow(), nullptr);
+    if(server->journal != nullptr) {
+        journalAppend(server->journal, JOURNAL_DISCONNECT, connection);
+    }
+}
+
+/**
+ * Passes the request to the game thread serving the client, stamped with the current time
+ * @param server The server
+ * @param client The client that sent the request
+ * @param frame The frame holding the request, the server takes over the caller's reference
+ * @return True if the request may hand the client over to another game thread. The client's next requests
+ *         must wait until the game thread confirms handling it, they would go to the old thread otherwise
+ */
+bool serverPostRequest(Server* server, Client* client, Frame* frame) {
+    bool isJoin = (uint8_t)frameGetPayload(frame)[0] == (MDIR_REQUEST | MTYPE_JOIN);
+    channelPush(server->toWorkers[clientGetWorker(client)], CHANNEL_REQUEST, clientGetConnection(client), metricsNow(), frame);
+    return isJoin;
 }
 
-void serverLog(Server* server, const string& text) {
-    printf("\x1b[1;35m[SERVER: %d]\x1b[0m %s\n", server->sockFd, text.c_str());
+/**
+ * Asks the game thread serving the client to confirm that it has handled the client's requests
+ * @param server The server
+ * @param client The client that waits for the confirmation
+ */
+void serverPostSync(Server* server, Client* client) {
+    channelPush(server->toWorkers[clientGetWorker(client)], CHANNEL_SYNC, clientGetConnection(client), metricsNow(), nullptr);
+}
+
+/**
+ * Passes the game thread's confirmation to the client
+ * @param server The server
+ * @param connection The connection that has waited for the confirmation, ignored if it has been closed in the meantime
+ */
+void serverOnSync(Server* server, uint64_t connection) {
+    auto entry = server->connections->find(connection);
+    if(entry == server->connections->end()) return;
+    clientOnSync(entry->second.client);
+}
+
+/**
+ * Hands the connection over to the game thread that runs the room. The request is handled there,
+ * the requests sent before it are handled by the previous game thread.
+ * The game thread of a room is the room's identifier modulo the number of the game threads
+ * @param server The server
+ * @param connection The connection that's moving
+ * @param room The room the connection has a seat in
+ * @param frame The request to handle on the new game thread, the server takes over the caller's reference
+ */
+void serverMove(Server* server, uint64_t connection, uint32_t room, Frame* frame) {
+    Channel* toWorker = server->toWorkers[room % server->workerCount];
+    auto entry = server->connections->find(connection);
+    if(entry == server->connections->end()) {
+        // The seat is given back by the game thread of the room
+        frameRelease(frame);
+        channelPush(toWorker, CHANNEL_DISCONNECT, connection, metricsNow(), nullptr, room);
+        return;
+    }
+    clientSetWorker(entry->second.client, (int)(room % server->workerCount));
+    channelPush(toWorker, CHANNEL_CONNECT, connection, metricsNow(), nullptr, room);
+    channelPush(toWorker, CHANNEL_REQUEST, connection, metricsNow(), frame);
+}
+
+/**
+ * Sends the frame to the client. The frames for the connections that have been closed in the meantime are dropped
+ * @param server The server
+ * @param connection The connection to send the frame to
+ * @param frame The frame to send
+ */
+void serverSend(Server* server, uint64_t connection, Frame* frame) {
+    auto entry = server->connections->find(connection);
+    if(entry == server->connections->end()) return;
+    clientWriteFrame(entry->second.client, frame);
+}
+
+/**
+ * Sends the frame to all the members of the room
+ * @param server The server
+ * @param room The room
+ * @param frame The frame to send
+ */
+void serverBroadcast(Server* server, uint32_t room, Frame* frame) {
+    auto entry = server->rooms->find(room);
+    if(entry == server->rooms->end()) return;
+    for(Client* client : entry->second.members) {
+        clientWriteFrame(client, frame);
+    }
+}
+
+/**
+ * Makes the client receive the broadcasts of the room
+ * @param server The server
+ * @param connection The client's connection, ignored if it has been closed in the meantime
+ * @param room The room
+ */
+void serverAddMember(Server* server, uint64_t connection, uint32_t room) {
+    auto entry = server->connections->find(connection);
+    if(entry == server->connections->end() || entry->second.room != 0) return;
+
+    ServerRoom& members = (*server->rooms)[room];
+    entry->second.room = room;
+    entry->second.memberPosition = members.members.size();
+    members.members.push_back(entry->second.client);
+    members.connections.push_back(connection);
+}
+
+/**
+ * Stops sending the broadcasts to the client
+ * @param server The server
+ * @param connection The client's connection
+ */
+void serverRemoveMember(Server* server, uint64_t connection) {
+    auto entry = server->connections->find(connection);
+    if(entry == server->connections->end() || entry->second.room == 0) return;
+
+    // Move the last member into the removed one's place
+    auto room = server->rooms->find(entry->second.room);
+    ServerRoom& members = room->second;
+    size_t position = entry->second.memberPosition;
+    uint64_t lastConnection = members.connections.back();
+    if(lastConnection != connection) {
+        members.members[position] = members.members.back();
+        members.connections[position] = lastConnection;
+        (*server->connections)[lastConnection].memberPosition = position;
+    }
+    members.members.pop_back();
+    members.connections.pop_back();
+    entry->second.room = 0;
+    if(members.members.empty()) {
+        server->rooms->erase(room);
+    }
 }
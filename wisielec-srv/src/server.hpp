@@ -3,13 +3,31 @@
 
 struct Server;
 
+#include "channel.hpp"
 #include "epoll.hpp"
 #include "client.hpp"
+#include "journal.hpp"
+#include "timer.hpp"
 
-Server* serverCreate();
-void serverStart(Server* server, short port, Epoll* epoll);
+#define SERVER_MAX_THREADS 256     // A connection identifier modulo this number is the index of its I/O thread
+
+Server* serverCreate(int index, Channel** toWorkers, int workerCount);
+void serverStart(Server* server, short port, Epoll* epoll, TimerWheel* timers);
+void serverSetIdleTimeout(Server* server, uint64_t timeoutMs);
+void serverSetWatermarks(Server* server, size_t low, size_t high);
+void serverSetJournal(Server* server, Journal* journal);
+Journal* serverGetJournal(Server* server);
 void serverClose(Server* server);
 
 void serverOnClientClose(Server* server, Client* client);
+bool serverPostRequest(Server* server, Client* client, Frame* frame);
+void serverPostSync(Server* server, Client* client);
+void serverOnSync(Server* server, uint64_t connection);
+void serverMove(Server* server, uint64_t connection, uint32_t room, Frame* frame);
+
+void serverSend(Server* server, uint64_t connection, Frame* frame);
+void serverBroadcast(Server* server, uint32_t room, Frame* frame);
+void serverAddMember(Server* server, uint64_t connection, uint32_t room);
+void serverRemoveMember(Server* server, uint64_t connection);
 
 #endif
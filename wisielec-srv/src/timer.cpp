@@ -0,0 +1,348 @@
+#include "timer.hpp"
+
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+using namespace std;
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_MAX_DELTA ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS))    // About 4.6 hours in milliseconds
+#define TIMER_NONE UINT64_MAX
+
+void timerWheelOnExpire(EpollHandler* sender);
+void timerWheelAdvance(TimerWheel* wheel, uint64_t now);
+void timerWheelProcessTick(TimerWheel* wheel);
+void timerWheelArm(TimerWheel* wheel);
+uint64_t timerWheelGetNextTick(TimerWheel* wheel);
+void timerWheelPlace(TimerWheel* wheel, Timer* timer);
+void timerWheelUnlink(TimerWheel* wheel, Timer* timer);
+
+/**
+ * Structure representing a hierarchical timing wheel with a tick of one millisecond.
+ * Every level has 64 slots, each slot of a level covering 64 times longer time than a slot of the level below.
+ * A timer is put on the lowest level that covers its expiry, and moved down when the wheel reaches its slot.
+ * Scheduling and cancelling take O(1). The timerfd is armed for the next occupied slot only,
+ * so the event loop isn't woken up when there's nothing to do
+ */
+struct TimerWheel {
+    int fd;                                         // The timerfd
+    Epoll* epoll;
+    EpollHandler* epollHandler;
+    uint64_t current;                               // The tick the wheel has been processed up to
+    uint64_t armedTick;                             // The tick the timerfd is set to, TIMER_NONE if disarmed
+    Timer* slots[TIMER_LEVELS][TIMER_SLOTS];        // Doubly linked lists of the timers
+    uint64_t occupied[TIMER_LEVELS];                // Bitmasks of the non-empty slots
+};
+
+/**
+ * Structure representing a single timer. It can be scheduled any number of times
+ */
+struct Timer {
+    TimerWheel* wheel;
+    TimerHandler handler;
+    void* data;
+    uint64_t expires;           // The tick the timer expires on
+    Timer* previous;
+    Timer* next;
+    int level;                  // Position in the wheel, the level is -1 if the timer isn't scheduled
+    int slot;
+    bool isInPlace;             // Whether the timer was created in memory provided by the caller
+};
+
+/**
+ * Creates the timing wheel and attaches it to the epoll instance
+ * @param epoll The epoll instance that dispatches the timer expirations
+ * @return The timing wheel
+ */
+TimerWheel* timerWheelCreate(Epoll* epoll){
+    auto wheel = new TimerWheel();
+    wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(wheel->fd == -1){
+        delete wheel;
+        throw runtime_error("Failed to create the timer.");
+    }
+    wheel->epoll = epoll;
+    wheel->current = epollGetTime(epoll) / 1000000;
+    wheel->armedTick = TIMER_NONE;
+
+    wheel->epollHandler = epollCreateHandler(wheel->fd);
+    epollHandlerSetOnInput(wheel->epollHandler, timerWheelOnExpire);
+    *(TimerWheel**)(epollHandlerData(wheel->epollHandler)) = wheel;
+    epollRegisterHandler(epoll, wheel->epollHandler);
+    epollSetHandledEvents(wheel->epollHandler, EPOLLIN);
+    return wheel;
+}
+
+/**
+ * Releases the timing wheel. The timers that are still scheduled never expire
+ * @param wheel The timing wheel
+ */
+void timerWheelRelease(TimerWheel* wheel){
+    epollUnregisterHandler(wheel->epollHandler);
+    epollReleaseHandler(wheel->epollHandler);
+    close(wheel->fd);
+    delete wheel;
+}
+
+/**
+ * Returns the time of the current event loop wakeup in milliseconds. The clock is monotonic
+ * @param wheel The timing wheel
+ */
+uint64_t timerWheelGetTime(TimerWheel* wheel){
+    return epollGetTime(wheel->epoll) / 1000000;
+}
+
+/**
+ * Creates a timer that isn't scheduled yet
+ * @param wheel The timing wheel
+ * @param handler The function called when the timer expires
+ * @param data Any data the handler needs
+ * @return The timer
+ */
+Timer* timerCreate(TimerWheel* wheel, TimerHandler handler, void* data){
+    Timer* timer = timerCreate(wheel, handler, data, new Timer());
+    timer->isInPlace = false;
+    return timer;
+}
+
+/**
+ * Creates a timer in the provided memory. The memory must be freed by the caller after releasing the timer
+ * @param wheel The timing wheel
+ * @param handler The function called when the timer expires
+ * @param data Any data the handler needs
+ * @param memory At least timerGetSize() bytes
+ * @return The timer
+ */
+Timer* timerCreate(TimerWheel* wheel, TimerHandler handler, void* data, void* memory){
+    auto timer = new(memory) Timer();
+    timer->wheel = wheel;
+    timer->handler = handler;
+    timer->data = data;
+    timer->level = -1;
+    timer->isInPlace = true;
+    return timer;
+}
+
+/**
+ * Cancels and releases the timer. Can be called from the timer's own handler
+ * @param timer The timer
+ */
+void timerRelease(Timer* timer){
+    timerCancel(timer);
+    if(!timer->isInPlace){
+        delete timer;
+    }
+}
+
+/**
+ * Returns the number of bytes needed to create a timer in place
+ */
+size_t timerGetSize(){
+    return sizeof(Timer);
+}
+
+/**
+ * Schedules the timer, replacing its previous schedule
+ * @param timer The timer
+ * @param delayMs Number of milliseconds from the current event loop wakeup
+ */
+void timerSchedule(Timer* timer, uint64_t delayMs){
+    TimerWheel* wheel = timer->wheel;
+    timerCancel(timer);
+
+    // The current tick has already been processed
+    timer->expires = timerWheelGetTime(wheel) + delayMs;
+    if(timer->expires <= wheel->current){
+        timer->expires = wheel->current + 1;
+    }
+    timerWheelPlace(wheel, timer);
+
+    // Rescheduling usually moves the timer further, then the timerfd doesn't change
+    if(wheel->armedTick == TIMER_NONE || timer->expires < wheel->armedTick){
+        timerWheelArm(wheel);
+    }
+}
+
+/**
+ * Cancels the timer if it's scheduled. The timerfd is left as it is, an extra wakeup is cheaper than a syscall
+ * @param timer The timer
+ */
+void timerCancel(Timer* timer){
+    if(timer->level < 0) return;
+    timerWheelUnlink(timer->wheel, timer);
+}
+
+/**
+ * Checks if the timer is scheduled
+ * @param timer The timer
+ */
+bool timerIsScheduled(Timer* timer){
+    return timer->level >= 0;
+}
+
+/**
+ * Returns the data given when the timer was created
+ * @param timer The timer
+ */
+void* timerGetData(Timer* timer){
+    return timer->data;
+}
+
+/**
+ * Handles the timerfd expiration: runs the handlers of all the expired timers
+ * @param sender The handler of the timerfd
+ */
+void timerWheelOnExpire(EpollHandler* sender){
+    TimerWheel* wheel = *(TimerWheel**)epollHandlerData(sender);
+    uint64_t expirations;
+    while(read(wheel->fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR);
+
+    wheel->armedTick = TIMER_NONE;
+    timerWheelAdvance(wheel, timerWheelGetTime(wheel));
+    timerWheelArm(wheel);
+}
+
+/**
+ * Processes the wheel up to the given time. The ticks without any timers are skipped
+ * @param wheel The timing wheel
+ * @param now The time in milliseconds
+ */
+void timerWheelAdvance(TimerWheel* wheel, uint64_t now){
+    while(true){
+        uint64_t next = timerWheelGetNextTick(wheel);
+        if(next > now) break;
+        wheel->current = next;
+        timerWheelProcessTick(wheel);
+    }
+    if(now > wheel->current){
+        wheel->current = now;
+    }
+}
+
+/**
+ * Processes the current tick: moves the timers of the higher levels down, if the tick starts their slots,
+ * and runs the handlers of the timers that expire on it
+ * @param wheel The timing wheel
+ */
+void timerWheelProcessTick(TimerWheel* wheel){
+    uint64_t tick = wheel->current;
+    for(int level = TIMER_LEVELS - 1; level > 0; level--){
+        int shift = level * TIMER_SLOT_BITS;
+        if((tick & (((uint64_t)1 << shift) - 1)) != 0) continue;
+
+        int slot = (int)((tick >> shift) & (TIMER_SLOTS - 1));
+        Timer* timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = nullptr;
+        wheel->occupied[level] &= ~((uint64_t)1 << slot);
+        while(timer != nullptr){
+            Timer* next = timer->next;
+            timerWheelPlace(wheel, timer);
+            timer = next;
+        }
+    }
+
+    // The handlers can schedule and cancel any timers, so the slot is read again every time
+    int slot = (int)(tick & (TIMER_SLOTS - 1));
+    while(wheel->slots[0][slot] != nullptr){
+        Timer* timer = wheel->slots[0][slot];
+        timerWheelUnlink(wheel, timer);
+        timer->handler(timer);
+    }
+}
+
+/**
+ * Sets the timerfd to the next tick that has anything to process, or disarms it
+ * @param wheel The timing wheel
+ */
+void timerWheelArm(TimerWheel* wheel){
+    uint64_t next = timerWheelGetNextTick(wheel);
+    if(next == wheel->armedTick) return;
+
+    itimerspec spec {};
+    if(next != TIMER_NONE){
+        spec.it_value.tv_sec = (time_t)(next / 1000);
+        spec.it_value.tv_nsec = (long)(next % 1000) * 1000000;
+    }
+    timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    wheel->armedTick = next;
+}
+
+/**
+ * Finds the next tick that has anything to process: either timers expiring, or timers to be moved down
+ * @param wheel The timing wheel
+ * @return The tick or TIMER_NONE if there are no timers
+ */
+uint64_t timerWheelGetNextTick(TimerWheel* wheel){
+    uint64_t next = TIMER_NONE;
+    for(int level = 0; level < TIMER_LEVELS; level++){
+        uint64_t mask = wheel->occupied[level];
+        if(mask == 0) continue;
+
+        // The first occupied slot after the current one, with the slots rotated so that it's the lowest bit
+        int shift = level * TIMER_SLOT_BITS;
+        uint64_t base = (wheel->current >> shift) + 1;
+        int start = (int)(base & (TIMER_SLOTS - 1));
+        uint64_t rotated = start == 0 ? mask : (mask >> start) | (mask << (TIMER_SLOTS - start));
+        uint64_t tick = (base + __builtin_ctzll(rotated)) << shift;
+        if(tick < next) next = tick;
+    }
+    return next;
+}
+
+/**
+ * Puts the timer in the slot that covers its expiry
+ * @param wheel The timing wheel
+ * @param timer The timer, not linked into any slot
+ */
+void timerWheelPlace(TimerWheel* wheel, Timer* timer){
+    uint64_t expires = timer->expires;
+    if(expires < wheel->current) expires = wheel->current;
+    uint64_t delta = expires - wheel->current;
+    if(delta >= TIMER_MAX_DELTA){
+        // Too far away, the timer is moved down the highest level until it's close enough
+        expires = wheel->current + TIMER_MAX_DELTA - 1;
+        delta = TIMER_MAX_DELTA - 1;
+    }
+
+    int level = 0;
+    while(level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TIMER_SLOT_BITS))){
+        level++;
+    }
+    int slot = (int)((expires >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1));
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->previous = nullptr;
+    timer->next = wheel->slots[level][slot];
+    if(timer->next != nullptr){
+        timer->next->previous = timer;
+    }
+    wheel->slots[level][slot] = timer;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+/**
+ * Removes the timer from its slot
+ * @param wheel The timing wheel
+ * @param timer The scheduled timer
+ */
+void timerWheelUnlink(TimerWheel* wheel, Timer* timer){
+    if(timer->previous != nullptr){
+        timer->previous->next = timer->next;
+    }else{
+        wheel->slots[timer->level][timer->slot] = timer->next;
+        if(timer->next == nullptr){
+            wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+        }
+    }
+    if(timer->next != nullptr){
+        timer->next->previous = timer->previous;
+    }
+    timer->level = -1;
+}
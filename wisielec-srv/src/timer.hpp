@@ -0,0 +1,28 @@
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
+#include "epoll.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+struct TimerWheel;
+struct Timer;
+
+typedef void (*TimerHandler)(Timer* timer);
+
+TimerWheel* timerWheelCreate(Epoll* epoll);
+void timerWheelRelease(TimerWheel* wheel);
+uint64_t timerWheelGetTime(TimerWheel* wheel);
+
+Timer* timerCreate(TimerWheel* wheel, TimerHandler handler, void* data);
+Timer* timerCreate(TimerWheel* wheel, TimerHandler handler, void* data, void* memory);
+void timerRelease(Timer* timer);
+size_t timerGetSize();
+
+void timerSchedule(Timer* timer, uint64_t delayMs);
+void timerCancel(Timer* timer);
+bool timerIsScheduled(Timer* timer);
+void* timerGetData(Timer* timer);
+
+#endif
@@ -1,75 +1,353 @@
 #include "unicode.hpp"
 
-u32string utf8ToUtf32(string utf8){
-    char32_t currentChar;
-    u32string utf32 = U"";
+#if defined(__x86_64__) && defined(__GNUC__)
+#define UNICODE_SIMD
+#include <immintrin.h>
+#endif
 
-    for(auto c = utf8.begin(); c < utf8.end(); c++){
-        if((*c & 0x80) == 0){
+size_t utf8CopyAscii(const unsigned char* input, size_t length, char32_t* output);
+size_t utf32CopyAscii(const char32_t* input, size_t length, char* output);
+size_t utf8SkipAscii(const unsigned char* input, size_t length);
+
+#ifdef UNICODE_SIMD
+bool unicodeDetectAvx2();
+size_t utf8CopyAsciiAvx2(const unsigned char* input, size_t length, char32_t* output);
+size_t utf32CopyAsciiAvx2(const char32_t* input, size_t length, char* output);
+
+// SSE2 is always there on x86-64, AVX2 is used only if the processor supports it
+bool unicodeHasAvx2 = unicodeDetectAvx2();
+#endif
+
+/**
+ * Converts the UTF-8 text into UTF-32, rejecting malformed input: truncated sequences, invalid continuation bytes,
+ * overlong encodings, surrogates and code points above U+10FFFF
+ * @param input The UTF-8 text
+ * @param length Number of bytes of the text
+ * @param output Buffer for the result, must have space for at least length characters
+ * @return Number of characters written or UNICODE_INVALID if the input is malformed
+ */
+size_t utf8ToUtf32(const char* input, size_t length, char32_t* output){
+    auto bytes = (const unsigned char*)input;
+    size_t in = 0;
+    size_t out = 0;
+
+    while(in < length){
+        // Most of the text is ASCII, so it's copied in blocks until the first multi-byte character
+        size_t ascii = utf8CopyAscii(bytes + in, length - in, output + out);
+        in += ascii;
+        out += ascii;
+        if(in == length) break;
+
+        size_t charLength = utf8DecodeChar(input + in, length - in, output[out]);
+        if(charLength == 0) return UNICODE_INVALID;
+        in += charLength;
+        out++;
+    }
+    return out;
+}
+
+/**
+ * Converts the UTF-32 text into UTF-8
+ * @param input The UTF-32 text
+ * @param length Number of characters of the text
+ * @param output Buffer for the result, must have space for at least utf32GetUtf8Length(input, length) bytes
+ * @return Number of bytes written or UNICODE_INVALID if the input contains a surrogate or a character above U+10FFFF
+ */
+size_t utf32ToUtf8(const char32_t* input, size_t length, char* output){
+    size_t in = 0;
+    size_t out = 0;
+
+    while(in < length){
+        size_t ascii = utf32CopyAscii(input + in, length - in, output + out);
+        in += ascii;
+        out += ascii;
+        if(in == length) break;
+
+        char32_t c = input[in++];
+        if(c <= 0x7f){
             // Single-byte character
-            currentChar = *c;
-        }else if((*c & 0xe0) == 0xc0){
+            output[out++] = (char)c;
+        }else if(c <= 0x7ff){
             // Two-byte character
-            currentChar = (*c & 0x1f) << 6;
-            c++;
-            currentChar |= (*c & 0x3f);
-        }else if((*c & 0xf0) == 0xe0){
+            output[out++] = (char)(0xc0 | (c >> 6));
+            output[out++] = (char)(0x80 | (c & 0x3f));
+        }else if(c <= 0xffff){
             // Three-byte character
-            currentChar = (*c & 0x0f) << 12;
-            c++;
-            currentChar |= (*c & 0x3f) << 6;
-            c++;
-            currentChar |= (*c & 0x3f);
-        }else if((*c & 0xf8) == 0xf0){
+            if(c >= 0xd800 && c <= 0xdfff) return UNICODE_INVALID;
+            output[out++] = (char)(0xe0 | (c >> 12));
+            output[out++] = (char)(0x80 | ((c >> 6) & 0x3f));
+            output[out++] = (char)(0x80 | (c & 0x3f));
+        }else if(c <= 0x10ffff){
             // Four-byte character
-            currentChar = (*c & 0x03) << 18;
-            c++;
-            currentChar |= (*c & 0x3f) << 12;
-            c++;
-            currentChar |= (*c & 0x3f) << 6;
-            c++;
-            currentChar |= (*c & 0x3f);
+            output[out++] = (char)(0xf0 | (c >> 18));
+            output[out++] = (char)(0x80 | ((c >> 12) & 0x3f));
+            output[out++] = (char)(0x80 | ((c >> 6) & 0x3f));
+            output[out++] = (char)(0x80 | (c & 0x3f));
         }else{
             // Invalid character
-            return U"";
+            return UNICODE_INVALID;
         }
-        utf32 += currentChar;
     }
+    return out;
+}
 
-    return utf32;
+/**
+ * Counts the bytes needed to encode the UTF-32 text in UTF-8
+ * @param input The UTF-32 text
+ * @param length Number of characters of the text
+ * @return Number of bytes or UNICODE_INVALID if the text contains an invalid character
+ */
+size_t utf32GetUtf8Length(const char32_t* input, size_t length){
+    size_t result = 0;
+    for(size_t i = 0; i < length; i++){
+        char32_t c = input[i];
+        if(c <= 0x7f) result += 1;
+        else if(c <= 0x7ff) result += 2;
+        else if(c <= 0xffff && (c < 0xd800 || c > 0xdfff)) result += 3;
+        else if(c > 0xffff && c <= 0x10ffff) result += 4;
+        else return UNICODE_INVALID;
+    }
+    return result;
 }
 
-string utf32ToUtf8(u32string utf32){
-    string utf8 = "";
+/**
+ * Checks if the text is valid UTF-8, under the same rules as utf8ToUtf32
+ * @param input The text
+ * @param length Number of bytes of the text
+ */
+bool utf8Validate(const char* input, size_t length){
+    auto bytes = (const unsigned char*)input;
+    size_t in = 0;
+    while(in < length){
+        in += utf8SkipAscii(bytes + in, length - in);
+        if(in == length) break;
 
-    for(auto c = utf32.begin(); c < utf32.end(); c++){
-        if(*c <= 0x7f){
-            // Single-byte character
-            utf8 += *c;
-        }else if(*c <= 0x7ff){
-            // Two-byte character
-            utf8 += 0xc0 | (*c >> 6);
-            utf8 += 0x80 | (*c & 0x3f);
-        }else if(*c <= 0xffff){
-            // Three-byte character
-            utf8 += 0xe0 | (*c >> 12);
-            utf8 += 0x80 | ((*c >> 6) & 0x3f);
-            utf8 += 0x80 | (*c & 0x3f);
-        }else if(*c <= 0x10ffff){
-            // Four-byte character
-            utf8 += 0xf0 | (*c >> 18);
-            utf8 += 0x80 | ((*c >> 12) & 0x3f);
-            utf8 += 0x80 | ((*c >> 6) & 0x3f);
-            utf8 += 0x80 | (*c & 0x3f);
-        }else{
-            // Invalid character
-            return "";
-        }
+        char32_t c;
+        size_t charLength = utf8DecodeChar(input + in, length - in, c);
+        if(charLength == 0) return false;
+        in += charLength;
     }
+    return true;
+}
 
+u32string utf8ToUtf32(const string& utf8){
+    return utf8ToUtf32(utf8.data(), utf8.length());
+}
+
+/**
+ * Converts the UTF-8 text into UTF-32
+ * @param utf8 The UTF-8 text
+ * @param length Number of bytes of the text
+ * @return The converted text, empty if the input is malformed
+ */
+u32string utf8ToUtf32(const char* utf8, size_t length){
+    u32string utf32(length, U'\0');
+    size_t converted = utf8ToUtf32(utf8, length, utf32.data());
+    utf32.resize(converted == UNICODE_INVALID ? 0 : converted);
+    return utf32;
+}
+
+/**
+ * Converts the UTF-32 text into UTF-8
+ * @param utf32 The UTF-32 text
+ * @return The converted text, empty if the input contains an invalid character
+ */
+string utf32ToUtf8(const u32string& utf32){
+    size_t length = utf32GetUtf8Length(utf32.data(), utf32.length());
+    if(length == UNICODE_INVALID) return "";
+    string utf8(length, '\0');
+    utf32ToUtf8(utf32.data(), utf32.length(), utf8.data());
     return utf8;
 }
 
-u32string intToUtf32(int number){
-    return utf8ToUtf32(to_string(number));
-}
\ No newline at end of file
+/**
+ * Converts the letter to upper case. Supports the Latin letters used in English and Polish
+ * (ASCII, Latin-1 Supplement and Latin Extended-A), other characters are returned unchanged
+ * @param c The character
+ */
+char32_t unicodeToUpper(char32_t c){
+    if(c >= U'a' && c <= U'z') return c - 0x20;
+    if(c < 0xe0) return c;
+    // Latin-1 Supplement, except for the division sign
+    if(c <= 0xfe) return c == 0xf7 ? c : c - 0x20;
+    // Latin Extended-A: pairs of upper and lower case letters
+    if(c >= 0x100 && c <= 0x137) return c & ~(char32_t)1;
+    if(c >= 0x139 && c <= 0x148) return (c & 1) ? c : c - 1;
+    if(c >= 0x14a && c <= 0x177) return c & ~(char32_t)1;
+    if(c >= 0x179 && c <= 0x17e) return (c & 1) ? c : c - 1;
+    return c;
+}
+
+/**
+ * Decodes a single character, checking that it's complete and encoded in the shortest form
+ * @param input The first byte of the character
+ * @param available Number of bytes left in the input
+ * @param result The decoded character
+ * @return Number of bytes of the character or 0 if it's malformed
+ */
+size_t utf8DecodeChar(const char* input, size_t available, char32_t& result){
+    if(available == 0) return 0;
+    auto bytes = (const unsigned char*)input;
+    unsigned char lead = bytes[0];
+    size_t length;
+    char32_t minimum;
+    if(lead < 0x80){
+        // Single-byte character
+        result = lead;
+        return 1;
+    }else if((lead & 0xe0) == 0xc0){
+        // Two-byte character
+        length = 2;
+        minimum = 0x80;
+        result = lead & 0x1f;
+    }else if((lead & 0xf0) == 0xe0){
+        // Three-byte character
+        length = 3;
+        minimum = 0x800;
+        result = lead & 0x0f;
+    }else if((lead & 0xf8) == 0xf0){
+        // Four-byte character
+        length = 4;
+        minimum = 0x10000;
+        result = lead & 0x07;
+    }else{
+        // A continuation byte or an invalid lead byte
+        return 0;
+    }
+
+    if(available < length) return 0;
+    for(size_t i = 1; i < length; i++){
+        if((bytes[i] & 0xc0) != 0x80) return 0;
+        result = (result << 6) | (bytes[i] & 0x3f);
+    }
+    if(result < minimum || result > 0x10ffff || (result >= 0xd800 && result <= 0xdfff)) return 0;
+    return length;
+}
+
+/**
+ * Copies the leading ASCII characters of the UTF-8 text, widening them to UTF-32
+ * @param input The UTF-8 text
+ * @param length Number of bytes of the text
+ * @param output Buffer for the result
+ * @return Number of characters copied
+ */
+size_t utf8CopyAscii(const unsigned char* input, size_t length, char32_t* output){
+    size_t i = 0;
+#ifdef UNICODE_SIMD
+    if(unicodeHasAvx2){
+        i = utf8CopyAsciiAvx2(input, length, output);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= length; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        if(_mm_movemask_epi8(chunk) != 0) break;
+        __m128i low = _mm_unpacklo_epi8(chunk, zero);
+        __m128i high = _mm_unpackhi_epi8(chunk, zero);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(output + i + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(output + i + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128((__m128i*)(output + i + 12), _mm_unpackhi_epi16(high, zero));
+    }
+#endif
+    for(; i < length && input[i] < 0x80; i++){
+        output[i] = input[i];
+    }
+    return i;
+}
+
+/**
+ * Copies the leading ASCII characters of the UTF-32 text, narrowing them to UTF-8
+ * @param input The UTF-32 text
+ * @param length Number of characters of the text
+ * @param output Buffer for the result
+ * @return Number of characters copied
+ */
+size_t utf32CopyAscii(const char32_t* input, size_t length, char* output){
+    size_t i = 0;
+#ifdef UNICODE_SIMD
+    if(unicodeHasAvx2){
+        i = utf32CopyAsciiAvx2(input, length, output);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nonAscii = _mm_set1_epi32(~0x7f);
+    for(; i + 16 <= length; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(input + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(input + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(input + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(input + i + 12));
+        __m128i any = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), nonAscii);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(any, zero)) != 0xffff) break;
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(output + i), packed);
+    }
+#endif
+    for(; i < length && input[i] < 0x80; i++){
+        output[i] = (char)input[i];
+    }
+    return i;
+}
+
+/**
+ * Counts the leading ASCII bytes of the text
+ * @param input The text
+ * @param length Number of bytes of the text
+ */
+size_t utf8SkipAscii(const unsigned char* input, size_t length){
+    size_t i = 0;
+#ifdef UNICODE_SIMD
+    for(; i + 16 <= length; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        if(_mm_movemask_epi8(chunk) != 0) break;
+    }
+#endif
+    while(i < length && input[i] < 0x80){
+        i++;
+    }
+    return i;
+}
+
+#ifdef UNICODE_SIMD
+bool unicodeDetectAvx2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/**
+ * The AVX2 version of utf8CopyAscii, copying 32 characters at a time. The remaining characters are left to the caller
+ */
+__attribute__((target("avx2")))
+size_t utf8CopyAsciiAvx2(const unsigned char* input, size_t length, char32_t* output){
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(input + i));
+        if(_mm256_movemask_epi8(chunk) != 0) break;
+        for(size_t part = 0; part < 32; part += 8){
+            __m128i bytes = _mm_loadl_epi64((const __m128i*)(input + i + part));
+            _mm256_storeu_si256((__m256i*)(output + i + part), _mm256_cvtepu8_epi32(bytes));
+        }
+    }
+    return i;
+}
+
+/**
+ * The AVX2 version of utf32CopyAscii, copying 32 characters at a time. The remaining characters are left to the caller
+ */
+__attribute__((target("avx2")))
+size_t utf32CopyAsciiAvx2(const char32_t* input, size_t length, char* output){
+    size_t i = 0;
+    const __m256i nonAscii = _mm256_set1_epi32(~0x7f);
+    // Packing works within the 128-bit lanes, this puts the 4-byte groups back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for(; i + 32 <= length; i += 32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(input + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(input + i + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(input + i + 16));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(input + i + 24));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if(!_mm256_testz_si256(any, nonAscii)) break;
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256((__m256i*)(output + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    return i;
+}
+#endif
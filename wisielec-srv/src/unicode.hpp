@@ -1,12 +1,22 @@
 #ifndef UNICODE_HPP
 #define UNICODE_HPP
 
+#include <cstddef>
 #include <string>
 
 using namespace std;
 
-u32string utf8ToUtf32(string utf8);
-string utf32ToUtf8(u32string utf32);
-u32string intToUtf32(int number);
+#define UNICODE_INVALID ((size_t)-1)
+
+size_t utf8ToUtf32(const char* input, size_t length, char32_t* output);
+size_t utf32ToUtf8(const char32_t* input, size_t length, char* output);
+size_t utf32GetUtf8Length(const char32_t* input, size_t length);
+bool utf8Validate(const char* input, size_t length);
+size_t utf8DecodeChar(const char* input, size_t available, char32_t& result);
+
+u32string utf8ToUtf32(const string& utf8);
+u32string utf8ToUtf32(const char* utf8, size_t length);
+string utf32ToUtf8(const u32string& utf32);
+char32_t unicodeToUpper(char32_t c);
 
 #endif
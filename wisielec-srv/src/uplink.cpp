@@ -0,0 +1,208 @@
+#include "uplink.hpp"
+
+#include "backplane.hpp"
+#include "log.hpp"
+#include "server.hpp"
+
+#include <csignal>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+
+void uplinkRun(Uplink* uplink);
+void uplinkOnReceive(Channel* channel);
+void uplinkOnControl(Channel* channel);
+void uplinkOnPeerMessage(BackplanePeer* peer, const ChannelMessage& message);
+void uplinkOnPeerClose(BackplanePeer* peer);
+
+/**
+ * Structure representing a node's connection to the sequencer. To the I/O threads it looks like the only game thread:
+ * their messages are passed to the sequencer, whose game threads run the rooms, and the frames of the sequencer
+ * are passed back to the I/O threads. A broadcast arrives once and is handed to every I/O thread
+ */
+struct Uplink {
+    int sockFd;
+    Epoll* epoll;
+    BackplanePeer* peer;            // The connection to the sequencer, nullptr once it's lost
+    int ioThreadCount;
+    Channel** fromIoThreads;        // Messages of the I/O threads, by their indices. The thread is the consumer
+    Channel** toIoThreads;          // Frames for the I/O threads, by their indices. The thread is the producer
+    Channel* control;               // Messages from the main thread
+    thread* runner;
+    bool isRunning;
+    EpollStats stats;
+};
+
+/**
+ * Connects to the sequencer, but doesn't start passing the messages
+ * @param maxEvents Maximum number of events handled after a single wakeup
+ * @param path Path of the sequencer's Unix domain socket
+ * @param ioThreadCount Number of the I/O threads
+ * @param fromIoThreads The channels from the I/O threads. The array is copied
+ * @param toIoThreads The channels to the I/O threads. The array is copied
+ * @param control The channel from the main thread
+ * @return The uplink
+ */
+Uplink* uplinkCreate(int maxEvents, const char* path, int ioThreadCount, Channel** fromIoThreads,
+                     Channel** toIoThreads, Channel* control){
+    auto uplink = new Uplink();
+    uplink->sockFd = backplaneConnect(path);
+    uplink->epoll = epollCreate(maxEvents);
+    uplink->peer = nullptr;
+    uplink->ioThreadCount = ioThreadCount;
+    uplink->fromIoThreads = new Channel*[ioThreadCount];
+    uplink->toIoThreads = new Channel*[ioThreadCount];
+    for(int i = 0; i < ioThreadCount; i++){
+        uplink->fromIoThreads[i] = fromIoThreads[i];
+        uplink->toIoThreads[i] = toIoThreads[i];
+    }
+    uplink->control = control;
+    uplink->runner = nullptr;
+    uplink->isRunning = true;
+    uplink->stats = {};
+    return uplink;
+}
+
+/**
+ * Attaches the channels and the backplane connection to the uplink's event loop and runs the loop on a new thread
+ * @param uplink The uplink
+ */
+void uplinkStart(Uplink* uplink){
+    uplink->peer = backplanePeerCreate(uplink->sockFd, uplink->epoll, uplinkOnPeerMessage, uplinkOnPeerClose, uplink);
+    for(int i = 0; i < uplink->ioThreadCount; i++){
+        channelAttachConsumer(uplink->fromIoThreads[i], uplink->epoll, uplinkOnReceive, uplink);
+        channelAttachProducer(uplink->toIoThreads[i], uplink->epoll);
+    }
+    channelAttachConsumer(uplink->control, uplink->epoll, uplinkOnControl, uplink);
+    uplink->runner = new std::thread(uplinkRun, uplink);
+}
+
+/**
+ * Waits until the thread finishes, after the main thread has sent it CHANNEL_STOP
+ * @param uplink The uplink
+ */
+void uplinkJoin(Uplink* uplink){
+    if(uplink->runner == nullptr) return;
+    uplink->runner->join();
+    delete uplink->runner;
+    uplink->runner = nullptr;
+}
+
+/**
+ * Releases the uplink that has finished. The channels are left to their owner
+ * @param uplink The uplink
+ */
+void uplinkRelease(Uplink* uplink){
+    delete[] uplink->fromIoThreads;
+    delete[] uplink->toIoThreads;
+    delete uplink;
+}
+
+/**
+ * Returns the event loop statistics of the uplink that has finished
+ * @param uplink The uplink
+ */
+const EpollStats* uplinkGetStats(Uplink* uplink){
+    return &uplink->stats;
+}
+
+/**
+ * Runs the event loop until the main thread stops it, then disconnects from the sequencer
+ * @param uplink The uplink
+ */
+void uplinkRun(Uplink* uplink){
+    while(uplink->isRunning){
+        epollWaitForEvent(uplink->epoll);
+    }
+
+    // The sequencer forgets all the connections of the node
+    if(uplink->peer != nullptr){
+        backplanePeerClose(uplink->peer);
+    }
+    for(int i = 0; i < uplink->ioThreadCount; i++){
+        channelDetachConsumer(uplink->fromIoThreads[i]);
+        channelDetachProducer(uplink->toIoThreads[i]);
+    }
+    channelDetachConsumer(uplink->control);
+    uplink->stats = *epollGetStats(uplink->epoll);
+    epollRelease(uplink->epoll);
+}
+
+/**
+ * Passes the messages of the I/O threads to the sequencer. The channels are merged by the time
+ * the messages were received, as a game thread would do
+ * @param channel The channel that has messages
+ */
+void uplinkOnReceive(Channel* channel){
+    auto uplink = (Uplink*)channelGetData(channel);
+    while(true){
+        Channel* earliest = nullptr;
+        ChannelMessage* first = nullptr;
+        for(int i = 0; i < uplink->ioThreadCount; i++){
+            ChannelMessage* message = channelPeek(uplink->fromIoThreads[i]);
+            if(message != nullptr && (first == nullptr || message->time < first->time)){
+                earliest = uplink->fromIoThreads[i];
+                first = message;
+            }
+        }
+        if(first == nullptr) return;
+
+        if(uplink->peer != nullptr){
+            backplanePeerSend(uplink->peer, first->kind, first->connection, first->time, first->frame, first->room);
+        }
+        if(first->frame != nullptr) frameRelease(first->frame);
+        channelPop(earliest);
+    }
+}
+
+/**
+ * Handles the messages from the main thread
+ * @param channel The control channel
+ */
+void uplinkOnControl(Channel* channel){
+    auto uplink = (Uplink*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        if(message->kind == CHANNEL_STOP){
+            // The loop finishes after the current wakeup
+            uplink->isRunning = false;
+        }
+        channelPop(channel);
+    }
+}
+
+/**
+ * Passes the message from the sequencer to the I/O thread serving the connection, or to all of them
+ * @param peer The sequencer
+ * @param message The message, its frame is taken over
+ */
+void uplinkOnPeerMessage(BackplanePeer* peer, const ChannelMessage& message){
+    auto uplink = (Uplink*)backplanePeerGetData(peer);
+    if(message.kind == CHANNEL_BROADCAST){
+        for(int i = 0; i < uplink->ioThreadCount; i++){
+            frameRetain(message.frame);
+            channelPush(uplink->toIoThreads[i], CHANNEL_BROADCAST, 0, 0, message.frame, message.room);
+        }
+        frameRelease(message.frame);
+        return;
+    }
+    size_t index = message.connection % SERVER_MAX_THREADS;
+    if(index >= (size_t)uplink->ioThreadCount){
+        if(message.frame != nullptr) frameRelease(message.frame);
+        return;
+    }
+    channelPush(uplink->toIoThreads[index], message.kind, message.connection, 0, message.frame, message.room);
+}
+
+/**
+ * Handles the sequencer going away. The node can't serve its players without it, so the whole process stops
+ * @param peer The sequencer
+ */
+void uplinkOnPeerClose(BackplanePeer* peer){
+    auto uplink = (Uplink*)backplanePeerGetData(peer);
+    uplink->peer = nullptr;
+    LOG_ERROR(LOG_SOURCE_MAIN, "Lost the connection to the sequencer, stopping.");
+    kill(getpid(), SIGINT);
+}
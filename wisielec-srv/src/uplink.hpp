@@ -0,0 +1,17 @@
+#ifndef UPLINK_HPP
+#define UPLINK_HPP
+
+struct Uplink;
+
+#include "channel.hpp"
+#include "epoll.hpp"
+
+Uplink* uplinkCreate(int maxEvents, const char* path, int ioThreadCount, Channel** fromIoThreads,
+                     Channel** toIoThreads, Channel* control);
+void uplinkStart(Uplink* uplink);
+void uplinkJoin(Uplink* uplink);
+void uplinkRelease(Uplink* uplink);
+
+const EpollStats* uplinkGetStats(Uplink* uplink);
+
+#endif
@@ -0,0 +1,288 @@
+#include "uring.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+int uringEnter(Uring* ring, unsigned submitCount, unsigned waitCount, unsigned flags);
+
+/**
+ * Structure representing an io_uring instance: the submission and completion rings shared with the kernel.
+ * The submission queue entries are filled in order, so the index array is set up once and never changes.
+ * Only the thread that created the ring may use it
+ */
+struct Uring {
+    int fd;
+    void* ringMemory;               // Both rings, mapped together
+    size_t ringSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+
+    unsigned* sqHead;               // Written by the kernel
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqPending;             // Entries filled since the last submission
+
+    unsigned* cqHead;
+    unsigned* cqTail;               // Written by the kernel
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+};
+
+/**
+ * Creates the rings. Fails on kernels without io_uring, with io_uring disabled, or older than 5.13,
+ * which added the multishot poll
+ * @param submissionEntries Capacity of the submission ring, rounded up to a power of two by the kernel
+ * @param completionEntries Capacity of the completion ring, at least twice the submission ring
+ * @return The ring or nullptr if io_uring can't be used
+ */
+Uring* uringCreate(unsigned submissionEntries, unsigned completionEntries){
+    io_uring_params params {};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = completionEntries;
+    int fd = (int)syscall(__NR_io_uring_setup, submissionEntries, &params);
+    if(fd == -1) return nullptr;
+    // The resource tags came with the multishot poll, the kernels with the tags support it
+    uint32_t requiredFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RSRC_TAGS;
+    if((params.features & requiredFeatures) != requiredFeatures){
+        close(fd);
+        return nullptr;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    size_t ringSize = sqSize > cqSize ? sqSize : cqSize;
+    void* ringMemory = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ringMemory == MAP_FAILED){
+        close(fd);
+        return nullptr;
+    }
+    size_t sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        munmap(ringMemory, ringSize);
+        close(fd);
+        return nullptr;
+    }
+
+    auto ring = new Uring();
+    auto base = (char*)ringMemory;
+    ring->fd = fd;
+    ring->ringMemory = ringMemory;
+    ring->ringSize = ringSize;
+    ring->sqes = (io_uring_sqe*)sqes;
+    ring->sqesSize = sqesSize;
+    ring->sqHead = (unsigned*)(base + params.sq_off.head);
+    ring->sqTail = (unsigned*)(base + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(base + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->sqPending = 0;
+    ring->cqHead = (unsigned*)(base + params.cq_off.head);
+    ring->cqTail = (unsigned*)(base + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe*)(base + params.cq_off.cqes);
+
+    auto array = (unsigned*)(base + params.sq_off.array);
+    for(unsigned i = 0; i < params.sq_entries; i++){
+        array[i] = i;
+    }
+    return ring;
+}
+
+/**
+ * Releases the ring. The operations that haven't completed are cancelled by the kernel
+ * @param ring The ring
+ */
+void uringRelease(Uring* ring){
+    munmap(ring->sqes, ring->sqesSize);
+    munmap(ring->ringMemory, ring->ringSize);
+    close(ring->fd);
+    delete ring;
+}
+
+/**
+ * Returns a cleared submission queue entry to fill. The entry is submitted with the next uringSubmitAndWait,
+ * unless the ring is full, then the filled entries are submitted right away to make room
+ * @param ring The ring
+ * @return The entry
+ */
+io_uring_sqe* uringGetSqe(Uring* ring){
+    unsigned tail = *ring->sqTail;
+    if(tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries){
+        uringEnter(ring, ring->sqPending, 0, 0);
+    }
+    io_uring_sqe* sqe = &ring->sqes[tail & ring->sqMask];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->sqPending++;
+    return sqe;
+}
+
+/**
+ * Submits all the filled entries and waits for completions, with a single system call
+ * @param ring The ring
+ * @param waitCount Number of completions to wait for, 0 to only submit
+ * @return Number of the submitted entries or -errno
+ */
+int uringSubmitAndWait(Uring* ring, unsigned waitCount){
+    return uringEnter(ring, ring->sqPending, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0);
+}
+
+/**
+ * Returns the oldest completion that hasn't been seen
+ * @param ring The ring
+ * @return The completion, valid until uringSeeCqe, or nullptr if there are none
+ */
+io_uring_cqe* uringPeekCqe(Uring* ring){
+    unsigned head = *ring->cqHead;
+    if(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) return nullptr;
+    return &ring->cqes[head & ring->cqMask];
+}
+
+/**
+ * Gives the oldest completion back to the kernel
+ * @param ring The ring
+ */
+void uringSeeCqe(Uring* ring){
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Structure representing the buffers provided to the kernel, which picks one of them for every receive
+ * that completes, instead of the receive naming its buffer up front. The buffers are given back once they're read:
+ * either through a ring shared with the kernel (Linux 5.19), or with a submission entry per buffer
+ */
+struct UringBuffers {
+    Uring* ring;
+    uint16_t group;                 // The buffer group the receives select from
+    unsigned count;                 // Number of the buffers, a power of two
+    unsigned size;                  // Size of a single buffer
+    io_uring_buf_ring* entries;     // The ring shared with the kernel, its tail is written by the ring's owner. nullptr if none
+    char* memory;                   // The buffers themselves, one after another
+};
+
+/**
+ * Allocates the buffers and provides them to the kernel as a buffer group. With a ring, the buffers are registered
+ * at once, otherwise they're provided by a submission entry sent with the next submission
+ * @param ring The ring
+ * @param group Identifier of the group, which the receives select the buffers from
+ * @param count Number of the buffers, a power of two
+ * @param size Size of a single buffer
+ * @param isRing Whether to give the buffers back through a shared ring
+ * @return The buffers or nullptr if they can't be allocated or registered
+ */
+UringBuffers* uringCreateBuffers(Uring* ring, uint16_t group, unsigned count, unsigned size, bool isRing){
+    void* memory = mmap(nullptr, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) return nullptr;
+    void* entries = nullptr;
+    if(isRing){
+        entries = mmap(nullptr, count * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        io_uring_buf_reg registration {};
+        registration.ring_addr = (uint64_t)entries;
+        registration.ring_entries = count;
+        registration.bgid = group;
+        if(entries == MAP_FAILED
+                || syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1){
+            if(entries != MAP_FAILED) munmap(entries, count * sizeof(io_uring_buf));
+            munmap(memory, (size_t)count * size);
+            return nullptr;
+        }
+    }
+
+    auto buffers = new UringBuffers();
+    buffers->ring = ring;
+    buffers->group = group;
+    buffers->count = count;
+    buffers->size = size;
+    buffers->entries = (io_uring_buf_ring*)entries;
+    buffers->memory = (char*)memory;
+    if(isRing){
+        for(unsigned i = 0; i < count; i++){
+            uringRecycleBuffer(buffers, (uint16_t)i);
+        }
+    }else{
+        io_uring_sqe* sqe = uringGetSqe(ring);
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = (int)count;
+        sqe->addr = (uint64_t)memory;
+        sqe->len = size;
+        sqe->buf_group = group;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = URING_IGNORED;
+    }
+    return buffers;
+}
+
+/**
+ * Unregisters the buffers and frees them. The receives still waiting for data fail, as they have no buffers left
+ * @param buffers The buffers
+ */
+void uringReleaseBuffers(UringBuffers* buffers){
+    if(buffers->entries != nullptr){
+        io_uring_buf_reg registration {};
+        registration.bgid = buffers->group;
+        syscall(__NR_io_uring_register, buffers->ring->fd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+        munmap(buffers->entries, buffers->count * sizeof(io_uring_buf));
+    }
+    munmap(buffers->memory, (size_t)buffers->count * buffers->size);
+    delete buffers;
+}
+
+/**
+ * Returns the memory of the buffer the kernel has picked
+ * @param buffers The buffers
+ * @param id Identifier of the buffer, from the completion's flags
+ */
+char* uringGetBuffer(UringBuffers* buffers, uint16_t id){
+    return buffers->memory + (size_t)id * buffers->size;
+}
+
+/**
+ * Gives the buffer back to the kernel, once its content has been read. Without a ring,
+ * it's provided again by a submission entry sent with the next submission
+ * @param buffers The buffers
+ * @param id Identifier of the buffer
+ */
+void uringRecycleBuffer(UringBuffers* buffers, uint16_t id){
+    if(buffers->entries == nullptr){
+        io_uring_sqe* sqe = uringGetSqe(buffers->ring);
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = (uint64_t)uringGetBuffer(buffers, id);
+        sqe->len = buffers->size;
+        sqe->buf_group = buffers->group;
+        sqe->off = id;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = URING_IGNORED;
+        return;
+    }
+    uint16_t tail = buffers->entries->tail;
+    io_uring_buf& entry = buffers->entries->bufs[tail & (buffers->count - 1)];
+    entry.addr = (uint64_t)uringGetBuffer(buffers, id);
+    entry.len = buffers->size;
+    entry.bid = id;
+    __atomic_store_n(&buffers->entries->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Calls io_uring_enter, repeating it if it's interrupted before submitting anything
+ * @param ring The ring
+ * @param submitCount Number of the filled entries
+ * @param waitCount Number of completions to wait for
+ * @param flags IORING_ENTER_ flags
+ * @return Number of the submitted entries or -errno
+ */
+int uringEnter(Uring* ring, unsigned submitCount, unsigned waitCount, unsigned flags){
+    int submitted;
+    while((submitted = (int)syscall(__NR_io_uring_enter, ring->fd, submitCount, waitCount, flags, nullptr, 0)) == -1
+          && errno == EINTR && ring->sqPending > 0);
+    if(submitted == -1) return -errno;
+    ring->sqPending -= (unsigned)submitted;
+    return submitted;
+}
@@ -0,0 +1,25 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <linux/io_uring.h>
+#include <cstdint>
+
+#define URING_IGNORED UINT64_MAX    // User data of the entries whose completions aren't of interest
+
+struct Uring;
+struct UringBuffers;
+
+Uring* uringCreate(unsigned submissionEntries, unsigned completionEntries);
+void uringRelease(Uring* ring);
+
+io_uring_sqe* uringGetSqe(Uring* ring);
+int uringSubmitAndWait(Uring* ring, unsigned waitCount);
+io_uring_cqe* uringPeekCqe(Uring* ring);
+void uringSeeCqe(Uring* ring);
+
+UringBuffers* uringCreateBuffers(Uring* ring, uint16_t group, unsigned count, unsigned size, bool isRing);
+void uringReleaseBuffers(UringBuffers* buffers);
+char* uringGetBuffer(UringBuffers* buffers, uint16_t id);
+void uringRecycleBuffer(UringBuffers* buffers, uint16_t id);
+
+#endif
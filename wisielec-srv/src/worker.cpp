@@ -0,0 +1,365 @@
+#include "worker.hpp"
+
+#include "log.hpp"
+#include "metrics.hpp"
+#include "pool.hpp"
+#include "server.hpp"
+#include "game/hangman_player.hpp"
+#include "game/hangman_server.hpp"
+#include "game/room_manager.hpp"
+
+#include <new>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+#define PLAYERS_PER_SLAB 64
+
+void workerRun(Worker* worker);
+void workerOnReceive(Channel* channel);
+void workerOnControl(Channel* channel);
+void workerDispatch(Worker* worker, const ChannelMessage& message);
+void workerDestroyPlayer(Worker* worker, HangmanPlayer* player);
+
+/**
+ * Structure representing a game thread. It runs the games of its rooms and serves the players whose
+ * connections it has been handed. Nothing is shared with the other game threads but the room manager,
+ * so the rooms of different threads never wait for each other.
+ * All the objects of the thread are used only by the thread, once it has started
+ */
+struct Worker {
+    int index;
+    Epoll* epoll;
+    TimerWheel* timers;                                 // Runs the rounds and the guess cooldowns of the rooms
+    RoomManager* rooms;
+    int ioThreadCount;
+    Channel** fromIoThreads;                            // Requests from the I/O threads and the sequencer, the thread is the consumer
+    Channel** toIoThreads;                              // Frames for the I/O threads and the sequencer, the thread is the producer
+    Channel* control;                                   // Messages from the main thread, the thread is the consumer
+    unordered_map<uint64_t, HangmanPlayer*>* players;   // The players by their connections
+    unordered_map<uint32_t, HangmanServer*>* games;     // The games of the rooms that have players here
+    Pool* playerPool;                                   // Created by the thread itself, which owns it
+    thread* runner;
+    bool isRunning;
+    EpollStats stats;                                   // The event loop statistics, copied when the loop finishes
+};
+
+/**
+ * Creates the game thread with its event loop, but doesn't start it
+ * @param index Index of the thread, the rooms whose identifier modulo the number of the threads equals it run here
+ * @param maxEvents Maximum number of events handled after a single wakeup
+ * @param rooms The room manager shared by all the game threads
+ * @param ioThreadCount Number of the I/O threads, counting the sequencer that serves the connections of the nodes
+ * @param fromIoThreads The channels from the I/O threads, by their indices. The array is copied
+ * @param toIoThreads The channels to the I/O threads, by their indices. The array is copied
+ * @param control The channel from the main thread
+ * @return The thread
+ */
+Worker* workerCreate(int index, int maxEvents, RoomManager* rooms, int ioThreadCount,
+                     Channel** fromIoThreads, Channel** toIoThreads, Channel* control){
+    auto worker = new Worker();
+    worker->index = index;
+    worker->epoll = epollCreate(maxEvents);
+    worker->timers = timerWheelCreate(worker->epoll);
+    worker->rooms = rooms;
+    worker->ioThreadCount = ioThreadCount;
+    worker->fromIoThreads = new Channel*[ioThreadCount];
+    worker->toIoThreads = new Channel*[ioThreadCount];
+    for(int i = 0; i < ioThreadCount; i++){
+        worker->fromIoThreads[i] = fromIoThreads[i];
+        worker->toIoThreads[i] = toIoThreads[i];
+    }
+    worker->control = control;
+    worker->players = new unordered_map<uint64_t, HangmanPlayer*>();
+    worker->games = new unordered_map<uint32_t, HangmanServer*>();
+    worker->playerPool = nullptr;
+    worker->runner = nullptr;
+    worker->isRunning = true;
+    worker->stats = {};
+    return worker;
+}
+
+/**
+ * Attaches the channels to the thread's event loop and runs the loop on a new thread
+ * @param worker The game thread
+ */
+void workerStart(Worker* worker){
+    for(int i = 0; i < worker->ioThreadCount; i++){
+        channelAttachConsumer(worker->fromIoThreads[i], worker->epoll, workerOnReceive, worker);
+        channelAttachProducer(worker->toIoThreads[i], worker->epoll);
+    }
+    channelAttachConsumer(worker->control, worker->epoll, workerOnControl, worker);
+    worker->runner = new std::thread(workerRun, worker);
+}
+
+/**
+ * Waits until the thread finishes, after the main thread has sent it CHANNEL_STOP
+ * @param worker The game thread
+ */
+void workerJoin(Worker* worker){
+    if(worker->runner == nullptr) return;
+    worker->runner->join();
+    delete worker->runner;
+    worker->runner = nullptr;
+}
+
+/**
+ * Releases the thread that has finished. The channels are left to their owner
+ * @param worker The game thread
+ */
+void workerRelease(Worker* worker){
+    delete[] worker->fromIoThreads;
+    delete[] worker->toIoThreads;
+    delete worker->players;
+    delete worker->games;
+    delete worker;
+}
+
+/**
+ * Returns the index of the thread
+ * @param worker The game thread
+ */
+int workerGetIndex(Worker* worker){
+    return worker->index;
+}
+
+/**
+ * Returns the timing wheel of the thread's event loop
+ * @param worker The game thread
+ */
+TimerWheel* workerGetTimers(Worker* worker){
+    return worker->timers;
+}
+
+/**
+ * Returns the room manager shared by all the game threads
+ * @param worker The game thread
+ */
+RoomManager* workerGetRooms(Worker* worker){
+    return worker->rooms;
+}
+
+/**
+ * Returns the event loop statistics of the thread that has finished
+ * @param worker The game thread
+ */
+const EpollStats* workerGetStats(Worker* worker){
+    return &worker->stats;
+}
+
+/**
+ * Returns the game of the room, started if it isn't running yet. The room has to run on this thread
+ * @param worker The game thread
+ * @param room The room
+ */
+HangmanServer* workerOpenRoom(Worker* worker, uint32_t room){
+    auto entry = worker->games->find(room);
+    if(entry != worker->games->end()) return entry->second;
+    HangmanServer* game = worker->rooms->openRoom(room, worker);
+    worker->games->emplace(room, game);
+    return game;
+}
+
+/**
+ * Finishes the game of the room if no players are left in it
+ * @param worker The game thread
+ * @param room The room
+ */
+void workerCloseRoom(Worker* worker, uint32_t room){
+    auto entry = worker->games->find(room);
+    if(entry == worker->games->end() || entry->second->getPlayers().getCount() > 0) return;
+    delete entry->second;
+    worker->games->erase(entry);
+}
+
+/**
+ * Sends the frame to the connection. The frame isn't copied, the I/O thread only references it
+ * @param worker The game thread
+ * @param connection The connection to send the frame to
+ * @param frame The frame to send
+ */
+void workerSend(Worker* worker, uint64_t connection, Frame* frame){
+    frameRetain(frame);
+    channelPush(worker->toIoThreads[connection % SERVER_MAX_THREADS], CHANNEL_SEND, connection, 0, frame);
+}
+
+/**
+ * Sends the frame to all the members of the room. Each I/O thread gets a single message, however many members it has
+ * @param worker The game thread
+ * @param room The room
+ * @param frame The frame to send
+ */
+void workerBroadcast(Worker* worker, uint32_t room, Frame* frame){
+    for(int i = 0; i < worker->ioThreadCount; i++){
+        frameRetain(frame);
+        channelPush(worker->toIoThreads[i], CHANNEL_BROADCAST, 0, 0, frame, room);
+    }
+}
+
+/**
+ * Makes the connection receive the broadcasts of the room sent from now on
+ * @param worker The game thread
+ * @param connection The connection
+ * @param room The room
+ */
+void workerAddMember(Worker* worker, uint64_t connection, uint32_t room){
+    channelPush(worker->toIoThreads[connection % SERVER_MAX_THREADS], CHANNEL_ADD_MEMBER, connection, 0, nullptr, room);
+}
+
+/**
+ * Makes the connection stop receiving the broadcasts sent from now on
+ * @param worker The game thread
+ * @param connection The connection
+ */
+void workerRemoveMember(Worker* worker, uint64_t connection){
+    channelPush(worker->toIoThreads[connection % SERVER_MAX_THREADS], CHANNEL_REMOVE_MEMBER, connection, 0, nullptr);
+}
+
+/**
+ * Hands the connection over to the game thread of the room. The player of the connection is forgotten here
+ * once its current request has been handled
+ * @param worker The game thread
+ * @param connection The connection
+ * @param room The room the connection holds a seat in
+ * @param frame The request to handle on the game thread of the room, the message takes over the caller's reference
+ */
+void workerMove(Worker* worker, uint64_t connection, uint32_t room, Frame* frame){
+    channelPush(worker->toIoThreads[connection % SERVER_MAX_THREADS], CHANNEL_MOVE, connection, 0, frame, room);
+}
+
+/**
+ * Runs the event loop until the main thread stops it, then finishes the games and releases the loop
+ * @param worker The game thread
+ */
+void workerRun(Worker* worker){
+    LOG_INFO(LOG_SOURCE_MAIN, "Game thread {} started.", worker->index);
+    // The pool belongs to the thread that creates it, so it's created here rather than with the thread
+    worker->playerPool = poolCreate(sizeof(HangmanPlayer), PLAYERS_PER_SLAB);
+    while(worker->isRunning){
+        epollWaitForEvent(worker->epoll);
+    }
+
+    // The I/O threads have finished already, the frames left in the channels are released by their owner
+    for(auto& entry : *worker->players){
+        entry.second->~HangmanPlayer();
+    }
+    for(auto& entry : *worker->games){
+        delete entry.second;
+    }
+    poolRelease(worker->playerPool);
+    worker->playerPool = nullptr;
+    for(int i = 0; i < worker->ioThreadCount; i++){
+        channelDetachConsumer(worker->fromIoThreads[i]);
+        channelDetachProducer(worker->toIoThreads[i]);
+    }
+    channelDetachConsumer(worker->control);
+    timerWheelRelease(worker->timers);
+    worker->stats = *epollGetStats(worker->epoll);
+    epollRelease(worker->epoll);
+    LOG_INFO(LOG_SOURCE_MAIN, "Game thread {} finished.", worker->index);
+}
+
+/**
+ * Handles the messages from the I/O threads. All the channels are drained, not just the one that woke the thread up,
+ * and their messages are merged by the time they were received, so the requests are handled first come, first served
+ * @param channel The channel that has messages
+ */
+void workerOnReceive(Channel* channel){
+    auto worker = (Worker*)channelGetData(channel);
+    while(true){
+        // Every channel is in order by itself, so the earliest message is at the head of one of them
+        Channel* earliest = nullptr;
+        ChannelMessage* first = nullptr;
+        for(int i = 0; i < worker->ioThreadCount; i++){
+            ChannelMessage* message = channelPeek(worker->fromIoThreads[i]);
+            if(message != nullptr && (first == nullptr || message->time < first->time)){
+                earliest = worker->fromIoThreads[i];
+                first = message;
+            }
+        }
+        if(first == nullptr) return;
+
+        ChannelMessage message = *first;
+        channelPop(earliest);
+        workerDispatch(worker, message);
+    }
+}
+
+/**
+ * Handles the messages from the main thread
+ * @param channel The control channel
+ */
+void workerOnControl(Channel* channel){
+    auto worker = (Worker*)channelGetData(channel);
+    ChannelMessage* message;
+    while((message = channelPeek(channel)) != nullptr){
+        if(message->kind == CHANNEL_STOP){
+            // The loop finishes after the current wakeup
+            worker->isRunning = false;
+        }
+        channelPop(channel);
+    }
+}
+
+/**
+ * Passes the message from an I/O thread to the game
+ * @param worker The game thread
+ * @param message The message, its frame is released
+ */
+void workerDispatch(Worker* worker, const ChannelMessage& message){
+    switch(message.kind){
+        case CHANNEL_CONNECT: {
+            void* memory = poolAllocate(worker->playerPool);
+            auto player = new(memory) HangmanPlayer(worker, message.connection, message.room);
+            if(!worker->players->emplace(message.connection, player).second){
+                workerDestroyPlayer(worker, player);
+            }
+            break;
+        }
+        case CHANNEL_REQUEST: {
+            histogramObserve(&histogramRequestHandoff, metricsNow() - message.time);
+            auto entry = worker->players->find(message.connection);
+            if(entry == worker->players->end()) break;
+            HangmanPlayer* player = entry->second;
+            Frame* frame = message.frame;
+            player->parseMessage(frameGetPayload(frame), frameGetLength(frame) - FRAME_LENGTH_SIZE);
+            if(player->checkHasMoved()){
+                // The player takes its seat along to the game thread of the room
+                worker->players->erase(entry);
+                workerDestroyPlayer(worker, player);
+            }
+            break;
+        }
+        case CHANNEL_DISCONNECT: {
+            auto entry = worker->players->find(message.connection);
+            if(entry == worker->players->end()){
+                // The connection was closed while moving here, the seat it has taken is free again
+                if(message.room != ROOM_NONE) worker->rooms->releaseSeat(message.room);
+                break;
+            }
+            // Players that have lost leave the game as well
+            HangmanPlayer* player = entry->second;
+            worker->players->erase(entry);
+            player->onDisconnect();
+            workerDestroyPlayer(worker, player);
+            break;
+        }
+        case CHANNEL_SYNC: {
+            // The responses to the earlier requests are already in the same channel, ahead of the sync
+            channelPush(worker->toIoThreads[message.connection % SERVER_MAX_THREADS], CHANNEL_SYNC, message.connection, 0, nullptr);
+            break;
+        }
+    }
+    if(message.frame != nullptr) frameRelease(message.frame);
+}
+
+/**
+ * Releases the player's memory
+ * @param worker The game thread
+ * @param player The player
+ */
+void workerDestroyPlayer(Worker* worker, HangmanPlayer* player){
+    player->~HangmanPlayer();
+    poolFree(worker->playerPool, player);
+}
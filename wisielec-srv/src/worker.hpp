@@ -0,0 +1,34 @@
+#ifndef WORKER_HPP
+#define WORKER_HPP
+
+struct Worker;
+
+#include "channel.hpp"
+#include "epoll.hpp"
+#include "frame.hpp"
+#include "timer.hpp"
+
+class RoomManager;
+class HangmanServer;
+
+Worker* workerCreate(int index, int maxEvents, RoomManager* rooms, int ioThreadCount,
+                     Channel** fromIoThreads, Channel** toIoThreads, Channel* control);
+void workerStart(Worker* worker);
+void workerJoin(Worker* worker);
+void workerRelease(Worker* worker);
+
+int workerGetIndex(Worker* worker);
+TimerWheel* workerGetTimers(Worker* worker);
+RoomManager* workerGetRooms(Worker* worker);
+const EpollStats* workerGetStats(Worker* worker);
+
+HangmanServer* workerOpenRoom(Worker* worker, uint32_t room);
+void workerCloseRoom(Worker* worker, uint32_t room);
+
+void workerSend(Worker* worker, uint64_t connection, Frame* frame);
+void workerBroadcast(Worker* worker, uint32_t room, Frame* frame);
+void workerAddMember(Worker* worker, uint64_t connection, uint32_t room);
+void workerRemoveMember(Worker* worker, uint64_t connection);
+void workerMove(Worker* worker, uint64_t connection, uint32_t room, Frame* frame);
+
+#endif
@@ -0,0 +1,134 @@
+#include "test.hpp"
+#include "../src/dictionary.hpp"
+
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+using namespace std;
+
+Dictionary* testCompileDictionary(const string& words, string& path);
+map<string, int> testDrawAll(Dictionary* dictionary, DictionaryBag& bag);
+void testDrawWholeBag(Dictionary* dictionary, int category, int difficulty, uint64_t seed);
+void testDrawEmptyBag(Dictionary* dictionary);
+
+/**
+ * Checks that the shuffle bag returns every word exactly once per round,
+ * for the word counts that fill the permuted range exactly and those that need the cycle walk
+ */
+int main(){
+    // 1000 phrases in 3 categories, each of them with all the difficulties
+    string words;
+    for(int i = 0; i < 1000; i++){
+        string number = to_string(1000 + i).substr(1);
+        string phrase = i % 3 == 0 ? "A" + number : i % 3 == 1 ? "MEDIUM" + number : "HARDER PHRASE " + number;
+        words += "category" + to_string(i % 7 % 3) + "\t" + phrase + "\n";
+    }
+    string path;
+    Dictionary* dictionary = testCompileDictionary(words, path);
+    TEST_CHECK(dictionaryGetWordCount(dictionary) == 1000);
+    TEST_CHECK(dictionaryGetCategoryCount(dictionary) == 3);
+
+    for(uint64_t seed : {0ull, 1ull, 0x123456789abcdefull}){
+        testDrawWholeBag(dictionary, DICTIONARY_ANY, DICTIONARY_ANY, seed);
+        for(int category = 0; category < 3; category++){
+            testDrawWholeBag(dictionary, category, DICTIONARY_ANY, seed);
+            for(int difficulty = 0; difficulty < DICTIONARY_DIFFICULTY_COUNT; difficulty++){
+                testDrawWholeBag(dictionary, category, difficulty, seed);
+            }
+        }
+    }
+    testDrawEmptyBag(dictionary);
+    dictionaryClose(dictionary);
+    unlink(path.c_str());
+
+    // The smallest bags, 1 word and 4 words (exactly the permuted range)
+    for(const string& list : {string("KOT\n"), string("KOT\nPIES\nJEŻ\nŻÓŁW\n")}){
+        dictionary = testCompileDictionary(list, path);
+        testDrawWholeBag(dictionary, DICTIONARY_ANY, DICTIONARY_ANY, 7);
+        dictionaryClose(dictionary);
+        unlink(path.c_str());
+    }
+
+    return testFinish("dictionary_test");
+}
+
+/**
+ * Compiles the word list into a temporary file and opens it
+ * @param words The word list
+ * @param path Path of the created file, to be removed by the caller
+ * @return The dictionary
+ */
+Dictionary* testCompileDictionary(const string& words, string& path){
+    char name[] = "/tmp/wisielec-dictionary-XXXXXX";
+    int fd = mkstemp(name);
+    if(fd == -1){
+        perror("Failed to create the dictionary file");
+        exit(1);
+    }
+    close(fd);
+    path = name;
+
+    istringstream input(words);
+    dictionaryCompile(input, name);
+    return dictionaryOpen(name);
+}
+
+/**
+ * Draws as many words as the bag has
+ * @param dictionary The dictionary
+ * @param bag The bag
+ * @return Number of times each word has been drawn
+ */
+map<string, int> testDrawAll(Dictionary* dictionary, DictionaryBag& bag){
+    map<string, int> drawn;
+    for(uint32_t i = 0; i < bag.count; i++){
+        drawn[dictionaryDraw(dictionary, bag)]++;
+    }
+    return drawn;
+}
+
+/**
+ * Checks that two rounds of drawing from the bag return each of its words exactly once
+ * @param dictionary The dictionary
+ * @param category Number of the category or DICTIONARY_ANY
+ * @param difficulty The difficulty or DICTIONARY_ANY
+ * @param seed Seed of the bag
+ */
+void testDrawWholeBag(Dictionary* dictionary, int category, int difficulty, uint64_t seed){
+    DictionaryBag bag = dictionaryCreateBag(dictionary, category, difficulty, seed);
+
+    // The words the bag should contain, straight from its ranges of the index
+    map<string, int> expected;
+    uint32_t count = 0;
+    for(const auto& range : bag.ranges){
+        for(uint32_t i = 0; i < range.second; i++){
+            expected[dictionaryGetWord(dictionary, range.first + i)]++;
+        }
+        count += range.second;
+    }
+    TEST_CHECK(count == bag.count);
+    TEST_CHECK(bag.count > 0);
+    if(category == DICTIONARY_ANY && difficulty == DICTIONARY_ANY){
+        TEST_CHECK(expected.size() == dictionaryGetWordCount(dictionary));
+    }
+
+    for(int round = 0; round < 2; round++){
+        map<string, int> drawn = testDrawAll(dictionary, bag);
+        TEST_CHECK(drawn == expected);
+        TEST_CHECK(bag.position == bag.count);
+    }
+}
+
+/**
+ * Checks that a bag with no words draws empty strings
+ * @param dictionary The dictionary
+ */
+void testDrawEmptyBag(Dictionary* dictionary){
+    DictionaryBag bag = dictionaryCreateBag(dictionary, 1000, DICTIONARY_ANY, 0);
+    TEST_CHECK(bag.count == 0);
+    TEST_CHECK(dictionaryDraw(dictionary, bag).empty());
+}
@@ -0,0 +1,199 @@
+#include "test.hpp"
+#include "../src/game/hangman_player.hpp"
+#include "../src/game/player_registry.hpp"
+#include "../src/game/scoreboard.hpp"
+
+#include <string>
+
+using namespace std;
+
+/**
+ * The players and the scoreboard, updated the way HangmanServer updates them
+ */
+struct TestGame {
+    PlayerRegistry players;
+    Scoreboard scoreboard;
+
+    TestGame() : scoreboard(&players) {}
+};
+
+HangmanPlayer* testJoin(TestGame& game, const string& name);
+void testLeave(TestGame& game, HangmanPlayer* player);
+void testScore(TestGame& game, HangmanPlayer* player, int points);
+string testGetChanges(TestGame& game, uint64_t since);
+string testRow(const string& name, int score, int fails);
+string testChanges(uint64_t version, const string& players, const string& removed);
+void testLeaveAndRejoin();
+void testTruncatedChanges();
+
+/**
+ * Checks the delta responses of the scoreboard: which rows and removed players they list
+ * as the players leave and rejoin, and when they fall back to the whole table
+ */
+int main(){
+    testLeaveAndRejoin();
+    testTruncatedChanges();
+    return testFinish("scoreboard_test");
+}
+
+/**
+ * Adds a new player to the game
+ * @param game The game
+ * @param name Name of the player
+ * @return The player
+ */
+HangmanPlayer* testJoin(TestGame& game, const string& name){
+    auto player = new HangmanPlayer(nullptr, 0, 0);
+    player->setName(name);
+    player->setId(game.players.add(player));
+    game.scoreboard.onChange(player->getId());
+    return player;
+}
+
+/**
+ * Removes the player from the game and deletes it
+ * @param game The game
+ * @param player The player
+ */
+void testLeave(TestGame& game, HangmanPlayer* player){
+    game.scoreboard.onRemove(player->getId());
+    game.players.remove(player->getId());
+    delete player;
+}
+
+/**
+ * Adds the points to the player's score
+ * @param game The game
+ * @param player The player
+ * @param points Number of points to add
+ */
+void testScore(TestGame& game, HangmanPlayer* player, int points){
+    game.players.addScore(player->getId(), points);
+    game.scoreboard.onChange(player->getId());
+}
+
+/**
+ * Returns the content of the response with the changes since the version
+ * @param game The game
+ * @param since The version the client has
+ */
+string testGetChanges(TestGame& game, uint64_t since){
+    Frame* frame = game.scoreboard.getChangesFrame(since);
+    return string(frameGetPayload(frame) + 1, frameGetLength(frame) - FRAME_LENGTH_SIZE - 1);
+}
+
+/**
+ * Formats a row the way the scoreboard does
+ */
+string testRow(const string& name, int score, int fails){
+    return "{\"name\": \"" + name + "\",\"score\": " + to_string(score) + ",\"fails\": " + to_string(fails) + "}";
+}
+
+/**
+ * Formats a delta response the way the scoreboard does
+ * @param version The current version
+ * @param players The changed rows, separated with commas
+ * @param removed The quoted names of the removed players, separated with commas
+ */
+string testChanges(uint64_t version, const string& players, const string& removed){
+    return "{\"version\": " + to_string(version) + ", \"full\": 0, \"players\": [" + players + "], \"removed\": [" + removed + "]}";
+}
+
+/**
+ * Checks the deltas as the players join, score, leave, and rejoin or have their IDs reused
+ */
+void testLeaveAndRejoin(){
+    TestGame game;
+    TEST_CHECK(testGetChanges(game, 0) == testChanges(0, "", ""));
+
+    HangmanPlayer* alice = testJoin(game, "alice");                 // Version 1
+    HangmanPlayer* bob = testJoin(game, "bob");                     // Version 2
+    TEST_CHECK(testGetChanges(game, 0) == testChanges(2, testRow("alice", 0, 0) + ", " + testRow("bob", 0, 0), ""));
+    TEST_CHECK(testGetChanges(game, 1) == testChanges(2, testRow("bob", 0, 0), ""));
+    TEST_CHECK(testGetChanges(game, 2) == testChanges(2, "", ""));
+
+    // Only the last change of a row is listed
+    testScore(game, alice, 3);                                      // Version 3
+    testScore(game, alice, 2);                                      // Version 4
+    TEST_CHECK(testGetChanges(game, 2) == testChanges(4, testRow("alice", 5, 0), ""));
+
+    // A player that has left is listed once among the removed ones, and not among the rows
+    uint32_t bobId = bob->getId();
+    testScore(game, bob, 1);                                        // Version 5
+    testLeave(game, bob);                                           // Version 6
+    TEST_CHECK(testGetChanges(game, 0) == testChanges(6, testRow("alice", 5, 0), "\"bob\""));
+    TEST_CHECK(testGetChanges(game, 4) == testChanges(6, "", "\"bob\""));
+    TEST_CHECK(testGetChanges(game, 5) == testChanges(6, "", "\"bob\""));
+
+    // Another player gets the ID of the one that has left
+    HangmanPlayer* carol = testJoin(game, "carol");                 // Version 7
+    TEST_CHECK(carol->getId() == bobId);
+    TEST_CHECK(testGetChanges(game, 4) == testChanges(7, testRow("carol", 0, 0), "\"bob\""));
+    TEST_CHECK(testGetChanges(game, 6) == testChanges(7, testRow("carol", 0, 0), ""));
+
+    // A player that has rejoined is listed with the rows, with the new score
+    bob = testJoin(game, "bob");                                    // Version 8
+    TEST_CHECK(testGetChanges(game, 4) == testChanges(8, testRow("carol", 0, 0) + ", " + testRow("bob", 0, 0), ""));
+    TEST_CHECK(testGetChanges(game, 7) == testChanges(8, testRow("bob", 0, 0), ""));
+
+    // Leaving twice is reported once, leaving again after rejoining is reported
+    testLeave(game, bob);                                           // Version 9
+    bob = testJoin(game, "bob");                                    // Version 10
+    testLeave(game, bob);                                           // Version 11
+    TEST_CHECK(testGetChanges(game, 4) == testChanges(11, testRow("carol", 0, 0), "\"bob\""));
+    TEST_CHECK(testGetChanges(game, 9) == testChanges(11, "", "\"bob\""));
+    TEST_CHECK(testGetChanges(game, 10) == testChanges(11, "", "\"bob\""));
+
+    // The cached delta isn't reused for another version
+    TEST_CHECK(testGetChanges(game, 11) == testChanges(11, "", ""));
+    testScore(game, carol, 1);                                      // Version 12
+    TEST_CHECK(testGetChanges(game, 11) == testChanges(12, testRow("carol", 1, 0), ""));
+
+    // A version the client can't have gets the whole table
+    string full = testGetChanges(game, 13);
+    TEST_CHECK(full == "{\"version\": 12, \"full\": 1, \"players\": [" + testRow("alice", 5, 0) + ", "
+            + testRow("carol", 1, 0) + "], \"removed\": []}");
+
+    testLeave(game, alice);
+    testLeave(game, carol);
+}
+
+/**
+ * Checks that the deltas are exact up to the oldest remembered change, and that older versions get the whole table
+ */
+void testTruncatedChanges(){
+    TestGame game;
+    HangmanPlayer* alice = testJoin(game, "alice");                 // Version 1
+    HangmanPlayer* bob = testJoin(game, "bob");                     // Version 2
+    HangmanPlayer* carol = testJoin(game, "carol");                 // Version 3
+    testLeave(game, carol);                                         // Version 4
+
+    // The log holds up to SCOREBOARD_MAX_CHANGES changes. One more forgets the older half of them,
+    // so the changes are known since the version before the oldest one kept
+    uint64_t last = SCOREBOARD_MAX_CHANGES + 1;
+    uint64_t oldest = last - (SCOREBOARD_MAX_CHANGES - SCOREBOARD_MAX_CHANGES / 2 + 1);
+    while(game.scoreboard.getVersion() < last - 2){
+        testScore(game, alice, 1);
+    }
+    int aliceScore = (int)last - 6;
+    testLeave(game, bob);                                           // Version last - 1
+    testScore(game, alice, 1);                                      // Version last
+    aliceScore++;
+    TEST_CHECK(game.scoreboard.getVersion() == last);
+
+    TEST_CHECK(testGetChanges(game, oldest) == testChanges(last, testRow("alice", aliceScore, 0), "\"bob\""));
+    TEST_CHECK(testGetChanges(game, last - 1) == testChanges(last, testRow("alice", aliceScore, 0), ""));
+
+    string full = "{\"version\": " + to_string(last) + ", \"full\": 1, \"players\": ["
+            + testRow("alice", aliceScore, 0) + "], \"removed\": []}";
+    TEST_CHECK(testGetChanges(game, oldest - 1) == full);
+    TEST_CHECK(testGetChanges(game, 3) == full);
+    TEST_CHECK(testGetChanges(game, 0) == full);
+
+    // The next change keeps the log within the limit without forgetting anything else
+    testScore(game, alice, 1);
+    aliceScore++;
+    TEST_CHECK(testGetChanges(game, oldest) == testChanges(last + 1, testRow("alice", aliceScore, 0), "\"bob\""));
+
+    testLeave(game, alice);
+}
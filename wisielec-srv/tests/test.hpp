@@ -0,0 +1,35 @@
+#ifndef TEST_HPP
+#define TEST_HPP
+
+#include <cstdio>
+
+using namespace std;
+
+// Number of failed checks of the test program, returned from main
+inline int testFailures = 0;
+
+/**
+ * Checks the condition, printing it with its location if it doesn't hold. The test goes on after a failure
+ */
+#define TEST_CHECK(condition) \
+    do { \
+        if(!(condition)){ \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            testFailures++; \
+        } \
+    } while(false)
+
+/**
+ * Prints the result of the test program and returns its exit code
+ * @param name Name of the test program
+ */
+inline int testFinish(const char* name){
+    if(testFailures == 0){
+        printf("%s: OK\n", name);
+        return 0;
+    }
+    printf("%s: %d checks failed\n", name, testFailures);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include "test.hpp"
+#include "../src/unicode.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// Chooses the AVX2 paths of unicode.cpp, switched off to test the SSE2 ones
+extern bool unicodeHasAvx2;
+#endif
+
+size_t testDecodeReference(const unsigned char* input, size_t available, char32_t& result);
+string testEncodeReference(const u32string& text);
+void testDecodeChar();
+void testRejectMalformed();
+void testTranscode(const char* paths);
+void testCompareDecode(const string& utf8);
+void testCompareEncode(const u32string& utf32);
+
+/**
+ * Checks the UTF-8 rules against a reference decoder written straight from the table of well-formed sequences
+ * of the Unicode standard, and the SIMD paths against the scalar reference around the 16 and 32 byte blocks
+ */
+int main(){
+    testDecodeChar();
+    testRejectMalformed();
+    testTranscode("default");
+#if defined(__x86_64__) && defined(__GNUC__)
+    if(unicodeHasAvx2){
+        unicodeHasAvx2 = false;
+        testTranscode("SSE2");
+        unicodeHasAvx2 = true;
+    }
+#endif
+    return testFinish("unicode_test");
+}
+
+/**
+ * Decodes a single character under the table of well-formed UTF-8 byte sequences
+ * @param input The first byte of the character
+ * @param available Number of bytes left in the input
+ * @param result The decoded character
+ * @return Number of bytes of the character or 0 if it's malformed
+ */
+size_t testDecodeReference(const unsigned char* input, size_t available, char32_t& result){
+    // The lead bytes and the ranges of the second byte they allow, the other continuation bytes are 80..BF
+    struct Row { unsigned char leadFirst, leadLast, secondFirst, secondLast; size_t length; };
+    static const Row rows[] = {
+        { 0x00, 0x7f, 0x00, 0x00, 1 },
+        { 0xc2, 0xdf, 0x80, 0xbf, 2 },
+        { 0xe0, 0xe0, 0xa0, 0xbf, 3 },
+        { 0xe1, 0xec, 0x80, 0xbf, 3 },
+        { 0xed, 0xed, 0x80, 0x9f, 3 },
+        { 0xee, 0xef, 0x80, 0xbf, 3 },
+        { 0xf0, 0xf0, 0x90, 0xbf, 4 },
+        { 0xf1, 0xf3, 0x80, 0xbf, 4 },
+        { 0xf4, 0xf4, 0x80, 0x8f, 4 },
+    };
+    for(const Row& row : rows){
+        if(input[0] < row.leadFirst || input[0] > row.leadLast) continue;
+        if(available < row.length) return 0;
+        if(row.length == 1){
+            result = input[0];
+            return 1;
+        }
+        if(input[1] < row.secondFirst || input[1] > row.secondLast) return 0;
+        for(size_t i = 2; i < row.length; i++){
+            if(input[i] < 0x80 || input[i] > 0xbf) return 0;
+        }
+        result = input[0] & (0xff >> (row.length + 1));
+        for(size_t i = 1; i < row.length; i++){
+            result = (result << 6) | (input[i] & 0x3f);
+        }
+        return row.length;
+    }
+    return 0;
+}
+
+/**
+ * Encodes the valid characters one by one
+ * @param text The UTF-32 text without surrogates and characters above U+10FFFF
+ */
+string testEncodeReference(const u32string& text){
+    string result;
+    for(char32_t c : text){
+        if(c < 0x80){
+            result += (char)c;
+        }else if(c < 0x800){
+            result += (char)(0xc0 | (c >> 6));
+            result += (char)(0x80 | (c & 0x3f));
+        }else if(c < 0x10000){
+            result += (char)(0xe0 | (c >> 12));
+            result += (char)(0x80 | ((c >> 6) & 0x3f));
+            result += (char)(0x80 | (c & 0x3f));
+        }else{
+            result += (char)(0xf0 | (c >> 18));
+            result += (char)(0x80 | ((c >> 12) & 0x3f));
+            result += (char)(0x80 | ((c >> 6) & 0x3f));
+            result += (char)(0x80 | (c & 0x3f));
+        }
+    }
+    return result;
+}
+
+/**
+ * Compares utf8DecodeChar with the reference for every pair of the first two bytes,
+ * and for the boundary values of the third one. Covers the overlong forms, the surrogates,
+ * the characters above U+10FFFF and the truncated sequences
+ */
+void testDecodeChar(){
+    const unsigned char thirdBytes[] = { 0x00, 0x41, 0x7f, 0x80, 0x9f, 0xa0, 0xbf, 0xc0, 0xff };
+    int mismatches = 0;
+    for(int lead = 0; lead < 0x100; lead++){
+        for(int second = 0; second < 0x100; second++){
+            for(unsigned char third : thirdBytes){
+                unsigned char input[4] = { (unsigned char)lead, (unsigned char)second, third, 0x80 };
+                for(size_t available = 1; available <= 4; available++){
+                    char32_t expected = 0;
+                    char32_t result = 0;
+                    size_t expectedLength = testDecodeReference(input, available, expected);
+                    size_t length = utf8DecodeChar((const char*)input, available, result);
+                    if(length != expectedLength || (length != 0 && result != expected)) mismatches++;
+                }
+            }
+        }
+    }
+    TEST_CHECK(mismatches == 0);
+
+    // The boundaries, spelled out
+    struct Case { const char* bytes; size_t length; char32_t result; };
+    const Case cases[] = {
+        { "\xc2\x80", 2, 0x80 },
+        { "\xdf\xbf", 2, 0x7ff },
+        { "\xe0\xa0\x80", 3, 0x800 },
+        { "\xed\x9f\xbf", 3, 0xd7ff },
+        { "\xee\x80\x80", 3, 0xe000 },
+        { "\xef\xbf\xbf", 3, 0xffff },
+        { "\xf0\x90\x80\x80", 4, 0x10000 },
+        { "\xf4\x8f\xbf\xbf", 4, 0x10ffff },
+        { "\xc0\x80", 0, 0 },               // Overlong NUL
+        { "\xc1\xbf", 0, 0 },               // Overlong U+7F
+        { "\xe0\x9f\xbf", 0, 0 },           // Overlong U+7FF
+        { "\xf0\x8f\xbf\xbf", 0, 0 },       // Overlong U+FFFF
+        { "\xed\xa0\x80", 0, 0 },           // U+D800
+        { "\xed\xbf\xbf", 0, 0 },           // U+DFFF
+        { "\xf4\x90\x80\x80", 0, 0 },       // U+110000
+        { "\xf5\x80\x80\x80", 0, 0 },
+        { "\xff", 0, 0 },
+        { "\x80", 0, 0 },                   // A lone continuation byte
+        { "\xe2\x28\xa1", 0, 0 },           // Not a continuation byte
+    };
+    for(const Case& c : cases){
+        char32_t result = 0;
+        size_t length = utf8DecodeChar(c.bytes, string(c.bytes).length(), result);
+        TEST_CHECK(length == c.length);
+        if(c.length != 0) TEST_CHECK(result == c.result);
+    }
+
+    // Truncated sequences
+    char32_t result;
+    TEST_CHECK(utf8DecodeChar("\xe2\x82\xac", 2, result) == 0);
+    TEST_CHECK(utf8DecodeChar("\xf0\x9f\x98\x80", 3, result) == 0);
+    TEST_CHECK(utf8DecodeChar("\xc5\x81", 1, result) == 0);
+    TEST_CHECK(utf8DecodeChar("", 0, result) == 0);
+}
+
+/**
+ * Checks that the conversions reject the malformed input as a whole
+ */
+void testRejectMalformed(){
+    char32_t output[64];
+    for(const string& text : { string("ab\xc0\x80"), string("\xed\xa0\x80xyz"), string("za\xc5"),
+            string("\x80"), string("\xf4\x90\x80\x80") }){
+        TEST_CHECK(utf8ToUtf32(text.data(), text.length(), output) == UNICODE_INVALID);
+        TEST_CHECK(!utf8Validate(text.data(), text.length()));
+        TEST_CHECK(utf8ToUtf32(text).empty());
+    }
+
+    char buffer[64];
+    for(char32_t c : { (char32_t)0xd800, (char32_t)0xdfff, (char32_t)0x110000, (char32_t)0xffffffff }){
+        u32string text = U"abc";
+        text += c;
+        TEST_CHECK(utf32ToUtf8(text.data(), text.length(), buffer) == UNICODE_INVALID);
+        TEST_CHECK(utf32GetUtf8Length(text.data(), text.length()) == UNICODE_INVALID);
+        TEST_CHECK(utf32ToUtf8(text).empty());
+    }
+}
+
+/**
+ * Compares the conversions with the references for the texts around the SIMD block sizes:
+ * all ASCII, and with a single multi-byte character or a malformed byte at every position
+ * @param paths Name of the SIMD paths in use, printed if a check fails
+ */
+void testTranscode(const char* paths){
+    int failures = testFailures;
+    const vector<u32string> others = { U"ą", U"€", U"😀" };
+    for(size_t length : { 0, 1, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 100 }){
+        u32string ascii;
+        for(size_t i = 0; i < length; i++){
+            ascii += (char32_t)(' ' + (i * 7) % 95);
+        }
+        testCompareEncode(ascii);
+        testCompareDecode(testEncodeReference(ascii));
+
+        for(size_t position = 0; position < length; position++){
+            for(const u32string& other : others){
+                u32string text = ascii.substr(0, position) + other + ascii.substr(position + 1);
+                testCompareEncode(text);
+                testCompareDecode(testEncodeReference(text));
+            }
+
+            // A continuation byte and a truncated character in the middle of the ASCII
+            string utf8 = testEncodeReference(ascii);
+            utf8[position] = (char)0x80;
+            testCompareDecode(utf8);
+            utf8[position] = (char)0xc5;
+            testCompareDecode(utf8);
+        }
+    }
+    if(testFailures != failures){
+        printf("The checks above failed with the %s SIMD paths\n", paths);
+    }
+}
+
+/**
+ * Compares utf8ToUtf32 and utf8Validate with the reference decoder
+ * @param utf8 The text, valid or not
+ */
+void testCompareDecode(const string& utf8){
+    auto bytes = (const unsigned char*)utf8.data();
+    u32string expected;
+    bool isValid = true;
+    for(size_t in = 0; in < utf8.length() && isValid;){
+        char32_t c = 0;
+        size_t length = testDecodeReference(bytes + in, utf8.length() - in, c);
+        isValid = length != 0;
+        if(isValid) expected += c;
+        in += length;
+    }
+
+    vector<char32_t> output(utf8.length() + 1, 0);
+    size_t length = utf8ToUtf32(utf8.data(), utf8.length(), output.data());
+    TEST_CHECK(utf8Validate(utf8.data(), utf8.length()) == isValid);
+    if(isValid){
+        TEST_CHECK(length == expected.length());
+        TEST_CHECK(u32string(output.data(), length == UNICODE_INVALID ? 0 : length) == expected);
+    }else{
+        TEST_CHECK(length == UNICODE_INVALID);
+    }
+}
+
+/**
+ * Compares utf32ToUtf8 and utf32GetUtf8Length with the reference encoder
+ * @param utf32 The valid text
+ */
+void testCompareEncode(const u32string& utf32){
+    string expected = testEncodeReference(utf32);
+    TEST_CHECK(utf32GetUtf8Length(utf32.data(), utf32.length()) == expected.length());
+
+    vector<char> output(expected.length() + 1, 0);
+    size_t length = utf32ToUtf8(utf32.data(), utf32.length(), output.data());
+    TEST_CHECK(length == expected.length());
+    TEST_CHECK(string(output.data(), length == UNICODE_INVALID ? 0 : length) == expected);
+}
@@ -0,0 +1,608 @@
+#include "../src/buffer.hpp"
+#include "../src/channel.hpp"
+#include "../src/client.hpp"
+#include "../src/epoll.hpp"
+#include "../src/frame.hpp"
+#include "../src/log.hpp"
+#include "../src/server.hpp"
+#include "../src/timer.hpp"
+#include "../src/unicode.hpp"
+#include "../src/game/hangman_player.hpp"
+#include "../src/game/hangman_server.hpp"
+#include "../src/game/message.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+#define BENCH_DEFAULT_REPETITIONS 5
+#define BENCH_DEFAULT_TARGET_MS 100
+#define BENCH_CLIENT_BATCH 32           // Frames written or read at once, the window of requests of a client
+#define BENCH_GUESS_LETTERS "EAIONRTSLCUDPMHGBFYWKVXZJQ"
+#define BENCH_TEXT "Zażółć gęślą jaźń, hangman! "
+
+typedef uint64_t (*BenchmarkFunction)(size_t parameter, size_t iterations);
+
+/**
+ * A microbenchmark. The function runs the given number of operations and returns the nanoseconds
+ * spent in them, leaving out the preparation
+ */
+struct Benchmark {
+    const char* name;
+    size_t parameter;               // Size of the input, of the batch or of the room, depending on the benchmark
+    BenchmarkFunction function;
+};
+
+/**
+ * A client on one end of a socket pair, served by a real event loop. The benchmark plays both
+ * the remote end of the socket and the game thread receiving the requests
+ */
+struct BenchConnection {
+    Epoll* epoll;
+    TimerWheel* timers;
+    Channel* toWorker;
+    Server* server;
+    Client* client;
+    ClientLimits limits;
+    int peerFd;
+    int wakeFd;                     // Wakes the event loop up, so that it flushes the client's output
+    EpollHandler* wakeHandler;
+};
+
+uint64_t benchUtf8ToUtf32(size_t parameter, size_t iterations);
+uint64_t benchUtf32ToUtf8(size_t parameter, size_t iterations);
+uint64_t benchUtf8Validate(size_t parameter, size_t iterations);
+uint64_t benchMessageEncode(size_t parameter, size_t iterations);
+uint64_t benchBufferChain(size_t parameter, size_t iterations);
+uint64_t benchClientInput(size_t parameter, size_t iterations);
+uint64_t benchClientWrite(size_t parameter, size_t iterations);
+uint64_t benchMakeGuess(size_t parameter, size_t iterations);
+uint64_t benchScoreboardTable(size_t parameter, size_t iterations);
+uint64_t benchScoreboardChanges(size_t parameter, size_t iterations);
+uint64_t benchScoreboardTop(size_t parameter, size_t iterations);
+uint64_t benchScoreboard(size_t parameter, size_t iterations, const char* request);
+
+BenchConnection* benchConnectionCreate();
+void benchConnectionRelease(BenchConnection* connection);
+void benchConnectionDrain(BenchConnection* connection);
+void benchOnWake(EpollHandler* sender);
+
+/**
+ * A room played without any connections
+ */
+class BenchRoom : public HangmanServer {
+    public:
+    vector<HangmanPlayer*> members;
+
+    BenchRoom(size_t playerCount);
+    ~BenchRoom();
+
+    void restartRound();
+};
+
+string benchText(size_t length);
+size_t benchCalibrate(const Benchmark& benchmark, uint64_t targetNs);
+map<string, double> benchReadBaseline(const char* path);
+string benchKey(const char* name, size_t parameter);
+uint64_t benchNow();
+void printUsage(const char* program);
+
+const Benchmark benchmarks[] = {
+    { "utf8_to_utf32", 16, benchUtf8ToUtf32 },
+    { "utf8_to_utf32", 256, benchUtf8ToUtf32 },
+    { "utf8_to_utf32", 4096, benchUtf8ToUtf32 },
+    { "utf32_to_utf8", 16, benchUtf32ToUtf8 },
+    { "utf32_to_utf8", 256, benchUtf32ToUtf8 },
+    { "utf32_to_utf8", 4096, benchUtf32ToUtf8 },
+    { "utf8_validate", 16, benchUtf8Validate },
+    { "utf8_validate", 256, benchUtf8Validate },
+    { "utf8_validate", 4096, benchUtf8Validate },
+    { "message_encode", 32, benchMessageEncode },
+    { "message_encode", 1024, benchMessageEncode },
+    { "buffer_chain", 8, benchBufferChain },
+    { "buffer_chain", 64, benchBufferChain },
+    { "buffer_chain", 512, benchBufferChain },
+    { "client_input", 8, benchClientInput },
+    { "client_input", 256, benchClientInput },
+    { "client_write", 8, benchClientWrite },
+    { "client_write", 256, benchClientWrite },
+    { "make_guess", 1, benchMakeGuess },
+    { "make_guess", 32, benchMakeGuess },
+    { "make_guess", 256, benchMakeGuess },
+    { "scoreboard_table", 8, benchScoreboardTable },
+    { "scoreboard_table", 32, benchScoreboardTable },
+    { "scoreboard_table", 256, benchScoreboardTable },
+    { "scoreboard_changes", 32, benchScoreboardChanges },
+    { "scoreboard_changes", 256, benchScoreboardChanges },
+    { "scoreboard_top", 32, benchScoreboardTop },
+    { "scoreboard_top", 256, benchScoreboardTop },
+};
+
+/**
+ * Runs the microbenchmarks of the hot paths and prints one JSON object per benchmark and parameter,
+ * with the median, the fastest and the slowest of the repetitions in nanoseconds per operation.
+ * With a baseline (an earlier output), every result also has the ratio to the baseline's median
+ */
+int main(int argc, char** argv){
+    const char* filter = nullptr;
+    const char* baselinePath = nullptr;
+    int repetitions = BENCH_DEFAULT_REPETITIONS;
+    uint64_t targetMs = BENCH_DEFAULT_TARGET_MS;
+
+    int option;
+    while((option = getopt(argc, argv, "f:r:t:b:")) != -1){
+        switch(option){
+            case 'f':
+                // Only the benchmarks with this text in their names
+                filter = optarg;
+                break;
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 't':
+                // Minimum time of a single repetition
+                targetMs = strtoull(optarg, nullptr, 10);
+                break;
+            case 'b':
+                baselinePath = optarg;
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if(repetitions < 1){
+        printUsage(argv[0]);
+        return 1;
+    }
+    map<string, double> baseline;
+    if(baselinePath != nullptr){
+        baseline = benchReadBaseline(baselinePath);
+        if(baseline.empty()){
+            cerr << "No results in the baseline: " << baselinePath << endl;
+            return 1;
+        }
+    }
+    logSetLevel(LOG_LEVEL_NONE);
+
+    for(const Benchmark& benchmark : benchmarks){
+        if(filter != nullptr && strstr(benchmark.name, filter) == nullptr) continue;
+        size_t iterations = benchCalibrate(benchmark, targetMs * 1000000);
+        vector<double> results;
+        for(int i = 0; i < repetitions; i++){
+            results.push_back((double)benchmark.function(benchmark.parameter, iterations) / iterations);
+        }
+        sort(results.begin(), results.end());
+        double median = results[results.size() / 2];
+
+        printf("{\"benchmark\": \"%s\", \"parameter\": %zu, \"iterations\": %zu, \"repetitions\": %d, "
+               "\"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f",
+               benchmark.name, benchmark.parameter, iterations, repetitions, median, results.front(), results.back());
+        auto entry = baseline.find(benchKey(benchmark.name, benchmark.parameter));
+        if(entry != baseline.end() && entry->second > 0){
+            printf(", \"baseline_ns_per_op\": %.2f, \"ratio\": %.3f", entry->second, median / entry->second);
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+/**
+ * Decodes UTF-8 text of the given length in bytes
+ */
+uint64_t benchUtf8ToUtf32(size_t parameter, size_t iterations){
+    string text = benchText(parameter);
+    vector<char32_t> output(text.length());
+    size_t total = 0;
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        total += utf8ToUtf32(text.data(), text.length(), output.data());
+    }
+    uint64_t elapsed = benchNow() - start;
+    if(total == 0) cerr << "Nothing decoded" << endl;
+    return elapsed;
+}
+
+/**
+ * Encodes the characters of UTF-8 text of the given length in bytes
+ */
+uint64_t benchUtf32ToUtf8(size_t parameter, size_t iterations){
+    u32string text = utf8ToUtf32(benchText(parameter));
+    vector<char> output(text.length() * 4);
+    size_t total = 0;
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        total += utf32ToUtf8(text.data(), text.length(), output.data());
+    }
+    uint64_t elapsed = benchNow() - start;
+    if(total == 0) cerr << "Nothing encoded" << endl;
+    return elapsed;
+}
+
+/**
+ * Validates UTF-8 text of the given length in bytes, as the I/O threads do with every request
+ */
+uint64_t benchUtf8Validate(size_t parameter, size_t iterations){
+    string text = benchText(parameter);
+    size_t valid = 0;
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        valid += utf8Validate(text.data(), text.length());
+    }
+    uint64_t elapsed = benchNow() - start;
+    if(valid != iterations) cerr << "Invalid text" << endl;
+    return elapsed;
+}
+
+/**
+ * Encodes a notification with a body of the given length into a frame
+ */
+uint64_t benchMessageEncode(size_t parameter, size_t iterations){
+    Message message(MDIR_NOTIFY | MTYPE_GUESS, benchText(parameter));
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        frameRelease(message.encode());
+    }
+    return benchNow() - start;
+}
+
+/**
+ * Builds a chain of the given number of buffers referencing a frame, one bufferAttachNext at a time,
+ * and releases it. An operation is the whole chain
+ */
+uint64_t benchBufferChain(size_t parameter, size_t iterations){
+    Frame* frame = Message(MDIR_NOTIFY | MTYPE_SCORE, "{\"player\": \"bench\", \"score\": 1}").encode();
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        Buffer* head = bufferCreate(frame);
+        for(size_t j = 1; j < parameter; j++){
+            bufferAttachNext(head, bufferCreate(frame));
+        }
+        while(head != nullptr){
+            Buffer* next = bufferGetNext(head);
+            bufferRelease(head);
+            head = next;
+        }
+    }
+    uint64_t elapsed = benchNow() - start;
+    frameRelease(frame);
+    return elapsed;
+}
+
+/**
+ * Receives requests with bodies of the given length through a client: the remote end writes a window of requests,
+ * the event loop reads and frames them, and the game thread's end takes them from the channel.
+ * An operation is a single request
+ */
+uint64_t benchClientInput(size_t parameter, size_t iterations){
+    BenchConnection* connection = benchConnectionCreate();
+    string request(1, (char)(MDIR_REQUEST | MTYPE_GUESS));
+    request += benchText(parameter);
+    string batch;
+    for(int i = 0; i < BENCH_CLIENT_BATCH; i++){
+        uint32_t length = request.length();
+        char header[4] = { (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length };
+        batch.append(header, sizeof(header));
+        batch += request;
+    }
+
+    uint64_t start = benchNow();
+    for(size_t done = 0; done < iterations; done += BENCH_CLIENT_BATCH){
+        if(write(connection->peerFd, batch.data(), batch.length()) != (ssize_t)batch.length()){
+            cerr << "Failed to write the requests" << endl;
+            break;
+        }
+        epollWaitForEvent(connection->epoll);
+        benchConnectionDrain(connection);
+    }
+    uint64_t elapsed = benchNow() - start;
+    benchConnectionRelease(connection);
+    return elapsed;
+}
+
+/**
+ * Sends messages with bodies of the given length through a client: a batch of clientWrite calls,
+ * written together at the end of the event loop's wakeup, and read by the remote end.
+ * An operation is a single message
+ */
+uint64_t benchClientWrite(size_t parameter, size_t iterations){
+    BenchConnection* connection = benchConnectionCreate();
+    string message(1, (char)(MDIR_NOTIFY | MTYPE_GUESS));
+    message += benchText(parameter);
+    size_t batchLength = BENCH_CLIENT_BATCH * (message.length() + FRAME_LENGTH_SIZE);
+    vector<char> received(batchLength);
+
+    uint64_t start = benchNow();
+    for(size_t done = 0; done < iterations; done += BENCH_CLIENT_BATCH){
+        for(int i = 0; i < BENCH_CLIENT_BATCH; i++){
+            clientWrite(connection->client, message.data(), message.length());
+        }
+        uint64_t one = 1;
+        if(write(connection->wakeFd, &one, sizeof(one)) != sizeof(one)) break;
+        epollWaitForEvent(connection->epoll);
+        size_t receivedLength = 0;
+        while(receivedLength < batchLength){
+            ssize_t readBytes = read(connection->peerFd, received.data() + receivedLength, batchLength - receivedLength);
+            if(readBytes <= 0) break;
+            receivedLength += readBytes;
+        }
+    }
+    uint64_t elapsed = benchNow() - start;
+    benchConnectionRelease(connection);
+    return elapsed;
+}
+
+/**
+ * Makes guesses in a room of the given number of players, which take turns. Every round the letters are guessed
+ * in the order of their frequency, so that the hits and misses repeat. Starting the rounds isn't measured
+ */
+uint64_t benchMakeGuess(size_t parameter, size_t iterations){
+    // The rooms without a seed given draw the same phrases in every run
+    BenchRoom room(parameter);
+    const char* letters = BENCH_GUESS_LETTERS;
+    size_t letterCount = strlen(letters);
+    uint64_t elapsed = 0;
+    for(size_t done = 0; done < iterations; done += letterCount){
+        size_t count = min(letterCount, iterations - done);
+        uint64_t start = benchNow();
+        for(size_t i = 0; i < count; i++){
+            room.makeGuess(room.members[(done + i) % parameter], (char32_t)letters[i]);
+        }
+        elapsed += benchNow() - start;
+        room.restartRound();
+    }
+    return elapsed;
+}
+
+/**
+ * Serializes the whole scoreboard of a room of the given size after every change
+ */
+uint64_t benchScoreboardTable(size_t parameter, size_t iterations){
+    return benchScoreboard(parameter, iterations, "");
+}
+
+/**
+ * Serializes the change of a single row, as asked for by a client that keeps up with the scoreboard
+ */
+uint64_t benchScoreboardChanges(size_t parameter, size_t iterations){
+    return benchScoreboard(parameter, iterations, nullptr);
+}
+
+/**
+ * Serializes the ten best players after every change
+ */
+uint64_t benchScoreboardTop(size_t parameter, size_t iterations){
+    return benchScoreboard(parameter, iterations, "top 10");
+}
+
+/**
+ * Changes a row of the scoreboard and answers a request, as the MTYPE_SCORE handler does.
+ * Every change creates a new version, so every response is serialized again
+ * @param parameter Number of the players in the room
+ * @param iterations Number of the changes
+ * @param request The request, nullptr for the changes since the previous version
+ */
+uint64_t benchScoreboard(size_t parameter, size_t iterations, const char* request){
+    BenchRoom room(parameter);
+    Scoreboard& scoreboard = room.getScoreboard();
+    size_t totalLength = 0;
+    uint64_t start = benchNow();
+    for(size_t i = 0; i < iterations; i++){
+        uint32_t id = room.members[i % parameter]->getId();
+        scoreboard.onChange(id);
+        string content = request != nullptr ? request : to_string(scoreboard.getVersion() - 1);
+        totalLength += frameGetLength(scoreboard.getResponse(content, id));
+    }
+    uint64_t elapsed = benchNow() - start;
+    if(totalLength == 0) cerr << "Empty responses" << endl;
+    return elapsed;
+}
+
+/**
+ * Creates a client on a socket pair with its own event loop and a channel to nowhere
+ * @return The connection
+ */
+BenchConnection* benchConnectionCreate(){
+    auto connection = new BenchConnection();
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1){
+        perror("Failed to create the socket pair");
+        exit(1);
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    connection->peerFd = fds[1];
+    connection->epoll = epollCreate();
+    connection->timers = timerWheelCreate(connection->epoll);
+    connection->toWorker = channelCreate();
+    channelAttachProducer(connection->toWorker, connection->epoll);
+    connection->server = serverCreate(0, &connection->toWorker, 1);
+    connection->limits = { 0, CLIENT_DEFAULT_LOW_WATERMARK, CLIENT_DEFAULT_HIGH_WATERMARK };
+    connection->client = clientCreate(fds[0], connection->epoll, connection->server, connection->timers,
+                                      &connection->limits, 1, 0);
+
+    connection->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    connection->wakeHandler = epollCreateHandler(connection->wakeFd);
+    epollHandlerSetOnInput(connection->wakeHandler, benchOnWake);
+    *(BenchConnection**)epollHandlerData(connection->wakeHandler) = connection;
+    epollRegisterHandler(connection->epoll, connection->wakeHandler);
+    epollSetHandledEvents(connection->wakeHandler, EPOLLIN);
+    return connection;
+}
+
+/**
+ * Closes the client and releases the event loop with the channel
+ * @param connection The connection
+ */
+void benchConnectionRelease(BenchConnection* connection){
+    clientClose(connection->client);
+    benchConnectionDrain(connection);
+    epollUnregisterHandler(connection->wakeHandler);
+    epollReleaseHandler(connection->wakeHandler);
+    close(connection->wakeFd);
+    serverClose(connection->server);
+    channelDetachProducer(connection->toWorker);
+    channelRelease(connection->toWorker);
+    timerWheelRelease(connection->timers);
+    epollRelease(connection->epoll);
+    close(connection->peerFd);
+    delete connection;
+}
+
+/**
+ * Takes the requests from the channel as the game thread would, and confirms the windows of requests at once
+ * @param connection The connection
+ */
+void benchConnectionDrain(BenchConnection* connection){
+    ChannelMessage* message;
+    while((message = channelPeek(connection->toWorker)) != nullptr){
+        bool isSync = message->kind == CHANNEL_SYNC;
+        if(message->frame != nullptr) frameRelease(message->frame);
+        channelPop(connection->toWorker);
+        if(isSync) clientOnSync(connection->client);
+    }
+}
+
+/**
+ * Handles the wakeup that makes the event loop flush the client's output
+ * @param sender The eventfd handler
+ */
+void benchOnWake(EpollHandler* sender){
+    auto connection = *(BenchConnection**)epollHandlerData(sender);
+    uint64_t count;
+    if(read(connection->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+        perror("Failed to read the eventfd");
+    }
+}
+
+/**
+ * Creates the room with the players joined
+ * @param playerCount Number of the players
+ */
+BenchRoom::BenchRoom(size_t playerCount) : HangmanServer(1, nullptr) {
+    for(size_t i = 0; i < playerCount; i++){
+        auto player = new HangmanPlayer(nullptr, i, 1);
+        player->setName("player" + to_string(i));
+        this->joinPlayer(player);
+        this->members.push_back(player);
+    }
+}
+
+/**
+ * Makes the players leave and deletes them
+ */
+BenchRoom::~BenchRoom() {
+    for(HangmanPlayer* player : this->members){
+        this->leavePlayer(player);
+        delete player;
+    }
+}
+
+/**
+ * Starts a new round right away, without waiting for the round timer
+ */
+void BenchRoom::restartRound() {
+    this->startNewRound();
+}
+
+/**
+ * Returns the sample text, Polish letters mixed with ASCII, cut to the given number of bytes on a character boundary
+ * @param length Number of bytes
+ */
+string benchText(size_t length){
+    string text;
+    while(text.length() < length){
+        text += BENCH_TEXT;
+    }
+    text.resize(length);
+    // A character cut in half is dropped
+    while(!text.empty() && !utf8Validate(text.data(), text.length())){
+        text.pop_back();
+    }
+    while(text.length() < length){
+        text += ' ';
+    }
+    return text;
+}
+
+/**
+ * Finds the number of operations that take at least the target time, starting from a single one
+ * @param benchmark The benchmark
+ * @param targetNs The target time in nanoseconds
+ * @return Number of the operations
+ */
+size_t benchCalibrate(const Benchmark& benchmark, uint64_t targetNs){
+    size_t iterations = 1;
+    while(true){
+        uint64_t elapsed = benchmark.function(benchmark.parameter, iterations);
+        if(elapsed >= targetNs) return iterations;
+        // Aims a bit above the target, the short runs are less accurate
+        size_t next = elapsed > 0 ? (size_t)((double)iterations * targetNs * 1.2 / elapsed) : iterations * 100;
+        iterations = max(iterations * 2, min(next, iterations * 100));
+    }
+}
+
+/**
+ * Reads the medians of an earlier run
+ * @param path Path of the earlier output
+ * @return The medians by benchKey
+ */
+map<string, double> benchReadBaseline(const char* path){
+    map<string, double> baseline;
+    ifstream input(path);
+    string line;
+    while(getline(input, line)){
+        char name[64];
+        size_t parameter;
+        size_t iterations;
+        int repetitions;
+        double median;
+        if(sscanf(line.c_str(), "{\"benchmark\": \"%63[^\"]\", \"parameter\": %zu, \"iterations\": %zu, \"repetitions\": %d, "
+                  "\"ns_per_op\": %lf", name, &parameter, &iterations, &repetitions, &median) == 5){
+            baseline[benchKey(name, parameter)] = median;
+        }
+    }
+    return baseline;
+}
+
+/**
+ * Returns the key identifying a benchmark with its parameter
+ * @param name Name of the benchmark
+ * @param parameter The parameter
+ */
+string benchKey(const char* name, size_t parameter){
+    return string(name) + "/" + to_string(parameter);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t benchNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Prints how to run the program
+ * @param program Name of the program
+ */
+void printUsage(const char* program){
+    cout << "Usage: " << program << " [-f name filter] [-r repetitions] [-t minimum ms per repetition] [-b baseline output]" << endl;
+}
@@ -0,0 +1,39 @@
+#include "../src/dictionary.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * Compiles a word list into the dictionary file used by the server (option -d).
+ * Every line of the list is a phrase, optionally preceded by a category and a tab
+ */
+int main(int argc, char** argv){
+    if(argc != 3){
+        cout << "Usage: " << argv[0] << " word-list dictionary" << endl;
+        return 1;
+    }
+
+    ifstream input(argv[1]);
+    if(!input){
+        cout << "Failed to open the word list: " << argv[1] << endl;
+        return 1;
+    }
+
+    try {
+        dictionaryCompile(input, argv[2]);
+        Dictionary* dictionary = dictionaryOpen(argv[2]);
+        cout << dictionaryGetWordCount(dictionary) << " phrases in " << dictionaryGetCategoryCount(dictionary) << " categories:";
+        for(uint32_t i = 0; i < dictionaryGetCategoryCount(dictionary); i++){
+            cout << " " << dictionaryGetCategoryName(dictionary, i);
+        }
+        cout << endl;
+        dictionaryClose(dictionary);
+    } catch(const runtime_error& e) {
+        cout << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
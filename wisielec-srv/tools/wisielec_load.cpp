@@ -0,0 +1,928 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+#define LOAD_MAX_EVENTS 256
+#define LOAD_READ_SIZE 65536
+#define LOAD_ANSWER_TIMEOUT_NS 2000000000ull    // A guess without a notification after this long is counted as unanswered
+#define LOAD_HISTOGRAM_LINEAR 64                // Values below are counted exactly, the rest in 32 buckets per power of two
+#define LOAD_HISTOGRAM_BUCKETS (LOAD_HISTOGRAM_LINEAR + 58 * 32)
+
+#define LOAD_PLAYER_CONNECTING 0
+#define LOAD_PLAYER_JOINING 1
+#define LOAD_PLAYER_PLAYING 2
+#define LOAD_PLAYER_CLOSED 3
+
+#define LOAD_ACTION_GUESS 0
+#define LOAD_ACTION_POLL 1
+
+// The protocol, see readme.md
+#define LOAD_REQUEST_JOIN 0x01
+#define LOAD_REQUEST_LEAVE 0x02
+#define LOAD_REQUEST_GUESS 0x11
+#define LOAD_REQUEST_SCORE 0x12
+#define LOAD_RESPONSE_JOIN 0x41
+#define LOAD_RESPONSE_SCORE 0x52
+#define LOAD_NOTIFY_PHRASE 0x91
+#define LOAD_NOTIFY_SCORE 0x92
+#define LOAD_NOTIFY_HANG 0x93
+#define LOAD_NOTIFY_WIN 0xa1
+#define LOAD_NOTIFY_LOSE 0xa2
+
+struct LoadThread;
+
+/**
+ * Options of the run, shared by all the threads
+ */
+struct LoadOptions {
+    sockaddr_storage address;
+    socklen_t addressLength;
+    int playerCount;
+    int threadCount;
+    double connectRate;         // New connections per second, 0 to connect all at once
+    double guessRate;           // Guesses per second of a single player
+    double pollRate;            // Scoreboard requests per second of a single player, 0 to never ask
+    uint64_t thinkTimeNs;       // Maximum random delay added to every action
+    uint64_t durationNs;
+    string namePrefix;
+};
+
+/**
+ * Latency histogram with about 3% precision, from a microsecond up to hours
+ */
+struct LoadHistogram {
+    uint64_t buckets[LOAD_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+/**
+ * Counters of a thread, read by the main thread for the progress lines
+ */
+struct LoadCounters {
+    atomic<uint64_t> connected;
+    atomic<uint64_t> failed;            // Connections or joins that failed
+    atomic<uint64_t> disconnected;      // Connections closed by the server
+    atomic<uint64_t> rejoins;           // Joins after winning or losing a game
+    atomic<uint64_t> guesses;
+    atomic<uint64_t> answered;
+    atomic<uint64_t> unanswered;
+    atomic<uint64_t> polls;
+    atomic<uint64_t> pollsAnswered;
+    atomic<uint64_t> bytesIn;
+    atomic<uint64_t> bytesOut;
+};
+
+/**
+ * A simulated player: a connection that joins a room, guesses letters and polls the scoreboard
+ */
+struct LoadPlayer {
+    LoadThread* thread;
+    int index;                  // Index in the thread
+    int fd;
+    int state;                  // One of the LOAD_PLAYER_ constants
+    string name;
+    string input;               // Received bytes that don't make a whole message yet
+    string output;              // Bytes the socket hasn't taken yet
+    bool isWaitingForOutput;    // Whether EPOLLOUT is subscribed for
+    bool isScheduled;           // Whether the guesses and polls have been scheduled
+    string phrase;              // The latest phrase of the room, with the hidden letters as '_'
+    uint32_t guessedLetters;    // Bitmask of the letters guessed in the current round
+    uint64_t guessTime;         // When the unanswered guess was sent, 0 if there's none
+    uint64_t pollTime;          // When the unanswered scoreboard request was sent, 0 if there's none
+    string scoreVersion;        // Version of the scoreboard from the last response
+};
+
+/**
+ * A scheduled guess or scoreboard request of a player
+ */
+struct LoadAction {
+    uint64_t time;
+    int player;
+    int kind;                   // One of the LOAD_ACTION_ constants
+
+    bool operator>(const LoadAction& other) const {
+        return this->time > other.time;
+    }
+};
+
+/**
+ * A thread driving its share of the players with its own epoll instance
+ */
+struct LoadThread {
+    int index;
+    const LoadOptions* options;
+    int epollFd;
+    vector<LoadPlayer*> players;
+    priority_queue<LoadAction, vector<LoadAction>, greater<LoadAction>> actions;
+    size_t startedCount;        // Players whose connections have been started
+    uint64_t nextConnectTime;
+    double connectRate;         // This thread's share of the connect rate
+    mt19937_64 random;
+    LoadCounters counters;
+    LoadHistogram guessLatency; // From a guess to the notification about the player's score or fail
+    LoadHistogram pollLatency;  // From a scoreboard request to its response
+    thread* runner;
+};
+
+int parseAddress(const char* host, const char* port, LoadOptions& options);
+void raiseDescriptorLimit(size_t needed);
+void printProgress(const vector<LoadThread*>& threads, uint64_t elapsedNs, uint64_t previousGuesses, uint64_t previousAnswered,
+                   uint64_t previousPolls, double intervalSeconds);
+void printSummary(const vector<LoadThread*>& threads, double seconds);
+void printUsage(const char* program);
+
+LoadThread* loadThreadCreate(int index, const LoadOptions* options, int firstPlayer, int playerCount);
+void loadThreadRelease(LoadThread* thread);
+void loadThreadRun(LoadThread* thread);
+void loadThreadStartConnections(LoadThread* thread, uint64_t now);
+void loadThreadRunActions(LoadThread* thread, uint64_t now);
+int loadThreadGetTimeout(LoadThread* thread, uint64_t now);
+uint64_t loadThreadGetDelay(LoadThread* thread, double rate);
+
+void loadPlayerConnect(LoadPlayer* player);
+void loadPlayerOnEvent(LoadPlayer* player, uint32_t events, uint64_t now);
+void loadPlayerOnConnected(LoadPlayer* player);
+void loadPlayerRead(LoadPlayer* player, uint64_t now);
+void loadPlayerOnMessage(LoadPlayer* player, uint8_t type, const string& body, uint64_t now);
+void loadPlayerJoin(LoadPlayer* player);
+void loadPlayerGuess(LoadPlayer* player, uint64_t now);
+void loadPlayerPoll(LoadPlayer* player, uint64_t now);
+void loadPlayerSend(LoadPlayer* player, uint8_t type, const string& body);
+void loadPlayerWrite(LoadPlayer* player);
+void loadPlayerClose(LoadPlayer* player);
+bool loadPlayerIsMentioned(LoadPlayer* player, const string& body);
+
+void histogramRecord(LoadHistogram* histogram, uint64_t valueNs);
+void histogramMerge(LoadHistogram* target, const LoadHistogram* source);
+uint64_t histogramPercentile(const LoadHistogram* histogram, double percentile);
+string jsonGetValue(const string& json, const string& key);
+uint64_t loadNow();
+
+/**
+ * Puts load on a running server: simulated players connect, join the rooms, guess letters and poll the scoreboard
+ * at the given rates for the given time. Prints the throughput every second, and at the end the latencies
+ * from a guess to the notification about the guessing player, and from a scoreboard request to its response
+ */
+int main(int argc, char** argv){
+    LoadOptions options {};
+    options.playerCount = 100;
+    options.threadCount = 1;
+    options.connectRate = 1000;
+    options.guessRate = 1;
+    options.pollRate = 0.2;
+    options.thinkTimeNs = 0;
+    options.durationNs = 10 * 1000000000ull;
+    options.namePrefix = "bot";
+    const char* host = "127.0.0.1";
+
+    int option;
+    while((option = getopt(argc, argv, "h:n:T:c:g:q:k:d:N:")) != -1){
+        switch(option){
+            case 'h':
+                host = optarg;
+                break;
+            case 'n':
+                options.playerCount = atoi(optarg);
+                break;
+            case 'T':
+                options.threadCount = atoi(optarg);
+                break;
+            case 'c':
+                options.connectRate = atof(optarg);
+                break;
+            case 'g':
+                options.guessRate = atof(optarg);
+                break;
+            case 'q':
+                options.pollRate = atof(optarg);
+                break;
+            case 'k':
+                options.thinkTimeNs = strtoull(optarg, nullptr, 10) * 1000000;
+                break;
+            case 'd':
+                options.durationNs = (uint64_t)(atof(optarg) * 1e9);
+                break;
+            case 'N':
+                options.namePrefix = optarg;
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc){
+        cout << "Missing argument: server port number" << endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    if(options.playerCount < 1 || options.threadCount < 1 || options.guessRate <= 0 || options.connectRate < 0
+       || options.pollRate < 0){
+        printUsage(argv[0]);
+        return 1;
+    }
+    options.threadCount = min(options.threadCount, options.playerCount);
+    if(parseAddress(host, argv[optind], options) != 0){
+        cout << "Unknown address: " << host << ":" << argv[optind] << endl;
+        return 1;
+    }
+    raiseDescriptorLimit(options.playerCount + 64);
+
+    vector<LoadThread*> threads;
+    int firstPlayer = 0;
+    for(int i = 0; i < options.threadCount; i++){
+        int count = options.playerCount / options.threadCount + (i < options.playerCount % options.threadCount ? 1 : 0);
+        threads.push_back(loadThreadCreate(i, &options, firstPlayer, count));
+        firstPlayer += count;
+    }
+    uint64_t startTime = loadNow();
+    for(LoadThread* thread : threads){
+        thread->runner = new std::thread(loadThreadRun, thread);
+    }
+
+    // The threads stop by themselves, the main thread reports the progress meanwhile
+    uint64_t previousGuesses = 0, previousAnswered = 0, previousPolls = 0;
+    uint64_t previousTime = startTime;
+    while(true){
+        uint64_t now = loadNow();
+        uint64_t nextReport = previousTime + 1000000000ull;
+        if(nextReport > startTime + options.durationNs) break;
+        if(now < nextReport){
+            this_thread::sleep_for(chrono::nanoseconds(nextReport - now));
+        }
+        now = loadNow();
+        printProgress(threads, now - startTime, previousGuesses, previousAnswered, previousPolls,
+                      (now - previousTime) / 1e9);
+        previousGuesses = previousAnswered = previousPolls = 0;
+        for(LoadThread* thread : threads){
+            previousGuesses += thread->counters.guesses.load(memory_order_relaxed);
+            previousAnswered += thread->counters.answered.load(memory_order_relaxed);
+            previousPolls += thread->counters.polls.load(memory_order_relaxed);
+        }
+        previousTime = now;
+    }
+    for(LoadThread* thread : threads){
+        thread->runner->join();
+    }
+    printSummary(threads, (loadNow() - startTime) / 1e9);
+    for(LoadThread* thread : threads){
+        loadThreadRelease(thread);
+    }
+    return 0;
+}
+
+/**
+ * Resolves the server address
+ * @param host Host name or address
+ * @param port Port number
+ * @param options The options to fill the address in
+ * @return 0 on success
+ */
+int parseAddress(const char* host, const char* port, LoadOptions& options){
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if(getaddrinfo(host, port, &hints, &result) != 0 || result == nullptr) return -1;
+    memcpy(&options.address, result->ai_addr, result->ai_addrlen);
+    options.addressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/**
+ * Raises the limit of open descriptors as far as the hard limit allows
+ * @param needed Number of descriptors needed
+ */
+void raiseDescriptorLimit(size_t needed){
+    rlimit limit {};
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= needed) return;
+    limit.rlim_cur = min((rlim_t)needed, limit.rlim_max);
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < needed){
+        cout << "Warning: only " << limit.rlim_cur << " descriptors are allowed" << endl;
+    }
+}
+
+/**
+ * Prints a line with the rates since the last line
+ * @param threads The threads
+ * @param elapsedNs Time since the start
+ * @param previousGuesses Guesses counted at the last line
+ * @param previousAnswered Answered guesses counted at the last line
+ * @param previousPolls Scoreboard requests counted at the last line
+ * @param intervalSeconds Time since the last line
+ */
+void printProgress(const vector<LoadThread*>& threads, uint64_t elapsedNs, uint64_t previousGuesses, uint64_t previousAnswered,
+                   uint64_t previousPolls, double intervalSeconds){
+    uint64_t connected = 0, guesses = 0, answered = 0, polls = 0;
+    for(LoadThread* thread : threads){
+        connected += thread->counters.connected.load(memory_order_relaxed)
+                     - thread->counters.disconnected.load(memory_order_relaxed);
+        guesses += thread->counters.guesses.load(memory_order_relaxed);
+        answered += thread->counters.answered.load(memory_order_relaxed);
+        polls += thread->counters.polls.load(memory_order_relaxed);
+    }
+    printf("[%4llus] %llu connected, %.1f guesses/s, %.1f answers/s, %.1f scoreboard requests/s\n",
+           (unsigned long long)(elapsedNs / 1000000000ull), (unsigned long long)connected,
+           (guesses - previousGuesses) / intervalSeconds, (answered - previousAnswered) / intervalSeconds,
+           (polls - previousPolls) / intervalSeconds);
+    fflush(stdout);
+}
+
+/**
+ * Prints the totals of all the threads with the latency percentiles
+ * @param threads The finished threads
+ * @param seconds Duration of the run
+ */
+void printSummary(const vector<LoadThread*>& threads, double seconds){
+    uint64_t connected = 0, failed = 0, disconnected = 0, rejoins = 0, guesses = 0, answered = 0, unanswered = 0;
+    uint64_t polls = 0, pollsAnswered = 0, bytesIn = 0, bytesOut = 0;
+    LoadHistogram guessLatency {}, pollLatency {};
+    for(LoadThread* thread : threads){
+        LoadCounters& counters = thread->counters;
+        connected += counters.connected;
+        failed += counters.failed;
+        disconnected += counters.disconnected;
+        rejoins += counters.rejoins;
+        guesses += counters.guesses;
+        answered += counters.answered;
+        unanswered += counters.unanswered;
+        polls += counters.polls;
+        pollsAnswered += counters.pollsAnswered;
+        bytesIn += counters.bytesIn;
+        bytesOut += counters.bytesOut;
+        histogramMerge(&guessLatency, &thread->guessLatency);
+        histogramMerge(&pollLatency, &thread->pollLatency);
+    }
+    printf("Duration: %.1f s\n", seconds);
+    printf("Players: %llu connected, %llu failed, %llu disconnected by the server, %llu rejoins\n",
+           (unsigned long long)connected, (unsigned long long)failed, (unsigned long long)disconnected,
+           (unsigned long long)rejoins);
+    printf("Guesses: %llu sent (%.1f/s), %llu answered (%.1f/s), %llu unanswered\n",
+           (unsigned long long)guesses, guesses / seconds, (unsigned long long)answered, answered / seconds,
+           (unsigned long long)unanswered);
+    printf("Scoreboard requests: %llu sent (%.1f/s), %llu answered\n",
+           (unsigned long long)polls, polls / seconds, (unsigned long long)pollsAnswered);
+    printf("Traffic: %.1f KiB/s in, %.1f KiB/s out\n", bytesIn / 1024.0 / seconds, bytesOut / 1024.0 / seconds);
+    const pair<const char*, LoadHistogram*> latencies[] = {
+        { "Guess latency", &guessLatency },
+        { "Scoreboard latency", &pollLatency }
+    };
+    for(const auto& [label, histogram] : latencies){
+        if(histogram->count == 0) continue;
+        printf("%s (us): p50 %llu, p99 %llu, p999 %llu, max %llu\n", label,
+               (unsigned long long)histogramPercentile(histogram, 0.5), (unsigned long long)histogramPercentile(histogram, 0.99),
+               (unsigned long long)histogramPercentile(histogram, 0.999), (unsigned long long)(histogram->max / 1000));
+    }
+}
+
+/**
+ * Prints how to run the program
+ * @param program Name of the program
+ */
+void printUsage(const char* program){
+    cout << "Usage: " << program << " [-h host] [-n players] [-T threads] [-c connections per second] [-g guesses per second per player] [-q scoreboard requests per second per player] [-k maximum think time in ms] [-d duration in seconds] [-N name prefix] port" << endl;
+}
+
+/**
+ * Creates the thread with its players, but doesn't start it
+ * @param index Index of the thread
+ * @param options Options of the run
+ * @param firstPlayer Global index of the thread's first player, used in the names
+ * @param playerCount Number of the thread's players
+ * @return The thread
+ */
+LoadThread* loadThreadCreate(int index, const LoadOptions* options, int firstPlayer, int playerCount){
+    auto thread = new LoadThread();
+    thread->index = index;
+    thread->options = options;
+    thread->epollFd = epoll_create1(0);
+    thread->startedCount = 0;
+    thread->nextConnectTime = 0;
+    thread->connectRate = options->connectRate / options->threadCount;
+    thread->random.seed(random_device()() + index);
+    thread->guessLatency = {};
+    thread->pollLatency = {};
+    thread->runner = nullptr;
+    for(int i = 0; i < playerCount; i++){
+        auto player = new LoadPlayer();
+        player->thread = thread;
+        player->index = i;
+        player->fd = -1;
+        player->state = LOAD_PLAYER_CLOSED;
+        player->name = options->namePrefix + to_string(firstPlayer + i);
+        player->isWaitingForOutput = false;
+        player->isScheduled = false;
+        player->guessedLetters = 0;
+        player->guessTime = 0;
+        player->pollTime = 0;
+        thread->players.push_back(player);
+    }
+    return thread;
+}
+
+/**
+ * Releases the finished thread with its players
+ * @param thread The thread
+ */
+void loadThreadRelease(LoadThread* thread){
+    for(LoadPlayer* player : thread->players){
+        delete player;
+    }
+    close(thread->epollFd);
+    delete thread->runner;
+    delete thread;
+}
+
+/**
+ * Runs the thread until the end of the run, then closes the connections
+ * @param thread The thread
+ */
+void loadThreadRun(LoadThread* thread){
+    epoll_event events[LOAD_MAX_EVENTS];
+    uint64_t startTime = loadNow();
+    uint64_t endTime = startTime + thread->options->durationNs;
+    thread->nextConnectTime = startTime;
+    while(true){
+        uint64_t now = loadNow();
+        if(now >= endTime) break;
+        loadThreadStartConnections(thread, now);
+        loadThreadRunActions(thread, now);
+
+        int timeout = loadThreadGetTimeout(thread, now);
+        timeout = min<uint64_t>(timeout, (endTime - now + 999999) / 1000000);
+        int eventCount = epoll_wait(thread->epollFd, events, LOAD_MAX_EVENTS, timeout);
+        now = loadNow();
+        for(int i = 0; i < eventCount; i++){
+            loadPlayerOnEvent((LoadPlayer*)events[i].data.ptr, events[i].events, now);
+        }
+    }
+    for(LoadPlayer* player : thread->players){
+        if(player->state != LOAD_PLAYER_CLOSED){
+            close(player->fd);
+            player->state = LOAD_PLAYER_CLOSED;
+        }
+    }
+}
+
+/**
+ * Starts the connections due at the connect rate
+ * @param thread The thread
+ * @param now The current time
+ */
+void loadThreadStartConnections(LoadThread* thread, uint64_t now){
+    while(thread->startedCount < thread->players.size()
+          && (thread->connectRate == 0 || thread->nextConnectTime <= now)){
+        loadPlayerConnect(thread->players[thread->startedCount++]);
+        if(thread->connectRate > 0){
+            thread->nextConnectTime += (uint64_t)(1e9 / thread->connectRate);
+        }
+    }
+}
+
+/**
+ * Sends the guesses and scoreboard requests that are due, and schedules the next ones
+ * @param thread The thread
+ * @param now The current time
+ */
+void loadThreadRunActions(LoadThread* thread, uint64_t now){
+    while(!thread->actions.empty() && thread->actions.top().time <= now){
+        LoadAction action = thread->actions.top();
+        thread->actions.pop();
+        LoadPlayer* player = thread->players[action.player];
+        if(player->state == LOAD_PLAYER_CLOSED) continue;
+
+        double rate;
+        if(action.kind == LOAD_ACTION_GUESS){
+            loadPlayerGuess(player, now);
+            rate = thread->options->guessRate;
+        }else{
+            loadPlayerPoll(player, now);
+            rate = thread->options->pollRate;
+        }
+        // The schedule doesn't drift when the thread is late
+        action.time = max(action.time + loadThreadGetDelay(thread, rate), now);
+        thread->actions.push(action);
+    }
+}
+
+/**
+ * Returns how long epoll_wait may wait before the next action or connection is due
+ * @param thread The thread
+ * @param now The current time
+ * @return The timeout in milliseconds, rounded up
+ */
+int loadThreadGetTimeout(LoadThread* thread, uint64_t now){
+    uint64_t next = UINT64_MAX;
+    if(!thread->actions.empty()) next = thread->actions.top().time;
+    if(thread->startedCount < thread->players.size()) next = min(next, thread->nextConnectTime);
+    if(next == UINT64_MAX) return 1000;
+    if(next <= now) return 0;
+    return (int)min<uint64_t>((next - now + 999999) / 1000000, 1000);
+}
+
+/**
+ * Returns the delay until a player's next action of a kind: the interval of the rate with a random think time
+ * @param thread The thread
+ * @param rate Actions per second
+ */
+uint64_t loadThreadGetDelay(LoadThread* thread, double rate){
+    uint64_t delay = (uint64_t)(1e9 / rate);
+    if(thread->options->thinkTimeNs > 0){
+        delay += thread->random() % thread->options->thinkTimeNs;
+    }
+    return delay;
+}
+
+/**
+ * Starts connecting the player to the server
+ * @param player The player
+ */
+void loadPlayerConnect(LoadPlayer* player){
+    LoadThread* thread = player->thread;
+    const LoadOptions* options = thread->options;
+    player->fd = socket(options->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(player->fd == -1){
+        thread->counters.failed++;
+        return;
+    }
+    if(connect(player->fd, (const sockaddr*)&options->address, options->addressLength) == -1 && errno != EINPROGRESS){
+        close(player->fd);
+        thread->counters.failed++;
+        return;
+    }
+    player->state = LOAD_PLAYER_CONNECTING;
+    player->isWaitingForOutput = true;
+    epoll_event ee { EPOLLIN | EPOLLOUT, {.ptr=player} };
+    epoll_ctl(thread->epollFd, EPOLL_CTL_ADD, player->fd, &ee);
+}
+
+/**
+ * Handles the events of the player's socket
+ * @param player The player
+ * @param events The epoll events
+ * @param now The time of the wakeup
+ */
+void loadPlayerOnEvent(LoadPlayer* player, uint32_t events, uint64_t now){
+    if(player->state == LOAD_PLAYER_CLOSED) return;
+    if(player->state == LOAD_PLAYER_CONNECTING){
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(player->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if(error != 0 || (events & (EPOLLERR | EPOLLHUP))){
+            player->thread->counters.failed++;
+            close(player->fd);
+            player->state = LOAD_PLAYER_CLOSED;
+            return;
+        }
+        if(!(events & EPOLLOUT)) return;
+        loadPlayerOnConnected(player);
+        return;
+    }
+    if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+        loadPlayerRead(player, now);
+    }
+    if(player->state != LOAD_PLAYER_CLOSED && (events & EPOLLOUT)){
+        loadPlayerWrite(player);
+    }
+}
+
+/**
+ * Handles the connection being established: joins the game
+ * @param player The player
+ */
+void loadPlayerOnConnected(LoadPlayer* player){
+    player->thread->counters.connected++;
+    int noDelay = 1;
+    setsockopt(player->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    loadPlayerJoin(player);
+    loadPlayerWrite(player);
+}
+
+/**
+ * Reads what the socket has and handles every complete message
+ * @param player The player
+ * @param now The time of the wakeup
+ */
+void loadPlayerRead(LoadPlayer* player, uint64_t now){
+    char buffer[LOAD_READ_SIZE];
+    while(true){
+        ssize_t readBytes = read(player->fd, buffer, sizeof(buffer));
+        if(readBytes == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+        }
+        if(readBytes <= 0){
+            player->thread->counters.disconnected++;
+            loadPlayerClose(player);
+            return;
+        }
+        player->thread->counters.bytesIn += readBytes;
+        player->input.append(buffer, readBytes);
+        if(readBytes < (ssize_t)sizeof(buffer)) break;
+    }
+
+    // Every message is a big-endian length followed by the type and the body
+    size_t offset = 0;
+    while(player->input.length() - offset >= sizeof(uint32_t)){
+        auto data = (const uint8_t*)player->input.data() + offset;
+        uint32_t length = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+        if(player->input.length() - offset - sizeof(uint32_t) < length) break;
+        if(length > 0){
+            string body((const char*)data + sizeof(uint32_t) + 1, length - 1);
+            loadPlayerOnMessage(player, data[sizeof(uint32_t)], body, now);
+            if(player->state == LOAD_PLAYER_CLOSED) return;
+        }
+        offset += sizeof(uint32_t) + length;
+    }
+    player->input.erase(0, offset);
+}
+
+/**
+ * Handles a message from the server
+ * @param player The player
+ * @param type Type of the message
+ * @param body The body of the message
+ * @param now The time of the wakeup
+ */
+void loadPlayerOnMessage(LoadPlayer* player, uint8_t type, const string& body, uint64_t now){
+    LoadThread* thread = player->thread;
+    switch(type){
+        case LOAD_RESPONSE_JOIN: {
+            // Leaving the game is confirmed with an empty response of the same type
+            string success = jsonGetValue(body, "success");
+            if(success.empty()) break;
+            if(success != "1"){
+                thread->counters.failed++;
+                loadPlayerClose(player);
+                return;
+            }
+            player->state = LOAD_PLAYER_PLAYING;
+            if(!player->isScheduled){
+                // The players start at random moments, so that their actions spread evenly
+                player->isScheduled = true;
+                thread->actions.push({ now + thread->random() % (uint64_t)(1e9 / thread->options->guessRate),
+                                       player->index, LOAD_ACTION_GUESS });
+                if(thread->options->pollRate > 0){
+                    thread->actions.push({ now + thread->random() % (uint64_t)(1e9 / thread->options->pollRate),
+                                           player->index, LOAD_ACTION_POLL });
+                }
+            }
+            break;
+        }
+        case LOAD_NOTIFY_PHRASE: {
+            string phrase = jsonGetValue(body, "phrase");
+            // More hidden letters than before mean a new round
+            if(count(phrase.begin(), phrase.end(), '_') > count(player->phrase.begin(), player->phrase.end(), '_')){
+                player->guessedLetters = 0;
+            }
+            player->phrase = phrase;
+            break;
+        }
+        case LOAD_NOTIFY_SCORE:
+        case LOAD_NOTIFY_HANG:
+            if(player->guessTime != 0 && loadPlayerIsMentioned(player, body)){
+                histogramRecord(&thread->guessLatency, now - player->guessTime);
+                thread->counters.answered++;
+                player->guessTime = 0;
+            }
+            break;
+        case LOAD_NOTIFY_WIN:
+        case LOAD_NOTIFY_LOSE:
+            // The game is over for the player, it joins again to keep guessing
+            thread->counters.rejoins++;
+            player->guessTime = 0;
+            player->guessedLetters = 0;
+            loadPlayerSend(player, LOAD_REQUEST_LEAVE, "");
+            loadPlayerJoin(player);
+            loadPlayerWrite(player);
+            break;
+        case LOAD_RESPONSE_SCORE:
+            if(player->pollTime != 0){
+                histogramRecord(&thread->pollLatency, now - player->pollTime);
+                thread->counters.pollsAnswered++;
+                player->pollTime = 0;
+            }
+            player->scoreVersion = jsonGetValue(body, "version");
+            break;
+    }
+}
+
+/**
+ * Asks to join a room chosen by the server
+ * @param player The player
+ */
+void loadPlayerJoin(LoadPlayer* player){
+    player->state = LOAD_PLAYER_JOINING;
+    loadPlayerSend(player, LOAD_REQUEST_JOIN, player->name);
+}
+
+/**
+ * Guesses a letter that's neither visible nor guessed before in the round. A player has one guess at a time,
+ * the next one waits for the notification about the previous one, or until it's considered lost
+ * @param player The player
+ * @param now The current time
+ */
+void loadPlayerGuess(LoadPlayer* player, uint64_t now){
+    LoadThread* thread = player->thread;
+    if(player->state != LOAD_PLAYER_PLAYING) return;
+    if(player->guessTime != 0){
+        if(now - player->guessTime < LOAD_ANSWER_TIMEOUT_NS) return;
+        thread->counters.unanswered++;
+    }
+
+    uint32_t excluded = player->guessedLetters;
+    for(char c : player->phrase){
+        if(c >= 'A' && c <= 'Z') excluded |= 1u << (c - 'A');
+    }
+    int candidates[26];
+    int candidateCount = 0;
+    for(int i = 0; i < 26; i++){
+        if(!(excluded & (1u << i))) candidates[candidateCount++] = i;
+    }
+    int letter = candidateCount > 0 ? candidates[thread->random() % candidateCount] : (int)(thread->random() % 26);
+    player->guessedLetters |= 1u << letter;
+
+    loadPlayerSend(player, LOAD_REQUEST_GUESS, string(1, (char)('A' + letter)));
+    loadPlayerWrite(player);
+    player->guessTime = now;
+    thread->counters.guesses++;
+}
+
+/**
+ * Asks for the scoreboard changes since the last response, unless the last request hasn't been answered yet
+ * @param player The player
+ * @param now The current time
+ */
+void loadPlayerPoll(LoadPlayer* player, uint64_t now){
+    if(player->state != LOAD_PLAYER_PLAYING || player->pollTime != 0) return;
+    loadPlayerSend(player, LOAD_REQUEST_SCORE, player->scoreVersion.empty() ? "0" : player->scoreVersion);
+    loadPlayerWrite(player);
+    player->pollTime = now;
+    player->thread->counters.polls++;
+}
+
+/**
+ * Appends a message to the player's output
+ * @param player The player
+ * @param type Type of the message
+ * @param body Body of the message
+ */
+void loadPlayerSend(LoadPlayer* player, uint8_t type, const string& body){
+    uint32_t length = body.length() + 1;
+    char header[5] = { (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length, (char)type };
+    player->output.append(header, sizeof(header));
+    player->output.append(body);
+}
+
+/**
+ * Writes as much of the output as the socket takes, and waits for EPOLLOUT if it doesn't take everything
+ * @param player The player
+ */
+void loadPlayerWrite(LoadPlayer* player){
+    size_t written = 0;
+    while(written < player->output.length()){
+        ssize_t result = write(player->fd, player->output.data() + written, player->output.length() - written);
+        if(result == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            player->thread->counters.disconnected++;
+            loadPlayerClose(player);
+            return;
+        }
+        written += result;
+    }
+    player->thread->counters.bytesOut += written;
+    player->output.erase(0, written);
+
+    bool isWaitingForOutput = !player->output.empty();
+    if(isWaitingForOutput != player->isWaitingForOutput){
+        player->isWaitingForOutput = isWaitingForOutput;
+        epoll_event ee { EPOLLIN | (isWaitingForOutput ? (uint32_t)EPOLLOUT : 0u), {.ptr=player} };
+        epoll_ctl(player->thread->epollFd, EPOLL_CTL_MOD, player->fd, &ee);
+    }
+}
+
+/**
+ * Closes the player's connection. The player doesn't come back
+ * @param player The player
+ */
+void loadPlayerClose(LoadPlayer* player){
+    close(player->fd);
+    player->state = LOAD_PLAYER_CLOSED;
+    player->output.clear();
+    player->input.clear();
+}
+
+/**
+ * Checks whether the notification is about the player, by the "player" field
+ * @param player The player
+ * @param body The notification
+ */
+bool loadPlayerIsMentioned(LoadPlayer* player, const string& body){
+    return jsonGetValue(body, "player") == player->name;
+}
+
+/**
+ * Counts the value in the histogram
+ * @param histogram The histogram
+ * @param valueNs The latency in nanoseconds, counted in microseconds
+ */
+void histogramRecord(LoadHistogram* histogram, uint64_t valueNs){
+    uint64_t value = valueNs / 1000;
+    size_t bucket;
+    if(value < LOAD_HISTOGRAM_LINEAR){
+        bucket = value;
+    }else{
+        int exponent = 63 - __builtin_clzll(value);
+        bucket = LOAD_HISTOGRAM_LINEAR + (exponent - 6) * 32 + ((value >> (exponent - 5)) & 31);
+    }
+    histogram->buckets[min<size_t>(bucket, LOAD_HISTOGRAM_BUCKETS - 1)]++;
+    histogram->count++;
+    histogram->max = max(histogram->max, valueNs);
+}
+
+/**
+ * Adds the counts of one histogram to another
+ * @param target The histogram to add to
+ * @param source The histogram to add
+ */
+void histogramMerge(LoadHistogram* target, const LoadHistogram* source){
+    for(size_t i = 0; i < LOAD_HISTOGRAM_BUCKETS; i++){
+        target->buckets[i] += source->buckets[i];
+    }
+    target->count += source->count;
+    target->max = max(target->max, source->max);
+}
+
+/**
+ * Returns the value below which the given fraction of the counted values lies
+ * @param histogram The histogram
+ * @param percentile The fraction, e.g. 0.99
+ * @return The lower bound of the bucket with the percentile, in microseconds
+ */
+uint64_t histogramPercentile(const LoadHistogram* histogram, double percentile){
+    auto rank = (uint64_t)(percentile * histogram->count);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < LOAD_HISTOGRAM_BUCKETS; i++){
+        seen += histogram->buckets[i];
+        if(seen <= rank) continue;
+        if(i < LOAD_HISTOGRAM_LINEAR) return i;
+        size_t exponent = (i - LOAD_HISTOGRAM_LINEAR) / 32 + 6;
+        return (32 + (i - LOAD_HISTOGRAM_LINEAR) % 32) << (exponent - 5);
+    }
+    return histogram->max / 1000;
+}
+
+/**
+ * Returns the value of a key in the flat JSON the server sends, without the quotes of a string
+ * @param json The JSON object
+ * @param key The key
+ * @return The value or an empty string if there's no such key
+ */
+string jsonGetValue(const string& json, const string& key){
+    size_t position = json.find("\"" + key + "\":");
+    if(position == string::npos) return "";
+    position += key.length() + 3;
+    while(position < json.length() && json[position] == ' ') position++;
+    if(position < json.length() && json[position] == '"'){
+        size_t end = json.find('"', position + 1);
+        return json.substr(position + 1, end == string::npos ? string::npos : end - position - 1);
+    }
+    size_t end = json.find_first_of(",}", position);
+    return json.substr(position, end == string::npos ? string::npos : end - position);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t loadNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
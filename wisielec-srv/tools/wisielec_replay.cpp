@@ -0,0 +1,729 @@
+#include "../src/journal.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+#define REPLAY_MAX_EVENTS 256
+#define REPLAY_READ_SIZE 65536
+#define REPLAY_MAX_PENDING_BYTES (1024 * 1024)      // Above this many unwritten bytes the journal waits for the server
+#define REPLAY_ANSWER_TIMEOUT_NS 2000000000ull      // A request without a response after this long is counted as unanswered
+#define REPLAY_HISTOGRAM_LINEAR 64                  // Values below are counted exactly, the rest in 32 buckets per power of two
+#define REPLAY_HISTOGRAM_BUCKETS (REPLAY_HISTOGRAM_LINEAR + 58 * 32)
+
+#define REPLAY_CONNECTION_OPEN 0
+#define REPLAY_CONNECTION_CLOSING 1     // Closed in the journal, the rest of its output is being written
+#define REPLAY_CONNECTION_SHUT 2        // The output has ended, the responses are read until the server closes the connection
+#define REPLAY_CONNECTION_CLOSED 3
+
+// The protocol, see readme.md
+#define REPLAY_DIRECTION_MASK 0xc0
+#define REPLAY_DIRECTION_RESPONSE 0x40
+#define REPLAY_REQUEST_JOIN 0x01
+#define REPLAY_REQUEST_LEAVE 0x02
+#define REPLAY_REQUEST_ROOM 0x03
+#define REPLAY_REQUEST_GUESS 0x11
+#define REPLAY_REQUEST_SCORE 0x12
+#define REPLAY_NOTIFY_SCORE 0x92
+#define REPLAY_NOTIFY_HANG 0x93
+
+struct Replay;
+
+/**
+ * Latency histogram with about 3% precision, from a microsecond up to hours
+ */
+struct ReplayHistogram {
+    uint64_t buckets[REPLAY_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+/**
+ * A connection of the journal, opened anew to the server
+ */
+struct ReplayConnection {
+    Replay* replay;
+    uint64_t id;                    // Identifier of the connection in the journal
+    int fd;
+    int state;                      // One of the REPLAY_CONNECTION_ constants
+    bool isConnected;               // Whether the connection has been established, the output waits until then
+    string name;                    // The name of the latest join request
+    string input;                   // Received bytes that don't make a whole message yet
+    string output;                  // Bytes the socket hasn't taken yet
+    bool isWaitingForOutput;        // Whether EPOLLOUT is subscribed for
+    deque<uint64_t> requestTimes;   // When the requests waiting for their responses were sent, oldest first
+    uint64_t guessTime;             // When the guess waiting for the notification about the player was sent, 0 if there's none
+};
+
+/**
+ * The replay of a journal against a running server
+ */
+struct Replay {
+    sockaddr_storage address;
+    socklen_t addressLength;
+    double speed;                   // Multiplies the pace of the journal, 0 to replay it as fast as possible
+    uint64_t drainNs;               // How long to wait for the last responses after the journal ends
+    int epollFd;
+    JournalReader* reader;
+    JournalRecord next;             // The next record to replay
+    bool hasNext;
+    uint64_t startTime;             // When the replay started
+    uint64_t journalDuration;       // Time of the latest record replayed
+    size_t pendingBytes;            // Bytes of all the connections the sockets haven't taken yet
+    unordered_map<uint64_t, ReplayConnection*> connections;     // By their identifiers in the journal
+
+    uint64_t records;
+    uint64_t opened;
+    uint64_t failed;                // Connections that couldn't be established
+    uint64_t disconnected;          // Connections closed by the server before the journal closed them
+    uint64_t frames;
+    uint64_t requests;              // Frames that expect a response
+    uint64_t responses;
+    uint64_t unanswered;
+    uint64_t guesses;               // Guesses whose notification was waited for
+    uint64_t guessesAnswered;
+    uint64_t notifications;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    ReplayHistogram lag;            // How late the frames were sent, compared with the journal
+    ReplayHistogram responseLatency;
+    ReplayHistogram guessLatency;
+};
+
+int parseAddress(const char* host, const char* port, Replay* replay);
+void raiseDescriptorLimit(size_t needed);
+void printProgress(Replay* replay, uint64_t now, uint64_t previousFrames, uint64_t previousResponses, double intervalSeconds);
+void printSummary(Replay* replay, double seconds);
+void printUsage(const char* program);
+
+void replayRun(Replay* replay);
+void replayDispatch(Replay* replay, uint64_t now);
+void replayRecord(Replay* replay, const JournalRecord& record, uint64_t now);
+bool replayIsWaiting(Replay* replay, uint64_t now);
+void replayCloseAll(Replay* replay);
+ReplayConnection* replayConnectionCreate(Replay* replay, uint64_t id);
+void replayConnectionOnEvent(ReplayConnection* connection, uint32_t events, uint64_t now);
+void replayConnectionRead(ReplayConnection* connection, uint64_t now);
+void replayConnectionOnMessage(ReplayConnection* connection, uint8_t type, const string& body, uint64_t now);
+void replayConnectionSend(ReplayConnection* connection, const string& payload, uint64_t now);
+void replayConnectionWrite(ReplayConnection* connection);
+void replayConnectionCheckClosing(ReplayConnection* connection);
+void replayConnectionClose(ReplayConnection* connection);
+void replayConnectionExpire(ReplayConnection* connection, uint64_t now);
+
+void histogramRecord(ReplayHistogram* histogram, uint64_t valueNs);
+uint64_t histogramPercentile(const ReplayHistogram* histogram, double percentile);
+void printHistogram(const char* label, const ReplayHistogram* histogram);
+string jsonGetValue(const string& json, const string& key);
+uint64_t replayNow();
+
+/**
+ * Replays a journal captured by the server with -j: opens the captured connections again and sends their frames
+ * at the captured pace, a multiple of it, or as fast as the server takes them. The frames keep the order
+ * of the journal. Prints the throughput every second, and at the end the latencies from a request
+ * to its response and from a guess to the notification about the guessing player
+ */
+int main(int argc, char** argv){
+    auto replay = new Replay();
+    replay->speed = 1;
+    replay->drainNs = 2 * 1000000000ull;
+    const char* host = "127.0.0.1";
+
+    int option;
+    while((option = getopt(argc, argv, "h:s:w:")) != -1){
+        switch(option){
+            case 'h':
+                host = optarg;
+                break;
+            case 's':
+                replay->speed = atof(optarg);
+                break;
+            case 'w':
+                replay->drainNs = (uint64_t)(atof(optarg) * 1e9);
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind + 2 > argc || replay->speed < 0){
+        printUsage(argv[0]);
+        return 1;
+    }
+    if(parseAddress(host, argv[optind + 1], replay) != 0){
+        cout << "Unknown address: " << host << ":" << argv[optind + 1] << endl;
+        return 1;
+    }
+    try{
+        replay->reader = journalOpen(argv[optind]);
+    }catch(const runtime_error& error){
+        cout << error.what() << endl;
+        return 1;
+    }
+    uint64_t seed = journalReaderGetSeed(replay->reader);
+    printf("The journal was captured with the seed %llu, the server gives the same phrases when started with -S %llu\n",
+           (unsigned long long)seed, (unsigned long long)seed);
+    raiseDescriptorLimit(65536);
+
+    replay->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    replay->hasNext = journalRead(replay->reader, &replay->next);
+    replay->startTime = replayNow();
+    replayRun(replay);
+    printSummary(replay, (replayNow() - replay->startTime) / 1e9);
+
+    for(auto& entry : replay->connections){
+        delete entry.second;
+    }
+    close(replay->epollFd);
+    journalReaderClose(replay->reader);
+    delete replay;
+    return 0;
+}
+
+/**
+ * Resolves the server address
+ * @param host Host name or address
+ * @param port Port number
+ * @param replay The replay to fill the address in
+ * @return 0 on success
+ */
+int parseAddress(const char* host, const char* port, Replay* replay){
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if(getaddrinfo(host, port, &hints, &result) != 0 || result == nullptr) return -1;
+    memcpy(&replay->address, result->ai_addr, result->ai_addrlen);
+    replay->addressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/**
+ * Raises the limit of open descriptors as far as the hard limit allows
+ * @param needed Number of descriptors needed
+ */
+void raiseDescriptorLimit(size_t needed){
+    rlimit limit {};
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= needed) return;
+    limit.rlim_cur = min((rlim_t)needed, limit.rlim_max);
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+/**
+ * Prints a line with the rates since the last line
+ * @param replay The replay
+ * @param now The current time
+ * @param previousFrames Frames counted at the last line
+ * @param previousResponses Responses counted at the last line
+ * @param intervalSeconds Time since the last line
+ */
+void printProgress(Replay* replay, uint64_t now, uint64_t previousFrames, uint64_t previousResponses, double intervalSeconds){
+    size_t open = 0;
+    for(auto& entry : replay->connections){
+        if(entry.second->state != REPLAY_CONNECTION_CLOSED) open++;
+    }
+    printf("[%4llus] at %.1f s of the journal, %zu connections, %.1f frames/s, %.1f responses/s\n",
+           (unsigned long long)((now - replay->startTime) / 1000000000ull), replay->journalDuration / 1e9, open,
+           (replay->frames - previousFrames) / intervalSeconds, (replay->responses - previousResponses) / intervalSeconds);
+    fflush(stdout);
+}
+
+/**
+ * Prints the totals with the latency percentiles
+ * @param replay The finished replay
+ * @param seconds Duration of the replay
+ */
+void printSummary(Replay* replay, double seconds){
+    double journalSeconds = replay->journalDuration / 1e9;
+    printf("Duration: %.1f s for %.1f s of the journal (%.2fx)\n", seconds, journalSeconds,
+           seconds > 0 ? journalSeconds / seconds : 0);
+    printf("Records: %llu, connections: %llu opened, %llu failed, %llu closed by the server\n",
+           (unsigned long long)replay->records, (unsigned long long)replay->opened, (unsigned long long)replay->failed,
+           (unsigned long long)replay->disconnected);
+    printf("Frames: %llu sent (%.1f/s), %llu requests, %llu responses, %llu unanswered, %llu notifications\n",
+           (unsigned long long)replay->frames, replay->frames / seconds, (unsigned long long)replay->requests,
+           (unsigned long long)replay->responses, (unsigned long long)replay->unanswered,
+           (unsigned long long)replay->notifications);
+    printf("Guesses: %llu waited for, %llu answered\n",
+           (unsigned long long)replay->guesses, (unsigned long long)replay->guessesAnswered);
+    printf("Traffic: %.1f KiB/s in, %.1f KiB/s out\n", replay->bytesIn / 1024.0 / seconds, replay->bytesOut / 1024.0 / seconds);
+    if(replay->speed > 0){
+        printHistogram("Lag behind the journal", &replay->lag);
+    }
+    printHistogram("Response latency", &replay->responseLatency);
+    printHistogram("Guess latency", &replay->guessLatency);
+}
+
+/**
+ * Prints how to run the program
+ * @param program Name of the program
+ */
+void printUsage(const char* program){
+    cout << "Usage: " << program << " [-h host] [-s speed, 0 for as fast as possible] [-w seconds to wait for the last responses] journal port" << endl;
+}
+
+/**
+ * Replays the whole journal, then waits for the last responses and closes the connections
+ * @param replay The replay
+ */
+void replayRun(Replay* replay){
+    epoll_event events[REPLAY_MAX_EVENTS];
+    uint64_t previousFrames = 0, previousResponses = 0;
+    uint64_t previousTime = replay->startTime;
+    uint64_t drainEnd = 0;
+    while(true){
+        uint64_t now = replayNow();
+        replayDispatch(replay, now);
+        if(!replay->hasNext && replay->pendingBytes == 0){
+            // The journal has been sent whole
+            if(drainEnd == 0) drainEnd = now + replay->drainNs;
+            if(now >= drainEnd || !replayIsWaiting(replay, now)) break;
+        }
+
+        int timeout = 100;
+        if(replay->hasNext && replay->pendingBytes < REPLAY_MAX_PENDING_BYTES){
+            uint64_t due = replay->speed > 0
+                    ? replay->startTime + (uint64_t)(replay->next.time / replay->speed) : now;
+            timeout = due > now ? (int)min<uint64_t>((due - now + 999999) / 1000000, 100) : 0;
+        }
+        int eventCount = epoll_wait(replay->epollFd, events, REPLAY_MAX_EVENTS, timeout);
+        now = replayNow();
+        for(int i = 0; i < eventCount; i++){
+            replayConnectionOnEvent((ReplayConnection*)events[i].data.ptr, events[i].events, now);
+        }
+        if(now - previousTime >= 1000000000ull){
+            printProgress(replay, now, previousFrames, previousResponses, (now - previousTime) / 1e9);
+            previousFrames = replay->frames;
+            previousResponses = replay->responses;
+            previousTime = now;
+        }
+    }
+    replayCloseAll(replay);
+}
+
+/**
+ * Replays the records that are due. While the sockets don't take the output, the journal waits,
+ * so that the server isn't flooded faster than it reads
+ * @param replay The replay
+ * @param now The current time
+ */
+void replayDispatch(Replay* replay, uint64_t now){
+    while(replay->hasNext && replay->pendingBytes < REPLAY_MAX_PENDING_BYTES){
+        if(replay->speed > 0){
+            uint64_t due = replay->startTime + (uint64_t)(replay->next.time / replay->speed);
+            if(due > now) break;
+            if(replay->next.kind == JOURNAL_FRAME){
+                histogramRecord(&replay->lag, now - due);
+            }
+        }
+        replayRecord(replay, replay->next, now);
+        replay->journalDuration = replay->next.time;
+        replay->hasNext = journalRead(replay->reader, &replay->next);
+    }
+}
+
+/**
+ * Replays a single record
+ * @param replay The replay
+ * @param record The record
+ * @param now The current time
+ */
+void replayRecord(Replay* replay, const JournalRecord& record, uint64_t now){
+    replay->records++;
+    auto entry = replay->connections.find(record.connection);
+    ReplayConnection* connection = entry != replay->connections.end() ? entry->second : nullptr;
+    switch(record.kind){
+        case JOURNAL_CONNECT:
+            if(connection == nullptr){
+                replayConnectionCreate(replay, record.connection);
+            }
+            break;
+        case JOURNAL_FRAME:
+            if(connection == nullptr){
+                connection = replayConnectionCreate(replay, record.connection);
+            }
+            if(connection->state != REPLAY_CONNECTION_OPEN) break;
+            replayConnectionSend(connection, record.payload, now);
+            if(connection->isConnected){
+                replayConnectionWrite(connection);
+            }
+            break;
+        case JOURNAL_DISCONNECT:
+            if(connection == nullptr || connection->state != REPLAY_CONNECTION_OPEN) break;
+            connection->state = REPLAY_CONNECTION_CLOSING;
+            if(connection->isConnected){
+                replayConnectionWrite(connection);
+            }
+            break;
+    }
+}
+
+/**
+ * Checks whether any connection still waits for a response, a notification about a guess,
+ * or for the server to close a connection the journal has closed
+ * @param replay The replay
+ * @param now The current time
+ */
+bool replayIsWaiting(Replay* replay, uint64_t now){
+    for(auto& entry : replay->connections){
+        ReplayConnection* connection = entry.second;
+        if(connection->state == REPLAY_CONNECTION_CLOSED) continue;
+        replayConnectionExpire(connection, now);
+        replayConnectionCheckClosing(connection);
+        if(connection->state == REPLAY_CONNECTION_SHUT || !connection->requestTimes.empty() || connection->guessTime != 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Closes the connections the journal has left open, counting what they still wait for as unanswered
+ * @param replay The replay
+ */
+void replayCloseAll(Replay* replay){
+    for(auto& entry : replay->connections){
+        ReplayConnection* connection = entry.second;
+        if(connection->state == REPLAY_CONNECTION_CLOSED) continue;
+        replayConnectionClose(connection);
+    }
+}
+
+/**
+ * Opens a connection to the server for a connection of the journal
+ * @param replay The replay
+ * @param id Identifier of the connection in the journal
+ * @return The connection, closed if it couldn't be opened
+ */
+ReplayConnection* replayConnectionCreate(Replay* replay, uint64_t id){
+    auto connection = new ReplayConnection();
+    connection->replay = replay;
+    connection->id = id;
+    connection->guessTime = 0;
+    connection->state = REPLAY_CONNECTION_CLOSED;
+    connection->isConnected = false;
+    replay->connections[id] = connection;
+
+    connection->fd = socket(replay->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(connection->fd == -1){
+        replay->failed++;
+        return connection;
+    }
+    if(connect(connection->fd, (const sockaddr*)&replay->address, replay->addressLength) == -1 && errno != EINPROGRESS){
+        close(connection->fd);
+        replay->failed++;
+        return connection;
+    }
+    connection->state = REPLAY_CONNECTION_OPEN;
+    connection->isWaitingForOutput = true;
+    epoll_event ee { EPOLLIN | EPOLLOUT, {.ptr=connection} };
+    epoll_ctl(replay->epollFd, EPOLL_CTL_ADD, connection->fd, &ee);
+    return connection;
+}
+
+/**
+ * Handles the events of the connection's socket
+ * @param connection The connection
+ * @param events The epoll events
+ * @param now The time of the wakeup
+ */
+void replayConnectionOnEvent(ReplayConnection* connection, uint32_t events, uint64_t now){
+    if(connection->state == REPLAY_CONNECTION_CLOSED) return;
+    if(!connection->isConnected){
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if(error != 0 || (events & (EPOLLERR | EPOLLHUP))){
+            connection->replay->failed++;
+            replayConnectionClose(connection);
+            return;
+        }
+        if(!(events & EPOLLOUT)) return;
+        connection->replay->opened++;
+        connection->isConnected = true;
+        int noDelay = 1;
+        setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+        replayConnectionRead(connection, now);
+    }
+    if(connection->state != REPLAY_CONNECTION_CLOSED && (events & EPOLLOUT)){
+        replayConnectionWrite(connection);
+    }
+}
+
+/**
+ * Reads what the socket has and handles every complete message
+ * @param connection The connection
+ * @param now The time of the wakeup
+ */
+void replayConnectionRead(ReplayConnection* connection, uint64_t now){
+    char buffer[REPLAY_READ_SIZE];
+    while(true){
+        ssize_t readBytes = read(connection->fd, buffer, sizeof(buffer));
+        if(readBytes == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+        }
+        if(readBytes <= 0){
+            if(connection->state != REPLAY_CONNECTION_SHUT) connection->replay->disconnected++;
+            replayConnectionClose(connection);
+            return;
+        }
+        connection->replay->bytesIn += readBytes;
+        connection->input.append(buffer, readBytes);
+        if(readBytes < (ssize_t)sizeof(buffer)) break;
+    }
+
+    // Every message is a big-endian length followed by the type and the body
+    size_t offset = 0;
+    while(connection->input.length() - offset >= sizeof(uint32_t)){
+        auto data = (const uint8_t*)connection->input.data() + offset;
+        uint32_t length = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+        if(connection->input.length() - offset - sizeof(uint32_t) < length) break;
+        if(length > 0){
+            string body((const char*)data + sizeof(uint32_t) + 1, length - 1);
+            replayConnectionOnMessage(connection, data[sizeof(uint32_t)], body, now);
+        }
+        offset += sizeof(uint32_t) + length;
+    }
+    connection->input.erase(0, offset);
+}
+
+/**
+ * Handles a message from the server: a response answers the oldest request, a notification about
+ * the connection's player answers its guess
+ * @param connection The connection
+ * @param type Type of the message
+ * @param body The body of the message
+ * @param now The time of the wakeup
+ */
+void replayConnectionOnMessage(ReplayConnection* connection, uint8_t type, const string& body, uint64_t now){
+    Replay* replay = connection->replay;
+    replayConnectionExpire(connection, now);
+    if((type & REPLAY_DIRECTION_MASK) == REPLAY_DIRECTION_RESPONSE){
+        if(connection->requestTimes.empty()) return;
+        replay->responses++;
+        histogramRecord(&replay->responseLatency, now - connection->requestTimes.front());
+        connection->requestTimes.pop_front();
+        replayConnectionCheckClosing(connection);
+        return;
+    }
+    replay->notifications++;
+    if((type == REPLAY_NOTIFY_SCORE || type == REPLAY_NOTIFY_HANG) && connection->guessTime != 0
+       && jsonGetValue(body, "player") == connection->name){
+        replay->guessesAnswered++;
+        histogramRecord(&replay->guessLatency, now - connection->guessTime);
+        connection->guessTime = 0;
+    }
+}
+
+/**
+ * Queues a frame of the journal. The requests with a response are timed, and so is a guess
+ * unless the previous one is still waiting for its notification
+ * @param connection The connection
+ * @param payload Content of the frame
+ * @param now The current time
+ */
+void replayConnectionSend(ReplayConnection* connection, const string& payload, uint64_t now){
+    Replay* replay = connection->replay;
+    uint32_t length = payload.length();
+    char header[4] = { (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length };
+    connection->output.append(header, sizeof(header));
+    connection->output.append(payload);
+    replay->pendingBytes += sizeof(header) + payload.length();
+    replay->frames++;
+    if(payload.empty()) return;
+
+    switch((uint8_t)payload[0]){
+        case REPLAY_REQUEST_JOIN:
+            connection->name = payload.substr(1);
+            [[fallthrough]];
+        case REPLAY_REQUEST_LEAVE:
+        case REPLAY_REQUEST_ROOM:
+        case REPLAY_REQUEST_SCORE:
+            replay->requests++;
+            connection->requestTimes.push_back(now);
+            break;
+        case REPLAY_REQUEST_GUESS:
+            if(connection->guessTime == 0 && !connection->name.empty()){
+                replay->guesses++;
+                connection->guessTime = now;
+            }
+            break;
+    }
+}
+
+/**
+ * Writes as much of the output as the socket takes, and waits for EPOLLOUT if it doesn't take everything.
+ * @param connection The connection
+ */
+void replayConnectionWrite(ReplayConnection* connection){
+    Replay* replay = connection->replay;
+    size_t written = 0;
+    while(written < connection->output.length()){
+        ssize_t result = write(connection->fd, connection->output.data() + written, connection->output.length() - written);
+        if(result == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            replay->disconnected++;
+            replayConnectionClose(connection);
+            return;
+        }
+        written += result;
+    }
+    replay->bytesOut += written;
+    replay->pendingBytes -= written;
+    connection->output.erase(0, written);
+    replayConnectionCheckClosing(connection);
+
+    bool isWaitingForOutput = !connection->output.empty();
+    if(isWaitingForOutput != connection->isWaitingForOutput){
+        connection->isWaitingForOutput = isWaitingForOutput;
+        epoll_event ee { EPOLLIN | (isWaitingForOutput ? (uint32_t)EPOLLOUT : 0u), {.ptr=connection} };
+        epoll_ctl(replay->epollFd, EPOLL_CTL_MOD, connection->fd, &ee);
+    }
+}
+
+/**
+ * Ends the output of a connection the journal has closed, once it's written and the requests are answered.
+ * The server closes a connection as soon as it reads its end, dropping the requests it hasn't handled yet,
+ * and closing it right away would even reset it
+ * @param connection The connection
+ */
+void replayConnectionCheckClosing(ReplayConnection* connection){
+    if(connection->state != REPLAY_CONNECTION_CLOSING || !connection->output.empty() || !connection->requestTimes.empty()) return;
+    shutdown(connection->fd, SHUT_WR);
+    connection->state = REPLAY_CONNECTION_SHUT;
+}
+
+/**
+ * Closes the connection. Whatever it still waits for is counted as unanswered
+ * @param connection The connection
+ */
+void replayConnectionClose(ReplayConnection* connection){
+    Replay* replay = connection->replay;
+    close(connection->fd);
+    connection->state = REPLAY_CONNECTION_CLOSED;
+    replay->pendingBytes -= connection->output.length();
+    replay->unanswered += connection->requestTimes.size();
+    connection->requestTimes.clear();
+    connection->guessTime = 0;
+    connection->output.clear();
+    connection->input.clear();
+}
+
+/**
+ * Gives up on the requests and the guess that have waited too long, so that a request the server
+ * doesn't answer doesn't shift the responses to the later ones
+ * @param connection The connection
+ * @param now The current time
+ */
+void replayConnectionExpire(ReplayConnection* connection, uint64_t now){
+    while(!connection->requestTimes.empty() && now - connection->requestTimes.front() >= REPLAY_ANSWER_TIMEOUT_NS){
+        connection->requestTimes.pop_front();
+        connection->replay->unanswered++;
+    }
+    if(connection->guessTime != 0 && now - connection->guessTime >= REPLAY_ANSWER_TIMEOUT_NS){
+        connection->guessTime = 0;
+    }
+}
+
+/**
+ * Counts the value in the histogram
+ * @param histogram The histogram
+ * @param valueNs The latency in nanoseconds, counted in microseconds
+ */
+void histogramRecord(ReplayHistogram* histogram, uint64_t valueNs){
+    uint64_t value = valueNs / 1000;
+    size_t bucket;
+    if(value < REPLAY_HISTOGRAM_LINEAR){
+        bucket = value;
+    }else{
+        int exponent = 63 - __builtin_clzll(value);
+        bucket = REPLAY_HISTOGRAM_LINEAR + (exponent - 6) * 32 + ((value >> (exponent - 5)) & 31);
+    }
+    histogram->buckets[min<size_t>(bucket, REPLAY_HISTOGRAM_BUCKETS - 1)]++;
+    histogram->count++;
+    histogram->max = max(histogram->max, valueNs);
+}
+
+/**
+ * Returns the value below which the given fraction of the counted values lies
+ * @param histogram The histogram
+ * @param percentile The fraction, e.g. 0.99
+ * @return The lower bound of the bucket with the percentile, in microseconds
+ */
+uint64_t histogramPercentile(const ReplayHistogram* histogram, double percentile){
+    auto rank = (uint64_t)(percentile * histogram->count);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < REPLAY_HISTOGRAM_BUCKETS; i++){
+        seen += histogram->buckets[i];
+        if(seen <= rank) continue;
+        if(i < REPLAY_HISTOGRAM_LINEAR) return i;
+        size_t exponent = (i - REPLAY_HISTOGRAM_LINEAR) / 32 + 6;
+        return (32 + (i - REPLAY_HISTOGRAM_LINEAR) % 32) << (exponent - 5);
+    }
+    return histogram->max / 1000;
+}
+
+/**
+ * Prints the percentiles of the histogram, unless it's empty
+ * @param label What the histogram measures
+ * @param histogram The histogram
+ */
+void printHistogram(const char* label, const ReplayHistogram* histogram){
+    if(histogram->count == 0) return;
+    printf("%s (us): p50 %llu, p99 %llu, p999 %llu, max %llu\n", label,
+           (unsigned long long)histogramPercentile(histogram, 0.5), (unsigned long long)histogramPercentile(histogram, 0.99),
+           (unsigned long long)histogramPercentile(histogram, 0.999), (unsigned long long)(histogram->max / 1000));
+}
+
+/**
+ * Returns the value of a key in the flat JSON the server sends, without the quotes of a string
+ * @param json The JSON object
+ * @param key The key
+ * @return The value or an empty string if there's no such key
+ */
+string jsonGetValue(const string& json, const string& key){
+    size_t position = json.find("\"" + key + "\":");
+    if(position == string::npos) return "";
+    position += key.length() + 3;
+    while(position < json.length() && json[position] == ' ') position++;
+    if(position < json.length() && json[position] == '"'){
+        size_t end = json.find('"', position + 1);
+        return json.substr(position + 1, end == string::npos ? string::npos : end - position - 1);
+    }
+    size_t end = json.find_first_of(",}", position);
+    return json.substr(position, end == string::npos ? string::npos : end - position);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+uint64_t replayNow(){
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}